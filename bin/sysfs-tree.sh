@@ -0,0 +1,61 @@
+#!/bin/bash
+
+###############################################################################
+# Builds a synthetic cpufreq tree, to initialize the library on any number of
+# CPUs without the hardware:
+#
+#   $ PWR_SYSFS_ROOT=<dir> <program using the library>
+#
+# Every policy has <policy size> CPUs, 16 frequencies from 1.0 to 2.5 GHz and
+# the userspace governor. Writes to scaling_setspeed land in regular files.
+#
+# Usage: $ sysfs-tree.sh <dir> <nb cpus> [<policy size>]
+#
+###############################################################################
+#
+# Copyright 2014-2015 Reservoir Labs, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# 
+#     http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+###############################################################################
+
+
+USAGE="Usage: $0 <dir> <nb cpus> [<policy size>]"
+
+if [ "x$1" == "x" ] || [ "x$2" == "x" ]
+then
+	echo $USAGE
+	exit 1
+fi
+
+ROOT=$1
+CPUS=$2
+POLICY=${3:-1}
+FREQS=`seq 2500000 -100000 1000000 | tr '\n' ' '`
+
+mkdir -p $ROOT/devices/system/cpu || exit 2
+echo "0-$((CPUS - 1))" > $ROOT/devices/system/cpu/online
+
+for ((CPU = 0; CPU < CPUS; ++CPU)) ; do
+	DIR=$ROOT/devices/system/cpu/cpu$CPU/cpufreq
+	FIRST=$((CPU / POLICY * POLICY))
+	mkdir -p $DIR
+	echo `seq -s ' ' $FIRST $((FIRST + POLICY - 1))` > $DIR/affected_cpus
+	echo 10000 > $DIR/cpuinfo_transition_latency
+	echo 2500000 > $DIR/cpuinfo_max_freq
+	echo 1000000 > $DIR/cpuinfo_min_freq
+	echo "$FREQS" > $DIR/scaling_available_frequencies
+	echo userspace > $DIR/scaling_governor
+	echo 1000000 > $DIR/scaling_setspeed
+	echo 1000000 > $DIR/scaling_cur_freq
+done
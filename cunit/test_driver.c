@@ -14,13 +14,16 @@
   */
 
 
+#define _GNU_SOURCE
 
 #include "power-api.h"
 
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "CUnit/Basic.h"
@@ -217,8 +220,713 @@ void test_power_energy_counters(void) {
 	finalize();
 }
 
+void test_membound(void) {
+    pwr_membound_params_t params;
+    pwr_membound_report_t report;
+
+    initialize();
+
+    pwr_membound_default_params(&params);
+    pwr_membound_start(ctx, &params);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_membound_start(ctx, &params);
+    CU_ASSERT(PWR_ALREADY_INITIALIZED == pwr_error(ctx));
+
+    sleep(1);
+    pwr_membound_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_membound_report(ctx, &report);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(report.duration > 0);
+    CU_ASSERT(report.mem_samples <= report.samples);
+    CU_ASSERT(report.est_slowdown <= report.lowered_time);
+
+    finalize();
+}
+
+void test_wait_hints(void) {
+    initialize();
+
+    pwr_wait_configure(ctx, 0, 1);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_wait_configure(ctx, 0, 2);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+
+    // the level is restored whether the island was lowered or not
+    unsigned long island = pwr_island_of_cpu(ctx, sched_getcpu());
+    unsigned int level = pwr_current_speed_level(ctx, island);
+    pwr_wait_begin(ctx);
+    pwr_wait_begin(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_wait_end(ctx);
+    pwr_wait_end(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(level == pwr_current_speed_level(ctx, island));
+
+    pwr_wait_end(ctx);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+
+    pwr_wait_report_t report;
+    pwr_wait_report(ctx, &report);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(report.waits == 1);
+    CU_ASSERT(report.lowered_time <= report.wait_time);
+
+    finalize();
+}
+
+void test_model(void) {
+    initialize();
+
+    // frequency-bound phase: time halves when the frequency doubles
+    unsigned int nb_levels = pwr_num_speed_levels(ctx, 0);
+    unsigned int max = nb_levels - 1;
+    pwr_model_sample(ctx, 0, 1, 0, 1, 2, 20);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_model_sample(ctx, 0, 1, max, 1, 1, 40);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    // the static power of the node may favour an intermediate level
+    double time;
+    energy_t energy, min_energy = 0;
+    for (unsigned int level = 0; level < nb_levels; ++level) {
+        pwr_model_predict(ctx, 0, 1, level, &time, &energy);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        if (level == 0 || energy < min_energy) {
+            min_energy = energy;
+        }
+    }
+    unsigned int best = pwr_best_level(ctx, 0, 1, PWR_OBJECTIVE_ENERGY, 0);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_model_predict(ctx, 0, 1, best, &time, &energy);
+    CU_ASSERT(energy == min_energy);
+
+    CU_ASSERT(max == pwr_best_level(ctx, 0, 1, PWR_OBJECTIVE_DEADLINE, 1));
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_best_level(ctx, 0, 1, PWR_OBJECTIVE_DEADLINE, 0.5);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    pwr_model_predict(ctx, 0, 1, max, &time, &energy);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(time == 1 && energy == 40);
+
+    pwr_best_level(ctx, 0, 2, PWR_OBJECTIVE_EDP, 0);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    pwr_model_sample(ctx, 0, PWR_MAX_PHASES, 0, 1, 1, 1);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_budget(void) {
+    initialize();
+
+    unsigned long nb_islands = pwr_num_phys_islands(ctx);
+    unsigned int levels[nb_islands];
+
+    pwr_budget_solve(ctx, 1000, levels);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    // power grows with the level index on every island
+    for (unsigned long i = 0; i < nb_islands; ++i) {
+        unsigned int nb_levels = pwr_num_speed_levels(ctx, i);
+        double watts[nb_levels];
+        for (unsigned int l = 0; l < nb_levels; ++l) {
+            watts[l] = 10 + l;
+        }
+        pwr_budget_set_power(ctx, i, watts);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+    }
+
+    pwr_budget_solve(ctx, 10 * nb_islands - 1, levels);
+    CU_ASSERT(PWR_OVER_P_BUDGET == pwr_error(ctx));
+
+    double power = pwr_budget_solve(ctx, 1e6, levels);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(power <= 1e6);
+
+    pwr_budget_set_weight(ctx, 0, -1);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+    pwr_budget_set_weight(ctx, nb_islands, 1);
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_power_table(void) {
+    initialize();
+
+    unsigned int nb_levels = pwr_num_speed_levels(ctx, 0);
+    double watts[nb_levels];
+    for (unsigned int l = 0; l < nb_levels; ++l) {
+        watts[l] = 20 + l;
+    }
+
+    pwr_level_power(ctx, 0, 0, PWR_LOAD_MEMORY);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    pwr_set_level_power(ctx, 0, PWR_LOAD_MEMORY, watts);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    char path[] = "/tmp/pwr-table-XXXXXX";
+    close(mkstemp(path));
+    pwr_save_power_table(ctx, path);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    finalize();
+
+    initialize();
+    pwr_load_power_table(ctx, path);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(20 + nb_levels - 1 ==
+        pwr_level_power(ctx, 0, nb_levels - 1, PWR_LOAD_MEMORY));
+    pwr_level_power(ctx, 0, 0, PWR_LOAD_COMPUTE);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    unlink(path);
+
+    pwr_load_power_table(ctx, path);
+    CU_ASSERT(PWR_IO_ERR == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_thermal(void) {
+    initialize();
+
+    double temperature = pwr_temperature(ctx, 0);
+    CU_ASSERT(PWR_OK == pwr_error(ctx) || PWR_UNAVAILABLE == pwr_error(ctx));
+    if (pwr_error(ctx) == PWR_OK) {
+        CU_ASSERT(temperature < pwr_critical_temperature(ctx, 0));
+    }
+    pwr_temperature(ctx, pwr_num_phys_islands(ctx));
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    pwr_thermal_cap_start(ctx, -1, 0.1);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+    pwr_thermal_cap_stop(ctx);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_idle_states(void) {
+    initialize();
+
+    unsigned int nb_states = pwr_num_idle_states(ctx, 0);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(nb_states <= PWR_MAX_IDLE_STATES);
+
+    pwr_idle_residency_t residency;
+    pwr_idle_residency(ctx, 0, &residency);
+    if (nb_states > 0) {
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(residency.interval > 0);
+
+        pwr_idle_state_t info;
+        pwr_idle_state(ctx, 0, nb_states - 1, &info);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        pwr_idle_state(ctx, 0, nb_states, &info);
+        CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+    } else {
+        CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    pwr_num_idle_states(ctx, pwr_num_phys_islands(ctx));
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_turbo(void) {
+    initialize();
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        finalize();
+        return;
+    }
+
+    for (unsigned long i = 0; i < pwr_num_phys_islands(ctx); ++i) {
+        unsigned int num_levels = pwr_num_speed_levels(ctx, i);
+        unsigned int level = pwr_turbo_level(ctx, i);
+
+        if (pwr_error(ctx) == PWR_OK) {
+            CU_ASSERT(level == num_levels - 1);
+
+            freq_t nominal, max;
+            pwr_turbo_range(ctx, i, &nominal, &max);
+            CU_ASSERT(PWR_OK == pwr_error(ctx));
+            CU_ASSERT(nominal < max);
+        } else {
+            CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+        }
+
+        pwr_effective_frequency(ctx, i);
+        CU_ASSERT(PWR_OK == pwr_error(ctx) ||
+                  PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    bool enabled = pwr_turbo_enabled(ctx);
+    if (pwr_error(ctx) == PWR_OK) {
+        pwr_enable_turbo(ctx, enabled);
+        CU_ASSERT(PWR_OK == pwr_error(ctx) || PWR_IO_ERR == pwr_error(ctx));
+        CU_ASSERT(enabled == pwr_turbo_enabled(ctx));
+    }
+
+    pwr_turbo_level(ctx, pwr_num_phys_islands(ctx));
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_hwp(void) {
+    initialize();
+
+    bool available = pwr_hwp_available(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_hwp_request_t request;
+    pwr_hwp_request(ctx, 0, &request);
+    if (available) {
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+        pwr_hwp_caps_t caps;
+        pwr_hwp_capabilities(ctx, 0, &caps);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(caps.lowest <= caps.highest);
+
+        unsigned int epp = pwr_epp(ctx, 0);
+        pwr_set_epp(ctx, 0, epp);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        pwr_set_epp(ctx, 0, PWR_EPP_POWERSAVE + 1);
+        CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+    } else {
+        CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    if (pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        pwr_set_speed_control(ctx, PWR_CONTROL_HWP);
+        CU_ASSERT(PWR_OK == pwr_error(ctx) ||
+                  (!available && PWR_UNAVAILABLE == pwr_error(ctx)));
+        pwr_set_speed_control(ctx, PWR_CONTROL_SETSPEED);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(PWR_CONTROL_SETSPEED == pwr_speed_control(ctx));
+    }
+
+    finalize();
+}
+
+void test_uncore(void) {
+    initialize();
+
+    unsigned long num_islands = pwr_num_phys_islands(ctx);
+    unsigned long num_uncore = pwr_num_uncore_islands(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    for (unsigned long u = num_islands; u < num_islands + num_uncore; ++u) {
+        unsigned int num_levels = pwr_num_speed_levels(ctx, u);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(num_levels > 0);
+        CU_ASSERT(pwr_current_speed_level(ctx, u) < num_levels);
+
+        freq_t min, max;
+        pwr_uncore_limits(ctx, u, &min, &max);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(min <= max);
+
+        pwr_request_speed_level(ctx, u, num_levels);
+        CU_ASSERT(PWR_UNSUPPORTED_SPEED_LEVEL == pwr_error(ctx));
+    }
+
+    pwr_uncore_frequency(ctx, num_islands + num_uncore);
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_capacity(void) {
+    initialize();
+
+    speed_t max_capacity = 0;
+    for (unsigned long i = 0; i < pwr_num_phys_islands(ctx); ++i) {
+        pwr_core_type_t type = pwr_island_core_type(ctx, i);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(type <= PWR_CORE_EFFICIENCY);
+
+        speed_t capacity = pwr_island_capacity(ctx, i);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(capacity > 0 && capacity <= PWR_SPEED_SCALE);
+        if (capacity > max_capacity) {
+            max_capacity = capacity;
+        }
+
+        if (pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+            unsigned int num_levels = pwr_num_speed_levels(ctx, i);
+            speed_t max_speed = pwr_speed(ctx, i, num_levels - 1);
+            CU_ASSERT(max_speed <= PWR_SPEED_SCALE);
+            CU_ASSERT(pwr_speed(ctx, i, 0) <= max_speed);
+            pwr_speed(ctx, i, num_levels);
+            CU_ASSERT(PWR_UNSUPPORTED_SPEED_LEVEL == pwr_error(ctx));
+
+            CU_ASSERT(0 == pwr_level_for_speed(ctx, i, 0));
+            CU_ASSERT(PWR_OK == pwr_error(ctx));
+            unsigned int level = pwr_level_for_speed(ctx, i, max_speed);
+            CU_ASSERT(PWR_OK == pwr_error(ctx));
+            CU_ASSERT(pwr_speed(ctx, i, level) >= max_speed);
+            pwr_level_for_speed(ctx, i, PWR_SPEED_SCALE + 1);
+            CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+        }
+    }
+    CU_ASSERT(max_capacity == PWR_SPEED_SCALE);
+
+    finalize();
+
+    // without a calibrated table, the speeds follow the island capacity
+    char *table = getenv(PWR_POWER_TABLE_ENV);
+    table = table != NULL ? strdup(table) : NULL;
+    setenv(PWR_POWER_TABLE_ENV, "/nonexistent/power-table", 1);
+    initialize();
+    if (table != NULL) {
+        setenv(PWR_POWER_TABLE_ENV, table, 1);
+        free(table);
+    } else {
+        unsetenv(PWR_POWER_TABLE_ENV);
+    }
+
+    if (pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        for (unsigned long i = 0; i < pwr_num_phys_islands(ctx); ++i) {
+            unsigned int num_levels = pwr_num_speed_levels(ctx, i);
+            CU_ASSERT(pwr_speed(ctx, i, num_levels - 1) ==
+                pwr_island_capacity(ctx, i));
+        }
+    }
+
+    finalize();
+}
+
+void test_idle_monitor(void) {
+    pwr_idle_monitor_params_t params;
+    pwr_idle_monitor_report_t report;
+
+    initialize();
+
+    pwr_idle_monitor_default_params(&params);
+    params.idle_threshold = 2;
+    pwr_idle_monitor_start(ctx, &params);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+
+    pwr_idle_monitor_default_params(&params);
+    params.period = 0.01;
+    pwr_idle_monitor_start(ctx, &params);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_idle_monitor_start(ctx, &params);
+    CU_ASSERT(PWR_ALREADY_INITIALIZED == pwr_error(ctx));
+
+    sleep(1);
+    pwr_idle_monitor_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_idle_monitor_report(ctx, &report);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(report.duration > 0);
+    CU_ASSERT(report.idle_samples <= report.samples);
+    CU_ASSERT(report.restorations <= report.lowerings);
+
+    pwr_idle_monitor_stop(ctx);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_governor(void) {
+    pwr_governor_params_t params;
+    pwr_governor_report_t report;
+
+    initialize();
+
+    pwr_governor_default_params(&params);
+    params.target_util = 0;
+    pwr_governor_start(ctx, &params);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+
+    unsigned int level = pwr_current_speed_level(ctx, 0);
+    pwr_governor_default_params(&params);
+    params.period = 0.001;
+    pwr_governor_start(ctx, &params);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_governor_start(ctx, &params);
+    CU_ASSERT(PWR_ALREADY_INITIALIZED == pwr_error(ctx));
+
+    sleep(1);
+    pwr_governor_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(level == pwr_current_speed_level(ctx, 0));
+
+    pwr_governor_report(ctx, &report);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(report.duration > 0);
+    CU_ASSERT(report.samples > 0);
+    CU_ASSERT(report.stride >= 1);
+    CU_ASSERT(report.overhead < 0.1);
+
+    finalize();
+}
+
+void test_freq_watch(void) {
+    pwr_freq_watch_report_t report;
+
+    initialize();
+
+    CU_ASSERT(0 == pwr_external_speed_changes(ctx, 0));
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    // tracepoints may not be readable
+    pwr_freq_watch_start(ctx);
+    if (pwr_error(ctx) == PWR_OK) {
+        pwr_freq_watch_start(ctx);
+        CU_ASSERT(PWR_ALREADY_INITIALIZED == pwr_error(ctx));
+
+        // the changes made by the library are not external
+        unsigned int level = pwr_current_speed_level(ctx, 0);
+        pwr_request_speed_level(ctx, 0, 0);
+        pwr_request_speed_level(ctx, 0, level);
+        sleep(1);
+
+        CU_ASSERT(0 == pwr_external_speed_changes(ctx, 0));
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(level == pwr_current_speed_level(ctx, 0));
+
+        pwr_freq_watch_stop(ctx);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+        pwr_freq_watch_report(ctx, &report);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(report.duration > 0);
+        CU_ASSERT(report.external_changes <= report.events);
+    } else {
+        CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    pwr_freq_watch_stop(ctx);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    finalize();
+}
+
+void test_schedule(void) {
+    pwr_schedule_report_t report;
+    struct timespec ts;
+
+    initialize();
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    unsigned int level = pwr_current_speed_level(ctx, 0);
+    unsigned int max = pwr_num_speed_levels(ctx, 0) - 1;
+
+    pwr_schedule_speed_level(ctx, pwr_num_phys_islands(ctx), 0, now);
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+    pwr_schedule_speed_level(ctx, 0, max + 1, now);
+    CU_ASSERT(PWR_UNSUPPORTED_SPEED_LEVEL == pwr_error(ctx));
+
+    // the last change of the island wins
+    pwr_schedule_speed_level(ctx, 0, 0, now + 10000000);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_schedule_speed_level(ctx, 0, max, now + 10000000);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    usleep(100000);
+    CU_ASSERT(max == pwr_current_speed_level(ctx, 0));
+
+    pwr_schedule_speed_level(ctx, 0, level, now + 10000000000ULL);
+    CU_ASSERT(1 == pwr_cancel_scheduled_speed_levels(ctx, 0));
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_schedule_report(ctx, &report);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(report.scheduled == 3);
+    CU_ASSERT(report.issued == 2);
+    CU_ASSERT(report.canceled == 1);
+    CU_ASSERT(report.batches == 1);
+
+    pwr_request_speed_level(ctx, 0, level);
+    finalize();
+}
+
+void test_record_replay(void) {
+    const char *path = "/tmp/power-api-test.log";
+    pwr_schedule_report_t report;
+
+    initialize();
+
+    unsigned int level = pwr_current_speed_level(ctx, 0);
+    unsigned int max = pwr_num_speed_levels(ctx, 0) - 1;
+
+    // requests of the current level are not issued, hence not recorded
+    pwr_request_speed_level(ctx, 0, max);
+    pwr_record_start(ctx, path);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_request_speed_level(ctx, 0, 0);
+    pwr_phase_marker(ctx, 1);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    // the batched requests are recorded as well
+    unsigned int levels[pwr_num_phys_islands(ctx)];
+    for (unsigned long i = 0; i < pwr_num_phys_islands(ctx); ++i) {
+        levels[i] = pwr_current_speed_level(ctx, i);
+    }
+    levels[0] = max;
+    pwr_request_speed_levels(ctx, levels);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_record_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    pwr_replay_start(ctx, "/nonexistent/power-api-test.log");
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    // the second request waits for the marker
+    pwr_request_speed_level(ctx, 0, level);
+    pwr_replay_start(ctx, path);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    usleep(100000);
+    CU_ASSERT(0 == pwr_current_speed_level(ctx, 0));
+
+    pwr_phase_marker(ctx, 2);
+    CU_ASSERT(PWR_REQUEST_DENIED == pwr_error(ctx));
+    pwr_phase_marker(ctx, 1);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    usleep(100000);
+    CU_ASSERT(max == pwr_current_speed_level(ctx, 0));
+
+    // stopping the replay keeps the changes scheduled by the application
+    pwr_schedule_speed_level(ctx, 0, level, UINT64_MAX);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_replay_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    CU_ASSERT(1 == pwr_cancel_scheduled_speed_levels(ctx, 0));
+    pwr_schedule_report(ctx, &report);
+    CU_ASSERT(report.issued == 2);
+
+    pwr_request_speed_level(ctx, 0, level);
+    remove(path);
+    finalize();
+}
+
+void test_trace(void) {
+    const char *path = "/tmp/power-api-test.json";
+    char header[16] = { 0 };
+
+    initialize();
+
+    pwr_trace_stop(ctx);
+    CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+
+    pwr_trace_start(ctx, path);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_trace_start(ctx, path);
+    CU_ASSERT(PWR_ALREADY_INITIALIZED == pwr_error(ctx));
+    pwr_num_speed_levels(ctx, 0);
+    pwr_current_speed_level(ctx, pwr_num_phys_islands(ctx));
+    pwr_trace_stop(ctx);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    FILE *file = fopen(path, "r");
+    CU_ASSERT(file != NULL);
+    if (file != NULL) {
+        CU_ASSERT(fread(header, 1, 15, file) == 15);
+        CU_ASSERT(strcmp(header, "{\"traceEvents\":") == 0);
+        fclose(file);
+    }
+
+    remove(path);
+    finalize();
+}
+
+void test_stats(void) {
+    pwr_stats_t before, after;
+
+    initialize();
+
+    pwr_get_stats(ctx, &before);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+
+    unsigned int level = pwr_current_speed_level(ctx, 0);
+    pwr_request_speed_level(ctx, 0, level);
+    pwr_current_speed_level(ctx, PWR_MAX_PHYS_ISLANDS);
+    int error = PWR_STATS_ERROR_INDEX(pwr_error(ctx));
+    pwr_get_stats(ctx, &after);
+
+    pwr_module_stats_t *dvfs = &after.modules[PWR_MODULE_DVFS];
+    CU_ASSERT(dvfs->calls == before.modules[PWR_MODULE_DVFS].calls + 3);
+    CU_ASSERT(dvfs->errors[error] ==
+        before.modules[PWR_MODULE_DVFS].errors[error] + 1);
+
+    pwr_latency_stats_t *request =
+        &after.latencies[PWR_LATENCY_REQUEST_SPEED_LEVEL];
+    uint64_t bucketed = 0;
+    for (unsigned int b = 0; b < PWR_STATS_BUCKETS; ++b) {
+        bucketed += request->buckets[b];
+    }
+    CU_ASSERT(request->calls ==
+        before.latencies[PWR_LATENCY_REQUEST_SPEED_LEVEL].calls + 1);
+    CU_ASSERT(bucketed == request->calls);
+
+    // the cpufreq attributes are counted by the shared helpers
+    char governor[32];
+    before = after;
+    pwr_governor(ctx, governor, sizeof(governor));
+    if (PWR_OK == pwr_error(ctx)) {
+        pwr_get_stats(ctx, &after);
+        CU_ASSERT(dvfs->syscalls ==
+            before.modules[PWR_MODULE_DVFS].syscalls + 1);
+    }
+
+    // nothing is counted while disabled
+    pwr_get_stats(ctx, &before);
+    pwr_enable_stats(ctx, false);
+    CU_ASSERT(PWR_OK == pwr_error(ctx));
+    pwr_governor(ctx, governor, sizeof(governor));
+    pwr_request_speed_level(ctx, 0, level);
+    pwr_enable_stats(ctx, true);
+    pwr_get_stats(ctx, &after);
+    CU_ASSERT(0 == memcmp(&before, &after, sizeof(before)));
+
+    finalize();
+}
+
 void test_increase_voltage(void) {
-    CU_ASSERT(!PWR_UNIMPLEMENTED);
+    initialize();
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        finalize();
+        return;
+    }
+
+    // reading the offset must not change it
+    int offset = pwr_voltage_offset(ctx, 0);
+    if (pwr_error(ctx) == PWR_OK) {
+        pwr_increase_voltage(ctx, 0, 0);
+        CU_ASSERT(PWR_OK == pwr_error(ctx));
+        CU_ASSERT(offset == pwr_voltage_offset(ctx, 0));
+
+        pwr_increase_voltage(ctx, 0, 1000);
+        CU_ASSERT(PWR_UNSUPPORTED_VOLTAGE == pwr_error(ctx));
+        CU_ASSERT(offset == pwr_voltage_offset(ctx, 0));
+    } else {
+        CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    voltage_t voltage = pwr_voltage(ctx, 0);
+    if (pwr_error(ctx) == PWR_OK) {
+        CU_ASSERT(voltage > 0);
+    } else {
+        CU_ASSERT(PWR_UNAVAILABLE == pwr_error(ctx));
+    }
+
+    pwr_increase_voltage(ctx, pwr_num_phys_islands(ctx), 0);
+    CU_ASSERT(PWR_INVALID_ISLAND == pwr_error(ctx));
+
+    finalize();
 }
 
 void test_efficiency(void) {
@@ -289,7 +997,61 @@ int main() {
                             test_set_speed_priority)	 ||
 		NULL == CU_add_test(pSuite,
 							"pwr_energy_counters()",
-							test_power_energy_counters)) {
+							test_power_energy_counters)  ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_membound_*()",
+                            test_membound)               ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_wait_*()",
+                            test_wait_hints)             ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_model_*()",
+                            test_model)                  ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_budget_*()",
+                            test_budget)                 ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_*_power_table()",
+                            test_power_table)            ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_temperature()",
+                            test_thermal)                ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_idle_*()",
+                            test_idle_states)            ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_turbo_*()",
+                            test_turbo)                  ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_hwp_*()",
+                            test_hwp)                    ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_uncore_*()",
+                            test_uncore)                 ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_island_capacity()",
+                            test_capacity)               ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_idle_monitor_*()",
+                            test_idle_monitor)           ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_governor_*()",
+                            test_governor)               ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_freq_watch_*()",
+                            test_freq_watch)             ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_schedule_*()",
+                            test_schedule)               ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_record_*(), pwr_replay_*()",
+                            test_record_replay)          ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_trace_*()",
+                            test_trace)                  ||
+        NULL == CU_add_test(pSuite,
+                            "pwr_get_stats()",
+                            test_stats)) {
         CU_cleanup_registry();
         return CU_get_error();
     }
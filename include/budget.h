@@ -0,0 +1,86 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the distribution of a power budget across the islands.
+ *
+ * Given the power drawn by every island at each speed level and a throughput
+ * weight per island, the optimizer selects the speed levels maximizing the
+ * weighted throughput of the node while keeping its power under a budget. The
+ * throughput of a speed level is taken proportional to its frequency.
+ *
+ * That multiple-choice knapsack is solved greedily on the concave hull of each
+ * island's (power, throughput) curve. Hulls only depend on the power tables
+ * and are cached, so that solving again after a weight change costs
+ * O(upgrades * log islands).
+ */
+
+#ifndef __BUDGET_H__
+#define __BUDGET_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Sets the power drawn by an island at each speed level.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param watts The power at each speed level, in W, one value per level.
+ */
+void pwr_budget_set_power(pwr_ctx_t *ctx, unsigned long island,
+    const double *watts);
+
+/**
+ * Sets the throughput weight of an island. Every island has a weight of 1 by
+ * default. An island with a weight of 0 is kept at its lowest power level.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param weight The weight, non-negative.
+ */
+void pwr_budget_set_weight(pwr_ctx_t *ctx, unsigned long island,
+    double weight);
+
+/**
+ * Computes the speed levels maximizing the weighted throughput under a power
+ * budget. The error is set to PWR_OVER_P_BUDGET if even the lowest power
+ * levels exceed the budget, in which case those levels are returned.
+ *
+ * @param ctx The current library context.
+ * @param budget The node power budget, in W.
+ * @param levels[out] The selected speed levels, one per island.
+ *
+ * @return The power drawn with the selected levels, in W.
+ */
+double pwr_budget_solve(pwr_ctx_t *ctx, double budget, unsigned int *levels);
+
+/**
+ * Computes the speed levels for a power budget like pwr_budget_solve() and
+ * requests them with pwr_request_speed_levels().
+ *
+ * @param ctx The current library context.
+ * @param budget The node power budget, in W.
+ */
+void pwr_budget_apply(pwr_ctx_t *ctx, double budget);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the control of the idle states (C-states) of the islands
+ *  and their residency statistics.
+ *
+ * Idle states are the cpuidle states of the CPUs, listed from the shallowest
+ * to the deepest. Every CPU of an island is assumed to support the same
+ * states as its first CPU. Residencies are reported as deltas since the
+ * previous report on the same island, summed over the CPUs of the island.
+ * Package C-state residencies are read from the MSRs of the first CPU of the
+ * island and reported as fractions of the elapsed time.
+ */
+
+#ifndef __CSTATE_H__
+#define __CSTATE_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+/** \addtogroup limits
+  * @{
+  */
+
+/** The maximum number of idle states per island supported by the Power API */
+#define PWR_MAX_IDLE_STATES (16)
+
+/** @} */
+
+/** The package C-states whose residency is reported */
+enum pwr_package_cstate_t {
+    PWR_PKG_C2 = 0,         /**< Package C2 */
+    PWR_PKG_C3,             /**< Package C3 */
+    PWR_PKG_C6,             /**< Package C6 */
+    PWR_PKG_C7,             /**< Package C7 */
+    PWR_NB_PKG_CSTATES      /**< Number of package C-states */
+};
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Description of an idle state.
+ */
+typedef struct {
+    char name[16];                  //!< Name of the state, e.g. "C6".
+    unsigned long exit_latency;     //!< Worst exit latency, in us.
+    unsigned long target_residency; //!< Minimal worthwhile residency, in us.
+    bool enabled;                   //!< Is the state enabled on every CPU?
+} pwr_idle_state_t;
+
+/**
+ * Idle residency of an island since the previous report.
+ */
+typedef struct {
+    double interval;                        //!< Time covered, in s.
+    double time[PWR_MAX_IDLE_STATES];       //!< Time in each state, in s.
+    unsigned long usage[PWR_MAX_IDLE_STATES];   //!< Entries in each state.
+    double package[PWR_NB_PKG_CSTATES];     //!< Package C-state residency,
+                                            //!< as a fraction of the interval,
+                                            //!< negative if unavailable.
+} pwr_idle_residency_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Number of idle states supported by an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The number of idle states, 0 if cpuidle is not available.
+ */
+unsigned int pwr_num_idle_states(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Describes an idle state of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param state The idle state, in [0, pwr_num_idle_states()).
+ * @param info[out] The description of the state.
+ */
+void pwr_idle_state(pwr_ctx_t *ctx, unsigned long island, unsigned int state,
+    pwr_idle_state_t *info);
+
+/**
+ * Enables or disables an idle state on every CPU of an island. Disabling the
+ * deep states bounds the wake-up latency of latency-critical jobs.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param state The idle state, in [0, pwr_num_idle_states()).
+ * @param enable True to enable the state, false to disable it.
+ */
+void pwr_enable_idle_state(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int state, bool enable);
+
+/**
+ * Reports the idle residency of an island since the previous report, or since
+ * the library was initialized.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param residency[out] The residency statistics.
+ */
+void pwr_idle_residency(pwr_ctx_t *ctx, unsigned long island,
+    pwr_idle_residency_t *residency);
+
+#endif
@@ -26,6 +26,16 @@
     #error "Never directly include this file, rather use power_api.h"
 #endif
 
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/** How the speed levels are applied to the islands */
+typedef enum {
+    PWR_CONTROL_SETSPEED = 0,   /**< Fixed frequency, through cpufreq */
+    PWR_CONTROL_HWP             /**< Frequency ceiling, through HWP */
+} pwr_speed_control_t;
+
 //====-------------------------------------------------------------------------
 // Functions
 //-----------------------------------------------------------------------------
@@ -37,6 +47,9 @@
   * monotonically until the fastest speed level at 
   * '<code>num_speed_levels - 1</code>'.
   *
+  * The speed level functions taking a single island also accept uncore
+  * islands, see uncore.h.
+  *
   * @todo Map speed level to integer between 0 and 100 inclusive?
   * 
   * @param ctx The current library context.
@@ -58,6 +71,37 @@ unsigned int pwr_num_speed_levels(pwr_ctx_t *ctx, unsigned long island);
 unsigned int pwr_current_speed_level(pwr_ctx_t *ctx, unsigned long island);
 
 
+/**
+  * The speed of a voltage island at a speed level
+  *
+  * Speeds are normalized across islands. When the power table holds the
+  * calibrated throughput of every level, the speed is the throughput measured
+  * on one CPU of the island. Otherwise an island runs at its capacity at its
+  * fastest speed level, and proportionally to the frequency below.
+  *
+  * @param ctx The current library context.
+  * @param island  The island of interest
+  * @param level  The speed level of interest
+  *
+  * @return The speed, in PWR_SPEED_SCALE units.
+  */
+speed_t pwr_speed(pwr_ctx_t *ctx, unsigned long island, unsigned int level);
+
+/**
+  * The slowest speed level of a voltage island reaching a speed
+  *
+  * Fails with PWR_REQUEST_DENIED when even the fastest level is too slow, and
+  * returns the fastest level.
+  *
+  * @param ctx The current library context.
+  * @param island  The island of interest
+  * @param speed  The speed to reach, in PWR_SPEED_SCALE units
+  *
+  * @return The speed level.
+  */
+unsigned int pwr_level_for_speed(pwr_ctx_t *ctx, unsigned long island,
+    speed_t speed);
+
 /**
   * Requests speed level change on a voltage island 
   * 
@@ -82,11 +126,66 @@ void pwr_request_speed_level(pwr_ctx_t *ctx, unsigned long island,
   */
 void pwr_increase_speed_level(pwr_ctx_t *ctx, unsigned long island, int delta);
 
+/**
+  * Requests speed level changes on every voltage island at once
+  *
+  * Only the islands whose speed level changes are written. The error is set if
+  * one of the islands could not be changed.
+  *
+  * @param ctx The current library context.
+  * @param levels  The requested speed levels, one per island
+  */
+void pwr_request_speed_levels(pwr_ctx_t *ctx, const unsigned int *levels);
+
+/**
+  * Sets the cpufreq governor of every CPU
+  *
+  * Only requires the structure module. The DVFS module relies on the userspace
+  * governor: speed level requests fail with PWR_DVFS_ERR until the userspace
+  * governor is set back.
+  *
+  * @param ctx The current library context.
+  * @param governor The name of the governor, e.g. "ondemand"
+  */
+void pwr_set_governor(pwr_ctx_t *ctx, const char *governor);
+
+/**
+  * Gets the cpufreq governor of the first CPU
+  *
+  * @param ctx The current library context.
+  * @param governor[out] Where to store the name of the governor
+  * @param size The size of the governor buffer
+  */
+void pwr_governor(pwr_ctx_t *ctx, char *governor, size_t size);
+
+/**
+  * Selects how speed levels are applied
+  *
+  * With PWR_CONTROL_SETSPEED, the default, an island runs at the frequency of
+  * its speed level. With PWR_CONTROL_HWP, the speed level is the highest
+  * frequency the processor may pick on the island, the processor scaling the
+  * frequency down by itself following the energy / performance preference of
+  * the island. The current speed levels are applied again in the new mode.
+  *
+  * @param ctx The current library context.
+  * @param control The new control mode
+  */
+void pwr_set_speed_control(pwr_ctx_t *ctx, pwr_speed_control_t control);
+
+/**
+  * Gets how speed levels are applied
+  *
+  * @param ctx The current library context.
+  *
+  * @return The control mode.
+  */
+pwr_speed_control_t pwr_speed_control(pwr_ctx_t *ctx);
+
 /**
   * Calculates the cost of switching speed levels
   *
-  * @todo Decide on unit for agility. Currently ns because of cpufreq default.
-  *       If agility in cycles, at what speed level? Full speed? to_speed?
+  * The agility is the worst transition latency reported by cpufreq, whatever
+  * the levels.
   *
   * @param ctx The current library context.
   * @param island  The island of interest
@@ -98,14 +197,52 @@ void pwr_increase_speed_level(pwr_ctx_t *ctx, unsigned long island, int delta);
 long pwr_agility(pwr_ctx_t *ctx, unsigned long island, unsigned int from_level,
     unsigned int to_level);
 
+/**
+  * The current voltage of an island
+  *
+  * The voltage is read from the IA32_PERF_STATUS register of the first CPU of
+  * the island. When the island runs at the frequency of its speed level, the
+  * reading is also recorded as the voltage of that level.
+  *
+  * @param ctx The current library context.
+  * @param island  The island of interest
+  *
+  * @return The voltage, in V. Fails with PWR_UNAVAILABLE when the processor
+  *  does not report it.
+  */
+voltage_t pwr_voltage(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+  * The voltage of an island at a speed level
+  *
+  * Voltages are recorded by pwr_voltage() and saved in the power tables by
+  * the calibration tool.
+  *
+  * @param ctx The current library context.
+  * @param island  The island of interest
+  * @param level  The speed level of interest
+  *
+  * @return The voltage, in V. Fails with PWR_UNAVAILABLE when the voltage of
+  *  the level was never measured.
+  */
+voltage_t pwr_level_voltage(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+
+/** The size of a voltage level, i.e. the unit of the voltage offsets, in V */
+#define PWR_VOLTAGE_STEP (1. / 1024)
+
 /**
   * Requests a voltage level modification of the given island 
   *
-  * <code>delta</code> can be positive or negative.
+  * <code>delta</code> can be positive or negative. The voltage is shifted by
+  * an offset of the core voltage plane, through the overclocking mailbox of
+  * Intel processors. The plane is shared by every island of the package. The
+  * offset stays within [-100 mV, +50 mV], and is restored when the library is
+  * finalized.
   *
-  * @todo IMPLEMENT
-  * @todo Most architectures don't make this adjustment available. How to deal 
-  *       with this fact?
+  * Fails with PWR_UNAVAILABLE when the processor does not expose the mailbox,
+  * and with PWR_UNSUPPORTED_VOLTAGE when the offset is out of bounds or
+  * rejected by the processor.
   *
   * @param ctx The current library context.
   * @param island  The island to change voltage on
@@ -113,4 +250,14 @@ long pwr_agility(pwr_ctx_t *ctx, unsigned long island, unsigned int from_level,
   */
 void pwr_increase_voltage(pwr_ctx_t *ctx, unsigned long island, int delta);
 
+/**
+  * The voltage offset of an island
+  *
+  * @param ctx The current library context.
+  * @param island  The island of interest
+  *
+  * @return The offset, in voltage levels of PWR_VOLTAGE_STEP.
+  */
+int pwr_voltage_offset(pwr_ctx_t *ctx, unsigned long island);
+
 #endif
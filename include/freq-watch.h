@@ -0,0 +1,96 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the watcher of the frequency changes made outside of the
+ *  library.
+ *
+ * The kernel, another process or the firmware may change the frequency of an
+ * island behind the back of the library, leaving its current speed level
+ * stale. When started, the watcher subscribes to the power:cpu_frequency
+ * tracepoint of every CPU through perf_event and receives the frequency
+ * changes in a background thread, without reading sysfs. A change that does
+ * not match the speed level last set by the library updates the level and is
+ * counted as external.
+ *
+ * Tracepoints are only readable with a permissive
+ * kernel.perf_event_paranoid setting (-1) or the CAP_PERFMON capability, and
+ * require tracefs to be mounted.
+ */
+
+#ifndef __FREQ_WATCH_H__
+#define __FREQ_WATCH_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Activity report of the frequency watcher.
+ */
+typedef struct {
+    double duration;                //!< Time the watcher ran, in s.
+    unsigned long events;           //!< Frequency changes received.
+    unsigned long external_changes; //!< Speed level changes made outside of
+                                    //!< the library.
+    unsigned long lost_events;      //!< Events dropped by the kernel.
+} pwr_freq_watch_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Starts watching the frequency changes of every island.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_freq_watch_start(pwr_ctx_t *ctx);
+
+/**
+ * Stops watching the frequency changes.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_freq_watch_stop(pwr_ctx_t *ctx);
+
+/**
+ * Reports what the watcher observed since it started. The report remains
+ * available after the watcher stops, until it is started again.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_freq_watch_report(pwr_ctx_t *ctx, pwr_freq_watch_report_t *report);
+
+/**
+ * Counts the speed level changes of an island made outside of the library
+ * since the watcher started.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The number of external changes.
+ */
+unsigned long pwr_external_speed_changes(pwr_ctx_t *ctx,
+    unsigned long island);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the predictive DVFS governor, an in-library alternative
+ *  to the ondemand governor of the kernel.
+ *
+ * When started, the governor samples the cycles and instructions of every CPU
+ * in a single background thread. The cycle rate of the busiest CPU gives the
+ * demand of an island, which is smoothed and extrapolated with a double
+ * exponential moving average. The forecast looks ahead by the agility of the
+ * island, so that a rising demand is met once the transition is effective.
+ * A sudden change of the instruction throughput marks a new phase: the
+ * history is then dropped and the governor follows the new demand at once.
+ *
+ * Speed levels are raised as soon as the forecast requires it and lowered no
+ * sooner than a dwell time after the previous transition. The governor owns
+ * the speed level of the islands while it runs.
+ *
+ * To bound its own overhead, the governor reads the counters of only a subset
+ * of the CPUs at every period, rotating among them, when reading them all
+ * would cost more than the allowed fraction of a CPU.
+ *
+ * Counters are read through perf_event and require the same permissions as
+ * the memory-boundedness controller.
+ */
+
+#ifndef __GOVERNOR_H__
+#define __GOVERNOR_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Parameters of the predictive governor.
+ * Use pwr_governor_default_params() to get a sensible initial value.
+ */
+typedef struct {
+    double period;          //!< Sampling period, in s.
+    double target_util;     //!< Utilization, in ]0, 1], aimed at when picking
+                            //!< a speed level.
+    double demand_weight;   //!< Weight of the last sample in the demand
+                            //!< average, in ]0, 1].
+    double trend_weight;    //!< Weight of the last sample in the demand trend,
+                            //!< in [0, 1].
+    double phase_threshold; //!< Relative change of the instruction throughput
+                            //!< that starts a new phase.
+    unsigned int dwell;     //!< Minimal time between a transition and a lower
+                            //!< level, as a multiple of the island agility.
+    double max_overhead;    //!< CPU time the governor may use, as a fraction
+                            //!< of one CPU.
+} pwr_governor_params_t;
+
+/**
+ * Activity report of the predictive governor.
+ */
+typedef struct {
+    double duration;            //!< Time the governor ran, in s.
+    unsigned long samples;      //!< Sampling periods elapsed.
+    unsigned long cpu_reads;    //!< Counter reads of a CPU.
+    unsigned long transitions;  //!< Speed level changes issued.
+    unsigned long phase_changes;//!< Phase changes detected.
+    unsigned long stride;       //!< Current number of periods between two
+                                //!< reads of a CPU.
+    double overhead;            //!< CPU time used by the governor, as a
+                                //!< fraction of one CPU.
+} pwr_governor_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Provides the default governor parameters.
+ *
+ * @param params[out] The parameters to initialize.
+ */
+void pwr_governor_default_params(pwr_governor_params_t *params);
+
+/**
+ * Starts the predictive governor on every island.
+ *
+ * @param ctx The current library context.
+ * @param params The governor parameters, or NULL to use the defaults.
+ */
+void pwr_governor_start(pwr_ctx_t *ctx, const pwr_governor_params_t *params);
+
+/**
+ * Stops the predictive governor and restores the speed levels the islands had
+ * when it started.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_governor_stop(pwr_ctx_t *ctx);
+
+/**
+ * Reports what the governor did since it started. The report remains
+ * available after the governor stops, until it is started again.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_governor_report(pwr_ctx_t *ctx, pwr_governor_report_t *report);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the control of the hardware-managed P-states (HWP) of
+ *  Intel processors.
+ *
+ * With HWP, the processor picks the frequency of every CPU by itself, within
+ * the bounds requested by the software and guided by an energy / performance
+ * preference (EPP). Performance levels are processor ratios, usually in units
+ * of 100 MHz.
+ *
+ * Requests are written to the IA32_HWP_REQUEST register of every CPU of an
+ * island, and only when they change. The requests found when the library was
+ * initialized are restored when it is finalized. The DVFS module can also
+ * drive its speed levels through HWP, see pwr_set_speed_control().
+ */
+
+#ifndef __HWP_H__
+#define __HWP_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+/** EPP favoring performance the most */
+#define PWR_EPP_PERFORMANCE (0)
+
+/** EPP balancing performance and energy */
+#define PWR_EPP_BALANCED (128)
+
+/** EPP favoring energy savings the most */
+#define PWR_EPP_POWERSAVE (255)
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Performance levels supported by an island.
+ */
+typedef struct {
+    unsigned int lowest;            //!< Lowest performance level.
+    unsigned int most_efficient;    //!< Most energy-efficient level.
+    unsigned int guaranteed;        //!< Highest sustainable level.
+    unsigned int highest;           //!< Highest level, turbo included.
+} pwr_hwp_caps_t;
+
+/**
+ * HWP request of an island.
+ */
+typedef struct {
+    unsigned int min;       //!< Lowest performance level allowed.
+    unsigned int max;       //!< Highest performance level allowed.
+    unsigned int desired;   //!< Level to run at, 0 to let the processor pick.
+    unsigned int epp;       //!< Energy / performance preference, in [0, 255].
+} pwr_hwp_request_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Is HWP enabled on the processor?
+ *
+ * @param ctx The current library context.
+ *
+ * @return True if HWP requests can be issued.
+ */
+bool pwr_hwp_available(pwr_ctx_t *ctx);
+
+/**
+ * Gets the performance levels supported by an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param caps[out] The performance levels.
+ */
+void pwr_hwp_capabilities(pwr_ctx_t *ctx, unsigned long island,
+    pwr_hwp_caps_t *caps);
+
+/**
+ * Gets the HWP request of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param request[out] The request.
+ */
+void pwr_hwp_request(pwr_ctx_t *ctx, unsigned long island,
+    pwr_hwp_request_t *request);
+
+/**
+ * Sets the HWP request of an island. The levels must be within the
+ * capabilities of the island, and <code>min <= max</code>.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param request The new request.
+ */
+void pwr_set_hwp_request(pwr_ctx_t *ctx, unsigned long island,
+    const pwr_hwp_request_t *request);
+
+/**
+ * Gets the energy / performance preference of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The preference, from PWR_EPP_PERFORMANCE to PWR_EPP_POWERSAVE.
+ */
+unsigned int pwr_epp(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Sets the energy / performance preference of an island, leaving the rest of
+ * its request untouched.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param epp The preference, from PWR_EPP_PERFORMANCE to PWR_EPP_POWERSAVE.
+ */
+void pwr_set_epp(pwr_ctx_t *ctx, unsigned long island, unsigned int epp);
+
+#endif
@@ -0,0 +1,101 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the monitor lowering the speed of idle islands.
+ *
+ * When started, the monitor reads the utilization of every CPU from
+ * /proc/stat in a background thread. An island whose utilization stays below
+ * a threshold is dropped to its minimum speed level; the level it ran at is
+ * requested again as soon as work returns. A level requested by the user
+ * while the island is lowered is left in place.
+ */
+
+#ifndef __IDLE_MONITOR_H__
+#define __IDLE_MONITOR_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Parameters of the idle-island monitor.
+ * Use pwr_idle_monitor_default_params() to get a sensible initial value.
+ */
+typedef struct {
+    double period;          //!< Sampling period, in s.
+    double idle_threshold;  //!< Utilization, in [0, 1], below which an island
+                            //!< is idle.
+    unsigned int hysteresis;//!< Consecutive idle samples required to lower an
+                            //!< island.
+} pwr_idle_monitor_params_t;
+
+/**
+ * Activity report of the idle-island monitor.
+ */
+typedef struct {
+    double duration;            //!< Time the monitor ran, in s.
+    unsigned long samples;      //!< Island samples taken.
+    unsigned long idle_samples; //!< Samples below the idle threshold.
+    unsigned long lowerings;    //!< Islands dropped to their minimum level.
+    unsigned long restorations; //!< Previous levels requested again.
+    double lowered_time;        //!< Island time spent lowered, in s.
+} pwr_idle_monitor_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Provides the default monitor parameters.
+ *
+ * @param params[out] The parameters to initialize.
+ */
+void pwr_idle_monitor_default_params(pwr_idle_monitor_params_t *params);
+
+/**
+ * Starts the idle-island monitor on every island.
+ *
+ * @param ctx The current library context.
+ * @param params The monitor parameters, or NULL to use the defaults.
+ */
+void pwr_idle_monitor_start(pwr_ctx_t *ctx,
+    const pwr_idle_monitor_params_t *params);
+
+/**
+ * Stops the idle-island monitor and restores the levels of the lowered
+ * islands.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_idle_monitor_stop(pwr_ctx_t *ctx);
+
+/**
+ * Reports what the monitor did since it started. The report remains available
+ * after the monitor stops, until it is started again.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_idle_monitor_report(pwr_ctx_t *ctx,
+    pwr_idle_monitor_report_t *report);
+
+#endif
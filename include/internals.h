@@ -21,9 +21,12 @@
  */
 
 #include <glib.h> 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "power-api.h"
 
@@ -87,8 +90,38 @@ typedef struct phys_island {
       * Worst case time to transition from on frequency / voltage to another
       */
     agility_t agility;
+
+    /* Microarchitecture of the cores of the island */
+    pwr_core_type_t core_type;
+
+    /* Highest frequency of the island, turbo included, 0 if unknown */
+    freq_t max_freq;
+
+    /* Speed of the island at its highest frequency, in PWR_SPEED_SCALE units */
+    speed_t capacity;
 } phys_island_t;
 
+/* Reader of the per-CPU times of /proc/stat */
+typedef struct proc_stat {
+    /* /proc/stat, -1 when not open */
+    int fd;
+
+    /* Read buffer, large enough for the lines of every CPU */
+    char *buf;
+
+    /* Size of the read buffer */
+    size_t size;
+} proc_stat_t;
+
+/* Times spent by a CPU since boot, in clock ticks */
+typedef struct cpu_time {
+    /* Time spent running tasks or interrupts */
+    uint64_t busy;
+
+    /* Time elapsed, idle included */
+    uint64_t total;
+} cpu_time_t;
+
 
 //====-------------------------------------------------------------------------
 // Private structures shared across all modules
@@ -108,6 +141,9 @@ typedef struct pwr_ctx {
 
     /* --- structure module --- */
 
+    /* Where sysfs is, /sys unless PWR_SYSFS_ROOT_ENV is set */
+    const char *sysfs_root;
+
     /* How many physical CPU are in the system? */
     unsigned long num_phys_cpu;
 
@@ -117,10 +153,37 @@ typedef struct pwr_ctx {
     /* Physical power islands on the system */
     phys_island_t **phys_islands;
 
+    /* Maps every CPU to its island */
+    unsigned long *cpu_islands;
+
+    /* Temperature sensors and thermal cap controller */
+    struct thermal *thermal;
+
+    /* Idle states of the islands */
+    struct cstates *cstates;
+
+    /* MSR device per CPU, opened on first use, NULL if not resolved */
+    int *msr_fds;
+
+    /* cpufreq directory per CPU, opened on first use */
+    int *cpufreq_fds;
+
     /* --- DVFS module --- */
     
-    /* File pointers fpr sysfs frequency control files, one per CPU */
-    FILE** island_throttle_files;
+    /* Descriptors of the sysfs frequency control files, one per island */
+    int *island_throttle_fds;
+
+    /* Serializes the speed level changes issued by the library threads */
+    pthread_mutex_t dvfs_lock;
+
+    /* How the speed levels are applied */
+    pwr_speed_control_t speed_control;
+
+    /* HWP state, NULL if the structure module is not available */
+    struct hwp *hwp;
+
+    /* Uncore islands, NULL if the structure module is not available */
+    struct uncore *uncore;
 
     /* --- Power measurements --- */
 
@@ -132,6 +195,125 @@ typedef struct pwr_ctx {
 
     /* Event set identifier (used by PAPI) */
     int event_set;
+
+    /* --- Energy snapshots (RAPL through powercap) --- */
+
+    /* How many RAPL domains are read for snapshots? */
+    unsigned long num_rapl_domains;
+
+    /* Open energy_uj files, one per domain */
+    int *rapl_fds;
+
+    /* Last raw value read on each domain, in uJ */
+    long long *rapl_last;
+
+    /* Value at which each domain counter wraps, in uJ */
+    long long *rapl_range;
+
+    /* Energy accumulated since the snapshots were initialized, in J */
+    double rapl_total;
+
+    /* Protects the snapshot accumulator */
+    pthread_mutex_t rapl_lock;
+
+    /* --- Memory-boundedness controller --- */
+
+    /* Controller state, NULL when never started */
+    struct membound *membound;
+
+    /* --- Idle-island monitor --- */
+
+    /* Monitor state, NULL when never started */
+    struct idle_monitor *idle_monitor;
+
+    /* --- Predictive governor --- */
+
+    /* Governor state, NULL when never started */
+    struct governor *governor;
+
+    /* --- Frequency change watcher --- */
+
+    /* Watcher state, NULL when never started. Set with the DVFS lock held. */
+    struct freq_watch *freq_watch;
+
+    /* --- Scheduled speed levels --- */
+
+    /* Scheduler state, NULL until a change is scheduled */
+    struct schedule *schedule;
+
+    /* --- Record and replay --- */
+
+    /* Protects the recorder and the replay state, and the records buffer */
+    pthread_mutex_t record_lock;
+
+    /* Recorder state, NULL when not recording. Set with the lock held. */
+    struct recorder *recorder;
+
+    /* Replay state, NULL when not replaying. Set with the lock held. */
+    struct replay *replay;
+
+    /* --- Call tracing --- */
+
+    /* Active tracer, NULL when not tracing */
+    struct tracer *tracer;
+
+    /* Stopped tracers, kept until the library is finalized */
+    struct tracer *retired_tracers;
+
+    /* --- Statistics --- */
+
+    /* Counters, updated with relaxed atomic operations */
+    pwr_stats_t stats;
+
+    /*
+     * What the traced calls maintain, INSTRUMENT_STATS and INSTRUMENT_TRACE
+     * bits. Nothing is done on the calls when it is 0.
+     */
+    unsigned int instrument;
+
+    /* --- Wait-phase hints --- */
+
+    /* Wait hints state, NULL if the DVFS module is not available */
+    struct wait_hints *wait;
+
+    /* --- Online energy / performance model --- */
+
+    /* Model state, NULL if the DVFS module is not available */
+    struct model *model;
+
+    /* --- Power budget distribution --- */
+
+    /* Budget state, NULL if the DVFS module is not available */
+    struct budget *budget;
+
+    /* --- Voltage control --- */
+
+    /* Voltage offsets state, NULL if the DVFS module is not available */
+    struct voltage *voltage;
+
+    /* --- Turbo --- */
+
+    /* Turbo state, NULL if the DVFS module is not available */
+    struct turbo *turbo;
+
+    /* --- Calibrated power tables --- */
+
+    /*
+      * Power per island, speed level and load, i.e.
+      * <code>level_power[island][level * PWR_NB_LOADS + load]</code>. NULL
+      * when no table was loaded.
+      */
+    double **level_power;
+
+    /*
+      * Compute throughput per island and speed level, i.e.
+      * <code>level_throughput[island][level]</code>. Allocated with
+      * level_power.
+      */
+    double **level_throughput;
+
+    /* Highest throughput, 0 until every level of every island is calibrated */
+    double throughput_scale;
 } pwr_ctx_t;
 
 
@@ -143,16 +325,184 @@ typedef struct pwr_ctx {
 // ###### General functions ######
 
 
+/* Size of the buffers reading whole sysfs attributes: a page and a NUL */
+#define SYSFS_ATTR_SIZE 4097
+
+/*
+  * Prepares the cpufreq directory cache. The directories are opened on first
+  * use.
+  *
+  * @param ctx The current library context.
+  */
+void init_cpufreq(pwr_ctx_t *ctx);
+
+/*
+  * Closes the cpufreq directories.
+  */
+void free_cpufreq(pwr_ctx_t *ctx);
+
+/*
+  * Opens a file of <code>/sys/devices/system/cpu/cpu_id/cpufreq</code>, under
+  * the sysfs root of the context.
+  *
+  * @param cpu The CPU of the file
+  * @param name The cpufreq file
+  * @param flags The open flags
+  *
+  * @return The file descriptor, or a negative value on error.
+  */
+int open_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    int flags);
+
+/*
+  * Reads a cpufreq file into a buffer, without its trailing newline.
+  *
+  * @param buf[out] The file content, NUL-terminated
+  * @param size The buffer size, SYSFS_ATTR_SIZE reads any attribute
+  *
+  * @return The content length, or -1 on error.
+  */
+ssize_t read_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    char *buf, size_t size);
+
+/*
+  * Reads an integer from a cpufreq file.
+  *
+  * @return true on success.
+  */
+bool read_cpufreq_ll(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    long long *value);
+
+/*
+  * Writes a string to a cpufreq file.
+  *
+  * @return true on success, false if the file cannot be written or the kernel
+  *  rejects the value.
+  */
+bool write_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    const char *value);
+
+/*
+  * Reads the monotonic clock.
+  *
+  * @return The current time in ns, from an arbitrary origin.
+  */
+uint64_t monotonic_ns(void);
+
+/*
+  * Opens a perf_event counter on a CPU, counting all the processes. The
+  * counters of a group are scheduled together and read at once with
+  * read_perf_group().
+  *
+  * @param cpu The CPU to count on
+  * @param type The perf_event type (PERF_TYPE_*)
+  * @param config The perf_event config of the counted event
+  * @param group_fd The group leader, or -1 to create a new group
+  *
+  * @return The counter file descriptor, or -1 on error.
+  */
+int open_perf_counter(unsigned long cpu, uint32_t type, uint64_t config,
+    int group_fd);
+
+/*
+  * Reads the counters of a perf_event group, scaled together if the group
+  * was multiplexed. Scaled values are estimates and may decrease from one
+  * read to the next.
+  *
+  * @param fd The group leader.
+  * @param num The number of counters in the group.
+  * @param values[out] The counter values, in the order they were opened.
+  * @param enabled[out] Time the group was enabled in ns, or NULL.
+  *
+  * @return False if the group cannot be read or never ran.
+  */
+bool read_perf_group(int fd, unsigned int num, uint64_t *values,
+    uint64_t *enabled);
+
+/*
+  * Reads an integer from an open sysfs file.
+  *
+  * @param fd The file descriptor, read from offset 0.
+  * @param value[out] The value read.
+  *
+  * @return True if a value was read.
+  */
+bool read_sysfs_ll(int fd, long long *value);
+
 /*
-  * Builds a filename of the form 
-  * <code>/sys/devices/system/cpu/cpu_id/cpufreq/filename</code>
+  * Reads an integer from a sysfs file, opening and closing it.
   *
-  * @param cpu_id The unique identifier of the cpu to build a filename for
-  * @param filename The cpufreq file to use in the filename
+  * @param path The file path.
+  * @param value[out] The value read.
   *
-  * @return A sysfs filename as a <code>GString</code> 
+  * @return True if a value was read.
   */
-GString* sysfs_filename(unsigned long cpu_id, const char* filename); 
+bool read_sysfs_file_ll(const char *path, long long *value);
+
+/*
+  * Opens /proc/stat and sizes the read buffer for a number of CPUs. Nothing is
+  * allocated afterwards when reading.
+  *
+  * @param ps[out] The reader.
+  * @param num_cpu The number of CPUs to read the times of.
+  *
+  * @return True if /proc/stat can be read.
+  */
+bool open_proc_stat(proc_stat_t *ps, unsigned long num_cpu);
+
+/*
+  * Reads the times of every CPU from /proc/stat. The times of the CPUs that
+  * are not listed, e.g. offline, are left untouched.
+  *
+  * @param ps The reader.
+  * @param times[out] The times, indexed by CPU ID.
+  * @param num_cpu The number of entries of times.
+  *
+  * @return True if the file was read.
+  */
+bool read_proc_stat(proc_stat_t *ps, cpu_time_t *times,
+    unsigned long num_cpu);
+
+/*
+  * Closes /proc/stat and releases the read buffer.
+  */
+void close_proc_stat(proc_stat_t *ps);
+
+/*
+  * Prepares the MSR device cache. The devices are opened on first use.
+  *
+  * @param ctx The current library context.
+  */
+void init_msr(pwr_ctx_t *ctx);
+
+/*
+  * Closes the MSR devices.
+  */
+void free_msr(pwr_ctx_t *ctx);
+
+/*
+  * Reads a model-specific register. May be called from any thread.
+  *
+  * @param cpu The CPU to read the register on
+  * @param msr The register address
+  * @param value[out] The register value
+  *
+  * @return true on success, false if the register cannot be read.
+  */
+bool read_msr(pwr_ctx_t *ctx, unsigned long cpu, uint32_t msr,
+    uint64_t *value);
+
+/*
+  * Writes a model-specific register. May be called from any thread.
+  *
+  * @param cpu The CPU to write the register on
+  * @param msr The register address
+  * @param value The new register value
+  *
+  * @return true on success, false if the register cannot be written.
+  */
+bool write_msr(pwr_ctx_t *ctx, unsigned long cpu, uint32_t msr,
+    uint64_t value);
 
 
 // ###### Structure functions ######
@@ -189,6 +539,53 @@ void init_speed_levels(pwr_ctx_t *ctx);
  */
 void free_speed_data(pwr_ctx_t *ctx);
 
+/*
+ * Writes a new speed level on an island. That is the function behind
+ * pwr_request_speed_level(), it can be called from the library threads as it
+ * does not modify the context error.
+ *
+ * @return PWR_OK once the level is written, even when it is clamped to the
+ *         thermal cap, or the error code.
+ */
+pwr_err_t set_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level);
+
+/*
+ * Writes new speed levels on several islands, taking the DVFS lock once.
+ * Nothing is written if one of the islands or levels is invalid.
+ *
+ * @param islands The islands to change.
+ * @param levels The new speed level of each island.
+ * @param num How many islands to change.
+ *
+ * @return PWR_OK or the last error code.
+ */
+pwr_err_t set_speed_levels(pwr_ctx_t *ctx, const unsigned long *islands,
+    const unsigned int *levels, unsigned long num);
+
+/*
+ * Writes the speed level of every island whose level changes. That is the
+ * function behind pwr_request_speed_levels(), for the callers inside the
+ * library. The DVFS module must be initialized.
+ *
+ * @param levels The new speed level of each island.
+ *
+ * @return PWR_OK, PWR_OVER_T_BUDGET if a level is clamped to the thermal cap,
+ *         or the error code.
+ */
+pwr_err_t request_speed_levels(pwr_ctx_t *ctx, const unsigned int *levels);
+
+/*
+ * Writes the frequency of a speed level in the throttle file of an island, or
+ * in its HWP request in the HWP control mode. Called with the DVFS lock held,
+ * on a valid level. The level is clamped to the thermal cap of the island.
+ *
+ * @return PWR_OK once the level is written, even when it is clamped, or
+ *         PWR_DVFS_ERR.
+ */
+pwr_err_t write_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level);
+
 // ###### Energy-related functions ######
 
 
@@ -204,3 +601,610 @@ void init_energy(pwr_ctx_t *ctx);
   */
 void free_energy_data(pwr_ctx_t *ctx);
 
+/*
+  * Opens the RAPL counters used for internal energy snapshots. Snapshots are
+  * independent of pwr_start_energy_count() and may be taken from any thread.
+  *
+  * @param ctx The current library context.
+  */
+void init_energy_snapshots(pwr_ctx_t *ctx);
+
+/*
+  * Reads the energy consumed by the node since the snapshots were initialized.
+  * The interval of a counter that wrapped around with an unknown range is
+  * dropped.
+  *
+  * @param ctx The current library context.
+  * @param joules[out] The energy consumed, in J.
+  *
+  * @return True on success, false if no RAPL counter is readable.
+  */
+bool energy_snapshot(pwr_ctx_t *ctx, double *joules);
+
+/*
+  * Closes the RAPL counters used for snapshots.
+  */
+void free_energy_snapshots(pwr_ctx_t *ctx);
+
+// ###### Wait-phase hints ######
+
+/*
+  * Allocates the per-island waiter counts. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_wait_hints(pwr_ctx_t *ctx);
+
+/*
+  * Restores the islands lowered by waiting threads and releases the wait
+  * hints resources.
+  */
+void free_wait_hints(pwr_ctx_t *ctx);
+
+// ###### Online energy / performance model ######
+
+/*
+  * Allocates the per-island models. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_model(pwr_ctx_t *ctx);
+
+/*
+  * Releases the models.
+  */
+void free_model(pwr_ctx_t *ctx);
+
+// ###### Power budget distribution ######
+
+/*
+  * Allocates the per-island power tables. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_budget(pwr_ctx_t *ctx);
+
+/*
+  * Releases the power tables.
+  */
+void free_budget(pwr_ctx_t *ctx);
+
+/*
+  * Sets the power of each speed level of a valid island. That is the function
+  * behind pwr_budget_set_power(), for the power table.
+  *
+  * @return PWR_OK or PWR_REQUEST_DENIED if a power is negative or infinite.
+  */
+pwr_err_t budget_set_power(pwr_ctx_t *ctx, unsigned long island,
+    const double *watts);
+
+// ###### Temperature ######
+
+/*
+  * Opens the temperature sensors of every island. Requires the structure
+  * module.
+  *
+  * @param ctx The current library context.
+  */
+void init_thermal(pwr_ctx_t *ctx);
+
+/*
+  * Stops the thermal cap controller and closes the sensors.
+  */
+void free_thermal(pwr_ctx_t *ctx);
+
+/*
+  * Clamps a speed level to the thermal cap of an island and records it as the
+  * level requested for the island. May be called from any thread.
+  *
+  * @param island The island to change the speed level on.
+  * @param level The requested speed level.
+  *
+  * @return The fastest allowed level not above the requested one.
+  */
+unsigned int thermal_clamp(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+
+/*
+  * Tells if a speed level is above the thermal cap of an island, in which case
+  * the public requests report PWR_OVER_T_BUDGET. May be called from any thread.
+  */
+bool thermal_capped(pwr_ctx_t *ctx, unsigned long island, unsigned int level);
+
+// ###### Idle states ######
+
+/*
+  * Lists the idle states of every island and takes the initial residency
+  * snapshot. Requires the structure module.
+  *
+  * @param ctx The current library context.
+  */
+void init_cstates(pwr_ctx_t *ctx);
+
+/*
+  * Closes the cpuidle directories.
+  */
+void free_cstates(pwr_ctx_t *ctx);
+
+// ###### Voltages ######
+
+/*
+  * Allocates the voltage tables of the islands and reads their current
+  * voltage. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_voltages(pwr_ctx_t *ctx);
+
+/*
+  * Restores the voltage offsets changed by the library and frees the voltage
+  * tables.
+  */
+void free_voltages(pwr_ctx_t *ctx);
+
+// ###### Turbo ######
+
+/*
+  * Detects the turbo levels and ranges of the islands and the turbo switch of
+  * the node. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_turbo(pwr_ctx_t *ctx);
+
+/*
+  * Restores the turbo setting changed by the library.
+  */
+void free_turbo(pwr_ctx_t *ctx);
+
+// ###### Hardware-managed P-states ######
+
+/*
+  * Reads the HWP capabilities and requests of the islands. Requires the
+  * structure module.
+  *
+  * @param ctx The current library context.
+  */
+void init_hwp(pwr_ctx_t *ctx);
+
+/*
+  * Restores the HWP requests changed by the library.
+  */
+void free_hwp(pwr_ctx_t *ctx);
+
+/*
+  * Can speed levels be applied through HWP?
+  */
+bool hwp_available(pwr_ctx_t *ctx);
+
+/*
+  * Applies a speed level to an island as an HWP frequency ceiling. Called with
+  * the DVFS lock held, on a valid level.
+  *
+  * @return PWR_OK or PWR_DVFS_ERR.
+  */
+pwr_err_t hwp_write_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+
+// ###### Uncore frequency ######
+
+/*
+  * Finds the uncore islands, through the intel_uncore_frequency driver or the
+  * MSRs. Requires the structure module.
+  *
+  * @param ctx The current library context.
+  */
+void init_uncore(pwr_ctx_t *ctx);
+
+/*
+  * Restores the uncore limits changed by the library.
+  */
+void free_uncore(pwr_ctx_t *ctx);
+
+/*
+  * Is the island ID the one of an uncore island?
+  */
+bool is_uncore_island(pwr_ctx_t *ctx, unsigned long island);
+
+/*
+  * Number of speed levels of an uncore island.
+  */
+unsigned int uncore_num_levels(pwr_ctx_t *ctx, unsigned long island);
+
+/*
+  * Current speed level of an uncore island.
+  */
+unsigned int uncore_current_level(pwr_ctx_t *ctx, unsigned long island);
+
+/*
+  * Pins an uncore island to the frequency of a speed level.
+  *
+  * @return PWR_OK, PWR_UNSUPPORTED_SPEED_LEVEL or PWR_DVFS_ERR.
+  */
+pwr_err_t uncore_set_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+
+// ###### Calibrated power tables ######
+
+/*
+  * Loads the power table designated by the environment, if any. An invalid
+  * table is reported and ignored. Requires the DVFS module.
+  *
+  * @param ctx The current library context.
+  */
+void init_power_table(pwr_ctx_t *ctx);
+
+/*
+  * Releases the power table.
+  */
+void free_power_table(pwr_ctx_t *ctx);
+
+/*
+  * Gets the calibrated speed of an island at a speed level.
+  *
+  * @param speed[out] The speed, in PWR_SPEED_SCALE units.
+  *
+  * @return True if the throughput of every level of every island is calibrated.
+  */
+bool table_speed(pwr_ctx_t *ctx, unsigned long island, unsigned int level,
+    speed_t *speed);
+
+// ###### Memory-boundedness controller ######
+
+/*
+  * Stops the controller if it runs and releases its resources.
+  */
+void free_membound_data(pwr_ctx_t *ctx);
+
+// ###### Idle-island monitor ######
+
+/*
+  * Stops the monitor if it runs and releases its resources.
+  */
+void free_idle_monitor(pwr_ctx_t *ctx);
+
+// ###### Predictive governor ######
+
+/*
+  * Stops the governor if it runs and releases its resources.
+  */
+void free_governor(pwr_ctx_t *ctx);
+
+// ###### Frequency change watcher ######
+
+/*
+  * Stops the watcher if it runs and releases its resources.
+  */
+void free_freq_watch(pwr_ctx_t *ctx);
+
+/*
+  * Records that the library wrote a new speed level on an island, so that
+  * the frequency changes preceding the end of the write are not taken as
+  * external. Called with the DVFS lock held, after a successful write.
+  */
+void freq_watch_written(pwr_ctx_t *ctx, unsigned long island);
+
+// ###### Scheduled speed levels ######
+
+/*
+  * Stops the timer thread, dropping the pending changes, and releases the
+  * scheduler.
+  */
+void free_schedule(pwr_ctx_t *ctx);
+
+/*
+  * Schedules a speed level change to be written at a given time, without
+  * lead. The island and the level must be valid.
+  *
+  * @param issue_ns When to write the change, on the CLOCK_MONOTONIC clock.
+  * @param replayed Is the change scheduled by the replay of a log?
+  *
+  * @return PWR_OK, or PWR_ERR if the timer thread cannot be started.
+  */
+pwr_err_t schedule_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, uint64_t issue_ns, bool replayed);
+
+/*
+  * Cancels the pending changes of an island, or only those scheduled by the
+  * replay of a log.
+  *
+  * @return The number of canceled changes.
+  */
+unsigned long cancel_speed_levels(pwr_ctx_t *ctx, unsigned long island,
+    bool replayed);
+
+// ###### Record and replay ######
+
+/*
+  * Logs a speed level written by set_speed_level() or set_speed_levels() if
+  * recording. Called without the DVFS lock.
+  */
+void record_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+
+/*
+  * Stops recording and replaying.
+  */
+void free_record_replay(pwr_ctx_t *ctx);
+
+// ###### Call tracing ######
+
+/* The public functions recorded by the tracer */
+#define TRACE_FUNCTIONS \
+    X(pwr_budget_set_power, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_budget_set_weight, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_budget_solve, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_budget_apply, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_num_idle_states, PWR_MODULE_STRUCT) \
+    X(pwr_idle_state, PWR_MODULE_STRUCT) \
+    X(pwr_enable_idle_state, PWR_MODULE_STRUCT) \
+    X(pwr_idle_residency, PWR_MODULE_STRUCT) \
+    X(pwr_num_speed_levels, PWR_MODULE_DVFS) \
+    X(pwr_current_speed_level, PWR_MODULE_DVFS) \
+    X(pwr_speed, PWR_MODULE_DVFS) \
+    X(pwr_level_for_speed, PWR_MODULE_DVFS) \
+    X(pwr_request_speed_level, PWR_MODULE_DVFS) \
+    X(pwr_increase_speed_level, PWR_MODULE_DVFS) \
+    X(pwr_request_speed_levels, PWR_MODULE_DVFS) \
+    X(pwr_set_governor, PWR_MODULE_DVFS) \
+    X(pwr_governor, PWR_MODULE_DVFS) \
+    X(pwr_set_speed_control, PWR_MODULE_DVFS) \
+    X(pwr_speed_control, PWR_MODULE_DVFS) \
+    X(pwr_agility, PWR_MODULE_DVFS) \
+    X(pwr_start_energy_count, PWR_MODULE_ENERGY) \
+    X(pwr_stop_energy_count, PWR_MODULE_ENERGY) \
+    X(pwr_freq_watch_start, PWR_MODULE_DVFS) \
+    X(pwr_freq_watch_stop, PWR_MODULE_DVFS) \
+    X(pwr_freq_watch_report, PWR_MODULE_DVFS) \
+    X(pwr_external_speed_changes, PWR_MODULE_DVFS) \
+    X(pwr_governor_start, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_governor_stop, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_governor_report, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_efficiency, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_set_power_priority, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_set_speed_priority, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_hwp_available, PWR_MODULE_DVFS) \
+    X(pwr_hwp_capabilities, PWR_MODULE_DVFS) \
+    X(pwr_hwp_request, PWR_MODULE_DVFS) \
+    X(pwr_set_hwp_request, PWR_MODULE_DVFS) \
+    X(pwr_epp, PWR_MODULE_DVFS) \
+    X(pwr_set_epp, PWR_MODULE_DVFS) \
+    X(pwr_idle_monitor_start, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_idle_monitor_stop, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_idle_monitor_report, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_membound_start, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_membound_stop, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_membound_report, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_model_begin, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_model_end, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_model_sample, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_model_predict, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_best_level, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_level_power, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_set_level_power, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_set_level_throughput, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_load_power_table, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_save_power_table, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_record_start, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_record_stop, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_replay_start, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_replay_stop, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_phase_marker, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_schedule_speed_level, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_cancel_scheduled_speed_levels, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_schedule_report, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_num_phys_cpus, PWR_MODULE_STRUCT) \
+    X(pwr_num_phys_islands, PWR_MODULE_STRUCT) \
+    X(pwr_island_of_cpu, PWR_MODULE_STRUCT) \
+    X(pwr_island_core_type, PWR_MODULE_STRUCT) \
+    X(pwr_island_capacity, PWR_MODULE_STRUCT) \
+    X(pwr_temperature, PWR_MODULE_DVFS) \
+    X(pwr_critical_temperature, PWR_MODULE_DVFS) \
+    X(pwr_thermal_cap_start, PWR_MODULE_DVFS) \
+    X(pwr_thermal_cap_stop, PWR_MODULE_DVFS) \
+    X(pwr_thermal_report, PWR_MODULE_DVFS) \
+    X(pwr_turbo_level, PWR_MODULE_DVFS) \
+    X(pwr_turbo_range, PWR_MODULE_DVFS) \
+    X(pwr_enable_turbo, PWR_MODULE_DVFS) \
+    X(pwr_turbo_enabled, PWR_MODULE_DVFS) \
+    X(pwr_effective_frequency, PWR_MODULE_DVFS) \
+    X(pwr_num_uncore_islands, PWR_MODULE_DVFS) \
+    X(pwr_uncore_frequency, PWR_MODULE_DVFS) \
+    X(pwr_uncore_limits, PWR_MODULE_DVFS) \
+    X(pwr_set_uncore_limits, PWR_MODULE_DVFS) \
+    X(pwr_voltage, PWR_MODULE_DVFS) \
+    X(pwr_level_voltage, PWR_MODULE_DVFS) \
+    X(pwr_increase_voltage, PWR_MODULE_DVFS) \
+    X(pwr_voltage_offset, PWR_MODULE_DVFS) \
+    X(pwr_wait_configure, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_wait_begin, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_wait_end, PWR_MODULE_HIGH_LEVEL) \
+    X(pwr_wait_report, PWR_MODULE_HIGH_LEVEL)
+
+/* Identifiers of the traced functions */
+enum trace_function {
+#define X(name, module) TRACE_##name,
+    TRACE_FUNCTIONS
+#undef X
+    NB_TRACE_FUNCTIONS
+};
+
+/* Island of the calls that do not target an island */
+#define TRACE_NO_ISLAND ((unsigned long) -1)
+
+/* The calls are counted in the statistics */
+#define INSTRUMENT_STATS (1U << 0)
+
+/* The calls are recorded by the active tracer */
+#define INSTRUMENT_TRACE (1U << 1)
+
+/* A traced call in progress */
+typedef struct trace_scope {
+    /* The context of the call, NULL if nothing is maintained */
+    pwr_ctx_t *ctx;
+
+    /* What the call maintains, the context instrument when it started */
+    unsigned int instrument;
+
+    /* The tracer when the call started, NULL if not tracing */
+    struct tracer *tracer;
+
+    /* When the call started, in ns */
+    uint64_t start_ns;
+
+    /* The called function */
+    enum trace_function function;
+
+    /* The island of the call, or TRACE_NO_ISLAND */
+    unsigned long island;
+
+    /* The main argument of the call */
+    long long arg;
+} trace_scope_t;
+
+/*
+  * Records a finished call, with the context error as its result, in the
+  * buffer of the calling thread.
+  */
+void trace_record(const trace_scope_t *scope);
+
+/* Module of every traced function */
+extern const pwr_module_id_t trace_modules[NB_TRACE_FUNCTIONS];
+
+/*
+  * Gets the latency histogram of a function, -1 if its latency is not
+  * recorded. Folded at compile time, the function being a constant.
+  */
+static inline int trace_latency(enum trace_function function) {
+    switch (function) {
+    case TRACE_pwr_request_speed_level:
+        return PWR_LATENCY_REQUEST_SPEED_LEVEL;
+    case TRACE_pwr_start_energy_count:
+        return PWR_LATENCY_START_ENERGY_COUNT;
+    case TRACE_pwr_stop_energy_count:
+        return PWR_LATENCY_STOP_ENERGY_COUNT;
+    default:
+        return -1;
+    }
+}
+
+/*
+  * Starts a traced call.
+  */
+static inline trace_scope_t trace_enter(pwr_ctx_t *ctx,
+    enum trace_function function, unsigned long island, long long arg)
+{
+    trace_scope_t scope = { NULL, 0, NULL, 0, function, island, arg };
+    unsigned int instrument = ctx != NULL ?
+        __atomic_load_n(&ctx->instrument, __ATOMIC_ACQUIRE) : 0;
+
+    // the single check when disabled, trace_exit() then returns at once
+    if (instrument == 0) {
+        return scope;
+    }
+
+    scope.ctx = ctx;
+    scope.instrument = instrument;
+    if (__builtin_expect(instrument & INSTRUMENT_TRACE, 0)) {
+        scope.tracer = __atomic_load_n(&ctx->tracer, __ATOMIC_ACQUIRE);
+    }
+    if (__builtin_expect(scope.tracer != NULL, 0) ||
+        ((instrument & INSTRUMENT_STATS) && trace_latency(function) >= 0))
+    {
+        scope.start_ns = monotonic_ns();
+    }
+    return scope;
+}
+
+/*
+  * Counts a finished call in the statistics of its module.
+  */
+static inline void stats_call(const trace_scope_t *scope) {
+    pwr_stats_t *stats = &scope->ctx->stats;
+    pwr_module_stats_t *ms = &stats->modules[trace_modules[scope->function]];
+    pwr_err_t error = scope->ctx->error;
+
+    __atomic_fetch_add(&ms->calls, 1, __ATOMIC_RELAXED);
+    if (error >= PWR_ARCH_UNSUPPORTED && error <= PWR_DVFS_ERR) {
+        __atomic_fetch_add(&ms->errors[PWR_STATS_ERROR_INDEX(error)], 1,
+            __ATOMIC_RELAXED);
+    }
+
+    int latency = trace_latency(scope->function);
+    if (latency >= 0) {
+        pwr_latency_stats_t *ls = &stats->latencies[latency];
+        uint64_t ns = monotonic_ns() - scope->start_ns;
+        unsigned int bucket = 63 - __builtin_clzll(ns | 1);
+
+        if (bucket >= PWR_STATS_BUCKETS) {
+            bucket = PWR_STATS_BUCKETS - 1;
+        }
+        __atomic_fetch_add(&ls->calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ls->total_ns, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ls->buckets[bucket], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+  * Ends a traced call, when the traced function returns.
+  */
+static inline void trace_exit(trace_scope_t *scope) {
+    if (scope->ctx == NULL) {
+        return;
+    }
+
+    if (scope->instrument & INSTRUMENT_STATS) {
+        stats_call(scope);
+    }
+    if (__builtin_expect(scope->tracer != NULL, 0)) {
+        trace_record(scope);
+    }
+}
+
+/*
+  * Traces the enclosing public function. The call is counted in the
+  * statistics if enabled, and recorded if tracing, when the function returns,
+  * whatever the return statement. When neither is on, a call costs a single
+  * check.
+  *
+  * @param ctx The current library context.
+  * @param function The name of the function.
+  * @param island The island of the call, or TRACE_NO_ISLAND.
+  * @param arg The main argument of the call.
+  */
+#define TRACE_CALL(ctx, function, island, arg) \
+    trace_scope_t trace_scope __attribute__((cleanup(trace_exit))) = \
+        trace_enter((ctx), TRACE_##function, (island), (long long) (arg))
+
+/*
+  * Stops tracing and releases the tracers.
+  */
+void free_tracers(pwr_ctx_t *ctx);
+
+// ###### Statistics ######
+
+/*
+  * Counts system calls reading or writing the hardware state, one per read or
+  * write of a sysfs attribute or an MSR. Opening and closing the files is not
+  * counted.
+  *
+  * @param ctx The current library context.
+  * @param module The module issuing the calls.
+  * @param syscalls The number of system calls.
+  * @param bytes The number of bytes written.
+  */
+static inline void stats_io(pwr_ctx_t *ctx, pwr_module_id_t module,
+    unsigned long syscalls, unsigned long bytes)
+{
+    if (!(__atomic_load_n(&ctx->instrument, __ATOMIC_RELAXED) &
+          INSTRUMENT_STATS))
+    {
+        return;
+    }
+
+    pwr_module_stats_t *ms = &ctx->stats.modules[module];
+    __atomic_fetch_add(&ms->syscalls, syscalls, __ATOMIC_RELAXED);
+    if (bytes > 0) {
+        __atomic_fetch_add(&ms->bytes_written, bytes, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,117 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the automatic DVFS controller reacting to memory-bound
+ *  phases.
+ *
+ * When started, the controller samples the hardware counters of every island
+ * in a background thread. The phases during which the island mostly waits for
+ * the memory are run at a lower speed level, as the frequency has little
+ * impact on their execution time. The controller owns the speed level of the
+ * islands while it runs: speed levels requested by the user in the meantime
+ * may be overridden.
+ *
+ * Counters are read through perf_event and count every process running on
+ * the island. That requires a permissive kernel.perf_event_paranoid setting
+ * (0 or lower) or the CAP_PERFMON capability.
+ */
+
+#ifndef __MEMBOUND_H__
+#define __MEMBOUND_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Parameters of the memory-boundedness controller.
+ * Use pwr_membound_default_params() to get a sensible initial value.
+ */
+typedef struct {
+    double period;          //!< Sampling period, in s.
+    double ipc_threshold;   //!< Phases with a higher IPC are compute bound.
+    double mpki_threshold;  //!< LLC misses per 1000 instructions above which
+                            //!< a phase is memory bound.
+    double stall_threshold; //!< Fraction of backend stall cycles above which a
+                            //!< phase is memory bound, if counted.
+    double freq_ratio;      //!< Frequency ratio, relative to the reference
+                            //!< speed level, used in memory-bound phases.
+    unsigned int hysteresis;//!< Consecutive samples required to switch phase.
+    unsigned int dwell;     //!< Minimal time between two transitions, as a
+                            //!< multiple of the island agility.
+} pwr_membound_params_t;
+
+/**
+ * Activity report of the memory-boundedness controller.
+ * Estimates compare the lowered phases with memory-bound phases observed at
+ * the reference speed level, both in instruction throughput and power.
+ */
+typedef struct {
+    double duration;            //!< Time the controller ran, in s.
+    unsigned long samples;      //!< Island samples taken.
+    unsigned long mem_samples;  //!< Samples classified as memory bound.
+    unsigned long transitions;  //!< Speed level changes issued.
+    double lowered_time;        //!< Island time spent lowered, in s.
+    double est_slowdown;        //!< Estimated execution time lost, in s.
+    double energy;              //!< Node energy consumed, in J.
+    double est_energy_saved;    //!< Estimated node energy saved, in J.
+} pwr_membound_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Provides the default controller parameters.
+ *
+ * @param params[out] The parameters to initialize.
+ */
+void pwr_membound_default_params(pwr_membound_params_t *params);
+
+/**
+ * Starts the memory-boundedness controller on every island. The speed level
+ * of each island when the controller starts is used as the reference level,
+ * in compute-bound phases.
+ *
+ * @param ctx The current library context.
+ * @param params The controller parameters, or NULL to use the defaults.
+ */
+void pwr_membound_start(pwr_ctx_t *ctx, const pwr_membound_params_t *params);
+
+/**
+ * Stops the memory-boundedness controller and restores the reference speed
+ * levels.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_membound_stop(pwr_ctx_t *ctx);
+
+/**
+ * Reports what the controller did since it started. The report remains
+ * available after the controller stops, until it is started again.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_membound_report(pwr_ctx_t *ctx, pwr_membound_report_t *report);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the online energy / performance model of the speed
+ *  levels, learned from runtime measurements.
+ *
+ * The model is maintained per island and per application phase. For every
+ * speed level, it records the time and energy required to process one unit of
+ * progress, where the progress unit is defined by the application (iterations,
+ * cells, requests...). Samples are provided either by bracketing a piece of
+ * work with pwr_model_begin() and pwr_model_end(), in which case the library
+ * measures the node energy, or directly through pwr_model_sample().
+ *
+ * Speed levels that were never sampled are predicted by fitting
+ * <code>time = a + b / f</code> and <code>power = c + d * f^3</code> on the
+ * sampled levels. Decisions are cached and only recomputed after new samples,
+ * so that pwr_best_level() costs O(log levels).
+ */
+
+#ifndef __MODEL_H__
+#define __MODEL_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+/** \addtogroup limits
+  * @{
+  */
+
+/** The maximum number of application phases modeled per island */
+#define PWR_MAX_PHASES (64)
+
+/** @} */
+
+/**
+ * An optimization objective.
+ */
+typedef unsigned int pwr_objective_t;
+
+/** All the objectives supported by pwr_best_level() */
+enum pwr_objective_t {
+    PWR_OBJECTIVE_ENERGY = 0,   /**< Minimize the energy */
+    PWR_OBJECTIVE_EDP,          /**< Minimize the energy-delay product */
+    PWR_OBJECTIVE_DEADLINE,     /**< Minimize the energy within a time bound */
+    PWR_NB_OBJECTIVES           /**< Number of objectives */
+};
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Starts measuring a piece of work of the given phase on an island. The work
+ * runs at the current speed level of the island, which must not change until
+ * pwr_model_end() is called.
+ *
+ * @param ctx The current library context.
+ * @param island The island running the work.
+ * @param phase The application phase, in [0, PWR_MAX_PHASES).
+ */
+void pwr_model_begin(pwr_ctx_t *ctx, unsigned long island, unsigned int phase);
+
+/**
+ * Ends the measurement started by pwr_model_begin() and updates the model.
+ * The sample is dropped if the speed level changed in the meantime.
+ *
+ * @param ctx The current library context.
+ * @param island The island running the work.
+ * @param progress How many progress units were processed.
+ */
+void pwr_model_end(pwr_ctx_t *ctx, unsigned long island, double progress);
+
+/**
+ * Updates the model with a sample measured by the application.
+ *
+ * @param ctx The current library context.
+ * @param island The island that ran the work.
+ * @param phase The application phase, in [0, PWR_MAX_PHASES).
+ * @param level The speed level the work ran at.
+ * @param progress How many progress units were processed.
+ * @param time How long the work took, in s.
+ * @param energy The energy consumed, in J.
+ */
+void pwr_model_sample(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, unsigned int level, double progress, double time,
+    energy_t energy);
+
+/**
+ * Predicts the cost of one progress unit of a phase at a speed level.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param phase The application phase.
+ * @param level The speed level of interest.
+ * @param time[out] The predicted time per progress unit, in s.
+ * @param energy[out] The predicted energy per progress unit, in J.
+ */
+void pwr_model_predict(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, unsigned int level, double *time, energy_t *energy);
+
+/**
+ * Selects the best speed level for a phase on an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param phase The application phase.
+ * @param objective The optimization objective.
+ * @param deadline For PWR_OBJECTIVE_DEADLINE, the maximal time per progress
+ *  unit, in s. Ignored otherwise.
+ *
+ * @return The best speed level. The fastest level is returned when no level
+ *  meets the deadline, the current level if the phase was never sampled.
+ */
+unsigned int pwr_best_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, pwr_objective_t objective, double deadline);
+
+#endif
@@ -224,6 +224,8 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 //====-------------------------------------------------------------------------
 // Constants
@@ -309,11 +311,13 @@ extern "C" {
 /** Error: Request denied, over energy budget */
 #define PWR_OVER_E_BUDGET (12) // reserved for future
 
-/** Error: Request denied, over power budget */
-#define PWR_OVER_P_BUDGET (13) // reserved for future
+/** Error: Power budget too low, even the lowest speed levels draw more
+  * power than it allows */
+#define PWR_OVER_P_BUDGET (13)
 
-/** Error: Request denied, over thermal budget */
-#define PWR_OVER_T_BUDGET (14) // reserved for future
+/** Error: Speed level over the thermal budget, the island was set to the
+  * highest level the budget allows */
+#define PWR_OVER_T_BUDGET (14)
 
 /** Error: Specified island does not exist */
 #define PWR_INVALID_ISLAND (15)
@@ -333,16 +337,23 @@ typedef double efficiency_t;
 /** Voltage in Volts */
 typedef double voltage_t;
 
-/** Speed in UNDEFINED units */
+/**
+  * Speed in capacity units: PWR_SPEED_SCALE is the speed of the fastest island
+  * of the node at its highest frequency. Speeds compare islands of different
+  * core types directly.
+  */
 typedef long speed_t;
 
+/** The speed of the fastest island of the node */
+#define PWR_SPEED_SCALE (1024)
+
 /** Unit-less speed level */
 typedef long speed_level_t;
 
 /** Frequency in KHz */
 typedef long freq_t;
 
-/** Agility in UNDEFINED units */
+/** Agility, i.e. speed level transition latency, in ns */
 typedef long agility_t;
 
 /** Power in Watts */
@@ -393,6 +404,23 @@ typedef struct pwr_ctx pwr_ctx_t;
 #include "dvfs.h"
 #include "energy.h"
 #include "high-level.h"
+#include "membound.h"
+#include "wait.h"
+#include "model.h"
+#include "budget.h"
+#include "power-table.h"
+#include "thermal.h"
+#include "cstate.h"
+#include "turbo.h"
+#include "hwp.h"
+#include "uncore.h"
+#include "idle-monitor.h"
+#include "governor.h"
+#include "freq-watch.h"
+#include "schedule.h"
+#include "replay.h"
+#include "trace.h"
+#include "stats.h"
 
 //====-------------------------------------------------------------------------
 // Setup / shutdown
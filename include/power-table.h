@@ -0,0 +1,123 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the calibrated power tables: the power drawn by every
+ *  island at each speed level under reference workloads.
+ *
+ * Tables are measured by the pwr-calibrate tool and stored in a compact binary
+ * file. The library loads the file designated by the PWR_POWER_TABLE
+ * environment variable, or PWR_POWER_TABLE_PATH, when it is initialized. A
+ * table is only accepted if it was measured on the same islands and
+ * frequencies. Once loaded, the compute power of the islands is used as the
+ * default power table of the budget optimizer.
+ *
+ * The power of an island includes its share of the idle power of the node, so
+ * that the powers of all the islands add up to the power of the node.
+ *
+ * Tables also hold the throughput of the compute workload on one CPU of every
+ * island at each level. Once every level of every island is calibrated, speeds
+ * (see pwr_speed()) are the measured throughputs, scaled so that the fastest
+ * level of the node has a speed of PWR_SPEED_SCALE.
+ */
+
+#ifndef __POWER_TABLE_H__
+#define __POWER_TABLE_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+/** Default location of the power table */
+#define PWR_POWER_TABLE_PATH "/var/lib/power-api/power-table"
+
+/** Environment variable overriding the location of the power table */
+#define PWR_POWER_TABLE_ENV "PWR_POWER_TABLE"
+
+/**
+ * A reference workload.
+ */
+typedef unsigned int pwr_load_t;
+
+/** All the reference workloads of the power tables */
+enum pwr_load_t {
+    PWR_LOAD_COMPUTE = 0,   /**< Arithmetic, in-core workload */
+    PWR_LOAD_MEMORY,        /**< Memory bandwidth bound workload */
+    PWR_NB_LOADS            /**< Number of reference workloads */
+};
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Gets the calibrated power of an island at a speed level. The error is set to
+ * PWR_UNAVAILABLE if that level was not calibrated.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param level The speed level of interest.
+ * @param load The reference workload.
+ *
+ * @return The power, in W.
+ */
+double pwr_level_power(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, pwr_load_t load);
+
+/**
+ * Sets the calibrated power of an island, typically after measuring it.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param load The reference workload.
+ * @param watts The power at each speed level, in W, one value per level.
+ */
+void pwr_set_level_power(pwr_ctx_t *ctx, unsigned long island,
+    pwr_load_t load, const double *watts);
+
+/**
+ * Sets the calibrated compute throughput of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param throughput The throughput of one CPU at each speed level, in any unit
+ *  shared by all the islands, one value per level.
+ */
+void pwr_set_level_throughput(pwr_ctx_t *ctx, unsigned long island,
+    const double *throughput);
+
+/**
+ * Loads a power table file, replacing the current table.
+ *
+ * @param ctx The current library context.
+ * @param path The table file.
+ */
+void pwr_load_power_table(pwr_ctx_t *ctx, const char *path);
+
+/**
+ * Saves the current power table to a file. The file is replaced atomically.
+ *
+ * @param ctx The current library context.
+ * @param path The table file.
+ */
+void pwr_save_power_table(pwr_ctx_t *ctx, const char *path);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the recording and the replay of speed level schedules.
+ *
+ * While recording, every speed level written by the library, requested
+ * through pwr_request_speed_level(), pwr_request_speed_levels() or set by its
+ * controllers, is logged with its time to a compact binary file. The
+ * application may also log phase markers with pwr_phase_marker().
+ *
+ * A later run of the same job replays the log: the requests are issued again
+ * by the timer thread of the scheduler, at the same times. Times are relative
+ * to the last marker, so the schedule follows the pace of the new run: when
+ * the application reaches a marker, the requests following it in the log are
+ * scheduled from that instant on, and the requests of the previous phase that
+ * are still pending are applied at once.
+ *
+ * Logs use the byte order of the machine that recorded them and only replay
+ * on a node with the same number of islands.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Starts recording the speed level requests into a file, replacing it.
+ *
+ * @param ctx The current library context.
+ * @param path The log file.
+ */
+void pwr_record_start(pwr_ctx_t *ctx, const char *path);
+
+/**
+ * Stops recording and writes the rest of the log.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_record_stop(pwr_ctx_t *ctx);
+
+/**
+ * Starts replaying a log. The requests preceding the first marker are
+ * scheduled from now on.
+ *
+ * @param ctx The current library context.
+ * @param path The log file.
+ */
+void pwr_replay_start(pwr_ctx_t *ctx, const char *path);
+
+/**
+ * Stops replaying a log. The pending changes of the log are canceled, those
+ * scheduled with pwr_schedule_speed_level() are kept.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_replay_stop(pwr_ctx_t *ctx);
+
+/**
+ * Marks the start of an application phase. The marker is logged while
+ * recording; while replaying, the log is resumed after the next occurrence of
+ * the marker. Does nothing when neither recording nor replaying.
+ *
+ * @param ctx The current library context.
+ * @param marker The phase identifier.
+ */
+void pwr_phase_marker(pwr_ctx_t *ctx, unsigned int marker);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the scheduling of speed level changes ahead of time.
+ *
+ * An application that knows when its next phase starts can schedule the speed
+ * level of the phase in advance. The change is issued earlier than the phase
+ * start by the agility of the island, so that the new frequency is effective
+ * when the phase starts. A timer thread, started by the first scheduled
+ * change, issues the changes; changes falling within a few microseconds of
+ * each other are written together.
+ *
+ * Times are read on the CLOCK_MONOTONIC clock, in ns.
+ */
+
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Activity report of the speed level scheduler.
+ */
+typedef struct {
+    unsigned long scheduled;    //!< Changes scheduled.
+    unsigned long canceled;     //!< Changes canceled before being issued.
+    unsigned long issued;       //!< Changes issued.
+    unsigned long batches;      //!< Writes of one or several changes.
+    unsigned long failed;       //!< Batches whose write failed.
+    double max_lateness;        //!< Largest delay between the planned issue
+                                //!< time of a change and its write, in s.
+} pwr_schedule_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Schedules a speed level change. Changes of the same island take effect in
+ * the order of their times; a change whose time is already past is issued at
+ * once.
+ *
+ * @param ctx The current library context.
+ * @param island The island to change.
+ * @param level The new speed level.
+ * @param at When the level must be effective, on the CLOCK_MONOTONIC clock,
+ *  in ns.
+ */
+void pwr_schedule_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, uint64_t at);
+
+/**
+ * Cancels the changes of an island that were not issued yet.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The number of canceled changes.
+ */
+unsigned long pwr_cancel_scheduled_speed_levels(pwr_ctx_t *ctx,
+    unsigned long island);
+
+/**
+ * Reports what the scheduler did since the library was initialized.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_schedule_report(pwr_ctx_t *ctx, pwr_schedule_report_t *report);
+
+#endif
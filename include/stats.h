@@ -0,0 +1,119 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the statistics of the library activity.
+ *
+ * The library counts, per module, the calls of the public functions and
+ * their resulting error codes, as well as the system calls it issues to read
+ * or change the hardware state once initialized, and the bytes those calls
+ * write. The latencies of pwr_request_speed_level(), pwr_start_energy_count()
+ * and pwr_stop_energy_count() are also recorded in histograms with
+ * power-of-two buckets.
+ *
+ * The functions of the other headers are counted with the module they build
+ * on: the hardware controls (idle states, turbo, HWP, uncore, thermal,
+ * voltage) with PWR_MODULE_DVFS, the controllers, models and schedules with
+ * PWR_MODULE_HIGH_LEVEL.
+ *
+ * Counters only grow from the library initialization on, while enabled. They are updated
+ * with relaxed atomic operations, so that a snapshot taken while other
+ * threads use the library is consistent per counter only.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/** The number of error codes counted, from PWR_ARCH_UNSUPPORTED to PWR_DVFS_ERR */
+#define PWR_STATS_ERRORS (PWR_DVFS_ERR - PWR_ARCH_UNSUPPORTED + 1)
+
+/** The index of an error code in pwr_module_stats_t::errors */
+#define PWR_STATS_ERROR_INDEX(error) ((error) - PWR_ARCH_UNSUPPORTED)
+
+/**
+ * The number of latency buckets. Bucket b counts the calls that took between
+ * 2^b and 2^(b+1) ns, the last one every longer call.
+ */
+#define PWR_STATS_BUCKETS (40)
+
+/** The functions whose latency is recorded */
+enum pwr_latency_id_t {
+    PWR_LATENCY_REQUEST_SPEED_LEVEL = 0,    /**< pwr_request_speed_level() */
+    PWR_LATENCY_START_ENERGY_COUNT,         /**< pwr_start_energy_count() */
+    PWR_LATENCY_STOP_ENERGY_COUNT,          /**< pwr_stop_energy_count() */
+    PWR_NB_LATENCIES                        /**< Number of histograms */
+};
+
+/**
+ * Activity of a module.
+ */
+typedef struct {
+    uint64_t calls;                     //!< Calls of its public functions.
+    uint64_t errors[PWR_STATS_ERRORS];  //!< Calls per resulting error code,
+                                        //!< PWR_OK included.
+    uint64_t syscalls;                  //!< System calls reading or writing
+                                        //!< the hardware state.
+    uint64_t bytes_written;             //!< Bytes written to sysfs and MSRs.
+} pwr_module_stats_t;
+
+/**
+ * Latency histogram of a function.
+ */
+typedef struct {
+    uint64_t calls;                         //!< Calls measured.
+    uint64_t total_ns;                      //!< Sum of their latencies.
+    uint64_t buckets[PWR_STATS_BUCKETS];    //!< Calls per latency bucket.
+} pwr_latency_stats_t;
+
+/**
+ * Statistics of the library.
+ */
+typedef struct {
+    pwr_module_stats_t modules[PWR_NB_MODULES];         //!< Per module id.
+    pwr_latency_stats_t latencies[PWR_NB_LATENCIES];    //!< Per latency id.
+} pwr_stats_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Gets a snapshot of the library statistics.
+ *
+ * @param ctx The current library context.
+ * @param stats Filled with the statistics.
+ */
+void pwr_get_stats(pwr_ctx_t *ctx, pwr_stats_t *stats);
+
+/**
+ * Enables or disables the statistics, enabled from the library
+ * initialization on. While they are disabled and no trace is running, a call
+ * of the public functions costs a single check.
+ * @param ctx The current library context.
+ * @param enable True to count the activity, false to stop counting it.
+ */
+void pwr_enable_stats(pwr_ctx_t *ctx, bool enable);
+
+#endif
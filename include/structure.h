@@ -26,6 +26,29 @@
     #error "Never directly include this file, rather use power_api.h"
 #endif
 
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * The microarchitecture of the cores of an island.
+ */
+typedef unsigned int pwr_core_type_t;
+
+/**
+ * Environment variable replacing /sys for the CPU topology and cpufreq files,
+ * e.g. to initialize the library on a synthetic tree. The online CPUs are then
+ * read from devices/system/cpu/online under that root.
+ */
+#define PWR_SYSFS_ROOT_ENV "PWR_SYSFS_ROOT"
+
+/** Core types of hybrid processors */
+enum pwr_core_type_t {
+    PWR_CORE_UNKNOWN = 0,   /**< Not a hybrid processor, or unknown type */
+    PWR_CORE_PERFORMANCE,   /**< Performance core, e.g. Intel Core */
+    PWR_CORE_EFFICIENCY     /**< Efficiency core, e.g. Intel Atom */
+};
+
 //====-------------------------------------------------------------------------
 // Public Functions
 //-----------------------------------------------------------------------------
@@ -59,5 +82,27 @@ unsigned long pwr_num_phys_islands(pwr_ctx_t *ctx);
  */
 unsigned long pwr_island_of_cpu(pwr_ctx_t *ctx, unsigned long cpu);
 
+/**
+ * Returns the type of the cores of an island.
+ *
+ * @param ctx The current API context.
+ * @param island The island of interest.
+ *
+ * @return The core type, PWR_CORE_UNKNOWN on processors that are not hybrid.
+ */
+pwr_core_type_t pwr_island_core_type(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Returns the speed of an island at its highest frequency. The capacity comes
+ * from the kernel (cpu_capacity) when available, or is estimated from the core
+ * type and the highest frequency of the island.
+ *
+ * @param ctx The current API context.
+ * @param island The island of interest.
+ *
+ * @return The capacity, PWR_SPEED_SCALE for the fastest islands of the node.
+ */
+speed_t pwr_island_capacity(pwr_ctx_t *ctx, unsigned long island);
+
 #endif
 
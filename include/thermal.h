@@ -0,0 +1,104 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the temperature readout and the thermal cap controller.
+ *
+ * Temperatures are read from the coretemp hwmon sensors of the cores of each
+ * island, or of its packages when the cores have no sensor of their own. When
+ * coretemp is not available, the digital thermal sensor of the CPUs is read
+ * from the IA32_THERM_STATUS MSR. Sensors are opened once, when the library is
+ * initialized.
+ *
+ * The thermal cap controller keeps the islands below a temperature by lowering
+ * their maximal speed level before the hardware starts throttling. While an
+ * island is capped, faster speed levels requests are clamped to the cap and
+ * fail with PWR_OVER_T_BUDGET. The requested level is restored once the island
+ * cools down.
+ */
+
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Activity report of the thermal cap controller.
+ */
+typedef struct {
+    unsigned long samples;      //!< Island temperature samples taken.
+    unsigned long lowerings;    //!< How many times a cap was lowered.
+    double capped_time;         //!< Cumulated island time spent capped, in s.
+    double max_temperature;     //!< Highest temperature observed, in C.
+} pwr_thermal_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Reads the temperature of an island, the hottest of its sensors.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The temperature, in C.
+ */
+double pwr_temperature(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Gets the temperature at which the hardware of an island starts throttling.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The temperature, in C.
+ */
+double pwr_critical_temperature(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Starts the thermal cap controller on every island.
+ *
+ * @param ctx The current library context.
+ * @param cap The temperature to stay under, in C, or 0 to stay 5 C under the
+ *  critical temperature of each island.
+ * @param period The sampling period, in s.
+ */
+void pwr_thermal_cap_start(pwr_ctx_t *ctx, double cap, double period);
+
+/**
+ * Stops the thermal cap controller and restores the requested speed levels.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_thermal_cap_stop(pwr_ctx_t *ctx);
+
+/**
+ * Reports the activity of the thermal cap controller.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_thermal_report(pwr_ctx_t *ctx, pwr_thermal_report_t *report);
+
+#endif
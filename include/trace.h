@@ -0,0 +1,59 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the tracing of the library calls.
+ *
+ * While tracing, every call of a public function taking a context, except
+ * pwr_error(), pwr_is_initialized(), pwr_get_stats() and the setup and
+ * tracing functions, is recorded with its island, its main argument, the
+ * resulting error code, its start time and its duration. Calls are buffered
+ * per thread without locks and written by a background thread to a file in
+ * the Chrome trace event format, which chrome://tracing and Perfetto open.
+ * Calls made when a thread buffer is full are dropped and counted in the
+ * trace metadata.
+ *
+ * When tracing is disabled, a call costs a single test of the context.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Starts tracing the library calls into a file, replacing it.
+ *
+ * @param ctx The current library context.
+ * @param path The trace file.
+ */
+void pwr_trace_start(pwr_ctx_t *ctx, const char *path);
+
+/**
+ * Stops tracing, writes the remaining calls and closes the trace file.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_trace_stop(pwr_ctx_t *ctx);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the turbo (boost) awareness and control.
+ *
+ * cpufreq lists the whole turbo range of an island as a single speed level,
+ * one MHz above the nominal frequency. Requesting that level lets the hardware
+ * pick any frequency of the turbo range, depending on the number of active
+ * cores, the temperature and the power budget. The frequency actually reached
+ * is measured with the APERF / MPERF counters of the CPUs.
+ *
+ * Turbo is enabled or disabled for the whole node, through the cpufreq boost
+ * file, the intel_pstate no_turbo file or the IA32_MISC_ENABLE MSR, in that
+ * order of preference. The initial setting is restored when the library is
+ * finalized.
+ */
+
+#ifndef __TURBO_H__
+#define __TURBO_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Gets the turbo speed level of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The speed level, always the fastest one. Fails with PWR_UNAVAILABLE
+ *  when the island has no turbo level.
+ */
+unsigned int pwr_turbo_level(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Gets the turbo range of an island.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ * @param nominal[out] The nominal frequency, reached without turbo, in KHz.
+ * @param max[out] The highest turbo frequency, with a single active core, in
+ *  KHz.
+ */
+void pwr_turbo_range(pwr_ctx_t *ctx, unsigned long island, freq_t *nominal,
+    freq_t *max);
+
+/**
+ * Enables or disables turbo on the whole node.
+ *
+ * @param ctx The current library context.
+ * @param enable True to enable turbo, false to disable it.
+ */
+void pwr_enable_turbo(pwr_ctx_t *ctx, bool enable);
+
+/**
+ * Is turbo enabled?
+ *
+ * @param ctx The current library context.
+ *
+ * @return True if turbo is enabled on the node.
+ */
+bool pwr_turbo_enabled(pwr_ctx_t *ctx);
+
+/**
+ * Measures the average frequency of an island since the previous measure on
+ * the same island, or since the library was initialized. The time spent idle
+ * is not accounted for.
+ *
+ * @param ctx The current library context.
+ * @param island The island of interest.
+ *
+ * @return The effective frequency, in KHz, or 0 if the island was idle.
+ */
+freq_t pwr_effective_frequency(pwr_ctx_t *ctx, unsigned long island);
+
+#endif
@@ -0,0 +1,85 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the control of the uncore frequency of Intel processors.
+ *
+ * The uncore (caches, memory controller and interconnect) of every package, or
+ * die, is exposed as an uncore island. Uncore island <code>u</code> has the ID
+ * <code>pwr_num_phys_islands() + u</code>, so that the speed level functions
+ * of the DVFS module also drive the uncore islands: their speed levels step
+ * through the uncore frequency range by 100 MHz, and a level pins the uncore
+ * to its frequency.
+ *
+ * The uncore is controlled through the intel_uncore_frequency driver or, when
+ * it is not loaded, through the MSR_UNCORE_RATIO_LIMIT register. The limits
+ * found when the library was initialized are restored when it is finalized.
+ */
+
+#ifndef __UNCORE_H__
+#define __UNCORE_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Gets the number of uncore islands.
+ *
+ * @param ctx The current library context.
+ *
+ * @return The number of uncore islands, 0 if the uncore cannot be controlled.
+ */
+unsigned long pwr_num_uncore_islands(pwr_ctx_t *ctx);
+
+/**
+ * Reads the current frequency of an uncore island.
+ *
+ * @param ctx The current library context.
+ * @param island The uncore island of interest.
+ *
+ * @return The frequency, in KHz.
+ */
+freq_t pwr_uncore_frequency(pwr_ctx_t *ctx, unsigned long island);
+
+/**
+ * Gets the frequency limits of an uncore island.
+ *
+ * @param ctx The current library context.
+ * @param island The uncore island of interest.
+ * @param min[out] The lowest frequency allowed, in KHz.
+ * @param max[out] The highest frequency allowed, in KHz.
+ */
+void pwr_uncore_limits(pwr_ctx_t *ctx, unsigned long island, freq_t *min,
+    freq_t *max);
+
+/**
+ * Sets the frequency limits of an uncore island, within its frequency range.
+ *
+ * @param ctx The current library context.
+ * @param island The uncore island of interest.
+ * @param min The lowest frequency allowed, in KHz.
+ * @param max The highest frequency allowed, in KHz.
+ */
+void pwr_set_uncore_limits(pwr_ctx_t *ctx, unsigned long island, freq_t min,
+    freq_t max);
+
+#endif
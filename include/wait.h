@@ -0,0 +1,95 @@
+/*
+  * Copyright 2013-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/**
+ * @file
+ *  The file contains the wait-phase hints, used to reclaim the slack of
+ *  threads waiting at barriers or for communications.
+ *
+ * A thread about to wait calls pwr_wait_begin() and pwr_wait_end() once the
+ * wait is over. The island of the calling thread is dropped to its minimum
+ * speed level once enough of its CPUs are waiting for longer than a grace
+ * period, and its former speed level is restored as soon as one of them
+ * resumes. The threads still running on the island are thus never slowed down.
+ * Waits shorter than the grace period only cost a couple of atomic operations
+ * while the quorum is not reached.
+ *
+ * Contrarily to the rest of the library, these two functions are meant to be
+ * called concurrently from any thread. They only set the context error on
+ * failure.
+ */
+
+#ifndef __WAIT_H__
+#define __WAIT_H__
+
+#ifndef __POWER_API_H__
+    #error "Never directly include this file, rather use power_api.h"
+#endif
+
+//====-------------------------------------------------------------------------
+// Public data types
+//-----------------------------------------------------------------------------
+
+/**
+ * Slack reclaimed by the wait-phase hints since the library was initialized.
+ */
+typedef struct {
+    unsigned long waits;        //!< Completed waits.
+    double wait_time;           //!< Cumulated thread time spent waiting, in s.
+    unsigned long lowerings;    //!< How many times an island was lowered.
+    double lowered_time;        //!< Cumulated island time spent lowered, in s.
+} pwr_wait_report_t;
+
+//====-------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * Configures when islands are lowered. The default is a grace period of 1 ms
+ * and a quorum of 1 (every CPU of the island must be waiting).
+ *
+ * Must not be called while threads are waiting.
+ *
+ * @param ctx The current library context.
+ * @param grace How long the island must be waiting before being lowered, in s.
+ * @param quorum Fraction of the island CPUs that must be waiting, in (0, 1].
+ */
+void pwr_wait_configure(pwr_ctx_t *ctx, double grace, double quorum);
+
+/**
+ * Declares that the calling thread starts waiting. Calls may be nested, only
+ * the outermost pair is accounted.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_wait_begin(pwr_ctx_t *ctx);
+
+/**
+ * Declares that the calling thread stopped waiting.
+ *
+ * @param ctx The current library context.
+ */
+void pwr_wait_end(pwr_ctx_t *ctx);
+
+/**
+ * Reports the time spent waiting and the slack reclaimed by lowering islands.
+ *
+ * @param ctx The current library context.
+ * @param report[out] Where to store the report.
+ */
+void pwr_wait_report(pwr_ctx_t *ctx, pwr_wait_report_t *report);
+
+#endif
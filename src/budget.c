@@ -0,0 +1,458 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internals.h"
+
+/* Budget state of one island */
+typedef struct {
+    /* Power per speed level, in W, NULL until set */
+    double *watts;
+
+    /* Relative throughput per speed level, in (0, 1] */
+    double *value;
+
+    /* Throughput weight */
+    double weight;
+
+    /*
+     * Levels on the upper concave hull of the (power, throughput) curve, by
+     * increasing power. Each step along the hull has a lower gain per watt
+     * than the previous one.
+     */
+    unsigned int num_hull;
+    unsigned int *hull;
+
+    /* Must the hull be recomputed? */
+    bool dirty;
+} budget_island_t;
+
+/* Power budget state */
+struct budget {
+    /* Per-island state */
+    budget_island_t *islands;
+
+    /* Solver scratch: position on the hull and heap of islands, per island */
+    unsigned int *pos;
+    unsigned long *heap;
+    double *gain;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void update_hull(pwr_ctx_t *ctx, unsigned long island);
+static double step_gain(budget_island_t *bi, unsigned int pos);
+static void heap_push(struct budget *b, unsigned long *size,
+    unsigned long island);
+static unsigned long heap_pop(struct budget *b, unsigned long *size);
+static pwr_err_t solve(pwr_ctx_t *ctx, double budget, unsigned int *levels,
+    double *power);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_budget_set_power(pwr_ctx_t *ctx, unsigned long island,
+    const double *watts)
+{
+    TRACE_CALL(ctx, pwr_budget_set_power, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->budget == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    ctx->error = budget_set_power(ctx, island, watts);
+}
+
+void pwr_budget_set_weight(pwr_ctx_t *ctx, unsigned long island,
+    double weight)
+{
+    TRACE_CALL(ctx, pwr_budget_set_weight, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->budget == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    if (!(weight >= 0) || isinf(weight)) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    ctx->budget->islands[island].weight = weight;
+    ctx->error = PWR_OK;
+}
+
+double pwr_budget_solve(pwr_ctx_t *ctx, double budget, unsigned int *levels) {
+    TRACE_CALL(ctx, pwr_budget_solve, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (ctx->budget == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    double power = 0;
+    ctx->error = solve(ctx, budget, levels, &power);
+    return power;
+}
+
+void pwr_budget_apply(pwr_ctx_t *ctx, double budget) {
+    TRACE_CALL(ctx, pwr_budget_apply, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->budget == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    unsigned int levels[ctx->num_phys_islands];
+    double power;
+
+    ctx->error = solve(ctx, budget, levels, &power);
+    if (ctx->error != PWR_OK) {
+        return;
+    }
+
+    ctx->error = request_speed_levels(ctx, levels);
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_budget(pwr_ctx_t *ctx) {
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    unsigned long num = ctx->num_phys_islands;
+    struct budget *b = malloc(sizeof(*b));
+    b->islands = calloc(num, sizeof(*b->islands));
+    b->pos = calloc(num, sizeof(*b->pos));
+    b->heap = calloc(num, sizeof(*b->heap));
+    b->gain = calloc(num, sizeof(*b->gain));
+
+    for (unsigned long i = 0; i < num; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        budget_island_t *bi = &b->islands[i];
+        freq_t max_freq = 0;
+
+        for (unsigned int l = 0; l < pi->num_speed_levels; ++l) {
+            if (pi->freqs[l] > max_freq) {
+                max_freq = pi->freqs[l];
+            }
+        }
+
+        bi->weight = 1;
+        bi->value = calloc(pi->num_speed_levels, sizeof(*bi->value));
+        bi->hull = calloc(pi->num_speed_levels, sizeof(*bi->hull));
+        for (unsigned int l = 0; l < pi->num_speed_levels; ++l) {
+            bi->value[l] = max_freq > 0 ? (double) pi->freqs[l] / max_freq : 1;
+        }
+    }
+
+    ctx->budget = b;
+}
+
+pwr_err_t budget_set_power(pwr_ctx_t *ctx, unsigned long island,
+    const double *watts)
+{
+    unsigned int num_levels = ctx->phys_islands[island]->num_speed_levels;
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        if (!(watts[l] >= 0) || isinf(watts[l])) {
+            return PWR_REQUEST_DENIED;
+        }
+    }
+
+    budget_island_t *bi = &ctx->budget->islands[island];
+    if (bi->watts == NULL) {
+        bi->watts = malloc(num_levels * sizeof(*bi->watts));
+    }
+    memcpy(bi->watts, watts, num_levels * sizeof(*bi->watts));
+    bi->dirty = true;
+
+    return PWR_OK;
+}
+
+void free_budget(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->budget == NULL) {
+        return;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        free(ctx->budget->islands[i].watts);
+        free(ctx->budget->islands[i].value);
+        free(ctx->budget->islands[i].hull);
+    }
+
+    free(ctx->budget->islands);
+    free(ctx->budget->pos);
+    free(ctx->budget->heap);
+    free(ctx->budget->gain);
+    free(ctx->budget);
+    ctx->budget = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Chooses the speed levels of the islands that fit in a power budget. That
+  * is the function behind pwr_budget_solve() and pwr_budget_apply().
+  *
+  * @param levels[out] The chosen speed level of each island.
+  * @param power[out] The power drawn at those levels, in W.
+  *
+  * @return PWR_OK, PWR_OVER_P_BUDGET if even the lowest levels do not fit, or
+  *         PWR_UNAVAILABLE if an island has no power figures.
+  */
+pwr_err_t solve(pwr_ctx_t *ctx, double budget, unsigned int *levels,
+    double *power)
+{
+    struct budget *b = ctx->budget;
+    *power = 0;
+
+    // start every island on its lowest power level
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (b->islands[i].watts == NULL) {
+            return PWR_UNAVAILABLE;
+        }
+        update_hull(ctx, i);
+        b->pos[i] = 0;
+        *power += b->islands[i].watts[b->islands[i].hull[0]];
+    }
+
+    if (*power > budget) {
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            levels[i] = b->islands[i].hull[0];
+        }
+        return PWR_OVER_P_BUDGET;
+    }
+
+    // upgrade the island with the best weighted gain per watt while it fits
+    unsigned long size = 0;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        budget_island_t *bi = &b->islands[i];
+        if (bi->num_hull > 1 && bi->weight > 0) {
+            b->gain[i] = bi->weight * step_gain(bi, 0);
+            heap_push(b, &size, i);
+        }
+    }
+
+    while (size > 0) {
+        unsigned long i = heap_pop(b, &size);
+        budget_island_t *bi = &b->islands[i];
+        unsigned int from = bi->hull[b->pos[i]];
+        unsigned int to = bi->hull[b->pos[i] + 1];
+        double cost = bi->watts[to] - bi->watts[from];
+
+        // the next steps of that island are less efficient, drop it
+        if (*power + cost > budget) {
+            continue;
+        }
+
+        *power += cost;
+        ++b->pos[i];
+        if (b->pos[i] + 1 < bi->num_hull) {
+            b->gain[i] = bi->weight * step_gain(bi, b->pos[i]);
+            heap_push(b, &size, i);
+        }
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        levels[i] = b->islands[i].hull[b->pos[i]];
+    }
+
+    // spend the remaining budget on the best single upgrade, hull or not
+    for (;;) {
+        double best_gain = 0, best_cost = 0;
+        unsigned long best_island = 0;
+        unsigned int best_level = 0;
+
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            budget_island_t *bi = &b->islands[i];
+            phys_island_t *pi = ctx->phys_islands[i];
+            for (unsigned int l = pi->min_speed_level;
+                 l <= pi->max_speed_level; ++l)
+            {
+                double cost = bi->watts[l] - bi->watts[levels[i]];
+                double gain = bi->weight * (bi->value[l] - bi->value[levels[i]]);
+                if (*power + cost <= budget && gain > best_gain) {
+                    best_gain = gain;
+                    best_cost = cost;
+                    best_island = i;
+                    best_level = l;
+                }
+            }
+        }
+
+        if (best_gain <= 0) {
+            break;
+        }
+        levels[best_island] = best_level;
+        *power += best_cost;
+    }
+
+    return PWR_OK;
+}
+
+
+/**
+  * Recomputes the concave hull of an island if its power table changed.
+  * Levels are sorted by power, levels that do not increase the throughput are
+  * skipped, and levels below the segment joining their neighbours are removed.
+  */
+void update_hull(pwr_ctx_t *ctx, unsigned long island) {
+    budget_island_t *bi = &ctx->budget->islands[island];
+    phys_island_t *pi = ctx->phys_islands[island];
+    unsigned int n = 0;
+
+    if (!bi->dirty) {
+        return;
+    }
+
+    // insertion sort of the available levels by power, then throughput
+    unsigned int sorted[pi->num_speed_levels];
+    for (unsigned int l = pi->min_speed_level; l <= pi->max_speed_level; ++l) {
+        unsigned int j = n++;
+        while (j > 0 && (bi->watts[sorted[j - 1]] > bi->watts[l] ||
+            (bi->watts[sorted[j - 1]] == bi->watts[l] &&
+             bi->value[sorted[j - 1]] < bi->value[l])))
+        {
+            sorted[j] = sorted[j - 1];
+            --j;
+        }
+        sorted[j] = l;
+    }
+
+    bi->num_hull = 0;
+    for (unsigned int k = 0; k < n; ++k) {
+        unsigned int l = sorted[k];
+        unsigned int *h = bi->hull;
+
+        if (bi->num_hull > 0 && bi->value[l] <= bi->value[h[bi->num_hull - 1]]) {
+            continue;
+        }
+
+        // pop the last point while it lies under the segment to the new one
+        while (bi->num_hull >= 2) {
+            unsigned int a = h[bi->num_hull - 2], m = h[bi->num_hull - 1];
+            double cross =
+                (bi->watts[m] - bi->watts[a]) * (bi->value[l] - bi->value[a]) -
+                (bi->value[m] - bi->value[a]) * (bi->watts[l] - bi->watts[a]);
+            if (cross < 0) {
+                break;
+            }
+            --bi->num_hull;
+        }
+        h[bi->num_hull++] = l;
+    }
+
+    bi->dirty = false;
+}
+
+/**
+  * Computes the throughput gained per watt by the step of a hull starting at
+  * the given position.
+  */
+double step_gain(budget_island_t *bi, unsigned int pos) {
+    unsigned int from = bi->hull[pos], to = bi->hull[pos + 1];
+    double cost = bi->watts[to] - bi->watts[from];
+
+    return cost > 0 ? (bi->value[to] - bi->value[from]) / cost : INFINITY;
+}
+
+/**
+  * Inserts an island in the max-heap of gains.
+  */
+void heap_push(struct budget *b, unsigned long *size, unsigned long island) {
+    unsigned long i = (*size)++;
+
+    while (i > 0) {
+        unsigned long parent = (i - 1) / 2;
+        if (b->gain[b->heap[parent]] >= b->gain[island]) {
+            break;
+        }
+        b->heap[i] = b->heap[parent];
+        i = parent;
+    }
+    b->heap[i] = island;
+}
+
+/**
+  * Removes the island with the highest gain from the max-heap.
+  *
+  * @return The island removed.
+  */
+unsigned long heap_pop(struct budget *b, unsigned long *size) {
+    unsigned long top = b->heap[0];
+    unsigned long last = b->heap[--(*size)];
+    unsigned long i = 0;
+
+    for (;;) {
+        unsigned long child = 2 * i + 1;
+        if (child >= *size) {
+            break;
+        }
+        if (child + 1 < *size &&
+            b->gain[b->heap[child + 1]] > b->gain[b->heap[child]])
+        {
+            ++child;
+        }
+        if (b->gain[last] >= b->gain[b->heap[child]]) {
+            break;
+        }
+        b->heap[i] = b->heap[child];
+        i = child;
+    }
+    if (*size > 0) {
+        b->heap[i] = last;
+    }
+
+    return top;
+}
@@ -0,0 +1,447 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Time stamp counter, the reference of the package residency counters */
+#define MSR_IA32_TSC 0x10
+
+/** Package C-state residency counters, in TSC ticks */
+static const uint32_t pkg_msrs[PWR_NB_PKG_CSTATES] = {
+    0x60D,  // MSR_PKG_C2_RESIDENCY
+    0x3F8,  // MSR_PKG_C3_RESIDENCY
+    0x3F9,  // MSR_PKG_C6_RESIDENCY
+    0x3FA,  // MSR_PKG_C7_RESIDENCY
+};
+
+/* Idle states of one island */
+typedef struct {
+    unsigned int num_states;
+    pwr_idle_state_t states[PWR_MAX_IDLE_STATES];
+
+    /* cpuidle directory of every CPU of the island, -1 if missing */
+    int *dir_fds;
+
+    /*
+     * Time and usage counters of the states of every CPU, kept open for the
+     * reports, -1 if they cannot be opened
+     */
+    int (*time_fds)[PWR_MAX_IDLE_STATES];
+    int (*usage_fds)[PWR_MAX_IDLE_STATES];
+
+    /* Counters at the previous report */
+    uint64_t last_ns;
+    unsigned long long last_time[PWR_MAX_IDLE_STATES];     // in us
+    unsigned long long last_usage[PWR_MAX_IDLE_STATES];
+    uint64_t last_tsc;
+    uint64_t last_pkg[PWR_NB_PKG_CSTATES];
+
+    /* Which package counters can be read */
+    bool has_pkg[PWR_NB_PKG_CSTATES];
+} cstate_island_t;
+
+/* Idle states state */
+struct cstates {
+    cstate_island_t *islands;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static pwr_err_t check_args(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int state);
+static bool read_state_ll(pwr_ctx_t *ctx, int dir_fd, unsigned int state,
+    const char *file, long long *value);
+static int open_state(int dir_fd, unsigned int state, const char *file);
+static bool read_counter(pwr_ctx_t *ctx, int fd, int dir_fd,
+    unsigned int state, const char *file, long long *value);
+static void read_counters(pwr_ctx_t *ctx, unsigned long island,
+    unsigned long long *time, unsigned long long *usage, uint64_t *tsc,
+    uint64_t *pkg);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+unsigned int pwr_num_idle_states(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_num_idle_states, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    pwr_err_t err = check_args(ctx, island, 0);
+    if (err != PWR_OK && err != PWR_UNAVAILABLE) {
+        ctx->error = err;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->cstates->islands[island].num_states;
+}
+
+void pwr_idle_state(pwr_ctx_t *ctx, unsigned long island, unsigned int state,
+    pwr_idle_state_t *info)
+{
+    TRACE_CALL(ctx, pwr_idle_state, island, state);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, state);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    cstate_island_t *ci = &ctx->cstates->islands[island];
+    *info = ci->states[state];
+
+    // the state may be disabled on some CPUs only
+    info->enabled = true;
+    for (unsigned long c = 0; c < ctx->phys_islands[island]->num_cpu; ++c) {
+        long long disabled = 0;
+        if (read_state_ll(ctx, ci->dir_fds[c], state, "disable", &disabled) &&
+            disabled)
+        {
+            info->enabled = false;
+        }
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_enable_idle_state(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int state, bool enable)
+{
+    TRACE_CALL(ctx, pwr_enable_idle_state, island, state);
+    char file[32];
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, state);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    cstate_island_t *ci = &ctx->cstates->islands[island];
+    snprintf(file, sizeof(file), "state%u/disable", state);
+
+    ctx->error = PWR_OK;
+    for (unsigned long c = 0; c < ctx->phys_islands[island]->num_cpu; ++c) {
+        int fd = ci->dir_fds[c] >= 0 ? openat(ci->dir_fds[c], file, O_WRONLY) : -1;
+        if (fd < 0) {
+            ctx->error = PWR_REQUEST_DENIED;
+            continue;
+        }
+        stats_io(ctx, PWR_MODULE_STRUCT, 1, 1);
+        if (write(fd, enable ? "0" : "1", 1) != 1) {
+            ctx->error = PWR_IO_ERR;
+        }
+        close(fd);
+    }
+}
+
+void pwr_idle_residency(pwr_ctx_t *ctx, unsigned long island,
+    pwr_idle_residency_t *residency)
+{
+    TRACE_CALL(ctx, pwr_idle_residency, island, 0);
+    unsigned long long time[PWR_MAX_IDLE_STATES], usage[PWR_MAX_IDLE_STATES];
+    uint64_t tsc, pkg[PWR_NB_PKG_CSTATES];
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, 0);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    cstate_island_t *ci = &ctx->cstates->islands[island];
+    uint64_t now = monotonic_ns();
+    read_counters(ctx, island, time, usage, &tsc, pkg);
+
+    memset(residency, 0, sizeof(*residency));
+    residency->interval = (now - ci->last_ns) / 1e9;
+    for (unsigned int s = 0; s < ci->num_states; ++s) {
+        residency->time[s] = (time[s] - ci->last_time[s]) / 1e6;
+        residency->usage[s] = usage[s] - ci->last_usage[s];
+    }
+    for (unsigned int p = 0; p < PWR_NB_PKG_CSTATES; ++p) {
+        residency->package[p] = ci->has_pkg[p] && tsc != ci->last_tsc ?
+            (double) (pkg[p] - ci->last_pkg[p]) / (tsc - ci->last_tsc) : -1;
+    }
+
+    ci->last_ns = now;
+    memcpy(ci->last_time, time, sizeof(time));
+    memcpy(ci->last_usage, usage, sizeof(usage));
+    ci->last_tsc = tsc;
+    memcpy(ci->last_pkg, pkg, sizeof(pkg));
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_cstates(pwr_ctx_t *ctx) {
+    char path[PATH_MAX];
+
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
+
+    // read_counters() finds the islands through the context
+    struct cstates *cs = malloc(sizeof(*cs));
+    cs->islands = calloc(ctx->num_phys_islands, sizeof(*cs->islands));
+    ctx->cstates = cs;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        cstate_island_t *ci = &cs->islands[i];
+
+        ci->dir_fds = malloc(pi->num_cpu * sizeof(*ci->dir_fds));
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%lu/cpuidle",
+                ctx->sysfs_root, pi->cpus[c]);
+            ci->dir_fds[c] = open(path, O_RDONLY | O_DIRECTORY);
+        }
+
+        // the states of the first CPU
+        while (ci->dir_fds[0] >= 0 && ci->num_states < PWR_MAX_IDLE_STATES) {
+            pwr_idle_state_t *st = &ci->states[ci->num_states];
+            long long latency, target;
+            char file[32];
+
+            snprintf(file, sizeof(file), "state%u/name", ci->num_states);
+            int fd = openat(ci->dir_fds[0], file, O_RDONLY);
+            if (fd < 0) {
+                break;
+            }
+            stats_io(ctx, PWR_MODULE_STRUCT, 1, 0);
+            ssize_t len = pread(fd, st->name, sizeof(st->name) - 1, 0);
+            close(fd);
+            st->name[len > 0 ? len : 0] = '\0';
+            st->name[strcspn(st->name, "\n")] = '\0';
+
+            if (read_state_ll(ctx, ci->dir_fds[0], ci->num_states, "latency",
+                    &latency))
+            {
+                st->exit_latency = latency;
+            }
+            if (read_state_ll(ctx, ci->dir_fds[0], ci->num_states,
+                    "residency", &target))
+            {
+                st->target_residency = target;
+            }
+            st->enabled = true;
+            ++ci->num_states;
+        }
+
+        // the counters are read on every report
+        ci->time_fds = malloc(pi->num_cpu * sizeof(*ci->time_fds));
+        ci->usage_fds = malloc(pi->num_cpu * sizeof(*ci->usage_fds));
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            for (unsigned int s = 0; s < ci->num_states; ++s) {
+                ci->time_fds[c][s] = open_state(ci->dir_fds[c], s, "time");
+                ci->usage_fds[c][s] = open_state(ci->dir_fds[c], s, "usage");
+            }
+        }
+
+        // keep the package counters that can be read
+        uint64_t value;
+        for (unsigned int p = 0; p < PWR_NB_PKG_CSTATES; ++p) {
+            ci->has_pkg[p] = read_msr(ctx, pi->cpus[0], pkg_msrs[p], &value);
+        }
+
+        ci->last_ns = monotonic_ns();
+        read_counters(ctx, i, ci->last_time, ci->last_usage, &ci->last_tsc,
+            ci->last_pkg);
+    }
+}
+
+void free_cstates(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->cstates == NULL) {
+        return;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        cstate_island_t *ci = &ctx->cstates->islands[i];
+        for (unsigned long c = 0; c < ctx->phys_islands[i]->num_cpu; ++c) {
+            if (ci->dir_fds[c] >= 0) {
+                close(ci->dir_fds[c]);
+            }
+            for (unsigned int s = 0; s < ci->num_states; ++s) {
+                if (ci->time_fds[c][s] >= 0) {
+                    close(ci->time_fds[c][s]);
+                }
+                if (ci->usage_fds[c][s] >= 0) {
+                    close(ci->usage_fds[c][s]);
+                }
+            }
+        }
+        free(ci->dir_fds);
+        free(ci->time_fds);
+        free(ci->usage_fds);
+    }
+
+    free(ctx->cstates->islands);
+    free(ctx->cstates);
+    ctx->cstates = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Checks the arguments common to the idle state functions.
+  *
+  * @return PWR_OK or the error code to set. PWR_UNAVAILABLE is returned when
+  *  the island has no idle state.
+  */
+pwr_err_t check_args(pwr_ctx_t *ctx, unsigned long island, unsigned int state)
+{
+    if (ctx->cstates == NULL) {
+        return PWR_UNINITIALIZED;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        return PWR_INVALID_ISLAND;
+    }
+
+    if (ctx->cstates->islands[island].num_states == 0) {
+        return PWR_UNAVAILABLE;
+    }
+
+    if (state >= ctx->cstates->islands[island].num_states) {
+        return PWR_REQUEST_DENIED;
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Reads an integer attribute of an idle state of a CPU.
+  *
+  * @param dir_fd The cpuidle directory of the CPU.
+  *
+  * @return True if the value was read.
+  */
+bool read_state_ll(pwr_ctx_t *ctx, int dir_fd, unsigned int state,
+    const char *file, long long *value)
+{
+    int fd = open_state(dir_fd, state, file);
+    if (fd < 0) {
+        return false;
+    }
+
+    stats_io(ctx, PWR_MODULE_STRUCT, 1, 0);
+    bool ok = read_sysfs_ll(fd, value);
+    close(fd);
+
+    return ok;
+}
+
+/**
+  * Opens an attribute of an idle state of a CPU.
+  *
+  * @param dir_fd The cpuidle directory of the CPU.
+  *
+  * @return The file descriptor, or -1 if it cannot be opened.
+  */
+int open_state(int dir_fd, unsigned int state, const char *file) {
+    char path[48];
+
+    if (dir_fd < 0) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "state%u/%s", state, file);
+    return openat(dir_fd, path, O_RDONLY);
+}
+
+/**
+  * Reads an idle counter of a CPU from its open file, or through its cpuidle
+  * directory if it could not be kept open, e.g. when out of descriptors.
+  *
+  * @return True if the value was read.
+  */
+bool read_counter(pwr_ctx_t *ctx, int fd, int dir_fd, unsigned int state,
+    const char *file, long long *value)
+{
+    if (fd < 0) {
+        return read_state_ll(ctx, dir_fd, state, file, value);
+    }
+
+    stats_io(ctx, PWR_MODULE_STRUCT, 1, 0);
+    return read_sysfs_ll(fd, value);
+}
+
+/**
+  * Reads the idle counters of an island, summed over its CPUs, and the package
+  * counters of its first CPU. Counters that cannot be read are left to 0.
+  */
+void read_counters(pwr_ctx_t *ctx, unsigned long island,
+    unsigned long long *time, unsigned long long *usage, uint64_t *tsc,
+    uint64_t *pkg)
+{
+    cstate_island_t *ci = &ctx->cstates->islands[island];
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    for (unsigned int s = 0; s < ci->num_states; ++s) {
+        time[s] = 0;
+        usage[s] = 0;
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            long long value;
+            if (read_counter(ctx, ci->time_fds[c][s], ci->dir_fds[c], s,
+                    "time", &value))
+            {
+                time[s] += value;
+            }
+            if (read_counter(ctx, ci->usage_fds[c][s], ci->dir_fds[c], s,
+                    "usage", &value))
+            {
+                usage[s] += value;
+            }
+        }
+    }
+
+    *tsc = 0;
+    read_msr(ctx, pi->cpus[0], MSR_IA32_TSC, tsc);
+    for (unsigned int p = 0; p < PWR_NB_PKG_CSTATES; ++p) {
+        pkg[p] = 0;
+        if (ci->has_pkg[p]) {
+            read_msr(ctx, pi->cpus[0], pkg_msrs[p], &pkg[p]);
+        }
+    }
+}
@@ -15,10 +15,12 @@
   */
 
 #include <assert.h>
-#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "internals.h"
 
@@ -26,18 +28,28 @@
 // Forward declarations
 //-----------------------------------------------------------------------------
 
-static void sort_and_cast_freqs(gchar** freqs, freq_t* sorted, long num_freqs);
-static gint compare_freq(const freq_t f0, const freq_t f1);
+static long parse_freqs(const char *list, freq_t *freqs);
+static int compare_freq(const void *f0, const void *f1);
+static speed_t level_speed(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level);
+static pwr_err_t request_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level);
 
 //====-------------------------------------------------------------------------
 // Public functions
 //-----------------------------------------------------------------------------
 
 unsigned int pwr_num_speed_levels(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_num_speed_levels, island, 0);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return 0;
     }
+
+    if (is_uncore_island(ctx, island)) {
+        ctx->error = PWR_OK;
+        return uncore_num_levels(ctx, island);
+    }
     
     if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
         ctx->error = PWR_UNINITIALIZED;
@@ -54,10 +66,16 @@ unsigned int pwr_num_speed_levels(pwr_ctx_t *ctx, unsigned long island) {
 }
 
 unsigned int pwr_current_speed_level(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_current_speed_level, island, 0);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return 0;
     }
+
+    if (is_uncore_island(ctx, island)) {
+        ctx->error = PWR_OK;
+        return uncore_current_level(ctx, island);
+    }
     
     if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
         ctx->error = PWR_UNINITIALIZED;
@@ -73,85 +91,241 @@ unsigned int pwr_current_speed_level(pwr_ctx_t *ctx, unsigned long island) {
     return ctx->phys_islands[island]->current_speed_level;
 }
 
+speed_t pwr_speed(pwr_ctx_t *ctx, unsigned long island, unsigned int level) {
+    TRACE_CALL(ctx, pwr_speed, island, level);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    phys_island_t *pi = ctx->phys_islands[island];
+    if (level >= pi->num_speed_levels) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return level_speed(ctx, island, level);
+}
+
+unsigned int pwr_level_for_speed(pwr_ctx_t *ctx, unsigned long island,
+    speed_t speed)
+{
+    TRACE_CALL(ctx, pwr_level_for_speed, island, speed);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    phys_island_t *pi = ctx->phys_islands[island];
+    for (unsigned int level = pi->min_speed_level; level < pi->max_speed_level;
+         ++level)
+    {
+        if (level_speed(ctx, island, level) >= speed) {
+            ctx->error = PWR_OK;
+            return level;
+        }
+    }
+
+    ctx->error = level_speed(ctx, island, pi->max_speed_level) >= speed ?
+        PWR_OK : PWR_REQUEST_DENIED;
+    return pi->max_speed_level;
+}
+
 void pwr_request_speed_level(pwr_ctx_t *ctx, unsigned long island,
     unsigned int new_level)
 {
+    TRACE_CALL(ctx, pwr_request_speed_level, island, new_level);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    ctx->error = request_speed_level(ctx, island, new_level);
+}
+
+void pwr_increase_speed_level(pwr_ctx_t *ctx, unsigned long island, int delta)
+{
+    TRACE_CALL(ctx, pwr_increase_speed_level, island, delta);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return;
     }
     
-    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+    if (!is_uncore_island(ctx, island) &&
+        !pwr_is_initialized(ctx, PWR_MODULE_DVFS))
+    {
         ctx->error = PWR_UNINITIALIZED;
         return;
     }
 
-    if (island >= ctx->num_phys_islands) {
+    unsigned int current_level;
+    if (is_uncore_island(ctx, island)) {
+        current_level = uncore_current_level(ctx, island);
+    } else if (island < ctx->num_phys_islands) {
+        current_level = ctx->phys_islands[island]->current_speed_level;
+    } else {
         ctx->error = PWR_INVALID_ISLAND;
         return;
     }
 
-    if (new_level < ctx->phys_islands[island]->min_speed_level ||
-        new_level > ctx->phys_islands[island]->max_speed_level)
-    {
-        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+    ctx->error = request_speed_level(ctx, island, current_level + delta);
+}
+
+void pwr_request_speed_levels(pwr_ctx_t *ctx, const unsigned int *levels) {
+    TRACE_CALL(ctx, pwr_request_speed_levels, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    ctx->error = request_speed_levels(ctx, levels);
+}
+
+void pwr_set_governor(pwr_ctx_t *ctx, const char *governor) {
+    TRACE_CALL(ctx, pwr_set_governor, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        ctx->error = PWR_UNINITIALIZED;
         return;
     }
 
-    if ((new_level == ctx->phys_islands[island]->min_speed_level  ||
-         new_level == ctx->phys_islands[island]->max_speed_level) && 
-         new_level == ctx->phys_islands[island]->current_speed_level)
+    for (unsigned long island_id = 0;
+         island_id < ctx->num_phys_islands;
+         ++island_id)
     {
-        ctx->error = PWR_ALREADY_MINMAX;
+        for (unsigned long c = 0;
+            c < ctx->phys_islands[island_id]->num_cpu;
+            ++c)
+        {
+            unsigned long cpu_id = ctx->phys_islands[island_id]->cpus[c];
+
+            // the kernel rejects unknown governors on write
+            if (!write_cpufreq(ctx, cpu_id, "scaling_governor", governor)) {
+                if (ctx->err_fd) {
+                    fprintf(ctx->err_fd,
+                        "Failed to set the %s governor on cpu %lu\n",
+                        governor, cpu_id);
+                }
+                ctx->error = PWR_DVFS_ERR;
+                return;
+            }
+        }
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_governor(pwr_ctx_t *ctx, char *governor, size_t size) {
+    TRACE_CALL(ctx, pwr_governor, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
         return;
     }
 
-    // Write the speed to the throttle file, rewind
-    fprintf(ctx->island_throttle_files[island], "%ld",
-        ctx->phys_islands[island]->freqs[new_level]);
-    if (ferror(ctx->island_throttle_files[island])) {
-        ctx->error = PWR_DVFS_ERR;
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        ctx->error = PWR_UNINITIALIZED;
         return;
     }
 
-    if (fflush(ctx->island_throttle_files[island])) {
-        ctx->error = PWR_DVFS_ERR;
+    char gov[SYSFS_ATTR_SIZE];
+
+    if (read_cpufreq(ctx, ctx->phys_islands[0]->cpus[0], "scaling_governor",
+        gov, sizeof(gov)) < 0)
+    {
+        ctx->error = PWR_IO_ERR;
         return;
     }
 
-    // This is not really required on Linux
-    //rewind(island_throttle_files[island]);
-    //if (ferror(ctx->island_throttle_files[island])) {
-    //    ctx->error = PWR_DVFS_ERR;
-    //    return;
-    //}
-   
-    // Set the new level
-    ctx->phys_islands[island]->current_speed_level = new_level;
+    if (size > 0) {
+        snprintf(governor, size, "%s", gov);
+    }
 
     ctx->error = PWR_OK;
-    return;
 }
 
-void pwr_increase_speed_level(pwr_ctx_t *ctx, unsigned long island, int delta)
-{
+void pwr_set_speed_control(pwr_ctx_t *ctx, pwr_speed_control_t control) {
+    TRACE_CALL(ctx, pwr_set_speed_control, TRACE_NO_ISLAND, control);
+    pwr_err_t err = PWR_OK;
+
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return;
     }
-    
+
     if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
         ctx->error = PWR_UNINITIALIZED;
         return;
     }
 
-    unsigned int current_level = pwr_current_speed_level(ctx, island);
-    pwr_request_speed_level(ctx, island, current_level + delta);
+    if (control != PWR_CONTROL_SETSPEED && control != PWR_CONTROL_HWP) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    if (control == PWR_CONTROL_HWP && !hwp_available(ctx)) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->speed_control = control;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        pwr_err_t island_err = write_speed_level(ctx, i,
+            ctx->phys_islands[i]->current_speed_level);
+        if (island_err != PWR_OK) {
+            err = island_err;
+        }
+    }
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = err;
+}
+
+pwr_speed_control_t pwr_speed_control(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_speed_control, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return PWR_CONTROL_SETSPEED;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->speed_control;
 }
 
 long pwr_agility(pwr_ctx_t *ctx, unsigned long island, unsigned int from_level,
     unsigned int to_level)
 {
+    TRACE_CALL(ctx, pwr_agility, island, from_level);
     (void) from_level;
     (void) to_level;
 
@@ -183,15 +357,6 @@ long pwr_agility(pwr_ctx_t *ctx, unsigned long island, unsigned int from_level,
     return ctx->phys_islands[island]->agility;
 }
 
-void pwr_increase_voltage(pwr_ctx_t *ctx, unsigned long island, int delta) {
-    (void) island;
-    (void) delta;
-
-    if (ctx != NULL) {
-        ctx->error = PWR_UNIMPLEMENTED;
-    }
-}
-
 //====-------------------------------------------------------------------------
 // Library internal functions
 //-----------------------------------------------------------------------------
@@ -201,6 +366,8 @@ void init_speed_levels(pwr_ctx_t *ctx) {
     assert(pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
     assert(!pwr_is_initialized(ctx, PWR_MODULE_DVFS));
 
+    char buf[SYSFS_ATTR_SIZE];
+
     //===----------------------------------------------------------------------
     // Make sure we are using the userspace governor
     for (unsigned long island_id = 0;
@@ -211,34 +378,24 @@ void init_speed_levels(pwr_ctx_t *ctx) {
             c < ctx->phys_islands[island_id]->num_cpu;
             ++c)
         {
-            GString *gov_filename = sysfs_filename(c, "scaling_governor");
-            GError* file_error = NULL;
-            gchar* gov_char = NULL;
+            unsigned long cpu_id = ctx->phys_islands[island_id]->cpus[c];
 
-            if (!g_file_get_contents(gov_filename->str, &gov_char, NULL,
-                &file_error)) 
+            if (read_cpufreq(ctx, cpu_id, "scaling_governor", buf,
+                sizeof(buf)) < 0)
             {
                 if (ctx->err_fd) {
                     fprintf(ctx->err_fd,
-                        "Error opening governor file for cpu %ld...\n", c);
-                    fputs(file_error->message, ctx->err_fd);
+                        "Error opening governor file for cpu %ld: %s\n",
+                        cpu_id, strerror(errno));
                 }
-                g_error_free(file_error);
                 ctx->error = PWR_ARCH_UNSUPPORTED;
-
-                g_string_free(gov_filename, TRUE);
                 return;
             }
-        
-            bool error = strncmp("userspace", gov_char, 9) != 0;
-            
-            g_free(gov_char);
-            g_string_free(gov_filename, TRUE);
 
-            if (error) {
+            if (strcmp("userspace", buf) != 0) {
                 if (ctx->err_fd) {
                     fprintf(ctx->err_fd, "Invalid governor set on core %ld\n",
-                        c);
+                        cpu_id);
                 }
                 ctx->error = PWR_UNAVAILABLE;
                 return;
@@ -254,79 +411,49 @@ void init_speed_levels(pwr_ctx_t *ctx) {
          island_id < ctx->num_phys_islands;
          ++island_id)
     {
-        // Build path to sysfs entry for available frequencies
-        unsigned long cpu_id = ctx->phys_islands[island_id]->cpus[0];
-        GString* freq_filename = sysfs_filename(cpu_id, "scaling_available_frequencies");
-        
+        phys_island_t *pi = ctx->phys_islands[island_id];
+        unsigned long cpu_id = pi->cpus[0];
+
         // Get the frequencies
-        GError* file_error = NULL;                                              
-        gchar* freq_char = NULL;                                             
-        if (!g_file_get_contents(freq_filename->str, &freq_char, NULL, &file_error)) {
+        if (read_cpufreq(ctx, cpu_id, "scaling_available_frequencies", buf,
+            sizeof(buf)) < 0)
+        {
             if (ctx->err_fd) {
                 fprintf(ctx->err_fd,
-                    "Error opening speeds file for cpu %ld...\n", cpu_id);
-                fputs(file_error->message, ctx->err_fd);
+                    "Error opening speeds file for cpu %ld: %s\n",
+                    cpu_id, strerror(errno));
             }
-            g_error_free(file_error);
             ctx->error = PWR_ARCH_UNSUPPORTED;
-            g_string_free(freq_filename, TRUE);
-            return;                                                     
-        }
-        gchar** freq_vstr = g_strsplit(freq_char, " ", PWR_MAX_SPEED_LEVELS);
-
-        // Calculate the number of speed levels
-        gchar** ptr;
-        long num_speed_levels = -1;
-
-        for (ptr = freq_vstr; *ptr; ptr++) {
-            num_speed_levels++;
+            return;
         }
 
         // Set the number of speed levels / frequencies in island struct
-        ctx->phys_islands[island_id]->num_speed_levels = num_speed_levels;
-        ctx->phys_islands[island_id]->freqs = 
-            malloc(num_speed_levels * sizeof(*ctx->phys_islands[island_id]->freqs));
-        
-        // Sort frequencies low to high, set speed levels and min/max
-        sort_and_cast_freqs(freq_vstr, 
-                            ctx->phys_islands[island_id]->freqs, 
-                            num_speed_levels);
-        ctx->phys_islands[island_id]->min_speed_level = 0;
-        ctx->phys_islands[island_id]->max_speed_level = num_speed_levels - 1;
+        long num_speed_levels = parse_freqs(buf, NULL);
+        pi->num_speed_levels = num_speed_levels;
+        pi->freqs = malloc(num_speed_levels * sizeof(*pi->freqs));
 
-        g_strfreev(freq_vstr);
-        g_free(freq_char);
-        g_string_free(freq_filename, TRUE);
+        // Sort frequencies low to high, set speed levels and min/max
+        parse_freqs(buf, pi->freqs);
+        qsort(pi->freqs, num_speed_levels, sizeof(*pi->freqs), compare_freq);
+        pi->min_speed_level = 0;
+        pi->max_speed_level = num_speed_levels - 1;
 
         // fetch the former frequency used
         speed_t cur_freq = 0;
-        for (unsigned long cpu_id = 0;
-             cpu_id < ctx->phys_islands[island_id]->num_cpu;
-             ++cpu_id)
-        {
-            GString *curfreq_filename = 
-                sysfs_filename(cpu_id, "scaling_cur_freq");
-            GError* file_error = NULL;
-            gchar* curfreq_char = NULL;
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            long long cpu_freq;
 
-            if (!g_file_get_contents(curfreq_filename->str, &curfreq_char,
-                    NULL, &file_error)) 
+            if (!read_cpufreq_ll(ctx, pi->cpus[c], "scaling_cur_freq",
+                &cpu_freq))
             {
                 if (ctx->err_fd) {
                     fprintf(ctx->err_fd,
-                        "Error opening curfreq file for cpu %ld...\n", cpu_id);
-                    fputs(file_error->message, ctx->err_fd);
+                        "Error opening curfreq file for cpu %ld: %s\n",
+                        pi->cpus[c], strerror(errno));
                 }
-                g_error_free(file_error);
                 ctx->error = PWR_ARCH_UNSUPPORTED;
-                g_string_free(curfreq_filename, TRUE);
                 return;
             }
-        
-            speed_t cpu_freq;
-            sscanf(curfreq_char, "%ld", &cpu_freq);
-            g_free(curfreq_char);
-            g_string_free(curfreq_filename, TRUE);
 
             if (cpu_freq > cur_freq) {
                 cur_freq = cpu_freq;
@@ -335,15 +462,15 @@ void init_speed_levels(pwr_ctx_t *ctx) {
 
         speed_level_t cur_freq_lvl;
         for (cur_freq_lvl = 0;
-             cur_freq_lvl < ctx->phys_islands[island_id]->num_speed_levels;
+             cur_freq_lvl < pi->num_speed_levels;
              ++cur_freq_lvl)
         {
-            if (cur_freq == ctx->phys_islands[island_id]->freqs[cur_freq_lvl]) {
+            if (cur_freq == pi->freqs[cur_freq_lvl]) {
                 break;
             }
         }
 
-        if (cur_freq_lvl == ctx->phys_islands[island_id]->num_speed_levels) {
+        if (cur_freq_lvl == pi->num_speed_levels) {
             if (ctx->err_fd) {
                 fprintf(ctx->err_fd, "Incoherent curfreq file content\n");
             }
@@ -351,29 +478,33 @@ void init_speed_levels(pwr_ctx_t *ctx) {
             return;
         }
 
-        ctx->phys_islands[island_id]->current_speed_level = cur_freq_lvl;
+        pi->current_speed_level = cur_freq_lvl;
     }
 
     //===----------------------------------------------------------------------
     // Initialize throttle and speedometer files for each island
-    ctx->island_throttle_files = malloc(ctx->num_phys_islands * sizeof(FILE*));
-
+    ctx->island_throttle_fds =
+        malloc(ctx->num_phys_islands * sizeof(*ctx->island_throttle_fds));
     for (unsigned long island_id = 0;
          island_id < ctx->num_phys_islands;
          ++island_id)
     {
-        // Use first CPU in island to throttle and read speed from
-        unsigned long cpu_id = ctx->phys_islands[island_id]->cpus[0];
+        ctx->island_throttle_fds[island_id] = -1;
+    }
 
-        // Build path to sysfs entries
-        GString* throttle_filename = sysfs_filename(cpu_id, "scaling_setspeed");
+    for (unsigned long island_id = 0;
+         island_id < ctx->num_phys_islands;
+         ++island_id)
+    {
+        phys_island_t *pi = ctx->phys_islands[island_id];
 
-        // Get FILE*
-        ctx->island_throttle_files[island_id] = fopen(throttle_filename->str, "w");
-        g_string_free(throttle_filename, TRUE);
+        // Use first CPU in island to throttle and read speed from
+        unsigned long cpu_id = pi->cpus[0];
+        ctx->island_throttle_fds[island_id] =
+            open_cpufreq(ctx, cpu_id, "scaling_setspeed", O_WRONLY);
 
         // Sanity check
-        if (NULL == ctx->island_throttle_files[island_id]) {
+        if (ctx->island_throttle_fds[island_id] < 0) {
             if (ctx->err_fd) {
                 fprintf(ctx->err_fd,
                     "Failed to open DVFS throttle file for cpu %lu\n", cpu_id);
@@ -385,51 +516,22 @@ void init_speed_levels(pwr_ctx_t *ctx) {
         // Initialize the speed on that island
         // Set the controlling core to max frequency and ignore the rest by
         // setting the lowest speed on them
-        for (unsigned long c = 1;
-             c < ctx->phys_islands[island_id]->num_cpu;
-             ++c)
-        {
-            GString* tmp_filename = sysfs_filename(c, "scaling_setspeed");
-            FILE *setter_fd = fopen(tmp_filename->str, "w");
-            g_string_free(tmp_filename, TRUE);
-            
-            fprintf(setter_fd, "%ld", 
-                ctx->phys_islands[island_id]->freqs[ctx->phys_islands[island_id]->min_speed_level]);
-            if (ferror(setter_fd)) {
-                fclose(setter_fd);
-                if (ctx->err_fd) {
-                    fprintf(ctx->err_fd,
-                        "Failed to set the frequency on cpu %lu\n", c);
-                }
-                ctx->error = PWR_INIT_ERR;
-                return;
-            }
-
-            if (fflush(setter_fd)) {
+        snprintf(buf, sizeof(buf), "%ld", pi->freqs[pi->min_speed_level]);
+        for (unsigned long c = 1; c < pi->num_cpu; ++c) {
+            if (!write_cpufreq(ctx, pi->cpus[c], "scaling_setspeed", buf)) {
                 if (ctx->err_fd) {
                     fprintf(ctx->err_fd,
-                        "Failed to set the frequency on cpu %lu\n", c);
+                        "Failed to set the frequency on cpu %lu\n",
+                        pi->cpus[c]);
                 }
                 ctx->error = PWR_INIT_ERR;
-                fclose(setter_fd);
                 return;
             }
-
-            fclose(setter_fd);
-        }
-
-        fprintf(ctx->island_throttle_files[island_id], "%ld", 
-            ctx->phys_islands[island_id]->freqs[ctx->phys_islands[island_id]->max_speed_level]);
-        if (ferror(ctx->island_throttle_files[island_id])) {
-            if (ctx->err_fd) {
-                fprintf(ctx->err_fd,
-                    "Failed to set the frequency on island %lu\n", island_id);
-            }
-            ctx->error = PWR_INIT_ERR;
-            return;
         }
 
-        if (fflush(ctx->island_throttle_files[island_id])) {
+        int len = snprintf(buf, sizeof(buf), "%ld",
+            pi->freqs[pi->max_speed_level]);
+        if (pwrite(ctx->island_throttle_fds[island_id], buf, len, 0) != len) {
             if (ctx->err_fd) {
                 fprintf(ctx->err_fd,
                     "Failed to set the frequency on island %lu\n", island_id);
@@ -437,7 +539,6 @@ void init_speed_levels(pwr_ctx_t *ctx) {
             ctx->error = PWR_INIT_ERR;
             return;
         }
-
     }
 
     ctx->module_init |= (1U << PWR_MODULE_DVFS);
@@ -446,6 +547,127 @@ void init_speed_levels(pwr_ctx_t *ctx) {
     return;
 }
 
+pwr_err_t set_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level)
+{
+    assert(ctx != NULL);
+    assert(island < ctx->num_phys_islands);
+
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    if (new_level < pi->min_speed_level || new_level > pi->max_speed_level) {
+        return PWR_UNSUPPORTED_SPEED_LEVEL;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    pwr_err_t err = write_speed_level(ctx, island, new_level);
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    // logged without the DVFS lock, which the replay takes after its own
+    if (err == PWR_OK) {
+        record_speed_level(ctx, island, new_level);
+    }
+
+    return err;
+}
+
+pwr_err_t set_speed_levels(pwr_ctx_t *ctx, const unsigned long *islands,
+    const unsigned int *levels, unsigned long num)
+{
+    pwr_err_t err = PWR_OK;
+
+    assert(ctx != NULL);
+
+    if (num == 0) {
+        return PWR_OK;
+    }
+
+    for (unsigned long i = 0; i < num; ++i) {
+        if (islands[i] >= ctx->num_phys_islands) {
+            return PWR_INVALID_ISLAND;
+        }
+        phys_island_t *pi = ctx->phys_islands[islands[i]];
+        if (levels[i] < pi->min_speed_level ||
+            levels[i] > pi->max_speed_level)
+        {
+            return PWR_UNSUPPORTED_SPEED_LEVEL;
+        }
+    }
+
+    bool written[num];
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    for (unsigned long i = 0; i < num; ++i) {
+        pwr_err_t island_err = write_speed_level(ctx, islands[i], levels[i]);
+        written[i] = island_err == PWR_OK;
+        if (island_err != PWR_OK) {
+            err = island_err;
+        }
+    }
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    for (unsigned long i = 0; i < num; ++i) {
+        if (written[i]) {
+            record_speed_level(ctx, islands[i], levels[i]);
+        }
+    }
+
+    return err;
+}
+
+pwr_err_t request_speed_levels(pwr_ctx_t *ctx, const unsigned int *levels) {
+    // only write the islands whose level changes
+    unsigned long islands[ctx->num_phys_islands];
+    unsigned int new_levels[ctx->num_phys_islands];
+    unsigned long num = 0;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (levels[i] != ctx->phys_islands[i]->current_speed_level) {
+            islands[num] = i;
+            new_levels[num] = levels[i];
+            ++num;
+        }
+    }
+
+    pwr_err_t err = set_speed_levels(ctx, islands, new_levels, num);
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (err == PWR_OK && thermal_capped(ctx, i, levels[i])) {
+            err = PWR_OVER_T_BUDGET;
+        }
+    }
+    return err;
+}
+
+pwr_err_t write_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    new_level = thermal_clamp(ctx, island, new_level);
+
+    if (ctx->speed_control == PWR_CONTROL_HWP) {
+        pwr_err_t err = hwp_write_level(ctx, island, new_level);
+        if (err != PWR_OK) {
+            return err;
+        }
+        freq_watch_written(ctx, island);
+        pi->current_speed_level = new_level;
+        return PWR_OK;
+    }
+
+    // Write the speed to the throttle file
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%ld", pi->freqs[new_level]);
+    stats_io(ctx, PWR_MODULE_DVFS, 1, len);
+    if (pwrite(ctx->island_throttle_fds[island], buf, len, 0) != len) {
+        return PWR_DVFS_ERR;
+    }
+
+    // Set the new level, the changes it caused are not external
+    freq_watch_written(ctx, island);
+    pi->current_speed_level = new_level;
+    return PWR_OK;
+}
+
 void free_speed_data(pwr_ctx_t *ctx) {
     if (ctx == NULL) {
         return;
@@ -457,10 +679,10 @@ void free_speed_data(pwr_ctx_t *ctx) {
     }
 
     for (unsigned int i = 0; i < ctx->num_phys_islands; ++i) {
-        fclose(ctx->island_throttle_files[i]);
+        close(ctx->island_throttle_fds[i]);
         free(ctx->phys_islands[i]->freqs);
     }
-    free(ctx->island_throttle_files);
+    free(ctx->island_throttle_fds);
 
     ctx->error = PWR_OK;
 }
@@ -471,44 +693,104 @@ void free_speed_data(pwr_ctx_t *ctx) {
 //-----------------------------------------------------------------------------
 
 /**
-  * Sorted list of frequencies constructor
-  *
-  * Builds a sorted array of <code>freq_t</code> frequencies from an array of 
-  * <code>char*</code>.
+  * Parses a space separated list of frequencies.
   *
-  * @param freqs  An array of strings representing frequencies. These strings
-  *               should be null-terminated and numbers only 
-  *               (<code>^[0-9]+\0$</code>).
-  * @param sorted  A sorted version of <code>freqs</code>
-  * @param num_freqs  The number of elements in <code>freqs</code> and 
-  *                   <code>sorted</code>
+  * @param freqs[out] Filled with the frequencies if not NULL.
   *
-  * @retval PWR_OK
+  * @return The number of frequencies.
   */
-void sort_and_cast_freqs(gchar** freqs, freq_t* sorted, long num_freqs) {
-    GArray* tmp_sorted = g_array_new(FALSE, FALSE, sizeof(freq_t));
-    for (long i=0; i<num_freqs; ++i) {
-        freq_t freq = atoi(freqs[i]);
-        g_array_append_val(tmp_sorted, freq);
-    }
-    g_array_sort(tmp_sorted, (GCompareFunc)(&compare_freq));
-    for (long i=0; i<num_freqs; ++i) {
-        sorted[i] = g_array_index(tmp_sorted, freq_t, i);
+long parse_freqs(const char *list, freq_t *freqs) {
+    long num = 0;
+    char *end;
+
+    for (const char *p = list; ; p = end) {
+        freq_t freq = strtol(p, &end, 10);
+        if (end == p) {
+            return num;
+        }
+        if (freqs != NULL) {
+            freqs[num] = freq;
+        }
+        ++num;
     }
-    g_array_free(tmp_sorted, TRUE);
 }
 
-
 /**
   * Compares two frequencies
   *
-  * @param f0  Frequency to compare
-  * @param f1  Frequency to compare
+  * @param f0  Pointer to the frequency to compare
+  * @param f1  Pointer to the frequency to compare
   * 
-  * @return A negative value if f0 is higher than f1, 0 if they are equal or a
+  * @return A negative value if f0 is lower than f1, 0 if they are equal or a
   *  positive value otherwise.
   */
-gint compare_freq(const freq_t f0, const freq_t f1) {
-    return f1 - f0;
+int compare_freq(const void *f0, const void *f1) {
+    freq_t a = *(const freq_t *) f0;
+    freq_t b = *(const freq_t *) f1;
+
+    return (a > b) - (a < b);
+}
+
+/**
+  * Computes the speed of a valid level, from the speed table when one is
+  * loaded or else from the capacity of the island.
+  */
+speed_t level_speed(pwr_ctx_t *ctx, unsigned long island, unsigned int level)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    speed_t speed;
+    if (table_speed(ctx, island, level, &speed)) {
+        return speed;
+    }
+
+    if (level == pi->max_speed_level) {
+        return pi->capacity;
+    }
+
+    // the turbo level may be listed below the highest frequency
+    freq_t max_freq = pi->max_freq > pi->freqs[pi->max_speed_level] ?
+        pi->max_freq : pi->freqs[pi->max_speed_level];
+    return pi->capacity * pi->freqs[level] / max_freq;
 }
 
+/**
+  * Checks and writes a new speed level on an island. That is the function
+  * behind pwr_request_speed_level() and pwr_increase_speed_level().
+  *
+  * @return PWR_OK, PWR_OVER_T_BUDGET if the level is clamped to the thermal
+  *         cap, or the error code.
+  */
+pwr_err_t request_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int new_level)
+{
+    if (is_uncore_island(ctx, island)) {
+        return uncore_set_level(ctx, island, new_level);
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        return PWR_UNINITIALIZED;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        return PWR_INVALID_ISLAND;
+    }
+
+    phys_island_t *pi = ctx->phys_islands[island];
+    if (new_level < pi->min_speed_level || new_level > pi->max_speed_level) {
+        return PWR_UNSUPPORTED_SPEED_LEVEL;
+    }
+
+    if ((new_level == pi->min_speed_level  ||
+         new_level == pi->max_speed_level) &&
+         new_level == pi->current_speed_level)
+    {
+        return PWR_ALREADY_MINMAX;
+    }
+
+    pwr_err_t err = set_speed_level(ctx, island, new_level);
+    if (err == PWR_OK && thermal_capped(ctx, island, new_level)) {
+        err = PWR_OVER_T_BUDGET;
+    }
+    return err;
+}
@@ -28,11 +28,14 @@
 /** Internal null, constant measurement results */
 static pwr_emeas_t emeas_zero = { 0, 0, NULL, NULL, NULL };
 
+static void stop_energy_count(pwr_ctx_t *ctx);
+
 //====-------------------------------------------------------------------------
 // Public functions
 //-----------------------------------------------------------------------------
 
 void pwr_start_energy_count(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_start_energy_count, TRACE_NO_ISLAND, 0);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return;
@@ -46,7 +49,7 @@ void pwr_start_energy_count(pwr_ctx_t *ctx) {
     ctx->error = PWR_OK;
 
     if (ctx->emeas_running) {
-        pwr_stop_energy_count(ctx);
+        stop_energy_count(ctx);
     }
 
     PAPI_reset(ctx->event_set);
@@ -56,6 +59,7 @@ void pwr_start_energy_count(pwr_ctx_t *ctx) {
 }
 
 const pwr_emeas_t *pwr_stop_energy_count(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_stop_energy_count, TRACE_NO_ISLAND, 0);
     // fast status check here
     if (ctx == NULL || !(ctx->module_init & (1U << PWR_MODULE_ENERGY))) {
         return &emeas_zero;
@@ -66,9 +70,7 @@ const pwr_emeas_t *pwr_stop_energy_count(pwr_ctx_t *ctx) {
         return &emeas_zero;
     }
 
-    PAPI_stop(ctx->event_set, ctx->emeas->values);
-    ctx->emeas->duration = (PAPI_get_real_nsec() - ctx->emeas->duration) / 1e9;
-    ctx->emeas_running = false;
+    stop_energy_count(ctx);
 
     ctx->error = PWR_OK;
     return ctx->emeas;
@@ -224,7 +226,7 @@ void free_energy_data(pwr_ctx_t *ctx) {
 
     
     if (ctx->emeas_running) {
-        pwr_stop_energy_count(ctx);
+        stop_energy_count(ctx);
     }
 
     PAPI_cleanup_eventset(ctx->event_set);
@@ -243,6 +245,20 @@ void free_energy_data(pwr_ctx_t *ctx) {
     ctx->error = PWR_OK;
 }
 
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Stops the running measurement and records its duration.
+  */
+static void stop_energy_count(pwr_ctx_t *ctx) {
+    PAPI_stop(ctx->event_set, ctx->emeas->values);
+    ctx->emeas->duration = (PAPI_get_real_nsec() - ctx->emeas->duration) / 1e9;
+    ctx->emeas_running = false;
+}
+
 // PAPI is missing? provide failsafe implementation
 #else
 
@@ -254,12 +270,14 @@ void free_energy_data(pwr_ctx_t *ctx) {
 static pwr_emeas_t emeas_zero = { 0, 0, NULL, NULL, NULL };
 
 void pwr_start_energy_count(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_start_energy_count, TRACE_NO_ISLAND, 0);
     assert(ctx != NULL);
 
     ctx->error = PWR_ARCH_UNSUPPORTED;
 }
 
 const pwr_emeas_t *pwr_stop_energy_count(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_stop_energy_count, TRACE_NO_ISLAND, 0);
     assert(ctx != NULL);
 
     ctx->error = PWR_ARCH_UNSUPPORTED;
@@ -0,0 +1,546 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Where the tracepoint is described, tracefs first */
+static const char *tracepoint_dirs[] = {
+    "/sys/kernel/tracing/events/power/cpu_frequency",
+    "/sys/kernel/debug/tracing/events/power/cpu_frequency"
+};
+
+/** Offsets of the frequency and CPU fields when the format is unreadable */
+#define DEFAULT_STATE_OFFSET 8
+#define DEFAULT_CPU_OFFSET 12
+
+/** Data pages of the ring buffer of every CPU, a power of 2 */
+#define RING_PAGES 2
+
+/** How long the thread waits for events before checking it must stop, in ms */
+#define POLL_TIMEOUT 50
+
+/** Largest record copied out of the ring buffer */
+#define MAX_RECORD 256
+
+/* Ring buffer of one CPU */
+typedef struct {
+    /* The tracepoint event */
+    int fd;
+
+    /* The mapping: control page, then the data pages */
+    struct perf_event_mmap_page *page;
+} watch_ring_t;
+
+/* Watcher state */
+struct freq_watch {
+    /* Is the watching thread running? */
+    bool running;
+
+    /* The watching thread */
+    pthread_t thread;
+
+    /* Protects the report */
+    pthread_mutex_t lock;
+
+    /* Offsets of the frequency and the CPU in the raw tracepoint data */
+    size_t state_offset;
+    size_t cpu_offset;
+
+    /* Size of a mapping */
+    size_t map_size;
+
+    /* Ring buffer per CPU */
+    watch_ring_t *rings;
+
+    /* Poll descriptors, one per CPU */
+    struct pollfd *pollfds;
+
+    /* When was the last level written by the library, per island, in ns */
+    uint64_t *last_write_ns;
+
+    /* External changes per island, protected by the DVFS lock */
+    unsigned long *external_changes;
+
+    /* When the watcher was started, in ns */
+    uint64_t start_ns;
+
+    /* The activity report */
+    pwr_freq_watch_report_t report;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static long long tracepoint_id(struct freq_watch *fw);
+static bool open_rings(pwr_ctx_t *ctx, long long id);
+static void close_rings(pwr_ctx_t *ctx);
+static void *freq_watch_thread(void *arg);
+static void drain_ring(pwr_ctx_t *ctx, watch_ring_t *ring);
+static void handle_sample(pwr_ctx_t *ctx, const char *record);
+static unsigned int nearest_level(phys_island_t *pi, freq_t freq);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_freq_watch_start(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_freq_watch_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->freq_watch != NULL && ctx->freq_watch->running) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    free_freq_watch(ctx);
+
+    struct freq_watch *fw = calloc(1, sizeof(*fw));
+    pthread_mutex_init(&fw->lock, NULL);
+    fw->rings = malloc(ctx->num_phys_cpu * sizeof(*fw->rings));
+    fw->pollfds = malloc(ctx->num_phys_cpu * sizeof(*fw->pollfds));
+    fw->last_write_ns = calloc(ctx->num_phys_islands,
+        sizeof(*fw->last_write_ns));
+    fw->external_changes = calloc(ctx->num_phys_islands,
+        sizeof(*fw->external_changes));
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        fw->rings[cpu].fd = -1;
+        fw->rings[cpu].page = NULL;
+    }
+
+    // the library writes are stamped from now on
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->freq_watch = fw;
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    long long id = tracepoint_id(fw);
+    if (id < 0) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot find the power:cpu_frequency "
+                "tracepoint, is tracefs mounted?\n");
+        }
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    if (!open_rings(ctx, id)) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd,
+                "Cannot subscribe to the power:cpu_frequency tracepoint\n");
+        }
+        close_rings(ctx);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    fw->start_ns = monotonic_ns();
+    fw->running = true;
+
+    if (pthread_create(&fw->thread, NULL, &freq_watch_thread, ctx)) {
+        fw->running = false;
+        close_rings(ctx);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_freq_watch_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_freq_watch_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct freq_watch *fw = ctx->freq_watch;
+    if (fw == NULL || !fw->running) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_store_n(&fw->running, false, __ATOMIC_RELEASE);
+    pthread_join(fw->thread, NULL);
+
+    pthread_mutex_lock(&fw->lock);
+    fw->report.duration = (monotonic_ns() - fw->start_ns) / 1e9;
+    pthread_mutex_unlock(&fw->lock);
+
+    close_rings(ctx);
+    ctx->error = PWR_OK;
+}
+
+void pwr_freq_watch_report(pwr_ctx_t *ctx, pwr_freq_watch_report_t *report) {
+    TRACE_CALL(ctx, pwr_freq_watch_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct freq_watch *fw = ctx->freq_watch;
+    if (fw == NULL || report == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&fw->lock);
+    *report = fw->report;
+    if (fw->running) {
+        report->duration = (monotonic_ns() - fw->start_ns) / 1e9;
+    }
+    pthread_mutex_unlock(&fw->lock);
+
+    ctx->error = PWR_OK;
+}
+
+unsigned long pwr_external_speed_changes(pwr_ctx_t *ctx,
+    unsigned long island)
+{
+    TRACE_CALL(ctx, pwr_external_speed_changes, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    struct freq_watch *fw = ctx->freq_watch;
+    if (fw == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    unsigned long changes = fw->external_changes[island];
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = PWR_OK;
+    return changes;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void free_freq_watch(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->freq_watch == NULL) {
+        return;
+    }
+
+    struct freq_watch *fw = ctx->freq_watch;
+    if (fw->running) {
+        pwr_freq_watch_stop(ctx);
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->freq_watch = NULL;
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    pthread_mutex_destroy(&fw->lock);
+    free(fw->rings);
+    free(fw->pollfds);
+    free(fw->last_write_ns);
+    free(fw->external_changes);
+    free(fw);
+}
+
+void freq_watch_written(pwr_ctx_t *ctx, unsigned long island) {
+    if (ctx->freq_watch != NULL) {
+        ctx->freq_watch->last_write_ns[island] = monotonic_ns();
+    }
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Finds the ID of the tracepoint and the layout of its data.
+  *
+  * @return The tracepoint ID, or -1 if it cannot be found.
+  */
+long long tracepoint_id(struct freq_watch *fw) {
+    char path[128];
+    char line[256];
+    long long id = -1;
+    size_t d;
+
+    for (d = 0; d < sizeof(tracepoint_dirs) / sizeof(*tracepoint_dirs); ++d) {
+        snprintf(path, sizeof(path), "%s/id", tracepoint_dirs[d]);
+        if (read_sysfs_file_ll(path, &id)) {
+            break;
+        }
+    }
+    if (id < 0) {
+        return -1;
+    }
+
+    fw->state_offset = DEFAULT_STATE_OFFSET;
+    fw->cpu_offset = DEFAULT_CPU_OFFSET;
+
+    // lines look like "field:u32 state;	offset:8;	size:4;	signed:0;"
+    snprintf(path, sizeof(path), "%s/format", tracepoint_dirs[d]);
+    FILE *format = fopen(path, "r");
+    if (format == NULL) {
+        return id;
+    }
+    while (fgets(line, sizeof(line), format) != NULL) {
+        const char *offset = strstr(line, "offset:");
+        if (offset == NULL) {
+            continue;
+        }
+        if (strstr(line, " state;") != NULL) {
+            fw->state_offset = strtoul(offset + 7, NULL, 10);
+        } else if (strstr(line, " cpu_id;") != NULL) {
+            fw->cpu_offset = strtoul(offset + 7, NULL, 10);
+        }
+    }
+    fclose(format);
+
+    return id;
+}
+
+/**
+  * Opens the tracepoint on every CPU and maps its ring buffer.
+  *
+  * @param ctx The current library context.
+  * @param id The tracepoint ID.
+  *
+  * @return False if a CPU cannot be watched.
+  */
+bool open_rings(pwr_ctx_t *ctx, long long id) {
+    struct freq_watch *fw = ctx->freq_watch;
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = id;
+    attr.sample_period = 1;
+    attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    attr.wakeup_events = 1;
+    attr.use_clockid = 1;
+    attr.clockid = CLOCK_MONOTONIC;
+
+    fw->map_size = (1 + RING_PAGES) * sysconf(_SC_PAGESIZE);
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        watch_ring_t *ring = &fw->rings[cpu];
+
+        // glibc provides no wrapper for that syscall
+        ring->fd = syscall(__NR_perf_event_open, &attr, -1, (int) cpu, -1, 0);
+        if (ring->fd < 0) {
+            return false;
+        }
+
+        void *page = mmap(NULL, fw->map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, ring->fd, 0);
+        if (page == MAP_FAILED) {
+            return false;
+        }
+        ring->page = page;
+
+        fw->pollfds[cpu].fd = ring->fd;
+        fw->pollfds[cpu].events = POLLIN;
+    }
+
+    return true;
+}
+
+/**
+  * Unmaps the ring buffers and closes the tracepoints.
+  */
+void close_rings(pwr_ctx_t *ctx) {
+    struct freq_watch *fw = ctx->freq_watch;
+
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        watch_ring_t *ring = &fw->rings[cpu];
+
+        if (ring->page != NULL) {
+            munmap(ring->page, fw->map_size);
+            ring->page = NULL;
+        }
+        if (ring->fd >= 0) {
+            close(ring->fd);
+            ring->fd = -1;
+        }
+    }
+}
+
+/**
+  * Main loop of the watching thread: sleeps until events are available and
+  * drains the ring buffers that have some.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *freq_watch_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct freq_watch *fw = ctx->freq_watch;
+
+    while (__atomic_load_n(&fw->running, __ATOMIC_ACQUIRE)) {
+        int ready = poll(fw->pollfds, ctx->num_phys_cpu, POLL_TIMEOUT);
+
+        for (unsigned long cpu = 0; ready > 0 && cpu < ctx->num_phys_cpu;
+             ++cpu)
+        {
+            if (fw->pollfds[cpu].revents & POLLIN) {
+                drain_ring(ctx, &fw->rings[cpu]);
+                --ready;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+  * Handles every record available in a ring buffer and releases its space.
+  *
+  * @param ctx The current library context.
+  * @param ring The ring buffer to drain.
+  */
+void drain_ring(pwr_ctx_t *ctx, watch_ring_t *ring) {
+    struct freq_watch *fw = ctx->freq_watch;
+    struct perf_event_mmap_page *page = ring->page;
+    const char *data = (const char *) page + page->data_offset;
+    uint64_t size = page->data_size;
+    uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = page->data_tail;
+    char record[MAX_RECORD];
+
+    while (tail < head) {
+        const struct perf_event_header *header =
+            (const void *) (data + tail % size);
+
+        // a record wrapping around the end of the buffer is copied first
+        if (tail % size + header->size > size) {
+            if (header->size <= sizeof(record)) {
+                uint64_t first = size - tail % size;
+                memcpy(record, data + tail % size, first);
+                memcpy(record + first, data, header->size - first);
+                header = (const void *) record;
+            } else {
+                tail += header->size;
+                continue;
+            }
+        }
+
+        if (header->type == PERF_RECORD_SAMPLE) {
+            handle_sample(ctx, (const char *) header);
+        } else if (header->type == PERF_RECORD_LOST) {
+            const uint64_t *lost = (const void *) (header + 1);
+            pthread_mutex_lock(&fw->lock);
+            fw->report.lost_events += lost[1];
+            pthread_mutex_unlock(&fw->lock);
+        }
+        tail += header->size;
+    }
+
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+  * Updates the current speed level of the island of a frequency change that
+  * was not issued by the library. Changes older than the last library write
+  * on the island are ignored.
+  *
+  * @param ctx The current library context.
+  * @param record The sample record: header, time, then raw data.
+  */
+void handle_sample(pwr_ctx_t *ctx, const char *record) {
+    struct freq_watch *fw = ctx->freq_watch;
+    const char *body = record + sizeof(struct perf_event_header);
+    uint64_t time;
+    uint32_t raw_size, state, cpu;
+
+    memcpy(&time, body, sizeof(time));
+    memcpy(&raw_size, body + sizeof(time), sizeof(raw_size));
+    const char *raw = body + sizeof(time) + sizeof(raw_size);
+    if (raw_size < fw->state_offset + sizeof(state) ||
+        raw_size < fw->cpu_offset + sizeof(cpu))
+    {
+        return;
+    }
+    memcpy(&state, raw + fw->state_offset, sizeof(state));
+    memcpy(&cpu, raw + fw->cpu_offset, sizeof(cpu));
+
+    bool external = false;
+    if (cpu < ctx->num_phys_cpu &&
+        ctx->cpu_islands[cpu] < ctx->num_phys_islands)
+    {
+        unsigned long island = ctx->cpu_islands[cpu];
+        phys_island_t *pi = ctx->phys_islands[island];
+        unsigned int level = nearest_level(pi, state);
+
+        pthread_mutex_lock(&ctx->dvfs_lock);
+        if (time > fw->last_write_ns[island] &&
+            (speed_level_t) level != pi->current_speed_level)
+        {
+            pi->current_speed_level = level;
+            ++fw->external_changes[island];
+            external = true;
+        }
+        pthread_mutex_unlock(&ctx->dvfs_lock);
+    }
+
+    pthread_mutex_lock(&fw->lock);
+    ++fw->report.events;
+    if (external) {
+        ++fw->report.external_changes;
+    }
+    pthread_mutex_unlock(&fw->lock);
+}
+
+/**
+  * Finds the speed level of an island closest to a frequency.
+  */
+unsigned int nearest_level(phys_island_t *pi, freq_t freq) {
+    unsigned int level = pi->min_speed_level;
+
+    while (level < (unsigned int) pi->max_speed_level &&
+           pi->freqs[level + 1] <= freq)
+    {
+        ++level;
+    }
+    if (level < (unsigned int) pi->max_speed_level &&
+        pi->freqs[level + 1] - freq < freq - pi->freqs[level])
+    {
+        ++level;
+    }
+
+    return level;
+}
@@ -0,0 +1,581 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** The hardware counters read on every CPU */
+enum governor_counter {
+    CNT_CYCLES = 0,
+    CNT_INSTRUCTIONS,
+    NB_COUNTERS
+};
+
+/** perf_event configuration of the counters */
+static const uint64_t counter_configs[NB_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS
+};
+
+/** Longest forecast, in periods, whatever the agility of the island */
+#define MAX_HORIZON 16
+
+/** Weight of the last period in the estimated cost of a CPU read */
+#define COST_EWMA_WEIGHT 0.1
+
+/* Governor state of one CPU */
+typedef struct {
+    /* The counters, -1 if not opened. The cycles lead the group. */
+    int fds[NB_COUNTERS];
+
+    /* Counter values at the last read */
+    uint64_t last[NB_COUNTERS];
+
+    /* Time the counters were enabled at the last read, in ns */
+    uint64_t last_enabled;
+
+    /* Cycle rate between the last two reads, in Hz */
+    double demand;
+
+    /* Instruction rate between the last two reads, in instructions per s */
+    double ips;
+} governor_cpu_t;
+
+/* Governor state of one island */
+typedef struct {
+    /* The CPU state of the island, in the governor CPU array */
+    governor_cpu_t *cpus;
+
+    /* Speed level when the governor started */
+    speed_level_t start_level;
+
+    /* Has the demand been observed once? */
+    bool primed;
+
+    /* Smoothed demand, in Hz */
+    double demand;
+
+    /* Smoothed demand variation per period, in Hz */
+    double trend;
+
+    /* Smoothed instruction throughput, in instructions per s */
+    double ips;
+
+    /* How many periods the forecast looks ahead */
+    unsigned int horizon;
+
+    /* Minimal time between a transition and a lower level, in ns */
+    uint64_t dwell_ns;
+
+    /* When was the last transition issued, in ns */
+    uint64_t last_transition_ns;
+} governor_island_t;
+
+/* Governor state */
+struct governor {
+    /* The governor parameters */
+    pwr_governor_params_t params;
+
+    /* Is the sampling thread running? */
+    bool running;
+
+    /* The sampling thread */
+    pthread_t thread;
+
+    /* Protects the report */
+    pthread_mutex_t lock;
+
+    /* Per-CPU state, ordered by island */
+    governor_cpu_t *cpus;
+
+    /* Number of entries of cpus */
+    unsigned long num_cpus;
+
+    /* Per-island state */
+    governor_island_t *islands;
+
+    /* Speed level changes of a period, one slot per island */
+    unsigned long *change_islands;
+    unsigned int *change_levels;
+
+    /* Estimated CPU time of a CPU read, decisions included, in ns */
+    double read_cost;
+
+    /* When the governor was started, in ns */
+    uint64_t start_ns;
+
+    /* The activity report */
+    pwr_governor_report_t report;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool valid_params(const pwr_governor_params_t *params);
+static bool open_counters(pwr_ctx_t *ctx);
+static void close_counters(struct governor *gov);
+static void *governor_thread(void *arg);
+static void sample_cpu(governor_cpu_t *gc);
+static bool select_level(pwr_ctx_t *ctx, unsigned long island, uint64_t now,
+    unsigned int *level);
+static uint64_t thread_cpu_ns(void);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_governor_default_params(pwr_governor_params_t *params) {
+    if (params == NULL) {
+        return;
+    }
+
+    params->period = 0.01;
+    params->target_util = 0.8;
+    params->demand_weight = 0.5;
+    params->trend_weight = 0.3;
+    params->phase_threshold = 0.5;
+    params->dwell = 10;
+    params->max_overhead = 0.01;
+}
+
+void pwr_governor_start(pwr_ctx_t *ctx, const pwr_governor_params_t *params) {
+    TRACE_CALL(ctx, pwr_governor_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->governor != NULL && ctx->governor->running) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    free_governor(ctx);
+
+    struct governor *gov = calloc(1, sizeof(*gov));
+    if (params != NULL) {
+        gov->params = *params;
+    } else {
+        pwr_governor_default_params(&gov->params);
+    }
+    if (!valid_params(&gov->params)) {
+        free(gov);
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_init(&gov->lock, NULL);
+    gov->islands = calloc(ctx->num_phys_islands, sizeof(*gov->islands));
+    gov->change_islands = malloc(ctx->num_phys_islands *
+        sizeof(*gov->change_islands));
+    gov->change_levels = malloc(ctx->num_phys_islands *
+        sizeof(*gov->change_levels));
+    ctx->governor = gov;
+
+    //===----------------------------------------------------------------------
+    // Derive the forecast horizon and the dwell time from the agility
+    uint64_t period_ns = gov->params.period * 1e9;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        governor_island_t *gi = &gov->islands[i];
+        uint64_t agility = pi->agility > 0 ? pi->agility : 0;
+
+        gi->start_level = pi->current_speed_level;
+        gi->horizon = (agility + period_ns - 1) / period_ns;
+        if (gi->horizon < 1) {
+            gi->horizon = 1;
+        } else if (gi->horizon > MAX_HORIZON) {
+            gi->horizon = MAX_HORIZON;
+        }
+        gi->dwell_ns = agility * gov->params.dwell;
+    }
+
+    if (!open_counters(ctx)) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot open the hardware counters\n");
+        }
+        close_counters(gov);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    gov->start_ns = monotonic_ns();
+    gov->report.stride = 1;
+    gov->running = true;
+
+    if (pthread_create(&gov->thread, NULL, &governor_thread, ctx)) {
+        gov->running = false;
+        close_counters(gov);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_governor_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_governor_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct governor *gov = ctx->governor;
+    if (gov == NULL || !gov->running) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_store_n(&gov->running, false, __ATOMIC_RELEASE);
+    pthread_join(gov->thread, NULL);
+
+    // Restore the starting levels
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        gov->change_islands[i] = i;
+        gov->change_levels[i] = gov->islands[i].start_level;
+    }
+    ctx->error = set_speed_levels(ctx, gov->change_islands,
+        gov->change_levels, ctx->num_phys_islands);
+
+    close_counters(gov);
+}
+
+void pwr_governor_report(pwr_ctx_t *ctx, pwr_governor_report_t *report) {
+    TRACE_CALL(ctx, pwr_governor_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct governor *gov = ctx->governor;
+    if (gov == NULL || report == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&gov->lock);
+    *report = gov->report;
+    pthread_mutex_unlock(&gov->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void free_governor(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->governor == NULL) {
+        return;
+    }
+
+    struct governor *gov = ctx->governor;
+    if (gov->running) {
+        pwr_governor_stop(ctx);
+    }
+
+    pthread_mutex_destroy(&gov->lock);
+    free(gov->islands);
+    free(gov->change_islands);
+    free(gov->change_levels);
+    free(gov);
+    ctx->governor = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Checks that the governor parameters are within their ranges.
+  */
+bool valid_params(const pwr_governor_params_t *params) {
+    return params->period > 0 &&
+        params->target_util > 0 && params->target_util <= 1 &&
+        params->demand_weight > 0 && params->demand_weight <= 1 &&
+        params->trend_weight >= 0 && params->trend_weight <= 1 &&
+        params->phase_threshold > 0 && params->max_overhead > 0;
+}
+
+/**
+  * Opens the hardware counters on every CPU, island by island.
+  *
+  * @param ctx The current library context.
+  *
+  * @return False if a counter cannot be opened.
+  */
+bool open_counters(pwr_ctx_t *ctx) {
+    struct governor *gov = ctx->governor;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        gov->num_cpus += ctx->phys_islands[i]->num_cpu;
+    }
+    gov->cpus = calloc(gov->num_cpus, sizeof(*gov->cpus));
+    for (unsigned long k = 0; k < gov->num_cpus; ++k) {
+        for (int n = 0; n < NB_COUNTERS; ++n) {
+            gov->cpus[k].fds[n] = -1;
+        }
+    }
+
+    governor_cpu_t *gc = gov->cpus;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+
+        gov->islands[i].cpus = gc;
+        for (unsigned long c = 0; c < pi->num_cpu; ++c, ++gc) {
+            // one group per CPU, read at once
+            for (int n = 0; n < NB_COUNTERS; ++n) {
+                gc->fds[n] = open_perf_counter(pi->cpus[c],
+                    PERF_TYPE_HARDWARE, counter_configs[n],
+                    n == CNT_CYCLES ? -1 : gc->fds[CNT_CYCLES]);
+                if (gc->fds[n] < 0) {
+                    return false;
+                }
+            }
+            read_perf_group(gc->fds[CNT_CYCLES], NB_COUNTERS, gc->last,
+                &gc->last_enabled);
+        }
+    }
+
+    return true;
+}
+
+/**
+  * Closes the hardware counters of all the CPUs.
+  */
+void close_counters(struct governor *gov) {
+    if (gov->cpus == NULL) {
+        return;
+    }
+
+    for (unsigned long k = 0; k < gov->num_cpus; ++k) {
+        for (int n = 0; n < NB_COUNTERS; ++n) {
+            if (gov->cpus[k].fds[n] >= 0) {
+                close(gov->cpus[k].fds[n]);
+            }
+        }
+    }
+    free(gov->cpus);
+    gov->cpus = NULL;
+    gov->num_cpus = 0;
+}
+
+/**
+  * Main loop of the sampling thread. Every period, reads the CPUs whose turn
+  * it is, then picks the speed level of every island and issues the changes
+  * at once. The stride between two reads of a CPU follows the cost of the
+  * reads, to keep the overhead within bounds.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *governor_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct governor *gov = ctx->governor;
+    uint64_t period_ns = gov->params.period * 1e9;
+    uint64_t next = gov->start_ns;
+    uint64_t busy_ns = 0;
+    unsigned long stride = 1;
+    unsigned long tick = 0;
+
+    while (__atomic_load_n(&gov->running, __ATOMIC_ACQUIRE)) {
+        next += period_ns;
+        struct timespec ts = {
+            .tv_sec = next / 1000000000ULL,
+            .tv_nsec = next % 1000000000ULL
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        uint64_t cpu_start = thread_cpu_ns();
+        unsigned long reads = 0;
+
+        for (unsigned long k = tick % stride; k < gov->num_cpus; k += stride) {
+            sample_cpu(&gov->cpus[k]);
+            ++reads;
+        }
+        ++tick;
+
+        uint64_t now = monotonic_ns();
+        unsigned long num_changes = 0;
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            if (select_level(ctx, i, now, &gov->change_levels[num_changes])) {
+                gov->change_islands[num_changes++] = i;
+            }
+        }
+        if (num_changes > 0) {
+            set_speed_levels(ctx, gov->change_islands, gov->change_levels,
+                num_changes);
+        }
+
+        //===------------------------------------------------------------------
+        // Adapt the stride to the cost of the reads
+        uint64_t cost = thread_cpu_ns() - cpu_start;
+        busy_ns += cost;
+        if (reads > 0) {
+            double read_cost = (double) cost / reads;
+            gov->read_cost = gov->read_cost == 0 ? read_cost :
+                COST_EWMA_WEIGHT * read_cost +
+                (1 - COST_EWMA_WEIGHT) * gov->read_cost;
+        }
+        stride = 1 + gov->num_cpus * gov->read_cost /
+            (gov->params.max_overhead * period_ns);
+        if (stride > gov->num_cpus) {
+            stride = gov->num_cpus;
+        }
+
+        pthread_mutex_lock(&gov->lock);
+        ++gov->report.samples;
+        gov->report.cpu_reads += reads;
+        gov->report.transitions += num_changes;
+        gov->report.stride = stride;
+        gov->report.duration = (now - gov->start_ns) / 1e9;
+        gov->report.overhead = (double) busy_ns / (now - gov->start_ns);
+        pthread_mutex_unlock(&gov->lock);
+    }
+
+    return NULL;
+}
+
+/**
+  * Updates the rates of a CPU from its counters.
+  */
+void sample_cpu(governor_cpu_t *gc) {
+    uint64_t values[NB_COUNTERS];
+    uint64_t enabled;
+
+    if (!read_perf_group(gc->fds[CNT_CYCLES], NB_COUNTERS, values, &enabled) ||
+        enabled <= gc->last_enabled)
+    {
+        return;
+    }
+
+    // scaled counts are estimates, a decrease means nothing was counted
+    int64_t cycles = values[CNT_CYCLES] - gc->last[CNT_CYCLES];
+    int64_t instructions =
+        values[CNT_INSTRUCTIONS] - gc->last[CNT_INSTRUCTIONS];
+    double dt = (enabled - gc->last_enabled) / 1e9;
+    gc->demand = cycles > 0 ? cycles / dt : 0;
+    gc->ips = instructions > 0 ? instructions / dt : 0;
+
+    gc->last_enabled = enabled;
+    for (int n = 0; n < NB_COUNTERS; ++n) {
+        gc->last[n] = values[n];
+    }
+}
+
+/**
+  * Updates the demand forecast of an island and picks its speed level.
+  *
+  * @param ctx The current library context.
+  * @param island The island to decide for.
+  * @param now The current time, in ns.
+  * @param level[out] The speed level to request, if any.
+  *
+  * @return True if the speed level of the island must change.
+  */
+bool select_level(pwr_ctx_t *ctx, unsigned long island, uint64_t now,
+    unsigned int *level)
+{
+    struct governor *gov = ctx->governor;
+    const pwr_governor_params_t *params = &gov->params;
+    phys_island_t *pi = ctx->phys_islands[island];
+    governor_island_t *gi = &gov->islands[island];
+    double demand = 0, ips = 0;
+    bool new_phase = true;
+
+    // the busiest CPU sets the frequency of the island
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        if (gi->cpus[c].demand > demand) {
+            demand = gi->cpus[c].demand;
+        }
+        ips += gi->cpus[c].ips;
+    }
+
+    //===----------------------------------------------------------------------
+    // Forecast the demand
+    if (gi->primed) {
+        double change = ips > gi->ips ? ips - gi->ips : gi->ips - ips;
+        new_phase = change > params->phase_threshold *
+            (ips > gi->ips ? ips : gi->ips);
+    }
+    if (new_phase) {
+        if (gi->primed) {
+            pthread_mutex_lock(&gov->lock);
+            ++gov->report.phase_changes;
+            pthread_mutex_unlock(&gov->lock);
+        }
+        gi->primed = true;
+        gi->demand = demand;
+        gi->trend = 0;
+        gi->ips = ips;
+    } else {
+        double previous = gi->demand;
+        gi->demand = params->demand_weight * demand +
+            (1 - params->demand_weight) * (gi->demand + gi->trend);
+        gi->trend = params->trend_weight * (gi->demand - previous) +
+            (1 - params->trend_weight) * gi->trend;
+        gi->ips = params->demand_weight * ips +
+            (1 - params->demand_weight) * gi->ips;
+    }
+
+    double forecast = gi->demand + gi->horizon * gi->trend;
+    double target = forecast / params->target_util / 1000;
+
+    //===----------------------------------------------------------------------
+    // Pick the slowest level meeting the forecast
+    unsigned int new_level = pi->min_speed_level;
+    while (new_level < (unsigned int) pi->max_speed_level &&
+           pi->freqs[new_level] < target)
+    {
+        ++new_level;
+    }
+
+    speed_level_t current =
+        __atomic_load_n(&pi->current_speed_level, __ATOMIC_RELAXED);
+    if ((speed_level_t) new_level == current ||
+        ((speed_level_t) new_level < current &&
+         now - gi->last_transition_ns < gi->dwell_ns))
+    {
+        return false;
+    }
+
+    gi->last_transition_ns = now;
+    *level = new_level;
+    return true;
+}
+
+/**
+  * Reads the CPU time used by the calling thread.
+  *
+  * @return The CPU time, in ns.
+  */
+uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
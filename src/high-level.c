@@ -23,6 +23,7 @@
 void pwr_efficiency(pwr_ctx_t *ctx, unsigned long island,
     efficiency_t* efficiency) 
 {
+    TRACE_CALL(ctx, pwr_efficiency, island, 0);
     (void) island;
     (void) efficiency;
 
@@ -32,6 +33,7 @@ void pwr_efficiency(pwr_ctx_t *ctx, unsigned long island,
 }
 
 void pwr_set_power_priority(pwr_ctx_t *ctx, void* task, int priority) {
+    TRACE_CALL(ctx, pwr_set_power_priority, TRACE_NO_ISLAND, priority);
     (void) task;
     (void) priority;
 
@@ -41,6 +43,7 @@ void pwr_set_power_priority(pwr_ctx_t *ctx, void* task, int priority) {
 }
 
 void pwr_set_speed_priority(pwr_ctx_t *ctx,void* task, int priority) {
+    TRACE_CALL(ctx, pwr_set_speed_priority, TRACE_NO_ISLAND, priority);
     (void) task;
     (void) priority;
 
@@ -0,0 +1,373 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "internals.h"
+
+/** HWP enable, bit 0 */
+#define MSR_IA32_PM_ENABLE 0x770
+
+/** Performance levels: highest, guaranteed, most efficient and lowest */
+#define MSR_IA32_HWP_CAPABILITIES 0x771
+
+/** Request: min, max, desired and EPP, then the activity window */
+#define MSR_IA32_HWP_REQUEST 0x774
+
+/** The bus clock, multiplied by the ratios to get frequencies, in KHz */
+#define BUS_CLOCK 100000
+
+/* HWP state */
+struct hwp {
+    /* Is HWP enabled? */
+    bool available;
+
+    /* Capabilities of every island */
+    pwr_hwp_caps_t *caps;
+
+    /* Last request written on every island */
+    uint64_t *requests;
+
+    /* Request of every CPU when the library was initialized */
+    uint64_t *initial;
+
+    /* Were requests written by the library? */
+    bool changed;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static pwr_err_t check_island(pwr_ctx_t *ctx, unsigned long island);
+static uint64_t encode_request(uint64_t previous,
+    const pwr_hwp_request_t *request);
+static void decode_request(uint64_t value, pwr_hwp_request_t *request);
+static pwr_err_t write_request(pwr_ctx_t *ctx, unsigned long island,
+    uint64_t value);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+bool pwr_hwp_available(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_hwp_available, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return false;
+    }
+
+    if (ctx->hwp == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return false;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->hwp->available;
+}
+
+void pwr_hwp_capabilities(pwr_ctx_t *ctx, unsigned long island,
+    pwr_hwp_caps_t *caps)
+{
+    TRACE_CALL(ctx, pwr_hwp_capabilities, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_island(ctx, island);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    *caps = ctx->hwp->caps[island];
+    ctx->error = PWR_OK;
+}
+
+void pwr_hwp_request(pwr_ctx_t *ctx, unsigned long island,
+    pwr_hwp_request_t *request)
+{
+    TRACE_CALL(ctx, pwr_hwp_request, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_island(ctx, island);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    decode_request(ctx->hwp->requests[island], request);
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_set_hwp_request(pwr_ctx_t *ctx, unsigned long island,
+    const pwr_hwp_request_t *request)
+{
+    TRACE_CALL(ctx, pwr_set_hwp_request, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_island(ctx, island);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    const pwr_hwp_caps_t *caps = &ctx->hwp->caps[island];
+    if (request->min < caps->lowest || request->max > caps->highest ||
+        request->min > request->max || request->epp > PWR_EPP_POWERSAVE ||
+        (request->desired != 0 && (request->desired < request->min ||
+                                   request->desired > request->max)))
+    {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->error = write_request(ctx, island,
+        encode_request(ctx->hwp->requests[island], request));
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+}
+
+unsigned int pwr_epp(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_epp, island, 0);
+    pwr_hwp_request_t request;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    pwr_err_t err = check_island(ctx, island);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    decode_request(ctx->hwp->requests[island], &request);
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = PWR_OK;
+    return request.epp;
+}
+
+void pwr_set_epp(pwr_ctx_t *ctx, unsigned long island, unsigned int epp) {
+    TRACE_CALL(ctx, pwr_set_epp, island, epp);
+    pwr_hwp_request_t request;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_island(ctx, island);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    if (epp > PWR_EPP_POWERSAVE) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    decode_request(ctx->hwp->requests[island], &request);
+    request.epp = epp;
+    ctx->error = write_request(ctx, island,
+        encode_request(ctx->hwp->requests[island], &request));
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_hwp(pwr_ctx_t *ctx) {
+    uint64_t value;
+
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
+
+    struct hwp *hwp = calloc(1, sizeof(*hwp));
+    ctx->hwp = hwp;
+
+    if (!read_msr(ctx, 0, MSR_IA32_PM_ENABLE, &value) || !(value & 1)) {
+        return;
+    }
+
+    hwp->caps = malloc(ctx->num_phys_islands * sizeof(*hwp->caps));
+    hwp->requests = malloc(ctx->num_phys_islands * sizeof(*hwp->requests));
+    hwp->initial = malloc(ctx->num_phys_cpu * sizeof(*hwp->initial));
+
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        if (!read_msr(ctx, cpu, MSR_IA32_HWP_REQUEST, &hwp->initial[cpu])) {
+            return;
+        }
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        unsigned long cpu = ctx->phys_islands[i]->cpus[0];
+
+        if (!read_msr(ctx, cpu, MSR_IA32_HWP_CAPABILITIES, &value)) {
+            return;
+        }
+        hwp->caps[i].highest = value & 0xFF;
+        hwp->caps[i].guaranteed = (value >> 8) & 0xFF;
+        hwp->caps[i].most_efficient = (value >> 16) & 0xFF;
+        hwp->caps[i].lowest = (value >> 24) & 0xFF;
+
+        hwp->requests[i] = hwp->initial[cpu];
+    }
+
+    hwp->available = true;
+}
+
+void free_hwp(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->hwp == NULL) {
+        return;
+    }
+
+    if (ctx->hwp->changed) {
+        for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+            if (!write_msr(ctx, cpu, MSR_IA32_HWP_REQUEST,
+                    ctx->hwp->initial[cpu]) && ctx->err_fd)
+            {
+                fprintf(ctx->err_fd,
+                    "Failed to restore the HWP request of cpu %lu\n", cpu);
+            }
+        }
+    }
+
+    free(ctx->hwp->caps);
+    free(ctx->hwp->requests);
+    free(ctx->hwp->initial);
+    free(ctx->hwp);
+    ctx->hwp = NULL;
+}
+
+bool hwp_available(pwr_ctx_t *ctx) {
+    return ctx->hwp != NULL && ctx->hwp->available;
+}
+
+pwr_err_t hwp_write_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+    const pwr_hwp_caps_t *caps = &ctx->hwp->caps[island];
+    pwr_hwp_request_t request;
+
+    // the fastest level opens the whole turbo range
+    unsigned int ratio = level == pi->max_speed_level ?
+        caps->highest : pi->freqs[level] / BUS_CLOCK;
+    if (ratio < caps->lowest) {
+        ratio = caps->lowest;
+    } else if (ratio > caps->highest) {
+        ratio = caps->highest;
+    }
+
+    decode_request(ctx->hwp->requests[island], &request);
+    request.min = caps->lowest;
+    request.max = ratio;
+    request.desired = 0;
+
+    return write_request(ctx, island,
+        encode_request(ctx->hwp->requests[island], &request));
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Checks that HWP can be used on an island.
+  *
+  * @return PWR_OK or the error code to set.
+  */
+pwr_err_t check_island(pwr_ctx_t *ctx, unsigned long island) {
+    if (ctx->hwp == NULL) {
+        return PWR_UNINITIALIZED;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        return PWR_INVALID_ISLAND;
+    }
+
+    if (!ctx->hwp->available) {
+        return PWR_UNAVAILABLE;
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Builds the value of IA32_HWP_REQUEST, keeping the fields of the previous
+  * value that are not part of the request.
+  */
+uint64_t encode_request(uint64_t previous, const pwr_hwp_request_t *request)
+{
+    return (previous & ~0xFFFFFFFFULL) |
+        (uint64_t) (request->min & 0xFF) |
+        (uint64_t) (request->max & 0xFF) << 8 |
+        (uint64_t) (request->desired & 0xFF) << 16 |
+        (uint64_t) (request->epp & 0xFF) << 24;
+}
+
+/**
+  * Extracts the request from a value of IA32_HWP_REQUEST.
+  */
+void decode_request(uint64_t value, pwr_hwp_request_t *request) {
+    request->min = value & 0xFF;
+    request->max = (value >> 8) & 0xFF;
+    request->desired = (value >> 16) & 0xFF;
+    request->epp = (value >> 24) & 0xFF;
+}
+
+/**
+  * Writes a request on every CPU of an island, unless it is already in place.
+  * Called with the DVFS lock held.
+  *
+  * @return PWR_OK or PWR_DVFS_ERR.
+  */
+pwr_err_t write_request(pwr_ctx_t *ctx, unsigned long island, uint64_t value)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    if (value == ctx->hwp->requests[island]) {
+        return PWR_OK;
+    }
+
+    ctx->hwp->changed = true;
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        if (!write_msr(ctx, pi->cpus[c], MSR_IA32_HWP_REQUEST, value)) {
+            return PWR_DVFS_ERR;
+        }
+    }
+    ctx->hwp->requests[island] = value;
+
+    return PWR_OK;
+}
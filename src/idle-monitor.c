@@ -0,0 +1,379 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "internals.h"
+
+/* Monitor state of one island */
+typedef struct {
+    /* Is the island currently dropped to its minimum level? */
+    bool lowered;
+
+    /* Level the island ran at before it was lowered */
+    speed_level_t saved_level;
+
+    /* How many consecutive samples found the island idle */
+    unsigned int streak;
+} idle_island_t;
+
+/* Monitor state */
+struct idle_monitor {
+    /* The monitor parameters */
+    pwr_idle_monitor_params_t params;
+
+    /* Is the sampling thread running? */
+    bool running;
+
+    /* The sampling thread */
+    pthread_t thread;
+
+    /* Protects the report */
+    pthread_mutex_t lock;
+
+    /* The /proc/stat reader */
+    proc_stat_t stat;
+
+    /* CPU times of the current and the previous samples */
+    cpu_time_t *times;
+    cpu_time_t *last_times;
+
+    /* Per-island state */
+    idle_island_t *islands;
+
+    /* Speed level changes of a sample, one slot per island */
+    unsigned long *change_islands;
+    unsigned int *change_levels;
+
+    /* When the monitor was started, in ns */
+    uint64_t start_ns;
+
+    /* The activity report */
+    pwr_idle_monitor_report_t report;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void *idle_monitor_thread(void *arg);
+static bool sample_island(pwr_ctx_t *ctx, unsigned long island, double dt,
+    unsigned int *level);
+static void release_monitor(struct idle_monitor *im);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_idle_monitor_default_params(pwr_idle_monitor_params_t *params) {
+    if (params == NULL) {
+        return;
+    }
+
+    params->period = 0.1;
+    params->idle_threshold = 0.05;
+    params->hysteresis = 3;
+}
+
+void pwr_idle_monitor_start(pwr_ctx_t *ctx,
+    const pwr_idle_monitor_params_t *params)
+{
+    TRACE_CALL(ctx, pwr_idle_monitor_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->idle_monitor != NULL && ctx->idle_monitor->running) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    free_idle_monitor(ctx);
+
+    struct idle_monitor *im = calloc(1, sizeof(*im));
+    if (params != NULL) {
+        im->params = *params;
+    } else {
+        pwr_idle_monitor_default_params(&im->params);
+    }
+    if (im->params.period <= 0 || im->params.idle_threshold < 0 ||
+        im->params.idle_threshold > 1)
+    {
+        free(im);
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    // everything the sampling thread uses is allocated here
+    im->times = calloc(ctx->num_phys_cpu, sizeof(*im->times));
+    im->last_times = calloc(ctx->num_phys_cpu, sizeof(*im->last_times));
+    im->islands = calloc(ctx->num_phys_islands, sizeof(*im->islands));
+    im->change_islands = malloc(ctx->num_phys_islands *
+        sizeof(*im->change_islands));
+    im->change_levels = malloc(ctx->num_phys_islands *
+        sizeof(*im->change_levels));
+    pthread_mutex_init(&im->lock, NULL);
+    ctx->idle_monitor = im;
+
+    if (!open_proc_stat(&im->stat, ctx->num_phys_cpu) ||
+        !read_proc_stat(&im->stat, im->last_times, ctx->num_phys_cpu))
+    {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot read the CPU times in /proc/stat\n");
+        }
+        close_proc_stat(&im->stat);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    im->start_ns = monotonic_ns();
+    im->running = true;
+
+    if (pthread_create(&im->thread, NULL, &idle_monitor_thread, ctx)) {
+        im->running = false;
+        close_proc_stat(&im->stat);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_idle_monitor_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_idle_monitor_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct idle_monitor *im = ctx->idle_monitor;
+    if (im == NULL || !im->running) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_store_n(&im->running, false, __ATOMIC_RELEASE);
+    pthread_join(im->thread, NULL);
+
+    // Restore the levels of the islands still lowered
+    ctx->error = PWR_OK;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        idle_island_t *ii = &im->islands[i];
+        phys_island_t *pi = ctx->phys_islands[i];
+
+        if (ii->lowered && pi->current_speed_level == pi->min_speed_level) {
+            pwr_err_t err = set_speed_level(ctx, i, ii->saved_level);
+            if (err != PWR_OK) {
+                ctx->error = err;
+            }
+        }
+        ii->lowered = false;
+    }
+
+    close_proc_stat(&im->stat);
+}
+
+void pwr_idle_monitor_report(pwr_ctx_t *ctx,
+    pwr_idle_monitor_report_t *report)
+{
+    TRACE_CALL(ctx, pwr_idle_monitor_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct idle_monitor *im = ctx->idle_monitor;
+    if (im == NULL || report == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&im->lock);
+    *report = im->report;
+    pthread_mutex_unlock(&im->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void free_idle_monitor(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->idle_monitor == NULL) {
+        return;
+    }
+
+    if (ctx->idle_monitor->running) {
+        pwr_idle_monitor_stop(ctx);
+    }
+
+    release_monitor(ctx->idle_monitor);
+    ctx->idle_monitor = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Body of the sampling thread: reads the CPU times every period and issues
+  * the speed level changes of all the islands at once.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *idle_monitor_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct idle_monitor *im = ctx->idle_monitor;
+    uint64_t period_ns = im->params.period * 1e9;
+    uint64_t last = im->start_ns;
+    uint64_t next = last;
+
+    while (__atomic_load_n(&im->running, __ATOMIC_ACQUIRE)) {
+        next += period_ns;
+        struct timespec ts = {
+            .tv_sec = next / 1000000000ULL,
+            .tv_nsec = next % 1000000000ULL
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        if (!read_proc_stat(&im->stat, im->times, ctx->num_phys_cpu)) {
+            continue;
+        }
+
+        uint64_t now = monotonic_ns();
+        double dt = (now - last) / 1e9;
+        unsigned long num_changes = 0;
+        last = now;
+
+        pthread_mutex_lock(&im->lock);
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            if (sample_island(ctx, i, dt, &im->change_levels[num_changes])) {
+                im->change_islands[num_changes++] = i;
+            }
+        }
+        im->report.duration = (now - im->start_ns) / 1e9;
+        pthread_mutex_unlock(&im->lock);
+
+        if (num_changes > 0) {
+            set_speed_levels(ctx, im->change_islands, im->change_levels,
+                num_changes);
+        }
+
+        cpu_time_t *swap = im->last_times;
+        im->last_times = im->times;
+        im->times = swap;
+    }
+
+    return NULL;
+}
+
+/**
+  * Computes the utilization of an island since the last sample and decides
+  * whether it must be lowered or restored. Called with the report lock held.
+  *
+  * @param ctx The current library context.
+  * @param island The island to sample.
+  * @param dt Time elapsed since the last sample, in s.
+  * @param level[out] The speed level to request, if any.
+  *
+  * @return True if the speed level of the island must change.
+  */
+bool sample_island(pwr_ctx_t *ctx, unsigned long island, double dt,
+    unsigned int *level)
+{
+    struct idle_monitor *im = ctx->idle_monitor;
+    phys_island_t *pi = ctx->phys_islands[island];
+    idle_island_t *ii = &im->islands[island];
+    uint64_t busy = 0, total = 0;
+
+    // counters of offline CPUs do not move, idle time may go slightly back
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        const cpu_time_t *now = &im->times[pi->cpus[c]];
+        const cpu_time_t *before = &im->last_times[pi->cpus[c]];
+
+        if (now->total > before->total) {
+            total += now->total - before->total;
+        }
+        if (now->busy > before->busy) {
+            busy += now->busy - before->busy;
+        }
+    }
+    if (total == 0) {
+        return false;
+    }
+
+    ++im->report.samples;
+    if (ii->lowered) {
+        im->report.lowered_time += dt;
+    }
+
+    speed_level_t current =
+        __atomic_load_n(&pi->current_speed_level, __ATOMIC_RELAXED);
+
+    if (busy < im->params.idle_threshold * total) {
+        ++im->report.idle_samples;
+        if (ii->lowered || ++ii->streak < im->params.hysteresis) {
+            return false;
+        }
+
+        ii->streak = 0;
+        if (current == pi->min_speed_level) {
+            return false;
+        }
+        ii->lowered = true;
+        ii->saved_level = current;
+        ++im->report.lowerings;
+        *level = pi->min_speed_level;
+        return true;
+    }
+
+    ii->streak = 0;
+    if (!ii->lowered) {
+        return false;
+    }
+
+    // the user may have requested another level in the meantime
+    ii->lowered = false;
+    if (current != pi->min_speed_level) {
+        return false;
+    }
+    ++im->report.restorations;
+    *level = ii->saved_level;
+    return true;
+}
+
+/**
+  * Releases the memory of a stopped monitor.
+  */
+void release_monitor(struct idle_monitor *im) {
+    pthread_mutex_destroy(&im->lock);
+    free(im->times);
+    free(im->last_times);
+    free(im->islands);
+    free(im->change_islands);
+    free(im->change_levels);
+    free(im);
+}
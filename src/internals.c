@@ -14,7 +14,399 @@
   *	limitations under the License.
   */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "internals.h"
 
-// placeholder for private functions shared across the modules
+/** msr_fds value of a CPU whose MSR device was not opened yet */
+#define MSR_UNOPENED (-1)
+
+/** msr_fds value of a CPU whose MSR device cannot be opened */
+#define MSR_UNAVAILABLE (-2)
+
+/** cpufreq_fds value of a CPU whose cpufreq directory was not opened yet */
+#define CPUFREQ_UNOPENED (-1)
+
+/** cpufreq_fds value of a CPU without cpufreq directory */
+#define CPUFREQ_UNAVAILABLE (-2)
+
+/** Upper bound of the length of a CPU line of /proc/stat */
+#define PROC_STAT_LINE 256
+
+/** Fields of a CPU line making its total time: user to steal */
+#define PROC_STAT_FIELDS 8
+
+/** Fields of a CPU line counting idle time: idle and iowait */
+#define PROC_STAT_IDLE 3
+#define PROC_STAT_IOWAIT 4
+
+static int msr_fd(pwr_ctx_t *ctx, unsigned long cpu);
+static int cpufreq_fd(pwr_ctx_t *ctx, unsigned long cpu);
+static uint64_t parse_u64(const char **p, const char *end);
+
+// private functions shared across the modules
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int open_perf_counter(unsigned long cpu, uint32_t type, uint64_t config,
+    int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // glibc provides no wrapper for that syscall
+    return syscall(__NR_perf_event_open, &attr, -1, (int) cpu, group_fd, 0);
+}
+
+bool read_perf_group(int fd, unsigned int num, uint64_t *values,
+    uint64_t *enabled)
+{
+    uint64_t raw[3 + num];
+
+    if (read(fd, raw, sizeof(raw)) != (ssize_t) sizeof(raw) || raw[0] != num ||
+        raw[2] == 0)
+    {
+        return false;
+    }
+
+    // raw values are { count of events, time enabled, time running, counts }
+    for (unsigned int n = 0; n < num; ++n) {
+        values[n] = raw[2] < raw[1] ?
+            (double) raw[3 + n] * raw[1] / raw[2] : raw[3 + n];
+    }
+    if (enabled != NULL) {
+        *enabled = raw[1];
+    }
+
+    return true;
+}
+
+bool read_sysfs_ll(int fd, long long *value) {
+    char buf[32];
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        return false;
+    }
+    buf[len] = '\0';
+    *value = strtoll(buf, NULL, 10);
+
+    return true;
+}
+
+bool read_sysfs_file_ll(const char *path, long long *value) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = read_sysfs_ll(fd, value);
+    close(fd);
+
+    return ok;
+}
+
+bool open_proc_stat(proc_stat_t *ps, unsigned long num_cpu) {
+    // the aggregated line comes first
+    ps->size = (num_cpu + 1) * PROC_STAT_LINE;
+    ps->buf = malloc(ps->size);
+    ps->fd = open("/proc/stat", O_RDONLY);
+
+    return ps->fd >= 0;
+}
+
+bool read_proc_stat(proc_stat_t *ps, cpu_time_t *times, unsigned long num_cpu)
+{
+    ssize_t len = pread(ps->fd, ps->buf, ps->size, 0);
+    if (len <= 0) {
+        return false;
+    }
+
+    // the CPU lines come first, the remaining lines are not read entirely
+    const char *p = ps->buf;
+    const char *end = ps->buf + len;
+    while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            break;
+        }
+
+        p += 3;
+        if (*p >= '0' && *p <= '9') {
+            unsigned long cpu = parse_u64(&p, eol);
+            uint64_t fields[PROC_STAT_FIELDS];
+            uint64_t total = 0;
+
+            for (int f = 0; f < PROC_STAT_FIELDS; ++f) {
+                fields[f] = parse_u64(&p, eol);
+                total += fields[f];
+            }
+            if (cpu < num_cpu) {
+                times[cpu].total = total;
+                times[cpu].busy = total - fields[PROC_STAT_IDLE] -
+                    fields[PROC_STAT_IOWAIT];
+            }
+        }
+        p = eol + 1;
+    }
+
+    return true;
+}
+
+void close_proc_stat(proc_stat_t *ps) {
+    if (ps->fd >= 0) {
+        close(ps->fd);
+    }
+    free(ps->buf);
+    ps->fd = -1;
+    ps->buf = NULL;
+}
+
+void init_msr(pwr_ctx_t *ctx) {
+    ctx->msr_fds = malloc(ctx->num_phys_cpu * sizeof(*ctx->msr_fds));
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        ctx->msr_fds[cpu] = MSR_UNOPENED;
+    }
+}
+
+void free_msr(pwr_ctx_t *ctx) {
+    if (ctx->msr_fds == NULL) {
+        return;
+    }
+
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        if (ctx->msr_fds[cpu] >= 0) {
+            close(ctx->msr_fds[cpu]);
+        }
+    }
+    free(ctx->msr_fds);
+    ctx->msr_fds = NULL;
+}
+
+bool read_msr(pwr_ctx_t *ctx, unsigned long cpu, uint32_t msr,
+    uint64_t *value)
+{
+    int fd = msr_fd(ctx, cpu);
+    if (fd < 0) {
+        return false;
+    }
+
+    stats_io(ctx, PWR_MODULE_DVFS, 1, 0);
+    return pread(fd, value, sizeof(*value), msr) == sizeof(*value);
+}
+
+bool write_msr(pwr_ctx_t *ctx, unsigned long cpu, uint32_t msr,
+    uint64_t value)
+{
+    int fd = msr_fd(ctx, cpu);
+    if (fd < 0) {
+        return false;
+    }
+
+    stats_io(ctx, PWR_MODULE_DVFS, 1, sizeof(value));
+    return pwrite(fd, &value, sizeof(value), msr) == sizeof(value);
+}
+
+void init_cpufreq(pwr_ctx_t *ctx) {
+    ctx->cpufreq_fds = malloc(ctx->num_phys_cpu * sizeof(*ctx->cpufreq_fds));
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        ctx->cpufreq_fds[cpu] = CPUFREQ_UNOPENED;
+    }
+}
+
+void free_cpufreq(pwr_ctx_t *ctx) {
+    if (ctx->cpufreq_fds == NULL) {
+        return;
+    }
+
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        if (ctx->cpufreq_fds[cpu] >= 0) {
+            close(ctx->cpufreq_fds[cpu]);
+        }
+    }
+    free(ctx->cpufreq_fds);
+    ctx->cpufreq_fds = NULL;
+}
+
+int open_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    int flags)
+{
+    int dir_fd = cpufreq_fd(ctx, cpu);
+
+    return dir_fd >= 0 ? openat(dir_fd, name, flags) : -1;
+}
+
+ssize_t read_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    char *buf, size_t size)
+{
+    int fd = open_cpufreq(ctx, cpu, name, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // sysfs returns a whole attribute in a single read
+    stats_io(ctx, PWR_MODULE_DVFS, 1, 0);
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        --len;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+bool read_cpufreq_ll(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    long long *value)
+{
+    char buf[32];
+
+    if (read_cpufreq(ctx, cpu, name, buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+    *value = strtoll(buf, NULL, 10);
+
+    return true;
+}
+
+bool write_cpufreq(pwr_ctx_t *ctx, unsigned long cpu, const char *name,
+    const char *value)
+{
+    int fd = open_cpufreq(ctx, cpu, name, O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t len = strlen(value);
+    stats_io(ctx, PWR_MODULE_DVFS, 1, len);
+    bool ok = write(fd, value, len) == (ssize_t) len;
+    close(fd);
+
+    return ok;
+}
+
+/**
+  * Gets the MSR device of a CPU, opening it on first use. The device is opened
+  * read-only when writes are not permitted.
+  *
+  * @return The file descriptor, or a negative value if unavailable.
+  */
+int msr_fd(pwr_ctx_t *ctx, unsigned long cpu) {
+    if (ctx->msr_fds == NULL || cpu >= ctx->num_phys_cpu) {
+        return MSR_UNAVAILABLE;
+    }
+
+    int fd = __atomic_load_n(&ctx->msr_fds[cpu], __ATOMIC_ACQUIRE);
+    if (fd != MSR_UNOPENED) {
+        return fd;
+    }
+
+    char path[48];
+    snprintf(path, sizeof(path), "/dev/cpu/%lu/msr", cpu);
+    int new_fd = open(path, O_RDWR);
+    if (new_fd < 0) {
+        new_fd = open(path, O_RDONLY);
+    }
+    if (new_fd < 0) {
+        new_fd = MSR_UNAVAILABLE;
+    }
+
+    // another thread may have opened the device meanwhile
+    if (!__atomic_compare_exchange_n(&ctx->msr_fds[cpu], &fd, new_fd, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        if (new_fd >= 0) {
+            close(new_fd);
+        }
+        return fd;
+    }
+
+    return new_fd;
+}
+
+/**
+  * Parses the next decimal integer of a line, skipping what precedes it.
+  *
+  * @param p[in,out] Where to start, moved past the integer.
+  * @param end The end of the line.
+  *
+  * @return The integer, 0 if the line has no more.
+  */
+uint64_t parse_u64(const char **p, const char *end) {
+    const char *c = *p;
+    uint64_t value = 0;
+
+    while (c < end && (*c < '0' || *c > '9')) {
+        ++c;
+    }
+    while (c < end && *c >= '0' && *c <= '9') {
+        value = value * 10 + (*c - '0');
+        ++c;
+    }
+    *p = c;
+
+    return value;
+}
+
+/**
+  * Gets the cpufreq directory of a CPU, opening it on first use.
+  *
+  * @return The directory descriptor, or a negative value if unavailable.
+  */
+int cpufreq_fd(pwr_ctx_t *ctx, unsigned long cpu) {
+    if (ctx->cpufreq_fds == NULL || cpu >= ctx->num_phys_cpu) {
+        return CPUFREQ_UNAVAILABLE;
+    }
+
+    int fd = __atomic_load_n(&ctx->cpufreq_fds[cpu], __ATOMIC_ACQUIRE);
+    if (fd != CPUFREQ_UNOPENED) {
+        return fd;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%lu/cpufreq",
+        ctx->sysfs_root, cpu);
+    int new_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (new_fd < 0) {
+        // only a missing directory is final, EMFILE for instance is retried
+        if (errno != ENOENT && errno != ENOTDIR) {
+            return CPUFREQ_UNOPENED;
+        }
+        new_fd = CPUFREQ_UNAVAILABLE;
+    }
+
+    // another thread may have opened the directory meanwhile
+    if (!__atomic_compare_exchange_n(&ctx->cpufreq_fds[cpu], &fd, new_fd,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        if (new_fd >= 0) {
+            close(new_fd);
+        }
+        return fd;
+    }
 
+    return new_fd;
+}
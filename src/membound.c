@@ -0,0 +1,528 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** The hardware counters read on every CPU */
+enum membound_counter {
+    CNT_CYCLES = 0,
+    CNT_INSTRUCTIONS,
+    CNT_LLC_MISSES,
+    CNT_STALLS,         // optional, not provided by every PMU
+    NB_COUNTERS
+};
+
+/** perf_event configuration of the counters */
+static const uint64_t counter_configs[NB_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+};
+
+/** Weight of the last sample in the reference estimates */
+#define REF_EWMA_WEIGHT 0.5
+
+/* Controller state of one island */
+typedef struct {
+    /* Counter groups per CPU led by the cycles, -1 if not available */
+    int (*fds)[NB_COUNTERS];
+
+    /* Last counter values read, per CPU */
+    uint64_t (*last)[NB_COUNTERS];
+
+    /* Speed level used in compute-bound phases */
+    unsigned int ref_level;
+
+    /* Speed level used in memory-bound phases */
+    unsigned int low_level;
+
+    /* Is the island currently running at the low level? */
+    bool lowered;
+
+    /* How many consecutive samples disagree with the current level */
+    unsigned int streak;
+
+    /* Minimal time between two transitions, in ns */
+    uint64_t dwell_ns;
+
+    /* When was the last transition issued, in ns */
+    uint64_t last_transition_ns;
+
+    /* Instruction rate of memory-bound phases at the reference level */
+    double ref_rate;
+
+    /* Island power share in memory-bound phases at the reference level */
+    double ref_power;
+} membound_island_t;
+
+/* Controller state */
+struct membound {
+    /* The controller parameters */
+    pwr_membound_params_t params;
+
+    /* Is the sampling thread running? */
+    bool running;
+
+    /* The sampling thread */
+    pthread_t thread;
+
+    /* Protects the report */
+    pthread_mutex_t lock;
+
+    /* Per-island state */
+    membound_island_t *islands;
+
+    /* When the controller was started, in ns */
+    uint64_t start_ns;
+
+    /* Node energy when the controller was started, in J */
+    double start_energy;
+
+    /* Node energy at the last sample, in J */
+    double last_energy;
+
+    /* Is the node energy measurable? */
+    bool has_energy;
+
+    /* The activity report */
+    pwr_membound_report_t report;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool open_island_counters(pwr_ctx_t *ctx, unsigned long island);
+static void close_counters(pwr_ctx_t *ctx);
+static void *membound_thread(void *arg);
+static void sample_island(pwr_ctx_t *ctx, unsigned long island,
+    uint64_t now, double dt, double denergy);
+static bool read_group(const membound_island_t *mi, unsigned long c,
+    uint64_t *values);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_membound_default_params(pwr_membound_params_t *params) {
+    if (params == NULL) {
+        return;
+    }
+
+    params->period = 0.01;
+    params->ipc_threshold = 1.0;
+    params->mpki_threshold = 10.0;
+    params->stall_threshold = 0.5;
+    params->freq_ratio = 0.6;
+    params->hysteresis = 3;
+    params->dwell = 100;
+}
+
+void pwr_membound_start(pwr_ctx_t *ctx, const pwr_membound_params_t *params) {
+    TRACE_CALL(ctx, pwr_membound_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->membound != NULL && ctx->membound->running) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    free_membound_data(ctx);
+
+    struct membound *mb = calloc(1, sizeof(*mb));
+    if (params != NULL) {
+        mb->params = *params;
+    } else {
+        pwr_membound_default_params(&mb->params);
+    }
+    if (mb->params.period <= 0 || mb->params.freq_ratio <= 0) {
+        free(mb);
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_init(&mb->lock, NULL);
+    mb->islands = calloc(ctx->num_phys_islands, sizeof(*mb->islands));
+    ctx->membound = mb;
+
+    //===----------------------------------------------------------------------
+    // Compute the speed levels and open the counters of each island
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        membound_island_t *mi = &mb->islands[i];
+
+        mi->ref_level = pi->current_speed_level;
+        mi->low_level = mi->ref_level;
+        while (mi->low_level > (unsigned int) pi->min_speed_level &&
+               pi->freqs[mi->low_level - 1] >=
+                   mb->params.freq_ratio * pi->freqs[mi->ref_level])
+        {
+            --mi->low_level;
+        }
+
+        // both levels are within the island range, as pwr_agility() requires
+        mi->dwell_ns = (uint64_t) pi->agility * mb->params.dwell;
+
+        if (!open_island_counters(ctx, i)) {
+            if (ctx->err_fd) {
+                fprintf(ctx->err_fd,
+                    "Cannot open the hardware counters of island %lu\n", i);
+            }
+            close_counters(ctx);
+            ctx->error = PWR_UNAVAILABLE;
+            return;
+        }
+    }
+
+    mb->has_energy = energy_snapshot(ctx, &mb->start_energy);
+    mb->last_energy = mb->start_energy;
+    mb->start_ns = monotonic_ns();
+    mb->running = true;
+
+    if (pthread_create(&mb->thread, NULL, &membound_thread, ctx)) {
+        mb->running = false;
+        close_counters(ctx);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_membound_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_membound_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct membound *mb = ctx->membound;
+    if (mb == NULL || !mb->running) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_store_n(&mb->running, false, __ATOMIC_RELEASE);
+    pthread_join(mb->thread, NULL);
+
+    // Restore the reference levels
+    ctx->error = PWR_OK;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (mb->islands[i].lowered) {
+            pwr_err_t err = set_speed_level(ctx, i, mb->islands[i].ref_level);
+            if (err != PWR_OK) {
+                ctx->error = err;
+            }
+            mb->islands[i].lowered = false;
+        }
+    }
+
+    close_counters(ctx);
+}
+
+void pwr_membound_report(pwr_ctx_t *ctx, pwr_membound_report_t *report) {
+    TRACE_CALL(ctx, pwr_membound_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct membound *mb = ctx->membound;
+    if (mb == NULL || report == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&mb->lock);
+    *report = mb->report;
+    pthread_mutex_unlock(&mb->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void free_membound_data(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->membound == NULL) {
+        return;
+    }
+
+    if (ctx->membound->running) {
+        pwr_membound_stop(ctx);
+    }
+
+    pthread_mutex_destroy(&ctx->membound->lock);
+    free(ctx->membound->islands);
+    free(ctx->membound);
+    ctx->membound = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Opens the hardware counters on every CPU of an island.
+  *
+  * @param ctx The current library context.
+  * @param island The island to open the counters for.
+  *
+  * @return False if a mandatory counter cannot be opened.
+  */
+bool open_island_counters(pwr_ctx_t *ctx, unsigned long island) {
+    phys_island_t *pi = ctx->phys_islands[island];
+    membound_island_t *mi = &ctx->membound->islands[island];
+
+    mi->fds = malloc(pi->num_cpu * sizeof(*mi->fds));
+    mi->last = calloc(pi->num_cpu, sizeof(*mi->last));
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        for (int n = 0; n < NB_COUNTERS; ++n) {
+            mi->fds[c][n] = -1;
+        }
+    }
+
+    // one group per CPU, read at once and scaled together
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        for (int n = 0; n < NB_COUNTERS; ++n) {
+            mi->fds[c][n] = open_perf_counter(pi->cpus[c], PERF_TYPE_HARDWARE,
+                counter_configs[n], n == CNT_CYCLES ? -1 : mi->fds[c][0]);
+            if (mi->fds[c][n] < 0 && n != CNT_STALLS) {
+                return false;
+            }
+        }
+        read_group(mi, c, mi->last[c]);
+    }
+
+    return true;
+}
+
+/**
+  * Closes the hardware counters of all the islands.
+  *
+  * @param ctx The current library context.
+  */
+void close_counters(pwr_ctx_t *ctx) {
+    struct membound *mb = ctx->membound;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        membound_island_t *mi = &mb->islands[i];
+        if (mi->fds == NULL) {
+            continue;
+        }
+
+        for (unsigned long c = 0; c < ctx->phys_islands[i]->num_cpu; ++c) {
+            for (int n = 0; n < NB_COUNTERS; ++n) {
+                if (mi->fds[c][n] >= 0) {
+                    close(mi->fds[c][n]);
+                }
+            }
+        }
+        free(mi->fds);
+        free(mi->last);
+        mi->fds = NULL;
+        mi->last = NULL;
+    }
+}
+
+/**
+  * Main loop of the sampling thread.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *membound_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct membound *mb = ctx->membound;
+    uint64_t period_ns = mb->params.period * 1e9;
+    uint64_t last = mb->start_ns;
+    uint64_t next = last;
+
+    while (__atomic_load_n(&mb->running, __ATOMIC_ACQUIRE)) {
+        next += period_ns;
+        struct timespec ts = {
+            .tv_sec = next / 1000000000ULL,
+            .tv_nsec = next % 1000000000ULL
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        uint64_t now = monotonic_ns();
+        double dt = (now - last) / 1e9;
+        double energy = 0, denergy = -1;
+        last = now;
+
+        if (mb->has_energy && energy_snapshot(ctx, &energy)) {
+            denergy = energy - mb->last_energy;
+            mb->last_energy = energy;
+        }
+
+        pthread_mutex_lock(&mb->lock);
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            sample_island(ctx, i, now, dt, denergy);
+        }
+        mb->report.duration = (now - mb->start_ns) / 1e9;
+        mb->report.energy = mb->last_energy - mb->start_energy;
+        pthread_mutex_unlock(&mb->lock);
+    }
+
+    return NULL;
+}
+
+/**
+  * Reads the counters of an island, classifies its phase and updates the
+  * speed level and the report accordingly. Called with the report lock held.
+  *
+  * @param ctx The current library context.
+  * @param island The island to sample.
+  * @param now The current time, in ns.
+  * @param dt Time elapsed since the last sample, in s.
+  * @param denergy Node energy consumed since the last sample in J, negative
+  *  if unknown.
+  */
+void sample_island(pwr_ctx_t *ctx, unsigned long island, uint64_t now,
+    double dt, double denergy)
+{
+    struct membound *mb = ctx->membound;
+    const pwr_membound_params_t *params = &mb->params;
+    phys_island_t *pi = ctx->phys_islands[island];
+    membound_island_t *mi = &mb->islands[island];
+    double delta[NB_COUNTERS] = { 0 };
+    bool has_stalls = true;
+
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        uint64_t values[NB_COUNTERS];
+
+        has_stalls = has_stalls && mi->fds[c][CNT_STALLS] >= 0;
+        if (!read_group(mi, c, values)) {
+            continue;
+        }
+
+        // scaled counts are estimates, a decrease means nothing was counted
+        for (int n = 0; n < NB_COUNTERS; ++n) {
+            int64_t diff = values[n] - mi->last[c][n];
+            if (diff > 0) {
+                delta[n] += diff;
+            }
+            mi->last[c][n] = values[n];
+        }
+    }
+
+    // nothing ran on the island
+    if (delta[CNT_CYCLES] == 0 || delta[CNT_INSTRUCTIONS] == 0 || dt <= 0) {
+        return;
+    }
+
+    //===----------------------------------------------------------------------
+    // Classify the phase
+    double ipc = delta[CNT_INSTRUCTIONS] / delta[CNT_CYCLES];
+    double mpki = delta[CNT_LLC_MISSES] * 1000 / delta[CNT_INSTRUCTIONS];
+    double stalls = delta[CNT_STALLS] / delta[CNT_CYCLES];
+    bool mem_bound = ipc < params->ipc_threshold &&
+        (mpki >= params->mpki_threshold ||
+         (has_stalls && stalls >= params->stall_threshold));
+
+    //===----------------------------------------------------------------------
+    // Account the sample
+    double rate = delta[CNT_INSTRUCTIONS] / dt;
+    double share = (double) pi->num_cpu / ctx->num_phys_cpu;
+    pwr_membound_report_t *report = &mb->report;
+
+    ++report->samples;
+    if (mem_bound) {
+        ++report->mem_samples;
+    }
+
+    if (mi->lowered) {
+        report->lowered_time += dt;
+        if (mi->ref_rate > 0) {
+            // time the same work would have taken at the reference level
+            double ref_time = dt * rate / mi->ref_rate;
+            if (ref_time > dt) {
+                ref_time = dt;
+            }
+            report->est_slowdown += dt - ref_time;
+            if (denergy >= 0 && mi->ref_power > 0) {
+                report->est_energy_saved +=
+                    mi->ref_power * ref_time - denergy * share;
+            }
+        }
+    } else if (mem_bound) {
+        double w = mi->ref_rate > 0 ? REF_EWMA_WEIGHT : 1;
+        mi->ref_rate = w * rate + (1 - w) * mi->ref_rate;
+        if (denergy >= 0) {
+            mi->ref_power = w * denergy * share / dt + (1 - w) * mi->ref_power;
+        }
+    }
+
+    //===----------------------------------------------------------------------
+    // Switch the speed level with some hysteresis
+    if (mem_bound == mi->lowered || mi->low_level == mi->ref_level) {
+        mi->streak = 0;
+        return;
+    }
+
+    if (++mi->streak < params->hysteresis ||
+        now - mi->last_transition_ns < mi->dwell_ns)
+    {
+        return;
+    }
+
+    unsigned int level = mem_bound ? mi->low_level : mi->ref_level;
+    if (set_speed_level(ctx, island, level) == PWR_OK) {
+        mi->lowered = mem_bound;
+        mi->streak = 0;
+        mi->last_transition_ns = now;
+        ++report->transitions;
+    }
+}
+
+/**
+  * Reads the counters of a CPU, scaled to account for multiplexing.
+  *
+  * @param mi The island state.
+  * @param c The CPU index in the island.
+  * @param values[out] The estimated counter values, the stalls 0 if missing.
+  *
+  * @return False if the counters cannot be read.
+  */
+bool read_group(const membound_island_t *mi, unsigned long c,
+    uint64_t *values)
+{
+    // the stalls are opened last, the group lacks them if unavailable
+    unsigned int num = mi->fds[c][CNT_STALLS] >= 0 ?
+        NB_COUNTERS : NB_COUNTERS - 1;
+
+    values[CNT_STALLS] = 0;
+    return read_perf_group(mi->fds[c][CNT_CYCLES], num, values, NULL);
+}
@@ -0,0 +1,545 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "internals.h"
+
+/** Weight of a new sample in the per-level averages */
+#define SAMPLE_WEIGHT 0.25
+
+/* Measured cost of a speed level */
+typedef struct {
+    /* How many samples were taken at that level */
+    unsigned long count;
+
+    /* Average time per progress unit, in s */
+    double time;
+
+    /* Average energy per progress unit, in J */
+    double energy;
+} model_point_t;
+
+/* Model of one phase on one island */
+typedef struct {
+    /* Measured costs, per speed level */
+    model_point_t *points;
+
+    /* Predicted costs, per speed level */
+    double *time;
+    double *energy;
+
+    /* Were samples added since the decisions were cached? */
+    bool dirty;
+
+    /* Cached best levels for the energy and EDP objectives */
+    unsigned int best_energy;
+    unsigned int best_edp;
+
+    /*
+     * Levels that are the most energy-efficient at their speed, sorted by
+     * increasing time and thus decreasing energy.
+     */
+    unsigned int num_frontier;
+    unsigned int *frontier;
+} model_phase_t;
+
+/* Model of one island */
+typedef struct {
+    /* Per-phase models, allocated on first use */
+    model_phase_t *phases[PWR_MAX_PHASES];
+
+    /* Is a measurement running? */
+    bool open;
+
+    /* Phase, speed level, start time (ns) and energy of the measurement */
+    unsigned int phase;
+    unsigned int level;
+    uint64_t start_ns;
+    double start_energy;
+} model_island_t;
+
+/* Online model state */
+struct model {
+    /* Protects the model */
+    pthread_mutex_t lock;
+
+    /* Per-island models */
+    model_island_t *islands;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static pwr_err_t check_args(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase);
+static model_phase_t *get_phase(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase);
+static void add_sample(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, unsigned int level, double progress, double time,
+    double energy);
+static void update_decisions(pwr_ctx_t *ctx, unsigned long island,
+    model_phase_t *mp);
+static bool fit(const double *x, const double *y, const double *w,
+    unsigned int n, double *a, double *b);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_model_begin(pwr_ctx_t *ctx, unsigned long island, unsigned int phase)
+{
+    TRACE_CALL(ctx, pwr_model_begin, island, phase);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, phase);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    if (ctx->num_rapl_domains == 0) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    model_island_t *mi = &ctx->model->islands[island];
+
+    pthread_mutex_lock(&ctx->model->lock);
+    mi->open = energy_snapshot(ctx, &mi->start_energy);
+    mi->phase = phase;
+    mi->level = ctx->phys_islands[island]->current_speed_level;
+    mi->start_ns = monotonic_ns();
+    pthread_mutex_unlock(&ctx->model->lock);
+
+    ctx->error = mi->open ? PWR_OK : PWR_IO_ERR;
+}
+
+void pwr_model_end(pwr_ctx_t *ctx, unsigned long island, double progress) {
+    TRACE_CALL(ctx, pwr_model_end, island, 0);
+    double energy;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, 0);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    model_island_t *mi = &ctx->model->islands[island];
+
+    pthread_mutex_lock(&ctx->model->lock);
+    uint64_t now = monotonic_ns();
+    bool valid = mi->open && energy_snapshot(ctx, &energy);
+
+    if (!valid) {
+        ctx->error = PWR_REQUEST_DENIED;
+    } else if (mi->level !=
+               (unsigned int) ctx->phys_islands[island]->current_speed_level)
+    {
+        // the speed level changed during the measurement
+        ctx->error = PWR_UNAVAILABLE;
+    } else if (progress <= 0 || now <= mi->start_ns) {
+        ctx->error = PWR_REQUEST_DENIED;
+    } else {
+        add_sample(ctx, island, mi->phase, mi->level, progress,
+            (now - mi->start_ns) / 1e9, energy - mi->start_energy);
+        ctx->error = PWR_OK;
+    }
+    mi->open = false;
+    pthread_mutex_unlock(&ctx->model->lock);
+}
+
+void pwr_model_sample(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, unsigned int level, double progress, double time,
+    energy_t energy)
+{
+    TRACE_CALL(ctx, pwr_model_sample, island, phase);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, phase);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    if (level >= ctx->phys_islands[island]->num_speed_levels) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return;
+    }
+
+    if (progress <= 0 || time <= 0 || energy < 0) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->model->lock);
+    add_sample(ctx, island, phase, level, progress, time, energy);
+    pthread_mutex_unlock(&ctx->model->lock);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_model_predict(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, unsigned int level, double *time, energy_t *energy)
+{
+    TRACE_CALL(ctx, pwr_model_predict, island, phase);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pwr_err_t err = check_args(ctx, island, phase);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return;
+    }
+
+    if (level >= ctx->phys_islands[island]->num_speed_levels) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->model->lock);
+    model_phase_t *mp = ctx->model->islands[island].phases[phase];
+    if (mp == NULL) {
+        pthread_mutex_unlock(&ctx->model->lock);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    update_decisions(ctx, island, mp);
+    if (time != NULL) {
+        *time = mp->time[level];
+    }
+    if (energy != NULL) {
+        *energy = mp->energy[level];
+    }
+    pthread_mutex_unlock(&ctx->model->lock);
+
+    ctx->error = PWR_OK;
+}
+
+unsigned int pwr_best_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase, pwr_objective_t objective, double deadline)
+{
+    TRACE_CALL(ctx, pwr_best_level, island, phase);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    pwr_err_t err = check_args(ctx, island, phase);
+    if (err != PWR_OK) {
+        ctx->error = err;
+        return 0;
+    }
+
+    if (objective >= PWR_NB_OBJECTIVES) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return ctx->phys_islands[island]->current_speed_level;
+    }
+
+    pthread_mutex_lock(&ctx->model->lock);
+    model_phase_t *mp = ctx->model->islands[island].phases[phase];
+    if (mp == NULL) {
+        pthread_mutex_unlock(&ctx->model->lock);
+        ctx->error = PWR_UNAVAILABLE;
+        return ctx->phys_islands[island]->current_speed_level;
+    }
+
+    update_decisions(ctx, island, mp);
+
+    unsigned int level;
+    ctx->error = PWR_OK;
+    switch (objective) {
+        case PWR_OBJECTIVE_ENERGY:
+            level = mp->best_energy;
+            break;
+
+        case PWR_OBJECTIVE_EDP:
+            level = mp->best_edp;
+            break;
+
+        default: {
+            // slowest frontier level meeting the deadline, by bisection
+            unsigned int lo = 0, hi = mp->num_frontier;
+            while (lo < hi) {
+                unsigned int mid = (lo + hi) / 2;
+                if (mp->time[mp->frontier[mid]] <= deadline) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            if (lo == 0) {
+                level = mp->frontier[0];
+                ctx->error = PWR_UNAVAILABLE;
+            } else {
+                level = mp->frontier[lo - 1];
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->model->lock);
+
+    return level;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_model(pwr_ctx_t *ctx) {
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    struct model *model = malloc(sizeof(*model));
+    pthread_mutex_init(&model->lock, NULL);
+    model->islands = calloc(ctx->num_phys_islands, sizeof(*model->islands));
+
+    ctx->model = model;
+}
+
+void free_model(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->model == NULL) {
+        return;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        for (unsigned int p = 0; p < PWR_MAX_PHASES; ++p) {
+            model_phase_t *mp = ctx->model->islands[i].phases[p];
+            if (mp == NULL) {
+                continue;
+            }
+            free(mp->points);
+            free(mp->time);
+            free(mp->energy);
+            free(mp->frontier);
+            free(mp);
+        }
+    }
+
+    pthread_mutex_destroy(&ctx->model->lock);
+    free(ctx->model->islands);
+    free(ctx->model);
+    ctx->model = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Checks the arguments common to all the model functions.
+  *
+  * @return PWR_OK or the error code to set.
+  */
+pwr_err_t check_args(pwr_ctx_t *ctx, unsigned long island, unsigned int phase)
+{
+    if (ctx->model == NULL) {
+        return PWR_UNINITIALIZED;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        return PWR_INVALID_ISLAND;
+    }
+
+    if (phase >= PWR_MAX_PHASES) {
+        return PWR_REQUEST_DENIED;
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Gets the model of a phase, allocating it if needed. Called with the model
+  * lock held.
+  *
+  * @return The phase model.
+  */
+model_phase_t *get_phase(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int phase)
+{
+    model_island_t *mi = &ctx->model->islands[island];
+
+    if (mi->phases[phase] == NULL) {
+        unsigned int num_levels = ctx->phys_islands[island]->num_speed_levels;
+        model_phase_t *mp = calloc(1, sizeof(*mp));
+        mp->points = calloc(num_levels, sizeof(*mp->points));
+        mp->time = calloc(num_levels, sizeof(*mp->time));
+        mp->energy = calloc(num_levels, sizeof(*mp->energy));
+        mp->frontier = calloc(num_levels, sizeof(*mp->frontier));
+        mi->phases[phase] = mp;
+    }
+
+    return mi->phases[phase];
+}
+
+/**
+  * Accounts a sample in the model. Called with the model lock held.
+  */
+void add_sample(pwr_ctx_t *ctx, unsigned long island, unsigned int phase,
+    unsigned int level, double progress, double time, double energy)
+{
+    model_phase_t *mp = get_phase(ctx, island, phase);
+    model_point_t *pt = &mp->points[level];
+    double w = pt->count > 0 ? SAMPLE_WEIGHT : 1;
+
+    pt->time = w * time / progress + (1 - w) * pt->time;
+    pt->energy = w * energy / progress + (1 - w) * pt->energy;
+    ++pt->count;
+    mp->dirty = true;
+}
+
+/**
+  * Predicts the cost of every speed level and caches the best levels for
+  * each objective. Does nothing if no sample was added since the last call.
+  * Called with the model lock held.
+  */
+void update_decisions(pwr_ctx_t *ctx, unsigned long island, model_phase_t *mp)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+    unsigned int num_levels = pi->num_speed_levels;
+
+    if (!mp->dirty) {
+        return;
+    }
+    mp->dirty = false;
+
+    //===----------------------------------------------------------------------
+    // Fit the models on the sampled levels
+    double x_time[num_levels], x_power[num_levels];
+    double y_time[num_levels], y_power[num_levels], w[num_levels];
+    unsigned int n = 0, last = 0;
+
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        model_point_t *pt = &mp->points[l];
+        if (pt->count == 0 || pt->time <= 0) {
+            continue;
+        }
+
+        double f = pi->freqs[l] / 1e6;
+        x_time[n] = 1 / f;
+        y_time[n] = pt->time;
+        x_power[n] = f * f * f;
+        y_power[n] = pt->energy / pt->time;
+        w[n] = pt->count;
+        last = l;
+        ++n;
+    }
+
+    double ta = 0, tb = 0, pc = 0, pd = 0;
+    if (!fit(x_time, y_time, w, n, &ta, &tb) || ta < 0 || tb < 0) {
+        // purely frequency-bound
+        ta = 0;
+        tb = mp->points[last].time * pi->freqs[last] / 1e6;
+    }
+    if (!fit(x_power, y_power, w, n, &pc, &pd) || pc < 0 || pd < 0) {
+        // constant power
+        pc = mp->points[last].energy / mp->points[last].time;
+        pd = 0;
+    }
+
+    //===----------------------------------------------------------------------
+    // Predict the costs and find the best levels
+    mp->best_energy = mp->best_edp = 0;
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        model_point_t *pt = &mp->points[l];
+        double f = pi->freqs[l] / 1e6;
+
+        if (pt->count > 0) {
+            mp->time[l] = pt->time;
+            mp->energy[l] = pt->energy;
+        } else {
+            mp->time[l] = ta + tb / f;
+            mp->energy[l] = (pc + pd * f * f * f) * mp->time[l];
+        }
+
+        if (mp->energy[l] < mp->energy[mp->best_energy]) {
+            mp->best_energy = l;
+        }
+        if (mp->energy[l] * mp->time[l] <
+            mp->energy[mp->best_edp] * mp->time[mp->best_edp])
+        {
+            mp->best_edp = l;
+        }
+    }
+
+    //===----------------------------------------------------------------------
+    // Build the frontier: sort by time, keep the levels using less energy than
+    // every faster level
+    unsigned int order[num_levels];
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        unsigned int j = l;
+        while (j > 0 && mp->time[order[j - 1]] > mp->time[l]) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = l;
+    }
+
+    mp->num_frontier = 0;
+    for (unsigned int k = 0; k < num_levels; ++k) {
+        unsigned int l = order[k];
+        if (mp->num_frontier == 0 ||
+            mp->energy[l] < mp->energy[mp->frontier[mp->num_frontier - 1]])
+        {
+            mp->frontier[mp->num_frontier++] = l;
+        }
+    }
+}
+
+/**
+  * Weighted least squares fit of <code>y = a + b * x</code>.
+  *
+  * @return False if the points do not define a line.
+  */
+bool fit(const double *x, const double *y, const double *w, unsigned int n,
+    double *a, double *b)
+{
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+    for (unsigned int i = 0; i < n; ++i) {
+        sw += w[i];
+        sx += w[i] * x[i];
+        sy += w[i] * y[i];
+        sxx += w[i] * x[i] * x[i];
+        sxy += w[i] * x[i] * y[i];
+    }
+
+    double det = sw * sxx - sx * sx;
+    if (n < 2 || det <= 1e-12 * sxx * sw) {
+        return false;
+    }
+
+    *b = (sw * sxy - sx * sy) / det;
+    *a = (sy - *b * sx) / sw;
+    return true;
+}
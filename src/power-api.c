@@ -20,8 +20,8 @@
   */
 
 #include <assert.h>
-#include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "internals.h"
 
@@ -52,6 +52,35 @@ pwr_ctx_t *pwr_initialize(void* hw_behavior, void* speed_policy,
     ctx->module_init = 0;
     ctx->error = PWR_OK;
     ctx->err_fd = stderr;
+    ctx->membound = NULL;
+    ctx->idle_monitor = NULL;
+    ctx->governor = NULL;
+    ctx->freq_watch = NULL;
+    ctx->schedule = NULL;
+    ctx->recorder = NULL;
+    ctx->replay = NULL;
+    ctx->tracer = NULL;
+    ctx->retired_tracers = NULL;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->instrument = INSTRUMENT_STATS;
+    ctx->wait = NULL;
+    ctx->model = NULL;
+    ctx->budget = NULL;
+    ctx->level_power = NULL;
+    ctx->level_throughput = NULL;
+    ctx->throughput_scale = 0;
+    ctx->msr_fds = NULL;
+    ctx->cpufreq_fds = NULL;
+    ctx->thermal = NULL;
+    ctx->cstates = NULL;
+    ctx->voltage = NULL;
+    ctx->turbo = NULL;
+    ctx->hwp = NULL;
+    ctx->uncore = NULL;
+    ctx->speed_control = PWR_CONTROL_SETSPEED;
+    pthread_mutex_init(&ctx->dvfs_lock, NULL);
+    pthread_mutex_init(&ctx->record_lock, NULL);
+    init_energy_snapshots(ctx);
 
     // Initialize physical islands info
     init_struct_module(ctx);
@@ -59,9 +88,22 @@ pwr_ctx_t *pwr_initialize(void* hw_behavior, void* speed_policy,
     // only attempt to initialize the rest if the hardware hierarchy has been
     // resolved.
     if (ctx->error == PWR_OK) {
+        init_msr(ctx);
+        init_thermal(ctx);
+        init_cstates(ctx);
+        init_hwp(ctx);
+        init_uncore(ctx);
 
         // Initialize physical speeds info
         init_speed_levels(ctx);
+        if (pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+            init_wait_hints(ctx);
+            init_model(ctx);
+            init_budget(ctx);
+            init_voltages(ctx);
+            init_turbo(ctx);
+            init_power_table(ctx);
+        }
 
         // Initialize energy-related features
         init_energy(ctx);
@@ -73,6 +115,22 @@ pwr_ctx_t *pwr_initialize(void* hw_behavior, void* speed_policy,
 void pwr_finalize(pwr_ctx_t *ctx) {
     assert (ctx != NULL);
 
+    // stop the controllers first, they use the other modules
+    free_membound_data(ctx);
+    free_idle_monitor(ctx);
+    free_governor(ctx);
+    free_freq_watch(ctx);
+    free_record_replay(ctx);
+    free_schedule(ctx);
+    free_tracers(ctx);
+    free_thermal(ctx);
+    free_wait_hints(ctx);
+    free_model(ctx);
+    free_budget(ctx);
+    free_power_table(ctx);
+    free_voltages(ctx);
+    free_turbo(ctx);
+
     if (pwr_is_initialized(ctx, PWR_MODULE_ENERGY)) {
         free_energy_data(ctx);
     }
@@ -81,10 +139,19 @@ void pwr_finalize(pwr_ctx_t *ctx) {
         free_speed_data(ctx);
     }
 
+    free_cstates(ctx);
+    free_hwp(ctx);
+    free_uncore(ctx);
+    free_msr(ctx);
+    free_cpufreq(ctx);
+
     if (pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
         free_structure_data(ctx);
     }
 
+    free_energy_snapshots(ctx);
+    pthread_mutex_destroy(&ctx->dvfs_lock);
+    pthread_mutex_destroy(&ctx->record_lock);
     free(ctx);
 }
 
@@ -126,20 +193,3 @@ const char *pwr_strerror(const pwr_ctx_t *ctx) {
 
     return "Unknown error";
 }
-
-//====-------------------------------------------------------------------------
-// Library internal functions
-//-----------------------------------------------------------------------------
-
-GString* sysfs_filename(unsigned long cpu_id, const char* filename) {
-    GString* new_filename = g_string_new("/sys/devices/system/cpu/cpu");
-    char cpu_str[21];// Maximum chars in base 10 long value is 20 + 1 (\0)
-    sprintf(cpu_str, "%ld", cpu_id);
-
-    g_string_append(new_filename, cpu_str);
-    g_string_append(new_filename, "/cpufreq/");
-    g_string_append(new_filename, filename);
-
-    return new_filename;
-}
-
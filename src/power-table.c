@@ -0,0 +1,575 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * Power table file format, in the byte order of the machine:
+ *
+ *  header:     char magic[8] = "PWRTABLE"
+ *              uint32_t version
+ *              uint32_t num_islands
+ *              uint32_t num_loads
+ *              uint32_t reserved
+ *  per island: uint32_t num_levels
+ *              uint32_t reserved
+ *              per level: uint64_t freq, double watts[num_loads],
+ *                         double voltage (since version 2),
+ *                         double throughput (since version 3)
+ *
+ * Unmeasured entries are NaN. Loads unknown to the library are skipped, and
+ * loads missing from the file are left unmeasured. Older tables, without
+ * voltages or throughputs, are still accepted.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Magic string identifying the power table files */
+#define TABLE_MAGIC "PWRTABLE"
+
+/** Current version of the power table format */
+#define TABLE_VERSION 3
+
+/* Power table file header */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_islands;
+    uint32_t num_loads;
+    uint32_t reserved;
+} table_header_t;
+
+/* Power table island header */
+typedef struct {
+    uint32_t num_levels;
+    uint32_t reserved;
+} table_island_t;
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void alloc_table(pwr_ctx_t *ctx);
+static void set_budget_power(pwr_ctx_t *ctx, unsigned long island);
+static void update_throughput_scale(pwr_ctx_t *ctx);
+static pwr_err_t parse_table(pwr_ctx_t *ctx, const char *buf, size_t size);
+static pwr_err_t write_table(pwr_ctx_t *ctx, FILE *file);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+double pwr_level_power(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, pwr_load_t load)
+{
+    TRACE_CALL(ctx, pwr_level_power, island, level);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    if (level >= ctx->phys_islands[island]->num_speed_levels) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return 0;
+    }
+
+    if (load >= PWR_NB_LOADS) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return 0;
+    }
+
+    if (ctx->level_power == NULL ||
+        isnan(ctx->level_power[island][level * PWR_NB_LOADS + load]))
+    {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->level_power[island][level * PWR_NB_LOADS + load];
+}
+
+void pwr_set_level_power(pwr_ctx_t *ctx, unsigned long island,
+    pwr_load_t load, const double *watts)
+{
+    TRACE_CALL(ctx, pwr_set_level_power, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    if (load >= PWR_NB_LOADS) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    unsigned int num_levels = ctx->phys_islands[island]->num_speed_levels;
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        if (!(watts[l] >= 0) || isinf(watts[l])) {
+            ctx->error = PWR_REQUEST_DENIED;
+            return;
+        }
+    }
+
+    alloc_table(ctx);
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        ctx->level_power[island][l * PWR_NB_LOADS + load] = watts[l];
+    }
+
+    if (load == PWR_LOAD_COMPUTE) {
+        set_budget_power(ctx, island);
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_set_level_throughput(pwr_ctx_t *ctx, unsigned long island,
+    const double *throughput)
+{
+    TRACE_CALL(ctx, pwr_set_level_throughput, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    unsigned int num_levels = ctx->phys_islands[island]->num_speed_levels;
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        if (!(throughput[l] > 0) || isinf(throughput[l])) {
+            ctx->error = PWR_REQUEST_DENIED;
+            return;
+        }
+    }
+
+    alloc_table(ctx);
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        ctx->level_throughput[island][l] = throughput[l];
+    }
+    update_throughput_scale(ctx);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_load_power_table(pwr_ctx_t *ctx, const char *path) {
+    TRACE_CALL(ctx, pwr_load_power_table, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        ctx->error = PWR_IO_ERR;
+        return;
+    }
+
+    // tables are small, read the whole file at once
+    char *buf = NULL;
+    size_t size = 0;
+    long file_size;
+    if (fseek(file, 0, SEEK_END) == 0 && (file_size = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(file_size);
+        size = fread(buf, 1, file_size, file);
+    }
+    fclose(file);
+
+    if (buf == NULL || size != (size_t) file_size) {
+        free(buf);
+        ctx->error = PWR_IO_ERR;
+        return;
+    }
+
+    ctx->error = parse_table(ctx, buf, size);
+    free(buf);
+
+    if (ctx->error == PWR_OK) {
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            set_budget_power(ctx, i);
+        }
+        update_throughput_scale(ctx);
+    }
+}
+
+void pwr_save_power_table(pwr_ctx_t *ctx, const char *path) {
+    TRACE_CALL(ctx, pwr_save_power_table, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->level_power == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    // write a temporary file next to the table, then replace the table
+    size_t path_len = strlen(path);
+    char tmp_path[path_len + 5];
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        ctx->error = PWR_IO_ERR;
+        return;
+    }
+
+    pwr_err_t err = write_table(ctx, file);
+    if (fclose(file) != 0) {
+        err = PWR_IO_ERR;
+    }
+
+    if (err == PWR_OK && rename(tmp_path, path) != 0) {
+        err = PWR_IO_ERR;
+    }
+    if (err != PWR_OK) {
+        unlink(tmp_path);
+    }
+
+    ctx->error = err;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_power_table(pwr_ctx_t *ctx) {
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    const char *path = getenv(PWR_POWER_TABLE_ENV);
+    if (path == NULL) {
+        // the default table is optional
+        path = PWR_POWER_TABLE_PATH;
+        if (access(path, R_OK) != 0) {
+            return;
+        }
+    }
+
+    pwr_load_power_table(ctx, path);
+    if (ctx->error != PWR_OK) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Ignoring the power table %s: %s\n", path,
+                pwr_strerror(ctx));
+        }
+        ctx->error = PWR_OK;
+    }
+}
+
+void free_power_table(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->level_power == NULL) {
+        return;
+    }
+
+    // the island tables share a single allocation
+    free(ctx->level_power[0]);
+    free(ctx->level_power);
+    ctx->level_power = NULL;
+
+    free(ctx->level_throughput[0]);
+    free(ctx->level_throughput);
+    ctx->level_throughput = NULL;
+    ctx->throughput_scale = 0;
+}
+
+bool table_speed(pwr_ctx_t *ctx, unsigned long island, unsigned int level,
+    speed_t *speed)
+{
+    if (ctx->throughput_scale <= 0) {
+        return false;
+    }
+
+    *speed = ctx->level_throughput[island][level] * PWR_SPEED_SCALE /
+        ctx->throughput_scale + 0.5;
+    return true;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Allocates an empty power table, unless one already exists.
+  */
+void alloc_table(pwr_ctx_t *ctx) {
+    unsigned long total = 0;
+
+    if (ctx->level_power != NULL) {
+        return;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        total += ctx->phys_islands[i]->num_speed_levels;
+    }
+
+    double *entries = malloc(total * PWR_NB_LOADS * sizeof(*entries));
+    double *throughputs = malloc(total * sizeof(*throughputs));
+    for (unsigned long e = 0; e < total * PWR_NB_LOADS; ++e) {
+        entries[e] = NAN;
+    }
+    for (unsigned long e = 0; e < total; ++e) {
+        throughputs[e] = NAN;
+    }
+
+    ctx->level_power = malloc(ctx->num_phys_islands * sizeof(double *));
+    ctx->level_throughput = malloc(ctx->num_phys_islands * sizeof(double *));
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        ctx->level_power[i] = entries;
+        ctx->level_throughput[i] = throughputs;
+        entries += ctx->phys_islands[i]->num_speed_levels * PWR_NB_LOADS;
+        throughputs += ctx->phys_islands[i]->num_speed_levels;
+    }
+}
+
+/**
+  * Finds the highest throughput of the node, if every level of every island
+  * was calibrated.
+  */
+void update_throughput_scale(pwr_ctx_t *ctx) {
+    double scale = 0;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        for (unsigned int l = 0; l < ctx->phys_islands[i]->num_speed_levels;
+             ++l)
+        {
+            double throughput = ctx->level_throughput[i][l];
+            if (isnan(throughput)) {
+                ctx->throughput_scale = 0;
+                return;
+            }
+            if (throughput > scale) {
+                scale = throughput;
+            }
+        }
+    }
+
+    ctx->throughput_scale = scale;
+}
+
+/**
+  * Uses the compute power of an island as its budget power table, if every
+  * level was calibrated.
+  */
+void set_budget_power(pwr_ctx_t *ctx, unsigned long island) {
+    unsigned int num_levels = ctx->phys_islands[island]->num_speed_levels;
+    double watts[num_levels];
+
+    if (ctx->budget == NULL) {
+        return;
+    }
+
+    for (unsigned int l = 0; l < num_levels; ++l) {
+        watts[l] = ctx->level_power[island][l * PWR_NB_LOADS + PWR_LOAD_COMPUTE];
+        if (isnan(watts[l])) {
+            return;
+        }
+    }
+
+    budget_set_power(ctx, island, watts);
+}
+
+/**
+  * Fills the power table from the content of a table file. The table is left
+  * untouched if the file is invalid.
+  *
+  * @return PWR_OK, PWR_IO_ERR if the file is malformed or PWR_REQUEST_DENIED
+  *  if it was measured on other islands or frequencies.
+  */
+pwr_err_t parse_table(pwr_ctx_t *ctx, const char *buf, size_t size) {
+    table_header_t header;
+    size_t offset = sizeof(header);
+
+    if (size < sizeof(header)) {
+        return PWR_IO_ERR;
+    }
+
+    memcpy(&header, buf, sizeof(header));
+    if (memcmp(header.magic, TABLE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > TABLE_VERSION ||
+        header.num_loads == 0)
+    {
+        return PWR_IO_ERR;
+    }
+
+    if (header.num_islands != ctx->num_phys_islands) {
+        return PWR_REQUEST_DENIED;
+    }
+
+    // validate the whole file before touching the table
+    bool has_voltage = header.version >= 2;
+    bool has_throughput = header.version >= 3;
+    size_t entry_size = sizeof(uint64_t) +
+        (header.num_loads + has_voltage + has_throughput) * sizeof(double);
+    for (unsigned long i = 0; i < header.num_islands; ++i) {
+        table_island_t island;
+        phys_island_t *pi = ctx->phys_islands[i];
+
+        if (size - offset < sizeof(island)) {
+            return PWR_IO_ERR;
+        }
+        memcpy(&island, buf + offset, sizeof(island));
+        offset += sizeof(island);
+
+        if (island.num_levels != pi->num_speed_levels) {
+            return PWR_REQUEST_DENIED;
+        }
+        if ((size - offset) / entry_size < island.num_levels) {
+            return PWR_IO_ERR;
+        }
+
+        for (unsigned int l = 0; l < island.num_levels; ++l) {
+            uint64_t freq;
+            memcpy(&freq, buf + offset + l * entry_size, sizeof(freq));
+            if (freq != (uint64_t) pi->freqs[l]) {
+                return PWR_REQUEST_DENIED;
+            }
+        }
+        offset += island.num_levels * entry_size;
+    }
+
+    if (offset != size) {
+        return PWR_IO_ERR;
+    }
+
+    alloc_table(ctx);
+    offset = sizeof(header);
+    for (unsigned long i = 0; i < header.num_islands; ++i) {
+        unsigned int num_levels = ctx->phys_islands[i]->num_speed_levels;
+
+        offset += sizeof(table_island_t);
+        for (unsigned int l = 0; l < num_levels; ++l) {
+            const char *entry = buf + offset + sizeof(uint64_t);
+            for (unsigned int load = 0; load < PWR_NB_LOADS; ++load) {
+                double watts = NAN;
+                if (load < header.num_loads) {
+                    memcpy(&watts, entry + load * sizeof(double),
+                        sizeof(watts));
+                }
+                ctx->level_power[i][l * PWR_NB_LOADS + load] = watts;
+            }
+
+            // keep the voltages measured since the library was initialized
+            double voltage = NAN;
+            if (has_voltage) {
+                memcpy(&voltage, entry + header.num_loads * sizeof(double),
+                    sizeof(voltage));
+            }
+            if (!isnan(voltage)) {
+                ctx->phys_islands[i]->voltages[l] = voltage;
+            }
+
+            double throughput = NAN;
+            if (has_throughput) {
+                memcpy(&throughput,
+                    entry + (header.num_loads + 1) * sizeof(double),
+                    sizeof(throughput));
+            }
+            ctx->level_throughput[i][l] = throughput;
+            offset += entry_size;
+        }
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Writes the power table to a file.
+  *
+  * @return PWR_OK or PWR_IO_ERR.
+  */
+pwr_err_t write_table(pwr_ctx_t *ctx, FILE *file) {
+    table_header_t header = {
+        .version = TABLE_VERSION,
+        .num_islands = ctx->num_phys_islands,
+        .num_loads = PWR_NB_LOADS,
+    };
+    memcpy(header.magic, TABLE_MAGIC, sizeof(header.magic));
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        return PWR_IO_ERR;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        table_island_t island = { .num_levels = pi->num_speed_levels };
+
+        if (fwrite(&island, sizeof(island), 1, file) != 1) {
+            return PWR_IO_ERR;
+        }
+
+        for (unsigned int l = 0; l < pi->num_speed_levels; ++l) {
+            uint64_t freq = pi->freqs[l];
+            double voltage = pi->voltages[l];
+            if (fwrite(&freq, sizeof(freq), 1, file) != 1 ||
+                fwrite(&ctx->level_power[i][l * PWR_NB_LOADS],
+                    sizeof(double), PWR_NB_LOADS, file) != PWR_NB_LOADS ||
+                fwrite(&voltage, sizeof(voltage), 1, file) != 1 ||
+                fwrite(&ctx->level_throughput[i][l], sizeof(double), 1,
+                    file) != 1)
+            {
+                return PWR_IO_ERR;
+            }
+        }
+    }
+
+    return PWR_OK;
+}
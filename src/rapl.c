@@ -0,0 +1,190 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * Direct access to the RAPL energy counters through the Linux powercap
+ * interface. Those counters are used internally by the controllers to take
+ * energy snapshots without disturbing the PAPI-based measurements returned by
+ * pwr_start_energy_count() and pwr_stop_energy_count().
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Where the powercap zones are exposed */
+#define POWERCAP_DIR "/sys/class/powercap"
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool is_snapshot_domain(const char *zone);
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_energy_snapshots(pwr_ctx_t *ctx) {
+    char path[512];
+    DIR *dir;
+    struct dirent *entry;
+
+    assert(ctx != NULL);
+
+    ctx->num_rapl_domains = 0;
+    ctx->rapl_fds = NULL;
+    ctx->rapl_last = NULL;
+    ctx->rapl_range = NULL;
+    ctx->rapl_total = 0;
+    pthread_mutex_init(&ctx->rapl_lock, NULL);
+
+    dir = opendir(POWERCAP_DIR);
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_snapshot_domain(entry->d_name)) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), POWERCAP_DIR "/%s/energy_uj",
+            entry->d_name);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+
+        long long range = 0, value = 0;
+        snprintf(path, sizeof(path), POWERCAP_DIR "/%s/max_energy_range_uj",
+            entry->d_name);
+        int range_fd = open(path, O_RDONLY);
+        if (range_fd >= 0) {
+            read_sysfs_ll(range_fd, &range);
+            close(range_fd);
+        }
+
+        if (!read_sysfs_ll(fd, &value)) {
+            close(fd);
+            continue;
+        }
+
+        unsigned long d = ctx->num_rapl_domains++;
+        ctx->rapl_fds = realloc(ctx->rapl_fds,
+            ctx->num_rapl_domains * sizeof(*ctx->rapl_fds));
+        ctx->rapl_last = realloc(ctx->rapl_last,
+            ctx->num_rapl_domains * sizeof(*ctx->rapl_last));
+        ctx->rapl_range = realloc(ctx->rapl_range,
+            ctx->num_rapl_domains * sizeof(*ctx->rapl_range));
+        ctx->rapl_fds[d] = fd;
+        ctx->rapl_last[d] = value;
+        ctx->rapl_range[d] = range;
+    }
+
+    closedir(dir);
+}
+
+bool energy_snapshot(pwr_ctx_t *ctx, double *joules) {
+    assert(ctx != NULL);
+    assert(joules != NULL);
+
+    if (ctx->num_rapl_domains == 0) {
+        *joules = 0;
+        return false;
+    }
+
+    pthread_mutex_lock(&ctx->rapl_lock);
+    for (unsigned long d = 0; d < ctx->num_rapl_domains; ++d) {
+        long long value;
+        stats_io(ctx, PWR_MODULE_ENERGY, 1, 0);
+        if (!read_sysfs_ll(ctx->rapl_fds[d], &value)) {
+            continue;
+        }
+
+        long long delta = value - ctx->rapl_last[d];
+        ctx->rapl_last[d] = value;
+        if (delta < 0) {
+            // the counter wrapped around, the interval cannot be measured
+            // without its range
+            if (ctx->rapl_range[d] <= 0) {
+                continue;
+            }
+            delta += ctx->rapl_range[d];
+        }
+        ctx->rapl_total += delta / 1e6;
+    }
+    *joules = ctx->rapl_total;
+    pthread_mutex_unlock(&ctx->rapl_lock);
+
+    return true;
+}
+
+void free_energy_snapshots(pwr_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    for (unsigned long d = 0; d < ctx->num_rapl_domains; ++d) {
+        close(ctx->rapl_fds[d]);
+    }
+    free(ctx->rapl_fds);
+    free(ctx->rapl_last);
+    free(ctx->rapl_range);
+    ctx->num_rapl_domains = 0;
+    pthread_mutex_destroy(&ctx->rapl_lock);
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Tells if a powercap zone has to be accounted in the node energy. Packages
+  * (intel-rapl:N) and DRAM sub-zones are accounted, the core and uncore
+  * sub-zones are not as they are already included in the package.
+  *
+  * @param zone The name of the powercap zone.
+  *
+  * @return True if the zone energy is part of the node energy.
+  */
+bool is_snapshot_domain(const char *zone) {
+    char path[512], name[32] = { '\0' };
+
+    if (strncmp(zone, "intel-rapl:", 11) != 0) {
+        return false;
+    }
+
+    // top-level zone: a package
+    if (strchr(zone + 11, ':') == NULL) {
+        return true;
+    }
+
+    snprintf(path, sizeof(path), POWERCAP_DIR "/%s/name", zone);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t len = pread(fd, name, sizeof(name) - 1, 0);
+    close(fd);
+
+    return len > 0 && strncmp(name, "dram", 4) == 0;
+}
@@ -0,0 +1,486 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "internals.h"
+
+/** Identifies the log files, NUL included */
+#define LOG_MAGIC "PWRLOG\n"
+
+/** Version of the log format */
+#define LOG_VERSION 1
+
+/** Records buffered before being written to the log */
+#define RECORD_BUFFER 4096
+
+/** Kinds of log records */
+enum log_kind {
+    LOG_SPEED_LEVEL = 0,
+    LOG_MARKER
+};
+
+/* Header of a log file */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_islands;
+} log_header_t;
+
+/* A log record */
+typedef struct {
+    /* Time since the recording started, in ns */
+    uint64_t time_ns;
+
+    /* The island of a speed level, or the marker */
+    uint32_t id;
+
+    /* The speed level */
+    uint16_t level;
+
+    /* One of log_kind */
+    uint16_t kind;
+} log_record_t;
+
+/* Recorder state */
+struct recorder {
+    /* The log file */
+    FILE *file;
+
+    /* When the recording started, in ns */
+    uint64_t start_ns;
+
+    /* Records not written yet */
+    log_record_t *buffer;
+    unsigned long num_buffered;
+
+    /* Did a write fail? */
+    bool failed;
+};
+
+/* Replay state */
+struct replay {
+    /* The log */
+    log_record_t *records;
+    unsigned long num_records;
+
+    /* First record of the current phase */
+    unsigned long phase_first;
+
+    /* First record not scheduled yet, the end of the current phase */
+    unsigned long next;
+
+    /* When the current phase started in this run, in ns */
+    uint64_t anchor_ns;
+
+    /* When the current phase started in the log, in ns */
+    uint64_t phase_ns;
+
+    /* Pending level of every island when a phase ends, if flagged */
+    unsigned int *flush_levels;
+    bool *flush;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void append_record(struct recorder *rec, const log_record_t *record);
+static bool flush_records(struct recorder *rec);
+static pwr_err_t load_log(pwr_ctx_t *ctx, const char *path,
+    struct replay *rp);
+static pwr_err_t schedule_phase(pwr_ctx_t *ctx, struct replay *rp);
+static pwr_err_t replay_marker(pwr_ctx_t *ctx, struct replay *rp,
+    unsigned int marker);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_record_start(pwr_ctx_t *ctx, const char *path) {
+    TRACE_CALL(ctx, pwr_record_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->recorder != NULL) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot create the log %s\n", path);
+        }
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    log_header_t header = {
+        .magic = LOG_MAGIC,
+        .version = LOG_VERSION,
+        .num_islands = ctx->num_phys_islands
+    };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    struct recorder *rec = calloc(1, sizeof(*rec));
+    rec->file = file;
+    rec->buffer = malloc(RECORD_BUFFER * sizeof(*rec->buffer));
+    rec->start_ns = monotonic_ns();
+
+    pthread_mutex_lock(&ctx->record_lock);
+    __atomic_store_n(&ctx->recorder, rec, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->record_lock);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_record_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_record_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    // the speed level requests and markers use the recorder under the lock
+    pthread_mutex_lock(&ctx->record_lock);
+    struct recorder *rec = ctx->recorder;
+    if (rec == NULL) {
+        pthread_mutex_unlock(&ctx->record_lock);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_store_n(&ctx->recorder, NULL, __ATOMIC_RELAXED);
+    bool ok = flush_records(rec) && !rec->failed;
+    pthread_mutex_unlock(&ctx->record_lock);
+    ok = fclose(rec->file) == 0 && ok;
+
+    free(rec->buffer);
+    free(rec);
+
+    ctx->error = ok ? PWR_OK : PWR_ERR;
+}
+
+void pwr_replay_start(pwr_ctx_t *ctx, const char *path) {
+    TRACE_CALL(ctx, pwr_replay_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->replay != NULL) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    struct replay *rp = calloc(1, sizeof(*rp));
+    pwr_err_t err = load_log(ctx, path, rp);
+    if (err != PWR_OK) {
+        free(rp->records);
+        free(rp);
+        ctx->error = err;
+        return;
+    }
+
+    rp->flush_levels = malloc(ctx->num_phys_islands *
+        sizeof(*rp->flush_levels));
+    rp->flush = malloc(ctx->num_phys_islands * sizeof(*rp->flush));
+    rp->anchor_ns = monotonic_ns();
+
+    pthread_mutex_lock(&ctx->record_lock);
+    ctx->replay = rp;
+    ctx->error = schedule_phase(ctx, rp);
+    pthread_mutex_unlock(&ctx->record_lock);
+}
+
+void pwr_replay_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_replay_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    // the markers use the replay state under the lock
+    pthread_mutex_lock(&ctx->record_lock);
+    struct replay *rp = ctx->replay;
+    if (rp == NULL) {
+        pthread_mutex_unlock(&ctx->record_lock);
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        cancel_speed_levels(ctx, i, true);
+    }
+
+    ctx->replay = NULL;
+    pthread_mutex_unlock(&ctx->record_lock);
+
+    free(rp->records);
+    free(rp->flush_levels);
+    free(rp->flush);
+    free(rp);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_phase_marker(pwr_ctx_t *ctx, unsigned int marker) {
+    TRACE_CALL(ctx, pwr_phase_marker, TRACE_NO_ISLAND, marker);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->record_lock);
+    struct recorder *rec = ctx->recorder;
+    if (rec != NULL) {
+        log_record_t record = {
+            .time_ns = monotonic_ns() - rec->start_ns,
+            .id = marker,
+            .kind = LOG_MARKER
+        };
+        append_record(rec, &record);
+    }
+
+    struct replay *rp = ctx->replay;
+    ctx->error = rp != NULL ? replay_marker(ctx, rp, marker) : PWR_OK;
+    pthread_mutex_unlock(&ctx->record_lock);
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void record_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level)
+{
+    // most requests are made while not recording, they skip the lock
+    if (__atomic_load_n(&ctx->recorder, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->record_lock);
+    struct recorder *rec = ctx->recorder;
+    if (rec != NULL) {
+        log_record_t record = {
+            .time_ns = monotonic_ns() - rec->start_ns,
+            .id = island,
+            .level = level,
+            .kind = LOG_SPEED_LEVEL
+        };
+        append_record(rec, &record);
+    }
+    pthread_mutex_unlock(&ctx->record_lock);
+}
+
+void free_record_replay(pwr_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    if (ctx->recorder != NULL) {
+        pwr_record_stop(ctx);
+    }
+    if (ctx->replay != NULL) {
+        pwr_replay_stop(ctx);
+    }
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Adds a record to the buffer, writing the buffer when it is full. Called
+  * with the record lock held.
+  */
+void append_record(struct recorder *rec, const log_record_t *record) {
+    rec->buffer[rec->num_buffered++] = *record;
+    if (rec->num_buffered == RECORD_BUFFER && !flush_records(rec)) {
+        rec->failed = true;
+    }
+}
+
+/**
+  * Writes the buffered records to the log.
+  *
+  * @return False if the write failed.
+  */
+bool flush_records(struct recorder *rec) {
+    unsigned long num = rec->num_buffered;
+
+    rec->num_buffered = 0;
+    return fwrite(rec->buffer, sizeof(*rec->buffer), num, rec->file) == num;
+}
+
+/**
+  * Reads and checks a log.
+  *
+  * @param ctx The current library context.
+  * @param path The log file.
+  * @param rp[out] The replay state to load the records in.
+  *
+  * @return PWR_OK, PWR_UNAVAILABLE if the file cannot be read or
+  *  PWR_REQUEST_DENIED if it is not a log of that node.
+  */
+pwr_err_t load_log(pwr_ctx_t *ctx, const char *path, struct replay *rp) {
+    log_header_t header;
+    struct stat st;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot open the log %s\n", path);
+        }
+        return PWR_UNAVAILABLE;
+    }
+
+    if (fstat(fileno(file), &st) != 0 ||
+        fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LOG_VERSION ||
+        header.num_islands != ctx->num_phys_islands)
+    {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "%s is not a log of this node\n", path);
+        }
+        fclose(file);
+        return PWR_REQUEST_DENIED;
+    }
+
+    rp->num_records = (st.st_size - sizeof(header)) / sizeof(*rp->records);
+    rp->records = malloc(rp->num_records * sizeof(*rp->records));
+    bool ok = fread(rp->records, sizeof(*rp->records), rp->num_records,
+        file) == rp->num_records;
+    fclose(file);
+
+    for (unsigned long r = 0; ok && r < rp->num_records; ++r) {
+        const log_record_t *record = &rp->records[r];
+        if (record->kind == LOG_MARKER) {
+            continue;
+        }
+        ok = record->kind == LOG_SPEED_LEVEL &&
+            record->id < ctx->num_phys_islands &&
+            record->level >= ctx->phys_islands[record->id]->min_speed_level &&
+            record->level <= ctx->phys_islands[record->id]->max_speed_level;
+    }
+    if (!ok) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "The log %s is corrupted\n", path);
+        }
+        return PWR_REQUEST_DENIED;
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Schedules the requests of the current phase, up to the next marker.
+  * Called with the record lock held.
+  *
+  * @return PWR_OK or the scheduling error.
+  */
+pwr_err_t schedule_phase(pwr_ctx_t *ctx, struct replay *rp) {
+    for (; rp->next < rp->num_records; ++rp->next) {
+        const log_record_t *record = &rp->records[rp->next];
+        if (record->kind == LOG_MARKER) {
+            break;
+        }
+
+        pwr_err_t err = schedule_speed_level(ctx, record->id, record->level,
+            rp->anchor_ns + (record->time_ns - rp->phase_ns), true);
+        if (err != PWR_OK) {
+            return err;
+        }
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Resumes the log after the next occurrence of a marker. The requests left
+  * behind, pending or skipped, are replaced by the last level of each island.
+  * Called with the record lock held.
+  *
+  * @return PWR_OK, PWR_REQUEST_DENIED if the marker does not appear anymore,
+  *  or the scheduling error.
+  */
+pwr_err_t replay_marker(pwr_ctx_t *ctx, struct replay *rp,
+    unsigned int marker)
+{
+    unsigned long found = rp->next;
+
+    while (found < rp->num_records &&
+           (rp->records[found].kind != LOG_MARKER ||
+            rp->records[found].id != marker))
+    {
+        ++found;
+    }
+    if (found == rp->num_records) {
+        return PWR_REQUEST_DENIED;
+    }
+
+    //===----------------------------------------------------------------------
+    // Apply at once what the log planned before the marker
+    uint64_t now = monotonic_ns();
+    memset(rp->flush, 0, ctx->num_phys_islands * sizeof(*rp->flush));
+    for (unsigned long r = rp->phase_first; r < found; ++r) {
+        const log_record_t *record = &rp->records[r];
+        bool pending = r >= rp->next ||
+            rp->anchor_ns + (record->time_ns - rp->phase_ns) > now;
+
+        if (record->kind == LOG_SPEED_LEVEL && pending) {
+            rp->flush[record->id] = true;
+            rp->flush_levels[record->id] = record->level;
+        }
+    }
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (rp->flush[i]) {
+            cancel_speed_levels(ctx, i, true);
+            pwr_err_t err = schedule_speed_level(ctx, i, rp->flush_levels[i],
+                0, true);
+            if (err != PWR_OK) {
+                return err;
+            }
+        }
+    }
+
+    rp->anchor_ns = now;
+    rp->phase_ns = rp->records[found].time_ns;
+    rp->phase_first = found + 1;
+    rp->next = found + 1;
+
+    return schedule_phase(ctx, rp);
+}
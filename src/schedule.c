@@ -0,0 +1,482 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Changes issued within that window of the first one are batched, in ns */
+#define BATCH_WINDOW 20000
+
+/** Longest lead of a change on its effective time, in ns */
+#define MAX_LEAD 10000000
+
+/** Initial capacity of the pending changes heap */
+#define INITIAL_CAPACITY 16
+
+/** batch_slots value of an island absent from the batch */
+#define NO_SLOT ((unsigned long) -1)
+
+/* A pending change */
+typedef struct {
+    /* When the change must be written, in ns */
+    uint64_t issue_ns;
+
+    /* Order of the change among the scheduled ones, to break ties */
+    uint64_t seq;
+
+    /* The island to change */
+    unsigned long island;
+
+    /* The new speed level */
+    unsigned int level;
+
+    /* Was the change scheduled by the replay of a log? */
+    bool replayed;
+} pending_change_t;
+
+/* Scheduler state */
+struct schedule {
+    /* Is the timer thread running? */
+    bool running;
+
+    /* The timer thread */
+    pthread_t thread;
+
+    /* The timer, expiring when the earliest pending change is due */
+    int timer_fd;
+
+    /* Protects the pending changes and the report */
+    pthread_mutex_t lock;
+
+    /* Pending changes, a binary min-heap on the issue time */
+    pending_change_t *heap;
+
+    /* How many changes are pending */
+    unsigned long num_pending;
+
+    /* Capacity of the heap */
+    unsigned long capacity;
+
+    /* Sequence number of the next scheduled change */
+    uint64_t next_seq;
+
+    /* The batch being issued, one slot per island */
+    unsigned long *batch_islands;
+    unsigned int *batch_levels;
+
+    /* Slot of every island in the batch, NO_SLOT if absent */
+    unsigned long *batch_slots;
+
+    /* The activity report */
+    pwr_schedule_report_t report;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool start_scheduler(pwr_ctx_t *ctx);
+static void *schedule_thread(void *arg);
+static void arm_timer(struct schedule *sc);
+static bool earlier(const pending_change_t *a, const pending_change_t *b);
+static void heap_push(struct schedule *sc, const pending_change_t *change);
+static void heap_pop(struct schedule *sc, pending_change_t *change);
+static void heap_sift_down(struct schedule *sc, unsigned long i);
+static uint64_t island_lead(pwr_ctx_t *ctx, unsigned long island);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_schedule_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, uint64_t at)
+{
+    TRACE_CALL(ctx, pwr_schedule_speed_level, island, level);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    phys_island_t *pi = ctx->phys_islands[island];
+    if (level < pi->min_speed_level || level > pi->max_speed_level) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return;
+    }
+
+    uint64_t lead = island_lead(ctx, island);
+    ctx->error = schedule_speed_level(ctx, island, level,
+        at > lead ? at - lead : 0, false);
+}
+
+unsigned long pwr_cancel_scheduled_speed_levels(pwr_ctx_t *ctx,
+    unsigned long island)
+{
+    TRACE_CALL(ctx, pwr_cancel_scheduled_speed_levels, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return cancel_speed_levels(ctx, island, false);
+}
+
+void pwr_schedule_report(pwr_ctx_t *ctx, pwr_schedule_report_t *report) {
+    TRACE_CALL(ctx, pwr_schedule_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (report == NULL) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    struct schedule *sc = ctx->schedule;
+    if (sc == NULL) {
+        *report = (pwr_schedule_report_t) { 0 };
+        ctx->error = PWR_OK;
+        return;
+    }
+
+    pthread_mutex_lock(&sc->lock);
+    *report = sc->report;
+    pthread_mutex_unlock(&sc->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void free_schedule(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->schedule == NULL) {
+        return;
+    }
+
+    struct schedule *sc = ctx->schedule;
+    if (sc->running) {
+        // wake the thread up at once
+        pthread_mutex_lock(&sc->lock);
+        __atomic_store_n(&sc->running, false, __ATOMIC_RELEASE);
+        sc->num_pending = 0;
+        struct itimerspec spec = { .it_value = { .tv_nsec = 1 } };
+        timerfd_settime(sc->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        pthread_mutex_unlock(&sc->lock);
+
+        pthread_join(sc->thread, NULL);
+    }
+
+    close(sc->timer_fd);
+    pthread_mutex_destroy(&sc->lock);
+    free(sc->heap);
+    free(sc->batch_islands);
+    free(sc->batch_levels);
+    free(sc->batch_slots);
+    free(sc);
+    ctx->schedule = NULL;
+}
+
+pwr_err_t schedule_speed_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level, uint64_t issue_ns, bool replayed)
+{
+    // the scheduler is created once, by the first caller
+    if (__atomic_load_n(&ctx->schedule, __ATOMIC_ACQUIRE) == NULL) {
+        pthread_mutex_lock(&ctx->dvfs_lock);
+        bool started = ctx->schedule != NULL || start_scheduler(ctx);
+        pthread_mutex_unlock(&ctx->dvfs_lock);
+        if (!started) {
+            return PWR_ERR;
+        }
+    }
+
+    struct schedule *sc = ctx->schedule;
+    pending_change_t change = {
+        .issue_ns = issue_ns,
+        .island = island,
+        .level = level,
+        .replayed = replayed
+    };
+
+    pthread_mutex_lock(&sc->lock);
+    change.seq = sc->next_seq++;
+    heap_push(sc, &change);
+    ++sc->report.scheduled;
+    if (sc->heap[0].seq == change.seq) {
+        arm_timer(sc);
+    }
+    pthread_mutex_unlock(&sc->lock);
+
+    return PWR_OK;
+}
+
+unsigned long cancel_speed_levels(pwr_ctx_t *ctx, unsigned long island,
+    bool replayed)
+{
+    struct schedule *sc = ctx->schedule;
+    unsigned long canceled = 0;
+    if (sc == NULL) {
+        return 0;
+    }
+
+    // compact the heap, then restore its order
+    pthread_mutex_lock(&sc->lock);
+    unsigned long kept = 0;
+    for (unsigned long i = 0; i < sc->num_pending; ++i) {
+        if (sc->heap[i].island == island &&
+            (!replayed || sc->heap[i].replayed))
+        {
+            ++canceled;
+        } else {
+            sc->heap[kept++] = sc->heap[i];
+        }
+    }
+    sc->num_pending = kept;
+    for (unsigned long i = kept / 2; i-- > 0;) {
+        heap_sift_down(sc, i);
+    }
+    sc->report.canceled += canceled;
+    arm_timer(sc);
+    pthread_mutex_unlock(&sc->lock);
+
+    return canceled;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Creates the scheduler and its timer thread.
+  *
+  * @param ctx The current library context.
+  *
+  * @return False if the timer or the thread cannot be created.
+  */
+bool start_scheduler(pwr_ctx_t *ctx) {
+    struct schedule *sc = calloc(1, sizeof(*sc));
+
+    sc->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (sc->timer_fd < 0) {
+        free(sc);
+        return false;
+    }
+
+    pthread_mutex_init(&sc->lock, NULL);
+    sc->capacity = INITIAL_CAPACITY;
+    sc->heap = malloc(sc->capacity * sizeof(*sc->heap));
+    sc->batch_islands = malloc(ctx->num_phys_islands *
+        sizeof(*sc->batch_islands));
+    sc->batch_levels = malloc(ctx->num_phys_islands *
+        sizeof(*sc->batch_levels));
+    sc->batch_slots = malloc(ctx->num_phys_islands *
+        sizeof(*sc->batch_slots));
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        sc->batch_slots[i] = NO_SLOT;
+    }
+    sc->running = true;
+    __atomic_store_n(&ctx->schedule, sc, __ATOMIC_RELEASE);
+    if (pthread_create(&sc->thread, NULL, &schedule_thread, ctx)) {
+        sc->running = false;
+        free_schedule(ctx);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+  * Main loop of the timer thread: waits for the timer, then issues the due
+  * changes, and those due within the batch window, in a single write.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *schedule_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct schedule *sc = ctx->schedule;
+    uint64_t expirations;
+    pending_change_t change;
+
+    while (__atomic_load_n(&sc->running, __ATOMIC_ACQUIRE)) {
+        if (read(sc->timer_fd, &expirations, sizeof(expirations)) < 0) {
+            continue;
+        }
+
+        uint64_t now = monotonic_ns();
+        unsigned long num = 0;
+
+        // a later change of an island replaces its earlier ones
+        pthread_mutex_lock(&sc->lock);
+        while (sc->num_pending > 0 &&
+               sc->heap[0].issue_ns <= now + BATCH_WINDOW)
+        {
+            heap_pop(sc, &change);
+            if (now > change.issue_ns &&
+                (now - change.issue_ns) / 1e9 > sc->report.max_lateness)
+            {
+                sc->report.max_lateness = (now - change.issue_ns) / 1e9;
+            }
+
+            unsigned long slot = sc->batch_slots[change.island];
+            if (slot == NO_SLOT) {
+                slot = num++;
+                sc->batch_slots[change.island] = slot;
+                sc->batch_islands[slot] = change.island;
+            }
+            sc->batch_levels[slot] = change.level;
+            ++sc->report.issued;
+        }
+        for (unsigned long i = 0; i < num; ++i) {
+            sc->batch_slots[sc->batch_islands[i]] = NO_SLOT;
+        }
+        arm_timer(sc);
+        pthread_mutex_unlock(&sc->lock);
+
+        if (num == 0) {
+            continue;
+        }
+
+        pwr_err_t err = set_speed_levels(ctx, sc->batch_islands,
+            sc->batch_levels, num);
+
+        pthread_mutex_lock(&sc->lock);
+        ++sc->report.batches;
+        if (err != PWR_OK) {
+            ++sc->report.failed;
+        }
+        pthread_mutex_unlock(&sc->lock);
+    }
+
+    return NULL;
+}
+
+/**
+  * Arms the timer for the earliest pending change, or disarms it. Called with
+  * the scheduler lock held.
+  */
+void arm_timer(struct schedule *sc) {
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+    // a zero time would disarm the timer
+    if (sc->num_pending > 0) {
+        uint64_t issue = sc->heap[0].issue_ns > 0 ? sc->heap[0].issue_ns : 1;
+        spec.it_value.tv_sec = issue / 1000000000ULL;
+        spec.it_value.tv_nsec = issue % 1000000000ULL;
+    }
+    timerfd_settime(sc->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/**
+  * Is a change to be issued before another one?
+  */
+bool earlier(const pending_change_t *a, const pending_change_t *b) {
+    return a->issue_ns < b->issue_ns ||
+        (a->issue_ns == b->issue_ns && a->seq < b->seq);
+}
+
+/**
+  * Adds a change to the heap, growing it if needed.
+  */
+void heap_push(struct schedule *sc, const pending_change_t *change) {
+    if (sc->num_pending == sc->capacity) {
+        sc->capacity *= 2;
+        sc->heap = realloc(sc->heap, sc->capacity * sizeof(*sc->heap));
+    }
+
+    unsigned long i = sc->num_pending++;
+    while (i > 0 && earlier(change, &sc->heap[(i - 1) / 2])) {
+        sc->heap[i] = sc->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sc->heap[i] = *change;
+}
+
+/**
+  * Removes the earliest change from the heap.
+  */
+void heap_pop(struct schedule *sc, pending_change_t *change) {
+    *change = sc->heap[0];
+    sc->heap[0] = sc->heap[--sc->num_pending];
+    heap_sift_down(sc, 0);
+}
+
+/**
+  * Moves a change down the heap until it is earlier than its children.
+  */
+void heap_sift_down(struct schedule *sc, unsigned long i) {
+    pending_change_t change = sc->heap[i];
+
+    for (;;) {
+        unsigned long child = 2 * i + 1;
+        if (child >= sc->num_pending) {
+            break;
+        }
+        if (child + 1 < sc->num_pending &&
+            earlier(&sc->heap[child + 1], &sc->heap[child]))
+        {
+            ++child;
+        }
+        if (!earlier(&sc->heap[child], &change)) {
+            break;
+        }
+        sc->heap[i] = sc->heap[child];
+        i = child;
+    }
+    sc->heap[i] = change;
+}
+
+/**
+  * How long before its effective time a change of an island is written: the
+  * agility of the island, bounded to ignore unknown latencies.
+  *
+  * @return The lead, in ns.
+  */
+uint64_t island_lead(pwr_ctx_t *ctx, unsigned long island) {
+    agility_t agility = ctx->phys_islands[island]->agility;
+
+    if (agility <= 0) {
+        return 0;
+    }
+    return agility < MAX_LEAD ? (uint64_t) agility : MAX_LEAD;
+}
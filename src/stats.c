@@ -0,0 +1,60 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include "internals.h"
+
+const pwr_module_id_t trace_modules[NB_TRACE_FUNCTIONS] = {
+#define X(name, module) module,
+    TRACE_FUNCTIONS
+#undef X
+};
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_get_stats(pwr_ctx_t *ctx, pwr_stats_t *stats) {
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    // the statistics are made of counters only
+    const uint64_t *from = (const uint64_t *) &ctx->stats;
+    uint64_t *to = (uint64_t *) stats;
+    for (size_t c = 0; c < sizeof(*stats) / sizeof(uint64_t); ++c) {
+        to[c] = __atomic_load_n(&from[c], __ATOMIC_RELAXED);
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_enable_stats(pwr_ctx_t *ctx, bool enable) {
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (enable) {
+        __atomic_or_fetch(&ctx->instrument, INSTRUMENT_STATS,
+            __ATOMIC_RELEASE);
+    } else {
+        __atomic_and_fetch(&ctx->instrument, ~INSTRUMENT_STATS,
+            __ATOMIC_RELEASE);
+    }
+
+    ctx->error = PWR_OK;
+}
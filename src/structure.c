@@ -14,25 +14,65 @@
   *	limitations under the License.
   */
 
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 #include "internals.h"
 
+/** CPUs listed by the perf PMUs of the two core types of hybrid processors */
+#define PMU_CORE_CPUS "/devices/cpu_core/cpus"
+#define PMU_ATOM_CPUS "/devices/cpu_atom/cpus"
+
+/** CPUs online, read when sysfs is not the one of the running system */
+#define ONLINE_CPUS "/devices/system/cpu/online"
+
+/** CPUID leaf giving the core type in EAX bits 31:24 */
+#define CPUID_HYBRID_LEAF 0x1A
+#define CPUID_CORE_TYPE_ATOM 0x20
+#define CPUID_CORE_TYPE_CORE 0x40
+
+/**
+  * Performance of an efficiency core relative to a performance core at the
+  * same frequency, used when the kernel does not provide the CPU capacities
+  */
+#define EFFICIENCY_CORE_IPC 0.6
+
 //====-------------------------------------------------------------------------
 // Forward declarations
 //-----------------------------------------------------------------------------
 
 static gboolean phys_island_deep_eq(const phys_island_t* i0, const phys_island_t* i1);
-static gint compare_phys_cpu_id(unsigned long i0, unsigned long i1); 
+static gint compare_phys_cpu_id(gconstpointer i0, gconstpointer i1);
+static unsigned int parse_cpu_ids(const char *list, unsigned long *cpus);
+static void set_capacities(pwr_ctx_t *ctx);
+static pwr_core_type_t core_type(pwr_ctx_t *ctx, unsigned long cpu);
+static bool read_cpu_list(pwr_ctx_t *ctx, const char *name, char *list);
+static bool next_cpu_range(char **list, unsigned long *first,
+    unsigned long *last);
+static bool cpu_in_list(pwr_ctx_t *ctx, const char *name, unsigned long cpu,
+    bool *found);
+static unsigned long num_listed_cpus(pwr_ctx_t *ctx, const char *name);
 
 //====-------------------------------------------------------------------------
 // Public functions
 //-----------------------------------------------------------------------------
 
 unsigned long pwr_num_phys_cpus(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_num_phys_cpus, TRACE_NO_ISLAND, 0);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return 0;
@@ -48,6 +88,7 @@ unsigned long pwr_num_phys_cpus(pwr_ctx_t *ctx) {
 }
 
 unsigned long pwr_num_phys_islands(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_num_phys_islands, TRACE_NO_ISLAND, 0);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return 0;
@@ -63,6 +104,7 @@ unsigned long pwr_num_phys_islands(pwr_ctx_t *ctx) {
 }
 
 unsigned long pwr_island_of_cpu(pwr_ctx_t *ctx, unsigned long cpu) {
+    TRACE_CALL(ctx, pwr_island_of_cpu, TRACE_NO_ISLAND, cpu);
     if (ctx == NULL) {
         ctx->error = PWR_INIT_ERR;
         return 0;
@@ -73,14 +115,10 @@ unsigned long pwr_island_of_cpu(pwr_ctx_t *ctx, unsigned long cpu) {
         return ctx->num_phys_islands;
     }
 
-    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
-        phys_island_t *island = ctx->phys_islands[i];
-        for (unsigned long j = 0; j < island->num_cpu; ++j) {
-            if (island->cpus[j] == cpu) {
-                ctx->error = PWR_OK;
-                return i;
-            }
-        }
+    unsigned long island = ctx->cpu_islands[cpu];
+    if (island < ctx->num_phys_islands) {
+        ctx->error = PWR_OK;
+        return island;
     }
 
     ctx->error = PWR_ERR;
@@ -90,6 +128,48 @@ unsigned long pwr_island_of_cpu(pwr_ctx_t *ctx, unsigned long cpu) {
     return ctx->num_phys_islands;
 }
 
+pwr_core_type_t pwr_island_core_type(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_island_core_type, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return PWR_CORE_UNKNOWN;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return PWR_CORE_UNKNOWN;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return PWR_CORE_UNKNOWN;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->phys_islands[island]->core_type;
+}
+
+speed_t pwr_island_capacity(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_island_capacity, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->phys_islands[island]->capacity;
+}
+
 //====-------------------------------------------------------------------------
 // Library internal functions
 //-----------------------------------------------------------------------------
@@ -98,13 +178,27 @@ void init_struct_module(pwr_ctx_t *ctx) {
     assert(ctx != NULL);
     assert(!pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
 
-    ctx->num_phys_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *root = getenv(PWR_SYSFS_ROOT_ENV);
+    ctx->sysfs_root = root != NULL ? root : "/sys";
+    ctx->num_phys_cpu = root != NULL ? num_listed_cpus(ctx, ONLINE_CPUS) :
+        (unsigned long) sysconf(_SC_NPROCESSORS_ONLN);
     ctx->num_phys_islands = 0;
+    if (ctx->num_phys_cpu == 0) {
+        if (ctx->err_fd != NULL) {
+            fprintf(ctx->err_fd, "Cannot read the online CPUs under %s\n",
+                ctx->sysfs_root);
+        }
+        ctx->error = PWR_ARCH_UNSUPPORTED;
+        return;
+    }
+    init_cpufreq(ctx);
 
     //===----------------------------------------------------------------------
     // Build the island for every CPU 
 
     GPtrArray* phys_islands_gpa = g_ptr_array_new();
+    bool *placed = calloc(ctx->num_phys_cpu, sizeof(*placed));
+    char affected[SYSFS_ATTR_SIZE];
 
     // Check /sys/devices/system/cpu/cpu*/cpufreq/freqdomain_cpus to determine 
     // voltage island membership if it exists, affected_cpus otherwise.
@@ -113,66 +207,47 @@ void init_struct_module(pwr_ctx_t *ctx) {
     // and parsed to determine island membership
     for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
 
-        // Get affected CPU from sysfs
-        GError* file_error = NULL;
-        gchar* affected_char = NULL;
-        GString *affected_filename = sysfs_filename(cpu, "freqdomain_cpus");
+        // The island was already read from another of its CPUs
+        if (placed[cpu]) {
+            continue;
+        }
 
-        if (!g_file_get_contents(affected_filename->str, &affected_char,
-                                 NULL, &file_error))
+        // Get affected CPU from sysfs
+        if (read_cpufreq(ctx, cpu, "freqdomain_cpus", affected,
+                sizeof(affected)) < 0 &&
+            read_cpufreq(ctx, cpu, "affected_cpus", affected,
+                sizeof(affected)) < 0)
         {
-            g_string_free(affected_filename, TRUE);
-            g_error_free(file_error);
-            file_error = NULL;
-
-            // try the affected_cpus file
-            affected_filename = sysfs_filename(cpu, "affected_cpus");
-            if (!g_file_get_contents(affected_filename->str, &affected_char,
-                                     NULL, &file_error))
-            {
-                if (ctx->err_fd != NULL) {
-                    fprintf(ctx->err_fd,
-                        "Error opening affected cpu file for cpu %lu...\n",
-                        cpu);
-                    fputs(file_error->message, ctx->err_fd);
-                    fprintf(ctx->err_fd, "\n");
-                }
-                g_error_free(file_error);
-                ctx->error = PWR_ARCH_UNSUPPORTED;
-
-                g_string_free(affected_filename, TRUE);
-                g_ptr_array_free(phys_islands_gpa, TRUE);
-                return;
+            if (ctx->err_fd != NULL) {
+                fprintf(ctx->err_fd,
+                    "Error opening affected cpu file for cpu %lu: %s\n",
+                    cpu, strerror(errno));
             }
-        }
-        g_string_free(affected_filename, TRUE);
-        
-        gchar** affected_cpu_vstr = g_strsplit(affected_char, " ",
-            PWR_MAX_CPU_PER_PHYS_ISLAND);
-        gchar** ptr;
-
-        // Count CPU on same island
-        unsigned int num_affected_cpu = 0;
-        for (ptr = affected_cpu_vstr; *ptr; ptr++) {
-            num_affected_cpu++;
+            ctx->error = PWR_ARCH_UNSUPPORTED;
+
+            free(placed);
+            g_ptr_array_free(phys_islands_gpa, TRUE);
+            return;
         }
 
+        // Count CPU on same island, a CPU is at least on its own island
+        unsigned int num_affected_cpu = parse_cpu_ids(affected, NULL);
+
         // Build the island struct
         phys_island_t* new_pi = malloc(sizeof(*new_pi));
-        new_pi->num_cpu = num_affected_cpu;
-        new_pi->cpus = malloc(num_affected_cpu * sizeof(*new_pi->cpus));
+        new_pi->num_cpu = num_affected_cpu > 0 ? num_affected_cpu : 1;
+        new_pi->cpus = malloc(new_pi->num_cpu * sizeof(*new_pi->cpus));
+        new_pi->cpus[0] = cpu;
+        parse_cpu_ids(affected, new_pi->cpus);
 
         // Sort CPU in island
-        GArray *tmp_sorted = g_array_new(FALSE, FALSE, sizeof(*affected_cpu_vstr));
-        for (unsigned int i = 0; i < num_affected_cpu; ++i) {
-            unsigned long cpu_id = atoi(affected_cpu_vstr[i]);
-            g_array_append_val(tmp_sorted, cpu_id);
-        }
-
-        g_array_sort(tmp_sorted, (GCompareFunc) &compare_phys_cpu_id);
+        qsort(new_pi->cpus, new_pi->num_cpu, sizeof(*new_pi->cpus),
+            compare_phys_cpu_id);
 
-        for (unsigned int i = 0; i < num_affected_cpu; ++i) {
-            new_pi->cpus[i] = g_array_index(tmp_sorted, unsigned long, i);
+        for (unsigned long i = 0; i < new_pi->num_cpu; ++i) {
+            if (new_pi->cpus[i] < ctx->num_phys_cpu) {
+                placed[new_pi->cpus[i]] = true;
+            }
         }
 
         // Compare to existing islands, save if it is new
@@ -190,11 +265,8 @@ void init_struct_module(pwr_ctx_t *ctx) {
             ctx->num_phys_islands++;
             g_ptr_array_add(phys_islands_gpa, new_pi);
         } 
-
-        g_array_free(tmp_sorted, TRUE);
-        g_strfreev(affected_cpu_vstr);
-        g_free(affected_char);
     }
+    free(placed);
 
     //===----------------------------------------------------------------------
     // Convert the island to their internal form and setup the agility 
@@ -205,21 +277,16 @@ void init_struct_module(pwr_ctx_t *ctx) {
         
         // Set agility
         unsigned long cpu_id = ctx->phys_islands[i]->cpus[0];
-        
-        GString* agility_filename = sysfs_filename(cpu_id, "cpuinfo_transition_latency");
-        GError* file_error = NULL;
-        gchar* agility_char = NULL;
+        long long agility;
 
-        if (!g_file_get_contents(agility_filename->str, &agility_char, NULL,
-            &file_error)) 
+        if (!read_cpufreq_ll(ctx, cpu_id, "cpuinfo_transition_latency",
+            &agility))
         {
             if (ctx->err_fd != NULL) {
                 fprintf(ctx->err_fd,
                     "Error opening agility file for cpu %ld...\n",
                     cpu_id);
-                fputs(file_error->message, ctx->err_fd);
             }
-            g_error_free(file_error);
             ctx->error = PWR_ARCH_UNSUPPORTED;
 
             // free the island memory
@@ -235,17 +302,31 @@ void init_struct_module(pwr_ctx_t *ctx) {
                 free(ctx->phys_islands[0]);
             }
 
-            g_string_free(agility_filename, TRUE);
             g_ptr_array_free(phys_islands_gpa, TRUE);
             return;
         }
-        agility_t* island_agility = &(ctx->phys_islands[i]->agility);
-        sscanf(agility_char, "%ld", island_agility);
-        g_free(agility_char);
-        g_string_free(agility_filename, TRUE);
+        ctx->phys_islands[i]->agility = agility;
     }
 
     g_ptr_array_free(phys_islands_gpa, TRUE);
+
+    set_capacities(ctx);
+
+    //===----------------------------------------------------------------------
+    // Map the CPUs to their island, unknown CPU are mapped to an invalid id
+
+    ctx->cpu_islands = malloc(ctx->num_phys_cpu * sizeof(*ctx->cpu_islands));
+    for (unsigned long c = 0; c < ctx->num_phys_cpu; ++c) {
+        ctx->cpu_islands[c] = ctx->num_phys_islands;
+    }
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *island = ctx->phys_islands[i];
+        for (unsigned long j = 0; j < island->num_cpu; ++j) {
+            if (island->cpus[j] < ctx->num_phys_cpu) {
+                ctx->cpu_islands[island->cpus[j]] = i;
+            }
+        }
+    }
     
     // set the initialized flag
     ctx->error = PWR_OK;
@@ -267,6 +348,7 @@ void free_structure_data(pwr_ctx_t *ctx) {
         free(ctx->phys_islands[i]);
     }
     free(ctx->phys_islands);
+    free(ctx->cpu_islands);
     ctx->error = PWR_OK;
 }
 
@@ -303,12 +385,237 @@ gboolean phys_island_deep_eq(const phys_island_t* i0, const phys_island_t* i1) {
 /**
   * Compares two CPU ID
   *
-  * @param i0  CPU ID to compare
-  * @param i1  CPU ID to compare
+  * @param i0  Pointer to the CPU ID to compare
+  * @param i1  Pointer to the CPU ID to compare
   * 
   * @return A negative value if i0 is before i1, 0 if they are equal, or a
   *  positive value otherwise.
   */
-gint compare_phys_cpu_id(unsigned long i0, unsigned long i1) {
-    return i0 - i1;
+gint compare_phys_cpu_id(gconstpointer i0, gconstpointer i1) {
+    unsigned long a = *(const unsigned long *) i0;
+    unsigned long b = *(const unsigned long *) i1;
+
+    return (a > b) - (a < b);
+}
+
+/**
+  * Sets the core type, the highest frequency and the capacity of every island,
+  * from its first CPU.
+  *
+  * The capacities come from the kernel when it provides them. Otherwise they
+  * are estimated from the core types and the highest frequencies. They are
+  * scaled so that the fastest island has a capacity of PWR_SPEED_SCALE.
+  */
+void set_capacities(pwr_ctx_t *ctx) {
+    bool from_kernel = true;
+    double max_capacity = 0;
+    double capacities[ctx->num_phys_islands];
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        unsigned long cpu = pi->cpus[0];
+        long long value;
+
+        pi->core_type = core_type(ctx, cpu);
+
+        pi->max_freq = read_cpufreq_ll(ctx, cpu, "cpuinfo_max_freq", &value) ?
+            value : 0;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path),
+            "%s/devices/system/cpu/cpu%lu/cpu_capacity", ctx->sysfs_root, cpu);
+        if (read_sysfs_file_ll(path, &value) && value > 0) {
+            capacities[i] = value;
+        } else {
+            from_kernel = false;
+        }
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+
+        if (!from_kernel) {
+            capacities[i] = pi->max_freq > 0 ? pi->max_freq : 1;
+            if (pi->core_type == PWR_CORE_EFFICIENCY) {
+                capacities[i] *= EFFICIENCY_CORE_IPC;
+            }
+        }
+        if (capacities[i] > max_capacity) {
+            max_capacity = capacities[i];
+        }
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        ctx->phys_islands[i]->capacity =
+            capacities[i] * PWR_SPEED_SCALE / max_capacity + 0.5;
+    }
+}
+
+/**
+  * Finds the type of a core, from the perf PMUs of hybrid processors or from
+  * CPUID, run on the CPU.
+  */
+pwr_core_type_t core_type(pwr_ctx_t *ctx, unsigned long cpu) {
+    bool found = false;
+
+    if (cpu_in_list(ctx, PMU_CORE_CPUS, cpu, &found)) {
+        return PWR_CORE_PERFORMANCE;
+    }
+    if (cpu_in_list(ctx, PMU_ATOM_CPUS, cpu, &found)) {
+        return PWR_CORE_EFFICIENCY;
+    }
+    if (found) {
+        return PWR_CORE_UNKNOWN;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    cpu_set_t saved, set;
+
+    // only hybrid processors have the core type leaf
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+        !(edx & (1U << 15)))
+    {
+        return PWR_CORE_UNKNOWN;
+    }
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) != 0) {
+        return PWR_CORE_UNKNOWN;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return PWR_CORE_UNKNOWN;
+    }
+
+    pwr_core_type_t type = PWR_CORE_UNKNOWN;
+    if (__get_cpuid_count(CPUID_HYBRID_LEAF, 0, &eax, &ebx, &ecx, &edx)) {
+        switch (eax >> 24) {
+            case CPUID_CORE_TYPE_CORE: type = PWR_CORE_PERFORMANCE; break;
+            case CPUID_CORE_TYPE_ATOM: type = PWR_CORE_EFFICIENCY; break;
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+
+    return type;
+#else
+    return PWR_CORE_UNKNOWN;
+#endif
+}
+
+/**
+  * Reads a CPU list file, e.g. "0-7,16", under the sysfs root.
+  *
+  * @param name The file path, relative to the sysfs root.
+  * @param list[out] The list, of SYSFS_ATTR_SIZE bytes.
+  *
+  * @return False if the file cannot be read.
+  */
+bool read_cpu_list(pwr_ctx_t *ctx, const char *name, char *list) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s%s", ctx->sysfs_root, name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t len = pread(fd, list, SYSFS_ATTR_SIZE - 1, 0);
+    close(fd);
+    if (len < 0) {
+        return false;
+    }
+    list[len] = '\0';
+
+    return true;
+}
+
+/**
+  * Parses the next range of a CPU list, a single CPU being a range of one.
+  *
+  * @param list[in,out] Where to start, moved past the range.
+  *
+  * @return False at the end of the list.
+  */
+bool next_cpu_range(char **list, unsigned long *first, unsigned long *last) {
+    char *p = *list + strspn(*list, ",\n ");
+    char *end;
+
+    *first = strtoul(p, &end, 10);
+    if (end == p) {
+        return false;
+    }
+    *last = *end == '-' ? strtoul(end + 1, &end, 10) : *first;
+    *list = end;
+
+    return true;
+}
+
+/**
+  * Tests if a CPU is in a CPU list file.
+  *
+  * @param found[out] Set to true if the file exists.
+  *
+  * @return True if the CPU is listed.
+  */
+bool cpu_in_list(pwr_ctx_t *ctx, const char *name, unsigned long cpu,
+    bool *found)
+{
+    char list[SYSFS_ATTR_SIZE];
+    unsigned long first, last;
+
+    if (!read_cpu_list(ctx, name, list)) {
+        return false;
+    }
+    *found = true;
+
+    for (char *p = list; next_cpu_range(&p, &first, &last);) {
+        if (first <= cpu && cpu <= last) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+  * Counts the CPUs of a CPU list file.
+  *
+  * @return The number of CPUs, 0 if the file cannot be read.
+  */
+unsigned long num_listed_cpus(pwr_ctx_t *ctx, const char *name) {
+    char list[SYSFS_ATTR_SIZE];
+    unsigned long first, last, num = 0;
+
+    if (!read_cpu_list(ctx, name, list)) {
+        return 0;
+    }
+
+    for (char *p = list; next_cpu_range(&p, &first, &last);) {
+        num += last >= first ? last - first + 1 : 0;
+    }
+
+    return num;
+}
+
+/**
+  * Parses a space separated list of CPU ids.
+  *
+  * @param cpus[out] Filled with the ids if not NULL.
+  *
+  * @return The number of ids.
+  */
+unsigned int parse_cpu_ids(const char *list, unsigned long *cpus) {
+    unsigned int num = 0;
+    char *end;
+
+    for (const char *p = list; ; p = end) {
+        unsigned long cpu = strtoul(p, &end, 10);
+        if (end == p) {
+            return num;
+        }
+        if (cpus != NULL) {
+            cpus[num] = cpu;
+        }
+        ++num;
+    }
 }
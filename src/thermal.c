@@ -0,0 +1,656 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Where the hardware monitoring devices are listed, under the sysfs root */
+#define HWMON_DIR "/class/hwmon"
+
+/** Digital thermal sensor, in degrees under the critical temperature */
+#define MSR_IA32_THERM_STATUS 0x19C
+
+/** Critical temperature (TjMax) */
+#define MSR_TEMPERATURE_TARGET 0x1A2
+
+/** Critical temperature assumed when it cannot be read, in C */
+#define DEFAULT_CRITICAL 100.0
+
+/** Margin under the critical temperature of the default cap, in C */
+#define DEFAULT_CAP_MARGIN 5.0
+
+/** How much an island must cool under its cap before being raised, in C */
+#define CAP_HYSTERESIS 3.0
+
+/* A coretemp sensor found while scanning hwmon */
+typedef struct {
+    long package;
+    long core;              // -1 for a package sensor
+    char input[PATH_MAX];   // the temp*_input file
+    double critical;        // in C, 0 if unknown
+} sensor_t;
+
+/* Thermal state of one island */
+typedef struct {
+    /* Open temp*_input files, empty to read the MSR of every CPU instead */
+    unsigned int num_sensors;
+    int *sensor_fds;
+
+    /* Critical temperature, in C */
+    double critical;
+
+    /* Temperature cap, in C */
+    double cap;
+
+    /* Fastest speed level allowed, accessed atomically */
+    unsigned int ceiling;
+
+    /* Last speed level requested, accessed atomically */
+    unsigned int requested;
+
+    /* When the island was capped, in ns, 0 if not capped */
+    uint64_t capped_since;
+} thermal_island_t;
+
+/* Thermal state */
+struct thermal {
+    /* Per-island state */
+    thermal_island_t *islands;
+
+    /* Protects the report */
+    pthread_mutex_t lock;
+    pwr_thermal_report_t report;
+
+    /* Is the controller running? */
+    bool running;
+    pthread_t thread;
+    uint64_t period_ns;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static unsigned long find_sensors(pwr_ctx_t *ctx, sensor_t **sensors);
+static bool read_temperature(pwr_ctx_t *ctx, unsigned long island,
+    double *temperature);
+static void *thermal_thread(void *arg);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+double pwr_temperature(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_temperature, island, 0);
+    double temperature;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (ctx->thermal == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    if (!read_temperature(ctx, island, &temperature)) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return temperature;
+}
+
+double pwr_critical_temperature(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_critical_temperature, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (ctx->thermal == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->thermal->islands[island].critical;
+}
+
+void pwr_thermal_cap_start(pwr_ctx_t *ctx, double cap, double period) {
+    TRACE_CALL(ctx, pwr_thermal_cap_start, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->thermal == NULL || !pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    struct thermal *th = ctx->thermal;
+    if (th->running) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    if (cap < 0 || period <= 0) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    // the controller needs a temperature for every island
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        double temperature;
+        if (!read_temperature(ctx, i, &temperature)) {
+            ctx->error = PWR_UNAVAILABLE;
+            return;
+        }
+    }
+
+    memset(&th->report, 0, sizeof(th->report));
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        thermal_island_t *ti = &th->islands[i];
+        phys_island_t *pi = ctx->phys_islands[i];
+
+        ti->cap = cap > 0 ? cap : ti->critical - DEFAULT_CAP_MARGIN;
+        ti->capped_since = 0;
+        __atomic_store_n(&ti->ceiling, pi->max_speed_level, __ATOMIC_RELAXED);
+        __atomic_store_n(&ti->requested, pi->current_speed_level,
+            __ATOMIC_RELAXED);
+    }
+
+    th->period_ns = period * 1e9;
+    __atomic_store_n(&th->running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&th->thread, NULL, &thermal_thread, ctx)) {
+        th->running = false;
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_thermal_cap_stop(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_thermal_cap_stop, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct thermal *th = ctx->thermal;
+    if (th == NULL || !th->running) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    // Lift the caps and restore the requested levels. Clearing the flag with
+    // the DVFS lock held keeps the thread from writing a level afterwards.
+    ctx->error = PWR_OK;
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    __atomic_store_n(&th->running, false, __ATOMIC_RELEASE);
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        unsigned int requested =
+            __atomic_load_n(&th->islands[i].requested, __ATOMIC_RELAXED);
+        if (requested != (unsigned int) pi->current_speed_level) {
+            pwr_err_t err = write_speed_level(ctx, i, requested);
+            if (err != PWR_OK) {
+                ctx->error = err;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+    pthread_join(th->thread, NULL);
+
+    uint64_t now = monotonic_ns();
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        thermal_island_t *ti = &th->islands[i];
+
+        if (ti->capped_since != 0) {
+            th->report.capped_time += (now - ti->capped_since) / 1e9;
+            ti->capped_since = 0;
+        }
+    }
+}
+
+void pwr_thermal_report(pwr_ctx_t *ctx, pwr_thermal_report_t *report) {
+    TRACE_CALL(ctx, pwr_thermal_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->thermal == NULL || report == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->thermal->lock);
+    *report = ctx->thermal->report;
+    pthread_mutex_unlock(&ctx->thermal->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_thermal(pwr_ctx_t *ctx) {
+    sensor_t *sensors = NULL;
+    uint64_t target;
+
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
+
+    unsigned long num_sensors = find_sensors(ctx, &sensors);
+
+    struct thermal *th = calloc(1, sizeof(*th));
+    pthread_mutex_init(&th->lock, NULL);
+    th->islands = calloc(ctx->num_phys_islands, sizeof(*th->islands));
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        thermal_island_t *ti = &th->islands[i];
+        bool used[num_sensors + 1];
+        long packages[pi->num_cpu];
+        bool has_core = false;
+
+        memset(used, 0, sizeof(used));
+        ti->critical = 0;
+
+        // prefer the sensors of the cores of the island
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            char path[PATH_MAX];
+            long long package = -1, core = -1;
+
+            snprintf(path, sizeof(path),
+                "%s/devices/system/cpu/cpu%lu/topology/physical_package_id",
+                ctx->sysfs_root, pi->cpus[c]);
+            read_sysfs_file_ll(path, &package);
+            snprintf(path, sizeof(path),
+                "%s/devices/system/cpu/cpu%lu/topology/core_id",
+                ctx->sysfs_root, pi->cpus[c]);
+            read_sysfs_file_ll(path, &core);
+            packages[c] = package;
+
+            for (unsigned long s = 0; s < num_sensors; ++s) {
+                if (sensors[s].package == package && sensors[s].core == core) {
+                    used[s] = true;
+                    has_core = true;
+                }
+            }
+        }
+
+        // else the sensors of its packages, which give the critical
+        // temperature in both cases
+        for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+            for (unsigned long s = 0; s < num_sensors; ++s) {
+                if (sensors[s].package != packages[c] || sensors[s].core >= 0) {
+                    continue;
+                }
+                if (sensors[s].critical > 0) {
+                    ti->critical = sensors[s].critical;
+                }
+                if (!has_core) {
+                    used[s] = true;
+                }
+            }
+        }
+
+        ti->sensor_fds = calloc(num_sensors + 1, sizeof(*ti->sensor_fds));
+        for (unsigned long s = 0; s < num_sensors; ++s) {
+            int fd;
+            if (used[s] && (fd = open(sensors[s].input, O_RDONLY)) >= 0) {
+                ti->sensor_fds[ti->num_sensors++] = fd;
+                if (ti->critical == 0 && sensors[s].critical > 0) {
+                    ti->critical = sensors[s].critical;
+                }
+            }
+        }
+
+        if (ti->critical == 0) {
+            ti->critical = read_msr(ctx, pi->cpus[0], MSR_TEMPERATURE_TARGET,
+                &target) && ((target >> 16) & 0xff) != 0 ?
+                (double) ((target >> 16) & 0xff) : DEFAULT_CRITICAL;
+        }
+    }
+
+    free(sensors);
+    ctx->thermal = th;
+}
+
+void free_thermal(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->thermal == NULL) {
+        return;
+    }
+
+    if (ctx->thermal->running) {
+        pwr_thermal_cap_stop(ctx);
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        thermal_island_t *ti = &ctx->thermal->islands[i];
+        for (unsigned int s = 0; s < ti->num_sensors; ++s) {
+            close(ti->sensor_fds[s]);
+        }
+        free(ti->sensor_fds);
+    }
+
+    pthread_mutex_destroy(&ctx->thermal->lock);
+    free(ctx->thermal->islands);
+    free(ctx->thermal);
+    ctx->thermal = NULL;
+}
+
+unsigned int thermal_clamp(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level)
+{
+    if (ctx->thermal == NULL ||
+        !__atomic_load_n(&ctx->thermal->running, __ATOMIC_ACQUIRE))
+    {
+        return level;
+    }
+
+    thermal_island_t *ti = &ctx->thermal->islands[island];
+    __atomic_store_n(&ti->requested, level, __ATOMIC_RELAXED);
+
+    unsigned int ceiling = __atomic_load_n(&ti->ceiling, __ATOMIC_RELAXED);
+    return level < ceiling ? level : ceiling;
+}
+
+bool thermal_capped(pwr_ctx_t *ctx, unsigned long island, unsigned int level) {
+    if (ctx->thermal == NULL ||
+        !__atomic_load_n(&ctx->thermal->running, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    thermal_island_t *ti = &ctx->thermal->islands[island];
+    return level > __atomic_load_n(&ti->ceiling, __ATOMIC_RELAXED);
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Lists the coretemp sensors. The package of the sensors of a hwmon device
+  * is given by its "Package id" sensor.
+  *
+  * @param ctx The current library context.
+  * @param sensors[out] The sensors found, to be freed.
+  *
+  * @return How many sensors were found.
+  */
+unsigned long find_sensors(pwr_ctx_t *ctx, sensor_t **sensors) {
+    char path[PATH_MAX], label[64];
+    unsigned long num_sensors = 0;
+    struct dirent *hwmon, *entry;
+
+    *sensors = NULL;
+
+    snprintf(path, sizeof(path), "%s" HWMON_DIR, ctx->sysfs_root);
+    DIR *hwmon_dir = opendir(path);
+    if (hwmon_dir == NULL) {
+        return 0;
+    }
+
+    while ((hwmon = readdir(hwmon_dir)) != NULL) {
+        if (hwmon->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s" HWMON_DIR "/%s/name",
+            ctx->sysfs_root, hwmon->d_name);
+        FILE *name_file = fopen(path, "r");
+        if (name_file == NULL) {
+            continue;
+        }
+        bool coretemp = fgets(label, sizeof(label), name_file) != NULL &&
+            strncmp(label, "coretemp", 8) == 0;
+        fclose(name_file);
+        if (!coretemp) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s" HWMON_DIR "/%s", ctx->sysfs_root,
+            hwmon->d_name);
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            continue;
+        }
+
+        unsigned long first = num_sensors;
+        long package = -1;
+        while ((entry = readdir(dir)) != NULL) {
+            unsigned int index;
+            char suffix[8];
+            long id;
+
+            if (sscanf(entry->d_name, "temp%u_%7s", &index, suffix) != 2 ||
+                strcmp(suffix, "label") != 0)
+            {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "%s" HWMON_DIR "/%s/%s",
+                ctx->sysfs_root, hwmon->d_name, entry->d_name);
+            FILE *label_file = fopen(path, "r");
+            if (label_file == NULL) {
+                continue;
+            }
+            bool has_label = fgets(label, sizeof(label), label_file) != NULL;
+            fclose(label_file);
+            if (!has_label) {
+                continue;
+            }
+
+            sensor_t sensor = { .package = -1, .core = -1, .critical = 0 };
+            if (sscanf(label, "Package id %ld", &id) == 1) {
+                package = id;
+            } else if (sscanf(label, "Core %ld", &id) == 1) {
+                sensor.core = id;
+            } else {
+                continue;
+            }
+
+            long long crit;
+            snprintf(path, sizeof(path), "%s" HWMON_DIR "/%s/temp%u_crit",
+                ctx->sysfs_root, hwmon->d_name, index);
+            if (read_sysfs_file_ll(path, &crit)) {
+                sensor.critical = crit / 1000.0;
+            }
+            snprintf(sensor.input, sizeof(sensor.input),
+                "%s" HWMON_DIR "/%s/temp%u_input", ctx->sysfs_root,
+                hwmon->d_name, index);
+
+            *sensors = realloc(*sensors, (num_sensors + 1) * sizeof(**sensors));
+            (*sensors)[num_sensors++] = sensor;
+        }
+        closedir(dir);
+
+        // single package machines may have no package sensor
+        for (unsigned long s = first; s < num_sensors; ++s) {
+            (*sensors)[s].package = package >= 0 ? package : 0;
+        }
+    }
+
+    closedir(hwmon_dir);
+    return num_sensors;
+}
+
+/**
+  * Reads the hottest sensor of an island. The MSR of every CPU is read when
+  * the island has no hwmon sensor.
+  *
+  * @return True if a temperature was read.
+  */
+bool read_temperature(pwr_ctx_t *ctx, unsigned long island,
+    double *temperature)
+{
+    thermal_island_t *ti = &ctx->thermal->islands[island];
+    phys_island_t *pi = ctx->phys_islands[island];
+    bool found = false;
+
+    *temperature = -273.15;
+
+    for (unsigned int s = 0; s < ti->num_sensors; ++s) {
+        long long millidegrees;
+        stats_io(ctx, PWR_MODULE_DVFS, 1, 0);
+        if (read_sysfs_ll(ti->sensor_fds[s], &millidegrees)) {
+            found = true;
+            if (millidegrees / 1000.0 > *temperature) {
+                *temperature = millidegrees / 1000.0;
+            }
+        }
+    }
+
+    if (ti->num_sensors > 0) {
+        return found;
+    }
+
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        uint64_t status;
+
+        // bit 31: reading valid, bits 22:16: degrees under the critical one
+        if (read_msr(ctx, pi->cpus[c], MSR_IA32_THERM_STATUS, &status) &&
+            (status & (1ULL << 31)))
+        {
+            double t = ti->critical - ((status >> 16) & 0x7f);
+            found = true;
+            if (t > *temperature) {
+                *temperature = t;
+            }
+        }
+    }
+
+    return found;
+}
+
+/**
+  * Samples the temperature of the islands periodically. An island reaching its
+  * cap has its fastest speed level lowered by one step per period, and raised
+  * by one step per period once it cooled down.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *thermal_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct thermal *th = ctx->thermal;
+    uint64_t next = monotonic_ns();
+
+    while (__atomic_load_n(&th->running, __ATOMIC_ACQUIRE)) {
+        next += th->period_ns;
+        struct timespec ts = {
+            .tv_sec = next / 1000000000ULL,
+            .tv_nsec = next % 1000000000ULL
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            thermal_island_t *ti = &th->islands[i];
+            phys_island_t *pi = ctx->phys_islands[i];
+            double t;
+
+            if (!read_temperature(ctx, i, &t)) {
+                continue;
+            }
+
+            unsigned int ceiling =
+                __atomic_load_n(&ti->ceiling, __ATOMIC_RELAXED);
+            unsigned int current = pi->current_speed_level;
+            unsigned int new_ceiling = ceiling;
+
+            if (t >= ti->cap) {
+                new_ceiling = current < ceiling ? current : ceiling;
+                if (new_ceiling > (unsigned int) pi->min_speed_level) {
+                    --new_ceiling;
+                }
+            } else if (t < ti->cap - CAP_HYSTERESIS &&
+                ceiling < (unsigned int) pi->max_speed_level)
+            {
+                ++new_ceiling;
+            }
+
+            uint64_t now = monotonic_ns();
+            pthread_mutex_lock(&th->lock);
+            ++th->report.samples;
+            if (t > th->report.max_temperature) {
+                th->report.max_temperature = t;
+            }
+            if (new_ceiling < ceiling) {
+                ++th->report.lowerings;
+                if (ti->capped_since == 0) {
+                    ti->capped_since = now;
+                }
+            } else if (new_ceiling == (unsigned int) pi->max_speed_level &&
+                ti->capped_since != 0)
+            {
+                th->report.capped_time += (now - ti->capped_since) / 1e9;
+                ti->capped_since = 0;
+            }
+            pthread_mutex_unlock(&th->lock);
+
+            if (new_ceiling == ceiling) {
+                continue;
+            }
+
+            // the requested level is read with the lock held, so that a
+            // concurrent request is not overwritten, and clamped to the new
+            // ceiling by write_speed_level(). Nothing is written once the
+            // controller is stopped.
+            __atomic_store_n(&ti->ceiling, new_ceiling, __ATOMIC_RELAXED);
+            pthread_mutex_lock(&ctx->dvfs_lock);
+            unsigned int requested =
+                __atomic_load_n(&ti->requested, __ATOMIC_RELAXED);
+            unsigned int target =
+                requested < new_ceiling ? requested : new_ceiling;
+            if (__atomic_load_n(&th->running, __ATOMIC_ACQUIRE) &&
+                target != (unsigned int) pi->current_speed_level)
+            {
+                write_speed_level(ctx, i, requested);
+            }
+            pthread_mutex_unlock(&ctx->dvfs_lock);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,348 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Calls buffered per thread */
+#define TRACE_BUFFER 4096
+
+/** Time between two writes of the buffered calls, in ns */
+#define FLUSH_PERIOD 100000000ULL
+
+/** Names of the traced functions */
+static const char *function_names[NB_TRACE_FUNCTIONS] = {
+#define X(name, module) #name,
+    TRACE_FUNCTIONS
+#undef X
+};
+
+/** Generation of the last tracer started, identifies the tracers */
+static uint64_t last_generation;
+
+/** Buffer of the calling thread in the tracer of its generation */
+static __thread struct trace_buffer *thread_buffer;
+static __thread uint64_t thread_generation;
+
+/* A recorded call */
+typedef struct {
+    /* When the call started, in ns */
+    uint64_t start_ns;
+
+    /* How long the call took, in ns */
+    uint64_t duration_ns;
+
+    /* The island of the call, or TRACE_NO_ISLAND */
+    unsigned long island;
+
+    /* The main argument of the call */
+    long long arg;
+
+    /* The called function */
+    enum trace_function function;
+
+    /* The context error after the call */
+    pwr_err_t result;
+} trace_event_t;
+
+/* Calls of one thread, written by the thread and read by the tracer */
+struct trace_buffer {
+    /* Next buffer of the tracer */
+    struct trace_buffer *next;
+
+    /* The thread ID */
+    long tid;
+
+    /* Calls recorded, written by the thread only */
+    uint64_t head;
+
+    /* Calls written to the file, written by the tracer only */
+    uint64_t tail;
+
+    /* Calls dropped because the buffer was full */
+    unsigned long dropped;
+
+    /* The calls, a ring indexed by head and tail */
+    trace_event_t events[TRACE_BUFFER];
+};
+
+/* Tracer state */
+struct tracer {
+    /* Distinguishes the tracer from the ones before */
+    uint64_t generation;
+
+    /* The trace file */
+    FILE *file;
+
+    /* Is the writing thread running? */
+    bool running;
+
+    /* The writing thread */
+    pthread_t thread;
+
+    /* Protects the buffer list and the file */
+    pthread_mutex_t lock;
+
+    /* Buffers of the threads that made calls */
+    struct trace_buffer *buffers;
+
+    /* When tracing started, in ns */
+    uint64_t start_ns;
+
+    /* How many calls were written */
+    unsigned long written;
+
+    /* Next stopped tracer */
+    struct tracer *next;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void *trace_thread(void *arg);
+static void write_buffers(struct tracer *tr);
+static void write_event(struct tracer *tr, long tid,
+    const trace_event_t *event);
+static void free_tracer(struct tracer *tr);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_trace_start(pwr_ctx_t *ctx, const char *path) {
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->tracer != NULL) {
+        ctx->error = PWR_ALREADY_INITIALIZED;
+        return;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        if (ctx->err_fd) {
+            fprintf(ctx->err_fd, "Cannot create the trace %s\n", path);
+        }
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    struct tracer *tr = calloc(1, sizeof(*tr));
+    tr->generation = __atomic_add_fetch(&last_generation, 1, __ATOMIC_RELAXED);
+    tr->file = file;
+    pthread_mutex_init(&tr->lock, NULL);
+    tr->start_ns = monotonic_ns();
+    tr->running = true;
+
+    if (pthread_create(&tr->thread, NULL, &trace_thread, tr)) {
+        tr->running = false;
+        free_tracer(tr);
+        ctx->error = PWR_ERR;
+        return;
+    }
+
+    __atomic_store_n(&ctx->tracer, tr, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&ctx->instrument, INSTRUMENT_TRACE, __ATOMIC_RELEASE);
+    ctx->error = PWR_OK;
+}
+
+void pwr_trace_stop(pwr_ctx_t *ctx) {
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    struct tracer *tr = ctx->tracer;
+    if (tr == NULL) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    __atomic_and_fetch(&ctx->instrument, ~INSTRUMENT_TRACE, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->tracer, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&tr->running, false, __ATOMIC_RELEASE);
+    pthread_join(tr->thread, NULL);
+
+    // calls still in progress may use the buffers until finalization
+    write_buffers(tr);
+    unsigned long dropped = 0;
+    for (struct trace_buffer *buf = tr->buffers; buf != NULL; buf = buf->next) {
+        dropped += __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED);
+    }
+    fprintf(tr->file, "\n],\"displayTimeUnit\":\"ns\","
+        "\"otherData\":{\"dropped_calls\":\"%lu\"}}\n", dropped);
+    ctx->error = fclose(tr->file) == 0 ? PWR_OK : PWR_ERR;
+    tr->file = NULL;
+
+    tr->next = ctx->retired_tracers;
+    ctx->retired_tracers = tr;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void trace_record(const trace_scope_t *scope) {
+    struct tracer *tr = scope->tracer;
+    uint64_t end_ns = monotonic_ns();
+    struct trace_buffer *buf = thread_buffer;
+
+    // the thread may alternate between the tracers of several contexts,
+    // its buffer in this tracer is then reused, otherwise it is created
+    if (thread_generation != tr->generation) {
+        long tid = syscall(SYS_gettid);
+
+        pthread_mutex_lock(&tr->lock);
+        buf = tr->buffers;
+        while (buf != NULL && buf->tid != tid) {
+            buf = buf->next;
+        }
+        if (buf == NULL) {
+            buf = calloc(1, sizeof(*buf));
+            if (buf == NULL) {
+                pthread_mutex_unlock(&tr->lock);
+                return;
+            }
+            buf->tid = tid;
+            buf->next = tr->buffers;
+            tr->buffers = buf;
+        }
+        pthread_mutex_unlock(&tr->lock);
+
+        thread_buffer = buf;
+        thread_generation = tr->generation;
+    }
+
+    uint64_t head = buf->head;
+    if (head - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE) == TRACE_BUFFER) {
+        __atomic_fetch_add(&buf->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    trace_event_t *event = &buf->events[head % TRACE_BUFFER];
+    event->start_ns = scope->start_ns;
+    event->duration_ns = end_ns - scope->start_ns;
+    event->island = scope->island;
+    event->arg = scope->arg;
+    event->function = scope->function;
+    event->result = scope->ctx->error;
+    __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void free_tracers(pwr_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    if (ctx->tracer != NULL) {
+        pwr_trace_stop(ctx);
+    }
+
+    while (ctx->retired_tracers != NULL) {
+        struct tracer *tr = ctx->retired_tracers;
+        ctx->retired_tracers = tr->next;
+        free_tracer(tr);
+    }
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Main loop of the writing thread.
+  *
+  * @param arg The tracer.
+  *
+  * @return NULL.
+  */
+void *trace_thread(void *arg) {
+    struct tracer *tr = arg;
+    uint64_t next = tr->start_ns;
+
+    while (__atomic_load_n(&tr->running, __ATOMIC_ACQUIRE)) {
+        next += FLUSH_PERIOD;
+        struct timespec ts = {
+            .tv_sec = next / 1000000000ULL,
+            .tv_nsec = next % 1000000000ULL
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        write_buffers(tr);
+    }
+
+    return NULL;
+}
+
+/**
+  * Writes the calls recorded in every buffer to the trace file.
+  */
+void write_buffers(struct tracer *tr) {
+    pthread_mutex_lock(&tr->lock);
+    for (struct trace_buffer *buf = tr->buffers; buf != NULL; buf = buf->next) {
+        uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+
+        for (uint64_t tail = buf->tail; tail < head; ++tail) {
+            write_event(tr, buf->tid, &buf->events[tail % TRACE_BUFFER]);
+        }
+        __atomic_store_n(&buf->tail, head, __ATOMIC_RELEASE);
+    }
+    fflush(tr->file);
+    pthread_mutex_unlock(&tr->lock);
+}
+
+/**
+  * Writes a call as a complete event. Times are in us, as the format expects.
+  * Called with the tracer lock held.
+  */
+void write_event(struct tracer *tr, long tid, const trace_event_t *event) {
+    int64_t start = event->start_ns - tr->start_ns;
+
+    fprintf(tr->file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+        "\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,\"args\":{",
+        tr->written++ > 0 ? ",\n" : "", function_names[event->function],
+        start / 1e3, event->duration_ns / 1e3, (int) getpid(), tid);
+    if (event->island != TRACE_NO_ISLAND) {
+        fprintf(tr->file, "\"island\":%lu,", event->island);
+    }
+    fprintf(tr->file, "\"arg\":%lld,\"result\":%d}}", event->arg,
+        event->result);
+}
+
+/**
+  * Releases a stopped tracer and its buffers.
+  */
+void free_tracer(struct tracer *tr) {
+    if (tr->file != NULL) {
+        fclose(tr->file);
+    }
+
+    while (tr->buffers != NULL) {
+        struct trace_buffer *buf = tr->buffers;
+        tr->buffers = buf->next;
+        free(buf);
+    }
+    pthread_mutex_destroy(&tr->lock);
+    free(tr);
+}
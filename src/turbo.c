@@ -0,0 +1,460 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Node-wide boost switches, 1 when turbo is allowed */
+#define CPUFREQ_BOOST "/sys/devices/system/cpu/cpufreq/boost"
+
+/** intel_pstate switch, 1 when turbo is forbidden */
+#define PSTATE_NO_TURBO "/sys/devices/system/cpu/intel_pstate/no_turbo"
+
+/** Turbo disable bit of IA32_MISC_ENABLE */
+#define MSR_IA32_MISC_ENABLE 0x1A0
+#define MISC_ENABLE_TURBO_DISABLE (1ULL << 38)
+
+/** Maximum non-turbo ratio, bits 15:8 */
+#define MSR_PLATFORM_INFO 0xCE
+
+/** Maximum turbo ratio with one active core, bits 7:0 */
+#define MSR_TURBO_RATIO_LIMIT 0x1AD
+
+/** Cycles counted at the actual and at the nominal frequency while active */
+#define MSR_IA32_MPERF 0xE7
+#define MSR_IA32_APERF 0xE8
+
+/** The bus clock, multiplied by the ratios to get frequencies, in KHz */
+#define BUS_CLOCK 100000
+
+/** How far above the nominal frequency cpufreq lists the turbo level, in KHz */
+#define TURBO_LEVEL_OFFSET 1000
+
+/* How turbo is switched on and off */
+typedef enum {
+    BOOST_NONE,
+    BOOST_CPUFREQ,
+    BOOST_PSTATE,
+    BOOST_MSR
+} boost_control_t;
+
+/* Turbo state of one island */
+typedef struct {
+    /* Has the island a turbo level? */
+    bool has_turbo;
+
+    /* Nominal and maximal turbo frequencies, in KHz */
+    freq_t nominal;
+    freq_t max;
+
+    /* Frequency at which MPERF counts, in KHz */
+    freq_t mperf_freq;
+
+    /* Counters summed over the CPUs at the previous measure */
+    uint64_t last_aperf;
+    uint64_t last_mperf;
+} turbo_island_t;
+
+/* Turbo state */
+struct turbo {
+    turbo_island_t *islands;
+
+    boost_control_t control;
+
+    /* Setting when the library was initialized */
+    bool initial_enabled;
+
+    /* Was the setting changed by the library? */
+    bool changed;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool read_enabled(pwr_ctx_t *ctx, boost_control_t control,
+    bool *enabled);
+static pwr_err_t write_enabled(pwr_ctx_t *ctx, boost_control_t control,
+    bool enabled);
+static bool read_sysfs_flag(pwr_ctx_t *ctx, const char *path, bool *value);
+static bool write_sysfs_flag(pwr_ctx_t *ctx, const char *path, bool value);
+static bool read_perf_counters(pwr_ctx_t *ctx, unsigned long island,
+    uint64_t *aperf, uint64_t *mperf);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+unsigned int pwr_turbo_level(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_turbo_level, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    if (!ctx->turbo->islands[island].has_turbo) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->phys_islands[island]->max_speed_level;
+}
+
+void pwr_turbo_range(pwr_ctx_t *ctx, unsigned long island, freq_t *nominal,
+    freq_t *max)
+{
+    TRACE_CALL(ctx, pwr_turbo_range, island, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    turbo_island_t *ti = &ctx->turbo->islands[island];
+    if (!ti->has_turbo) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    *nominal = ti->nominal;
+    *max = ti->max;
+    ctx->error = PWR_OK;
+}
+
+void pwr_enable_turbo(pwr_ctx_t *ctx, bool enable) {
+    TRACE_CALL(ctx, pwr_enable_turbo, TRACE_NO_ISLAND, enable);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (ctx->turbo->control == BOOST_NONE) {
+        ctx->error = PWR_UNAVAILABLE;
+        return;
+    }
+
+    ctx->error = write_enabled(ctx, ctx->turbo->control, enable);
+    if (ctx->error == PWR_OK) {
+        ctx->turbo->changed = true;
+    }
+}
+
+bool pwr_turbo_enabled(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_turbo_enabled, TRACE_NO_ISLAND, 0);
+    bool enabled;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return false;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return false;
+    }
+
+    if (!read_enabled(ctx, ctx->turbo->control, &enabled)) {
+        ctx->error = PWR_UNAVAILABLE;
+        return false;
+    }
+
+    ctx->error = PWR_OK;
+    return enabled;
+}
+
+freq_t pwr_effective_frequency(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_effective_frequency, island, 0);
+    uint64_t aperf, mperf;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    if (!read_perf_counters(ctx, island, &aperf, &mperf)) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    turbo_island_t *ti = &ctx->turbo->islands[island];
+    uint64_t delta_aperf = aperf - ti->last_aperf;
+    uint64_t delta_mperf = mperf - ti->last_mperf;
+    ti->last_aperf = aperf;
+    ti->last_mperf = mperf;
+
+    ctx->error = PWR_OK;
+    if (delta_mperf == 0) {
+        return 0;
+    }
+    return (freq_t) ((double) delta_aperf / delta_mperf * ti->mperf_freq);
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_turbo(pwr_ctx_t *ctx) {
+    uint64_t value;
+    bool enabled;
+
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    struct turbo *t = calloc(1, sizeof(*t));
+    t->islands = calloc(ctx->num_phys_islands, sizeof(*t->islands));
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        turbo_island_t *ti = &t->islands[i];
+        unsigned long cpu = pi->cpus[0];
+
+        // cpufreq lists turbo as the nominal frequency plus 1 MHz
+        speed_level_t top = pi->max_speed_level;
+        ti->has_turbo = top > pi->min_speed_level &&
+            pi->freqs[top] - pi->freqs[top - 1] == TURBO_LEVEL_OFFSET;
+        ti->nominal = ti->has_turbo ? pi->freqs[top - 1] : pi->freqs[top];
+
+        // MPERF ticks at the nominal frequency reported by the processor
+        ti->mperf_freq = ti->nominal;
+        if (read_msr(ctx, cpu, MSR_PLATFORM_INFO, &value) &&
+            ((value >> 8) & 0xFF) != 0)
+        {
+            ti->mperf_freq = ((value >> 8) & 0xFF) * BUS_CLOCK;
+        }
+
+        // the highest turbo frequency, from the processor or from cpufreq
+        ti->max = pi->freqs[top];
+        if (pi->max_freq > ti->max) {
+            ti->max = pi->max_freq;
+        }
+        if (ti->has_turbo && read_msr(ctx, cpu, MSR_TURBO_RATIO_LIMIT, &value) &&
+            (freq_t) (value & 0xFF) * BUS_CLOCK > ti->nominal)
+        {
+            ti->max = (value & 0xFF) * BUS_CLOCK;
+        }
+
+        read_perf_counters(ctx, i, &ti->last_aperf, &ti->last_mperf);
+    }
+
+    // pick the first switch that can be read
+    for (t->control = BOOST_CPUFREQ; t->control <= BOOST_MSR; ++t->control) {
+        if (read_enabled(ctx, t->control, &enabled)) {
+            t->initial_enabled = enabled;
+            break;
+        }
+    }
+    if (t->control > BOOST_MSR) {
+        t->control = BOOST_NONE;
+    }
+
+    ctx->turbo = t;
+}
+
+void free_turbo(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->turbo == NULL) {
+        return;
+    }
+
+    if (ctx->turbo->changed &&
+        write_enabled(ctx, ctx->turbo->control, ctx->turbo->initial_enabled) !=
+        PWR_OK && ctx->err_fd)
+    {
+        fprintf(ctx->err_fd, "Failed to restore the turbo setting\n");
+    }
+
+    free(ctx->turbo->islands);
+    free(ctx->turbo);
+    ctx->turbo = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Reads whether turbo is enabled through one of the switches.
+  *
+  * @return True if the switch could be read.
+  */
+bool read_enabled(pwr_ctx_t *ctx, boost_control_t control, bool *enabled) {
+    bool flag;
+    uint64_t misc;
+
+    switch (control) {
+        case BOOST_CPUFREQ:
+            if (!read_sysfs_flag(ctx, CPUFREQ_BOOST, &flag)) {
+                return false;
+            }
+            *enabled = flag;
+            return true;
+
+        case BOOST_PSTATE:
+            if (!read_sysfs_flag(ctx, PSTATE_NO_TURBO, &flag)) {
+                return false;
+            }
+            *enabled = !flag;
+            return true;
+
+        case BOOST_MSR:
+            if (!read_msr(ctx, 0, MSR_IA32_MISC_ENABLE, &misc)) {
+                return false;
+            }
+            *enabled = !(misc & MISC_ENABLE_TURBO_DISABLE);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+  * Enables or disables turbo through one of the switches. The MSR is written
+  * on every CPU.
+  *
+  * @return PWR_OK or PWR_IO_ERR.
+  */
+pwr_err_t write_enabled(pwr_ctx_t *ctx, boost_control_t control, bool enabled)
+{
+    switch (control) {
+        case BOOST_CPUFREQ:
+            return write_sysfs_flag(ctx, CPUFREQ_BOOST, enabled) ? PWR_OK :
+                PWR_IO_ERR;
+
+        case BOOST_PSTATE:
+            return write_sysfs_flag(ctx, PSTATE_NO_TURBO, !enabled) ? PWR_OK :
+                PWR_IO_ERR;
+
+        case BOOST_MSR:
+            for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+                uint64_t misc;
+                if (!read_msr(ctx, cpu, MSR_IA32_MISC_ENABLE, &misc)) {
+                    return PWR_IO_ERR;
+                }
+                misc = enabled ? misc & ~MISC_ENABLE_TURBO_DISABLE :
+                    misc | MISC_ENABLE_TURBO_DISABLE;
+                if (!write_msr(ctx, cpu, MSR_IA32_MISC_ENABLE, misc)) {
+                    return PWR_IO_ERR;
+                }
+            }
+            return PWR_OK;
+
+        default:
+            return PWR_IO_ERR;
+    }
+}
+
+/**
+  * Reads a sysfs file holding "0" or "1".
+  *
+  * @param value[out] Is the flag set?
+  *
+  * @return True if the file could be read.
+  */
+bool read_sysfs_flag(pwr_ctx_t *ctx, const char *path, bool *value) {
+    long long flag;
+
+    stats_io(ctx, PWR_MODULE_DVFS, 1, 0);
+    if (!read_sysfs_file_ll(path, &flag)) {
+        return false;
+    }
+    *value = flag != 0;
+
+    return true;
+}
+
+/**
+  * Writes "0" or "1" to a sysfs file.
+  *
+  * @return True on success.
+  */
+bool write_sysfs_flag(pwr_ctx_t *ctx, const char *path, bool value) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    stats_io(ctx, PWR_MODULE_DVFS, 1, 1);
+    bool ok = write(fd, value ? "1" : "0", 1) == 1;
+    close(fd);
+
+    return ok;
+}
+
+/**
+  * Sums the APERF and MPERF counters of the CPUs of an island.
+  *
+  * @return True if every counter could be read.
+  */
+bool read_perf_counters(pwr_ctx_t *ctx, unsigned long island,
+    uint64_t *aperf, uint64_t *mperf)
+{
+    phys_island_t *pi = ctx->phys_islands[island];
+
+    *aperf = 0;
+    *mperf = 0;
+    for (unsigned long c = 0; c < pi->num_cpu; ++c) {
+        uint64_t a, m;
+
+        if (!read_msr(ctx, pi->cpus[c], MSR_IA32_MPERF, &m) ||
+            !read_msr(ctx, pi->cpus[c], MSR_IA32_APERF, &a))
+        {
+            return false;
+        }
+        *aperf += a;
+        *mperf += m;
+    }
+
+    return true;
+}
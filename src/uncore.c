@@ -0,0 +1,476 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+/** Where the intel_uncore_frequency driver lists the packages and dies */
+#define UNCORE_DIR "/sys/devices/system/cpu/intel_uncore_frequency"
+
+/** Uncore ratio limits: max in bits 6:0, min in bits 14:8 */
+#define MSR_UNCORE_RATIO_LIMIT 0x620
+
+/** Current uncore ratio, bits 6:0 */
+#define MSR_UNCORE_PERF_STATUS 0x621
+
+/** Uncore frequency step, in KHz */
+#define UNCORE_STEP 100000
+
+/* State of one uncore island */
+typedef struct {
+    /* min_freq_khz, max_freq_khz and current_freq_khz, -1 to use the MSRs */
+    int min_fd;
+    int max_fd;
+    int cur_fd;
+
+    /* A CPU of the package, to access its MSRs */
+    unsigned long cpu;
+
+    /* Widest limits allowed, in KHz */
+    freq_t range_min;
+    freq_t range_max;
+
+    /* Limits when the library was initialized, in KHz */
+    freq_t found_min;
+    freq_t found_max;
+
+    /* Current limits, in KHz */
+    freq_t min;
+    freq_t max;
+
+    /* Speed levels, stepping from range_min to range_max */
+    unsigned int num_levels;
+    unsigned int current_level;
+
+    /* Were the limits changed by the library? */
+    bool changed;
+} uncore_island_t;
+
+/* Uncore state */
+struct uncore {
+    unsigned long num_islands;
+    uncore_island_t *islands;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static uncore_island_t *get_island(pwr_ctx_t *ctx, unsigned long island,
+    pwr_err_t *err);
+static void add_island(struct uncore *uc, uncore_island_t *ui);
+static long package_cpu(pwr_ctx_t *ctx, long long package);
+static int open_attr(const char *dir, const char *name, int flags);
+static bool write_freq(pwr_ctx_t *ctx, int fd, freq_t freq);
+static pwr_err_t write_limits(pwr_ctx_t *ctx, uncore_island_t *ui, freq_t min,
+    freq_t max);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+unsigned long pwr_num_uncore_islands(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_num_uncore_islands, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (ctx->uncore == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return ctx->uncore->num_islands;
+}
+
+freq_t pwr_uncore_frequency(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_uncore_frequency, island, 0);
+    pwr_err_t err = PWR_OK;
+    long long freq;
+    uint64_t status;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    uncore_island_t *ui = get_island(ctx, island, &err);
+    if (ui == NULL) {
+        ctx->error = err;
+        return 0;
+    }
+
+    if (ui->cur_fd >= 0) {
+        stats_io(ctx, PWR_MODULE_DVFS, 1, 0);
+        if (read_sysfs_ll(ui->cur_fd, &freq)) {
+            ctx->error = PWR_OK;
+            return freq;
+        }
+    }
+
+    if (read_msr(ctx, ui->cpu, MSR_UNCORE_PERF_STATUS, &status)) {
+        ctx->error = PWR_OK;
+        return (status & 0x7F) * UNCORE_STEP;
+    }
+
+    ctx->error = PWR_UNAVAILABLE;
+    return 0;
+}
+
+void pwr_uncore_limits(pwr_ctx_t *ctx, unsigned long island, freq_t *min,
+    freq_t *max)
+{
+    TRACE_CALL(ctx, pwr_uncore_limits, island, 0);
+    pwr_err_t err = PWR_OK;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    uncore_island_t *ui = get_island(ctx, island, &err);
+    if (ui == NULL) {
+        ctx->error = err;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    *min = ui->min;
+    *max = ui->max;
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_set_uncore_limits(pwr_ctx_t *ctx, unsigned long island, freq_t min,
+    freq_t max)
+{
+    TRACE_CALL(ctx, pwr_set_uncore_limits, island, min);
+    pwr_err_t err = PWR_OK;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    uncore_island_t *ui = get_island(ctx, island, &err);
+    if (ui == NULL) {
+        ctx->error = err;
+        return;
+    }
+
+    if (min > max || min < ui->range_min || max > ui->range_max) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->error = write_limits(ctx, ui, min, max);
+    if (ctx->error == PWR_OK) {
+        // the closest level under the new ceiling
+        ui->current_level = (max - ui->range_min) / UNCORE_STEP;
+    }
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_uncore(pwr_ctx_t *ctx) {
+    char path[320];
+    uint64_t limits;
+
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_STRUCT));
+
+    struct uncore *uc = calloc(1, sizeof(*uc));
+
+    // the driver lists every package and die in a package_XX_die_YY directory
+    struct dirent **entries;
+    int num_entries = scandir(UNCORE_DIR, &entries, NULL, alphasort);
+    for (int e = 0; e < num_entries; ++e) {
+        unsigned int package, die;
+        long long min, max, cur_min, cur_max;
+
+        if (sscanf(entries[e]->d_name, "package_%u_die_%u", &package, &die)
+            == 2)
+        {
+            snprintf(path, sizeof(path), "%s/%s", UNCORE_DIR,
+                entries[e]->d_name);
+
+            uncore_island_t ui = {
+                .min_fd = open_attr(path, "min_freq_khz", O_RDWR),
+                .max_fd = open_attr(path, "max_freq_khz", O_RDWR),
+                .cur_fd = open_attr(path, "current_freq_khz", O_RDONLY),
+            };
+            long cpu = package_cpu(ctx, package);
+            int fd = open_attr(path, "initial_min_freq_khz", O_RDONLY);
+            bool ok = fd >= 0 && read_sysfs_ll(fd, &min);
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = open_attr(path, "initial_max_freq_khz", O_RDONLY);
+            ok = ok && fd >= 0 && read_sysfs_ll(fd, &max);
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            if (ok && cpu >= 0 && ui.min_fd >= 0 && ui.max_fd >= 0 &&
+                read_sysfs_ll(ui.min_fd, &cur_min) &&
+                read_sysfs_ll(ui.max_fd, &cur_max))
+            {
+                ui.cpu = cpu;
+                ui.min = cur_min;
+                ui.max = cur_max;
+                ui.range_min = min;
+                ui.range_max = max;
+                add_island(uc, &ui);
+            } else {
+                if (ui.min_fd >= 0) {
+                    close(ui.min_fd);
+                }
+                if (ui.max_fd >= 0) {
+                    close(ui.max_fd);
+                }
+                if (ui.cur_fd >= 0) {
+                    close(ui.cur_fd);
+                }
+            }
+        }
+        free(entries[e]);
+    }
+    if (num_entries >= 0) {
+        free(entries);
+    }
+
+    // else one island per package, through the MSRs
+    for (unsigned long package = 0; uc->num_islands == package; ++package) {
+        long cpu = package_cpu(ctx, package);
+        if (cpu < 0 || !read_msr(ctx, cpu, MSR_UNCORE_RATIO_LIMIT, &limits)) {
+            break;
+        }
+
+        uncore_island_t ui = {
+            .min_fd = -1, .max_fd = -1, .cur_fd = -1,
+            .cpu = cpu,
+            .min = ((limits >> 8) & 0x7F) * UNCORE_STEP,
+            .max = (limits & 0x7F) * UNCORE_STEP,
+        };
+        ui.range_min = ui.min;
+        ui.range_max = ui.max;
+        add_island(uc, &ui);
+    }
+
+    ctx->uncore = uc;
+}
+
+void free_uncore(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->uncore == NULL) {
+        return;
+    }
+
+    for (unsigned long u = 0; u < ctx->uncore->num_islands; ++u) {
+        uncore_island_t *ui = &ctx->uncore->islands[u];
+
+        if (ui->changed && write_limits(ctx, ui, ui->found_min,
+                ui->found_max) != PWR_OK && ctx->err_fd)
+        {
+            fprintf(ctx->err_fd,
+                "Failed to restore the limits of uncore island %lu\n", u);
+        }
+
+        if (ui->min_fd >= 0) {
+            close(ui->min_fd);
+            close(ui->max_fd);
+        }
+        if (ui->cur_fd >= 0) {
+            close(ui->cur_fd);
+        }
+    }
+
+    free(ctx->uncore->islands);
+    free(ctx->uncore);
+    ctx->uncore = NULL;
+}
+
+bool is_uncore_island(pwr_ctx_t *ctx, unsigned long island) {
+    return ctx->uncore != NULL && island >= ctx->num_phys_islands &&
+        island - ctx->num_phys_islands < ctx->uncore->num_islands;
+}
+
+unsigned int uncore_num_levels(pwr_ctx_t *ctx, unsigned long island) {
+    return ctx->uncore->islands[island - ctx->num_phys_islands].num_levels;
+}
+
+unsigned int uncore_current_level(pwr_ctx_t *ctx, unsigned long island) {
+    return ctx->uncore->islands[island - ctx->num_phys_islands].current_level;
+}
+
+pwr_err_t uncore_set_level(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level)
+{
+    uncore_island_t *ui = &ctx->uncore->islands[island - ctx->num_phys_islands];
+
+    if (level >= ui->num_levels) {
+        return PWR_UNSUPPORTED_SPEED_LEVEL;
+    }
+
+    freq_t freq = ui->range_min + level * UNCORE_STEP;
+
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    pwr_err_t err = write_limits(ctx, ui, freq, freq);
+    if (err == PWR_OK) {
+        ui->current_level = level;
+    }
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    return err;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Gets the state of an uncore island from its ID.
+  *
+  * @param err[out] The error code to set if the island is invalid.
+  *
+  * @return The island, or NULL if it is invalid.
+  */
+uncore_island_t *get_island(pwr_ctx_t *ctx, unsigned long island,
+    pwr_err_t *err)
+{
+    if (ctx->uncore == NULL) {
+        *err = PWR_UNINITIALIZED;
+        return NULL;
+    }
+
+    if (!is_uncore_island(ctx, island)) {
+        *err = PWR_INVALID_ISLAND;
+        return NULL;
+    }
+
+    return &ctx->uncore->islands[island - ctx->num_phys_islands];
+}
+
+/**
+  * Appends an island, its levels stepping through its initial range.
+  */
+void add_island(struct uncore *uc, uncore_island_t *ui) {
+    ui->found_min = ui->min;
+    ui->found_max = ui->max;
+    ui->num_levels = (ui->range_max - ui->range_min) / UNCORE_STEP + 1;
+    ui->current_level = ui->num_levels - 1;
+
+    uc->islands = realloc(uc->islands,
+        (uc->num_islands + 1) * sizeof(*uc->islands));
+    uc->islands[uc->num_islands++] = *ui;
+}
+
+/**
+  * Finds the first CPU of a package.
+  *
+  * @return The CPU, or -1 if the package does not exist.
+  */
+long package_cpu(pwr_ctx_t *ctx, long long package) {
+    char path[96];
+
+    for (unsigned long cpu = 0; cpu < ctx->num_phys_cpu; ++cpu) {
+        long long cpu_package;
+
+        snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%lu/topology/physical_package_id", cpu);
+        if (read_sysfs_file_ll(path, &cpu_package) && cpu_package == package) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+/**
+  * Opens an attribute of an uncore directory.
+  *
+  * @return The file descriptor, or -1.
+  */
+int open_attr(const char *dir, const char *name, int flags) {
+    char path[384];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, flags);
+}
+
+/**
+  * Writes a frequency to a sysfs attribute.
+  *
+  * @return True on success.
+  */
+bool write_freq(pwr_ctx_t *ctx, int fd, freq_t freq) {
+    char buf[32];
+
+    int len = snprintf(buf, sizeof(buf), "%ld", freq);
+    stats_io(ctx, PWR_MODULE_DVFS, 1, len);
+    return pwrite(fd, buf, len, 0) == len;
+}
+
+/**
+  * Sets the limits of an uncore island. Called with the DVFS lock held.
+  *
+  * @return PWR_OK or PWR_DVFS_ERR.
+  */
+pwr_err_t write_limits(pwr_ctx_t *ctx, uncore_island_t *ui, freq_t min,
+    freq_t max)
+{
+    ui->changed = true;
+
+    if (ui->min_fd >= 0) {
+        // keep min <= max between the two writes
+        bool ok = min > ui->max ?
+            write_freq(ctx, ui->max_fd, max) &&
+                write_freq(ctx, ui->min_fd, min) :
+            write_freq(ctx, ui->min_fd, min) &&
+                write_freq(ctx, ui->max_fd, max);
+        if (!ok) {
+            return PWR_DVFS_ERR;
+        }
+    } else {
+        uint64_t limits;
+        if (!read_msr(ctx, ui->cpu, MSR_UNCORE_RATIO_LIMIT, &limits)) {
+            return PWR_DVFS_ERR;
+        }
+        limits = (limits & ~0x7F7FULL) |
+            ((uint64_t) (min / UNCORE_STEP) & 0x7F) << 8 |
+            ((uint64_t) (max / UNCORE_STEP) & 0x7F);
+        if (!write_msr(ctx, ui->cpu, MSR_UNCORE_RATIO_LIMIT, limits)) {
+            return PWR_DVFS_ERR;
+        }
+    }
+
+    ui->min = min;
+    ui->max = max;
+
+    return PWR_OK;
+}
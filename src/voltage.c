@@ -0,0 +1,410 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "internals.h"
+
+/** Current ratio (bits 15:8) and core voltage (bits 47:32) of a CPU */
+#define MSR_IA32_PERF_STATUS 0x198
+
+/** Overclocking mailbox, holding the voltage offsets of the planes */
+#define MSR_OC_MAILBOX 0x150
+
+/** Mailbox commands and the core voltage plane */
+#define OC_READ_OFFSET 0x10
+#define OC_WRITE_OFFSET 0x11
+#define OC_PLANE_CORE 0
+
+/** How many times the mailbox is polled before giving up */
+#define OC_MAX_POLLS 1000
+
+/** The voltage unit of IA32_PERF_STATUS, in V */
+#define PERF_STATUS_VOLT (1. / 8192)
+
+/** The bus clock, multiplied by the ratio to get the frequency, in KHz */
+#define BUS_CLOCK 100000
+
+/**
+  * Bounds of the voltage offsets, in steps of PWR_VOLTAGE_STEP. Going further
+  * risks crashes when undervolting and damage when overvolting.
+  */
+#define MAX_UNDERVOLT 102   // ~100 mV
+#define MAX_OVERVOLT 51     // ~50 mV
+
+/* Voltage offset of one package, shared by all its islands */
+typedef struct {
+    /* First island of the package, whose CPU runs the mailbox commands */
+    unsigned long island;
+
+    /* Offset when the library first changed it, in steps */
+    int initial_offset;
+
+    /* Was the offset changed by the library? */
+    bool changed;
+} voltage_package_t;
+
+/* Voltage control state */
+struct voltage {
+    voltage_package_t *packages;
+    unsigned long num_packages;
+
+    /* Package of each island, as an index in packages */
+    unsigned long *island_packages;
+};
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static bool read_voltage(pwr_ctx_t *ctx, unsigned long island,
+    voltage_t *voltage, freq_t *freq);
+static pwr_err_t mailbox(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int command, int *offset);
+static void find_packages(pwr_ctx_t *ctx, struct voltage *v);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+voltage_t pwr_voltage(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_voltage, island, 0);
+    voltage_t voltage;
+    freq_t freq;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    if (!read_voltage(ctx, island, &voltage, &freq)) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    // the island settled on its speed level, record the voltage of the level
+    phys_island_t *pi = ctx->phys_islands[island];
+    if (freq == pi->freqs[pi->current_speed_level]) {
+        pi->voltages[pi->current_speed_level] = voltage;
+    }
+    pi->current_voltage = voltage;
+
+    ctx->error = PWR_OK;
+    return voltage;
+}
+
+voltage_t pwr_level_voltage(pwr_ctx_t *ctx, unsigned long island,
+    unsigned int level)
+{
+    TRACE_CALL(ctx, pwr_level_voltage, island, level);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    phys_island_t *pi = ctx->phys_islands[island];
+    if (level >= pi->num_speed_levels) {
+        ctx->error = PWR_UNSUPPORTED_SPEED_LEVEL;
+        return 0;
+    }
+
+    if (isnan(pi->voltages[level])) {
+        ctx->error = PWR_UNAVAILABLE;
+        return 0;
+    }
+
+    ctx->error = PWR_OK;
+    return pi->voltages[level];
+}
+
+void pwr_increase_voltage(pwr_ctx_t *ctx, unsigned long island, int delta) {
+    TRACE_CALL(ctx, pwr_increase_voltage, island, delta);
+    int offset;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    // the offset read is the one of the package, whatever island changed it
+    voltage_package_t *vp =
+        &ctx->voltage->packages[ctx->voltage->island_packages[island]];
+    pthread_mutex_lock(&ctx->dvfs_lock);
+
+    pwr_err_t err = mailbox(ctx, vp->island, OC_READ_OFFSET, &offset);
+    if (err == PWR_OK && delta != 0) {
+        long new_offset = (long) offset + delta;
+
+        if (new_offset < -MAX_UNDERVOLT || new_offset > MAX_OVERVOLT) {
+            err = PWR_UNSUPPORTED_VOLTAGE;
+        } else {
+            if (!vp->changed) {
+                vp->initial_offset = offset;
+            }
+
+            offset = new_offset;
+            err = mailbox(ctx, vp->island, OC_WRITE_OFFSET, &offset);
+            vp->changed = vp->changed || err == PWR_OK;
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    ctx->error = err;
+}
+
+int pwr_voltage_offset(pwr_ctx_t *ctx, unsigned long island) {
+    TRACE_CALL(ctx, pwr_voltage_offset, island, 0);
+    int offset = 0;
+
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return 0;
+    }
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS)) {
+        ctx->error = PWR_UNINITIALIZED;
+        return 0;
+    }
+
+    if (island >= ctx->num_phys_islands) {
+        ctx->error = PWR_INVALID_ISLAND;
+        return 0;
+    }
+
+    unsigned long package = ctx->voltage->island_packages[island];
+    pthread_mutex_lock(&ctx->dvfs_lock);
+    ctx->error = mailbox(ctx, ctx->voltage->packages[package].island,
+        OC_READ_OFFSET, &offset);
+    pthread_mutex_unlock(&ctx->dvfs_lock);
+
+    return offset;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_voltages(pwr_ctx_t *ctx) {
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    struct voltage *v = malloc(sizeof(*v));
+    find_packages(ctx, v);
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        phys_island_t *pi = ctx->phys_islands[i];
+        freq_t freq;
+
+        pi->num_voltages = pi->num_speed_levels;
+        pi->voltages = malloc(pi->num_voltages * sizeof(*pi->voltages));
+        for (long l = 0; l < pi->num_voltages; ++l) {
+            pi->voltages[l] = NAN;
+        }
+
+        if (!read_voltage(ctx, i, &pi->current_voltage, &freq)) {
+            pi->current_voltage = NAN;
+        } else if (freq == pi->freqs[pi->current_speed_level]) {
+            pi->voltages[pi->current_speed_level] = pi->current_voltage;
+        }
+    }
+
+    ctx->voltage = v;
+}
+
+void free_voltages(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->voltage == NULL) {
+        return;
+    }
+
+    // never leave the machine undervolted or overvolted
+    for (unsigned long p = 0; p < ctx->voltage->num_packages; ++p) {
+        voltage_package_t *vp = &ctx->voltage->packages[p];
+        int offset = vp->initial_offset;
+
+        if (vp->changed &&
+            mailbox(ctx, vp->island, OC_WRITE_OFFSET, &offset) != PWR_OK &&
+            ctx->err_fd)
+        {
+            fprintf(ctx->err_fd, "Failed to restore the voltage offset of "
+                "the package of island %lu\n", vp->island);
+        }
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        free(ctx->phys_islands[i]->voltages);
+        ctx->phys_islands[i]->voltages = NULL;
+        ctx->phys_islands[i]->num_voltages = 0;
+    }
+
+    free(ctx->voltage->packages);
+    free(ctx->voltage->island_packages);
+    free(ctx->voltage);
+    ctx->voltage = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Reads the current voltage and frequency of the first CPU of an island.
+  *
+  * @param voltage[out] The voltage, in V.
+  * @param freq[out] The frequency, in KHz.
+  *
+  * @return True if IA32_PERF_STATUS could be read and reports a voltage.
+  */
+bool read_voltage(pwr_ctx_t *ctx, unsigned long island, voltage_t *voltage,
+    freq_t *freq)
+{
+    uint64_t status;
+
+    if (!read_msr(ctx, ctx->phys_islands[island]->cpus[0],
+            MSR_IA32_PERF_STATUS, &status))
+    {
+        return false;
+    }
+
+    // older processors leave the voltage field empty
+    uint64_t volt = (status >> 32) & 0xFFFF;
+    if (volt == 0) {
+        return false;
+    }
+
+    *voltage = volt * PERF_STATUS_VOLT;
+    *freq = ((status >> 8) & 0xFF) * BUS_CLOCK;
+
+    return true;
+}
+
+/**
+  * Runs a command of the overclocking mailbox on the core voltage plane of the
+  * package of an island. The mailbox must not be used concurrently.
+  *
+  * @param command OC_READ_OFFSET or OC_WRITE_OFFSET.
+  * @param offset[inout] The offset to write, or the offset read, in steps of
+  *  PWR_VOLTAGE_STEP.
+  *
+  * @return PWR_OK, PWR_UNAVAILABLE if the mailbox cannot be accessed or
+  *  PWR_UNSUPPORTED_VOLTAGE if the processor rejected the command.
+  */
+pwr_err_t mailbox(pwr_ctx_t *ctx, unsigned long island, unsigned int command,
+    int *offset)
+{
+    unsigned long cpu = ctx->phys_islands[island]->cpus[0];
+    uint64_t request = (1ULL << 63) | ((uint64_t) OC_PLANE_CORE << 40) |
+        ((uint64_t) command << 32);
+    uint64_t reply;
+
+    // the offset is an 11 bit two's complement number in bits 31:21
+    if (command == OC_WRITE_OFFSET) {
+        request |= ((uint64_t) *offset & 0x7FF) << 21;
+    }
+
+    if (!write_msr(ctx, cpu, MSR_OC_MAILBOX, request)) {
+        return PWR_UNAVAILABLE;
+    }
+
+    // wait for the processor to clear the busy bit
+    unsigned int polls = 0;
+    do {
+        if (!read_msr(ctx, cpu, MSR_OC_MAILBOX, &reply)) {
+            return PWR_UNAVAILABLE;
+        }
+    } while ((reply >> 63) && ++polls < OC_MAX_POLLS);
+
+    if ((reply >> 63) || ((reply >> 32) & 0xFF) != 0) {
+        return PWR_UNSUPPORTED_VOLTAGE;
+    }
+
+    if (command == OC_READ_OFFSET) {
+        int value = (reply >> 21) & 0x7FF;
+        *offset = value >= 0x400 ? value - 0x800 : value;
+    }
+
+    return PWR_OK;
+}
+
+/**
+  * Groups the islands by package, from the package of their first CPU. An
+  * island whose package cannot be read gets a package of its own.
+  */
+void find_packages(pwr_ctx_t *ctx, struct voltage *v) {
+    long long packages[ctx->num_phys_islands];
+
+    v->packages = calloc(ctx->num_phys_islands, sizeof(*v->packages));
+    v->island_packages = calloc(ctx->num_phys_islands,
+        sizeof(*v->island_packages));
+    v->num_packages = 0;
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        char path[PATH_MAX];
+        unsigned long p;
+
+        packages[i] = -1;
+        snprintf(path, sizeof(path),
+            "%s/devices/system/cpu/cpu%lu/topology/physical_package_id",
+            ctx->sysfs_root, ctx->phys_islands[i]->cpus[0]);
+        read_sysfs_file_ll(path, &packages[i]);
+
+        for (p = 0; p < v->num_packages; ++p) {
+            if (packages[i] >= 0 &&
+                packages[v->packages[p].island] == packages[i])
+            {
+                break;
+            }
+        }
+        if (p == v->num_packages) {
+            v->packages[p].island = i;
+            ++v->num_packages;
+        }
+        v->island_packages[i] = p;
+    }
+}
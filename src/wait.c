@@ -0,0 +1,454 @@
+/**
+  * Copyright 2014-15 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "internals.h"
+
+/** Default grace period, in ns */
+#define DEFAULT_GRACE_NS 1000000ULL
+
+/* Waiting status of one island */
+typedef struct {
+    /* How many threads are waiting on the island, updated atomically */
+    unsigned long waiters;
+
+    /* How many waiters are required to lower the island */
+    unsigned long quorum;
+
+    /* When to lower the island, in ns, 0 if not scheduled */
+    uint64_t deadline;
+
+    /* Is the island currently lowered? */
+    bool lowered;
+
+    /* Speed level to restore when the wait ends */
+    unsigned int saved_level;
+
+    /* When was the island lowered, in ns */
+    uint64_t lowered_since;
+} wait_island_t;
+
+/* Wait hints state */
+struct wait_hints {
+    /* Protects the whole structure */
+    pthread_mutex_t lock;
+
+    /* Grace period before lowering an island, in ns */
+    uint64_t grace_ns;
+
+    /* Per-island status */
+    wait_island_t *islands;
+
+    /* Is the deadline thread started? */
+    bool thread_started;
+
+    /* Should the deadline thread stop? */
+    bool stop;
+
+    /* When the deadline thread wakes up next, in ns, 0 if not planned */
+    uint64_t next_wakeup;
+
+    /* The thread lowering the islands once their deadline is reached */
+    pthread_t thread;
+
+    /*
+     * Wakes the deadline thread up. A semaphore is used rather than a
+     * condition variable so that the thread is never caught by tools that
+     * interpose pthread_cond_*() to detect waits.
+     */
+    sem_t wakeup;
+
+    /* Completed waits, updated atomically */
+    unsigned long waits;
+
+    /* Cumulated wait time, in ns, updated atomically */
+    uint64_t wait_ns;
+
+    /* Number of times an island was lowered */
+    unsigned long lowerings;
+
+    /* Cumulated time islands were lowered, in ns */
+    uint64_t lowered_ns;
+};
+
+/* Island the calling thread waits on, per thread */
+static __thread struct {
+    pwr_ctx_t *ctx;
+    unsigned long island;
+    unsigned int depth;
+    uint64_t start;
+} current_wait;
+
+//====-------------------------------------------------------------------------
+// Forward declarations
+//-----------------------------------------------------------------------------
+
+static void schedule_lowering(pwr_ctx_t *ctx, unsigned long island);
+static void lower_island(pwr_ctx_t *ctx, unsigned long island);
+static pwr_err_t restore_island(pwr_ctx_t *ctx, unsigned long island);
+static void *deadline_thread(void *arg);
+
+//====-------------------------------------------------------------------------
+// Public functions
+//-----------------------------------------------------------------------------
+
+void pwr_wait_configure(pwr_ctx_t *ctx, double grace, double quorum) {
+    TRACE_CALL(ctx, pwr_wait_configure, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->wait == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (grace < 0 || quorum <= 0 || quorum > 1) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->wait->lock);
+    ctx->wait->grace_ns = grace * 1e9;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        unsigned long quorum_cpu = quorum * ctx->phys_islands[i]->num_cpu + 0.5;
+        ctx->wait->islands[i].quorum = quorum_cpu > 0 ? quorum_cpu : 1;
+    }
+    pthread_mutex_unlock(&ctx->wait->lock);
+
+    ctx->error = PWR_OK;
+}
+
+void pwr_wait_begin(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_wait_begin, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        return;
+    }
+
+    if (ctx->wait == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (current_wait.depth++ > 0) {
+        return;
+    }
+
+    int cpu = sched_getcpu();
+    if (cpu < 0 || (unsigned long) cpu >= ctx->num_phys_cpu ||
+        ctx->cpu_islands[cpu] >= ctx->num_phys_islands)
+    {
+        // the wait is still accounted so that pwr_wait_end() stays balanced
+        current_wait.ctx = NULL;
+        ctx->error = PWR_INVALID_ISLAND;
+        return;
+    }
+
+    unsigned long island = ctx->cpu_islands[cpu];
+    wait_island_t *wi = &ctx->wait->islands[island];
+    current_wait.ctx = ctx;
+    current_wait.island = island;
+    current_wait.start = monotonic_ns();
+
+    // only take the lock when the quorum is reached
+    if (__atomic_add_fetch(&wi->waiters, 1, __ATOMIC_ACQ_REL) < wi->quorum) {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->wait->lock);
+    if (__atomic_load_n(&wi->waiters, __ATOMIC_ACQUIRE) >= wi->quorum &&
+        !wi->lowered && wi->deadline == 0)
+    {
+        if (ctx->wait->grace_ns == 0) {
+            lower_island(ctx, island);
+        } else {
+            schedule_lowering(ctx, island);
+        }
+    }
+    pthread_mutex_unlock(&ctx->wait->lock);
+}
+
+void pwr_wait_end(pwr_ctx_t *ctx) {
+    TRACE_CALL(ctx, pwr_wait_end, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        return;
+    }
+
+    if (current_wait.depth == 0) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    if (--current_wait.depth > 0 || current_wait.ctx != ctx) {
+        return;
+    }
+
+    unsigned long island = current_wait.island;
+    wait_island_t *wi = &ctx->wait->islands[island];
+    current_wait.ctx = NULL;
+
+    __atomic_add_fetch(&ctx->wait->waits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->wait->wait_ns,
+        monotonic_ns() - current_wait.start, __ATOMIC_RELAXED);
+
+    // only take the lock when leaving the quorum
+    if (__atomic_sub_fetch(&wi->waiters, 1, __ATOMIC_ACQ_REL) + 1 <
+        wi->quorum)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->wait->lock);
+    if (__atomic_load_n(&wi->waiters, __ATOMIC_ACQUIRE) < wi->quorum) {
+        wi->deadline = 0;
+        pwr_err_t err = restore_island(ctx, island);
+        if (err != PWR_OK) {
+            ctx->error = err;
+        }
+    }
+    pthread_mutex_unlock(&ctx->wait->lock);
+}
+
+void pwr_wait_report(pwr_ctx_t *ctx, pwr_wait_report_t *report) {
+    TRACE_CALL(ctx, pwr_wait_report, TRACE_NO_ISLAND, 0);
+    if (ctx == NULL) {
+        ctx->error = PWR_INIT_ERR;
+        return;
+    }
+
+    if (ctx->wait == NULL) {
+        ctx->error = PWR_UNINITIALIZED;
+        return;
+    }
+
+    if (report == NULL) {
+        ctx->error = PWR_REQUEST_DENIED;
+        return;
+    }
+
+    struct wait_hints *wait = ctx->wait;
+    uint64_t now = monotonic_ns();
+
+    pthread_mutex_lock(&wait->lock);
+    report->waits = __atomic_load_n(&wait->waits, __ATOMIC_RELAXED);
+    report->wait_time =
+        __atomic_load_n(&wait->wait_ns, __ATOMIC_RELAXED) / 1e9;
+    report->lowerings = wait->lowerings;
+
+    uint64_t lowered_ns = wait->lowered_ns;
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        if (wait->islands[i].lowered) {
+            lowered_ns += now - wait->islands[i].lowered_since;
+        }
+    }
+    report->lowered_time = lowered_ns / 1e9;
+    pthread_mutex_unlock(&wait->lock);
+
+    ctx->error = PWR_OK;
+}
+
+//====-------------------------------------------------------------------------
+// Library internal functions
+//-----------------------------------------------------------------------------
+
+void init_wait_hints(pwr_ctx_t *ctx) {
+    assert(ctx != NULL);
+    assert(pwr_is_initialized(ctx, PWR_MODULE_DVFS));
+
+    struct wait_hints *wait = calloc(1, sizeof(*wait));
+    pthread_mutex_init(&wait->lock, NULL);
+    sem_init(&wait->wakeup, 0, 0);
+    wait->grace_ns = DEFAULT_GRACE_NS;
+    wait->islands = calloc(ctx->num_phys_islands, sizeof(*wait->islands));
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        wait->islands[i].quorum = ctx->phys_islands[i]->num_cpu;
+    }
+
+    ctx->wait = wait;
+}
+
+void free_wait_hints(pwr_ctx_t *ctx) {
+    if (ctx == NULL || ctx->wait == NULL) {
+        return;
+    }
+
+    struct wait_hints *wait = ctx->wait;
+
+    if (wait->thread_started) {
+        pthread_mutex_lock(&wait->lock);
+        wait->stop = true;
+        pthread_mutex_unlock(&wait->lock);
+        sem_post(&wait->wakeup);
+        pthread_join(wait->thread, NULL);
+    }
+
+    for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+        restore_island(ctx, i);
+    }
+
+    sem_destroy(&wait->wakeup);
+    pthread_mutex_destroy(&wait->lock);
+    free(wait->islands);
+    free(wait);
+    ctx->wait = NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Local functions
+//-----------------------------------------------------------------------------
+
+/**
+  * Asks the deadline thread to lower an island after the grace period,
+  * starting the thread if needed. Called with the wait lock held.
+  *
+  * @param ctx The current library context.
+  * @param island The island to lower.
+  */
+void schedule_lowering(pwr_ctx_t *ctx, unsigned long island) {
+    struct wait_hints *wait = ctx->wait;
+
+    uint64_t deadline = monotonic_ns() + wait->grace_ns;
+    wait->islands[island].deadline = deadline;
+
+    if (!wait->thread_started) {
+        if (pthread_create(&wait->thread, NULL, &deadline_thread, ctx)) {
+            // no thread, lower right away
+            wait->islands[island].deadline = 0;
+            lower_island(ctx, island);
+            return;
+        }
+        wait->thread_started = true;
+        return;
+    }
+
+    // the deadline thread will wake up in time by itself
+    if (wait->next_wakeup != 0 && wait->next_wakeup <= deadline) {
+        return;
+    }
+
+    sem_post(&wait->wakeup);
+}
+
+/**
+  * Drops an island to its minimum speed level, saving its current level.
+  * Called with the wait lock held.
+  *
+  * @param ctx The current library context.
+  * @param island The island to lower.
+  */
+void lower_island(pwr_ctx_t *ctx, unsigned long island) {
+    phys_island_t *pi = ctx->phys_islands[island];
+    wait_island_t *wi = &ctx->wait->islands[island];
+    unsigned int level = pi->current_speed_level;
+
+    if (level == pi->min_speed_level) {
+        return;
+    }
+
+    if (set_speed_level(ctx, island, pi->min_speed_level) == PWR_OK) {
+        wi->saved_level = level;
+        wi->lowered = true;
+        wi->lowered_since = monotonic_ns();
+        ++ctx->wait->lowerings;
+    }
+}
+
+/**
+  * Restores the speed level of an island if it was lowered. Called with the
+  * wait lock held.
+  *
+  * @param ctx The current library context.
+  * @param island The island to restore.
+  *
+  * @return PWR_OK or the error that occurred while changing the speed level.
+  */
+pwr_err_t restore_island(pwr_ctx_t *ctx, unsigned long island) {
+    wait_island_t *wi = &ctx->wait->islands[island];
+
+    if (!wi->lowered) {
+        return PWR_OK;
+    }
+
+    wi->lowered = false;
+    ctx->wait->lowered_ns += monotonic_ns() - wi->lowered_since;
+    return set_speed_level(ctx, island, wi->saved_level);
+}
+
+/**
+  * Main loop of the thread lowering the islands once their grace period is
+  * over.
+  *
+  * @param arg The library context.
+  *
+  * @return NULL.
+  */
+void *deadline_thread(void *arg) {
+    pwr_ctx_t *ctx = arg;
+    struct wait_hints *wait = ctx->wait;
+
+    pthread_mutex_lock(&wait->lock);
+    while (!wait->stop) {
+        uint64_t now = monotonic_ns();
+        uint64_t next = 0;
+
+        for (unsigned long i = 0; i < ctx->num_phys_islands; ++i) {
+            wait_island_t *wi = &wait->islands[i];
+            if (wi->deadline == 0) {
+                continue;
+            }
+
+            if (wi->deadline <= now) {
+                wi->deadline = 0;
+                if (__atomic_load_n(&wi->waiters, __ATOMIC_ACQUIRE) >=
+                    wi->quorum)
+                {
+                    lower_island(ctx, i);
+                }
+            } else if (next == 0 || wi->deadline < next) {
+                next = wi->deadline;
+            }
+        }
+        wait->next_wakeup = next;
+        pthread_mutex_unlock(&wait->lock);
+
+        if (next == 0) {
+            while (sem_wait(&wait->wakeup) && errno == EINTR);
+        } else {
+            // semaphores only wait on the realtime clock
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t abs_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec +
+                (next - now);
+            ts.tv_sec = abs_ns / 1000000000ULL;
+            ts.tv_nsec = abs_ns % 1000000000ULL;
+            sem_timedwait(&wait->wakeup, &ts);
+        }
+
+        pthread_mutex_lock(&wait->lock);
+    }
+    pthread_mutex_unlock(&wait->lock);
+
+    return NULL;
+}
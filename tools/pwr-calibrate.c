@@ -0,0 +1,263 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * This program measures the power drawn by every island at each speed level
+ * and saves it as a power table, loaded by the library when it is initialized.
+ *
+ * For each island, the compute then the memory workload kernels run on all the
+ * CPUs of the island, one pinned thread per CPU, while the island steps
+ * through its speed levels. The other islands stay idle at their lowest speed
+ * level. The idle power of the node is measured first and shared evenly
+ * between the islands. The voltage of each level is read under the compute
+ * workload, where the processor reports it, and saved with the table. The
+ * throughput of the compute workload per CPU gives the speed of each level.
+ *
+ * Usage:
+ *  pwr-calibrate [-t seconds] [table]
+ *
+ *  -t seconds  Measurement time per speed level (default: 1).
+ *  table       Where to save the table (default: $PWR_POWER_TABLE, or
+ *              PWR_POWER_TABLE_PATH).
+ *
+ * Typical output:
+ *  idle: 21.37 W
+ *  island 0 compute: 24.10 25.32 ... 41.89 W
+ *  island 0 memory: 26.73 27.40 ... 38.12 W
+ *  island 0 voltage: 0.702 0.716 ... 1.193 V
+ *  island 0 speed: 262 297 ... 1024
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+/** Time left to the island to settle after a speed change, in s */
+#define SETTLE_TIME 0.05
+
+/** Workload kernel used to calibrate each reference load */
+static const workload_kind_t kernels[PWR_NB_LOADS] = {
+    WORKLOAD_COMPUTE, WORKLOAD_MEMORY
+};
+
+//====-------------------------------------------------------------------------
+// Measurements
+//-----------------------------------------------------------------------------
+
+static void sleep_for(double seconds) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long) ((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Measures the average power of the node over a period of time.
+ *
+ * @return The power, in W, or a negative value on error.
+ */
+static double measure_power(pwr_ctx_t *ctx, double seconds) {
+    double joules = 0;
+
+    pwr_start_energy_count(ctx);
+    sleep_for(seconds);
+    const pwr_emeas_t *res = pwr_stop_energy_count(ctx);
+
+    if (pwr_error(ctx) != PWR_OK || res->duration <= 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < res->nbValues; ++i) {
+        double scale = strcmp(res->units[i], "nJ") == 0 ? 1e-9 : 1;
+        joules += res->values[i] * scale;
+    }
+
+    return joules / res->duration;
+}
+
+/**
+ * Measures the power of an island at every speed level under a workload.
+ *
+ * @return 0 on success.
+ */
+static int calibrate(pwr_ctx_t *ctx, unsigned long island, pwr_load_t load,
+    double seconds, double idle_share, double *watts, double *throughput)
+{
+    workload_params_t params;
+    int ret = 0;
+
+    workload_default_params(kernels[load], &params);
+    workload_t *wl = workload_start(ctx, island, &params);
+    if (wl == NULL) {
+        return -1;
+    }
+
+    unsigned int num_levels = pwr_num_speed_levels(ctx, island);
+    for (unsigned int l = 0; l < num_levels && ret == 0; ++l) {
+        pwr_request_speed_level(ctx, island, l);
+        if (pwr_error(ctx) == PWR_OVER_T_BUDGET) {
+            fprintf(stderr, "Island %lu capped below level %u by the thermal "
+                "budget\n", island, l);
+        } else if (pwr_error(ctx) != PWR_OK &&
+            pwr_error(ctx) != PWR_ALREADY_MINMAX)
+        {
+            ret = -1;
+            break;
+        }
+        sleep_for(SETTLE_TIME);
+
+        unsigned long long blocks = workload_blocks(wl);
+        double node_power = measure_power(ctx, seconds);
+        throughput[l] = (double) (workload_blocks(wl) - blocks) / seconds /
+            workload_num_threads(wl);
+        if (node_power < 0) {
+            ret = -1;
+            break;
+        }
+        watts[l] = node_power - idle_share * (pwr_num_phys_islands(ctx) - 1);
+        if (watts[l] < 0) {
+            watts[l] = 0;
+        }
+
+        // records the voltage of the level while the island is busy
+        if (load == PWR_LOAD_COMPUTE) {
+            pwr_voltage(ctx, island);
+        }
+    }
+
+    workload_stop(wl);
+
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't' && atof(optarg) > 0) {
+            seconds = atof(optarg);
+        } else {
+            printf("Usage: %s [-t seconds] [table]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char *path = getenv(PWR_POWER_TABLE_ENV);
+    if (optind < argc) {
+        path = argv[optind];
+    } else if (path == NULL) {
+        path = PWR_POWER_TABLE_PATH;
+    }
+
+    pwr_ctx_t *ctx = pwr_initialize(NULL, NULL, NULL);
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_DVFS) ||
+        !pwr_is_initialized(ctx, PWR_MODULE_ENERGY))
+    {
+        fprintf(stderr, "Failed to initialize the DVFS and energy modules\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned long num_islands = pwr_num_phys_islands(ctx);
+    unsigned int initial_levels[num_islands];
+    for (unsigned long i = 0; i < num_islands; ++i) {
+        initial_levels[i] = pwr_current_speed_level(ctx, i);
+        pwr_request_speed_level(ctx, i, 0);
+    }
+
+    int ret = EXIT_SUCCESS;
+    sleep_for(SETTLE_TIME);
+    double idle_power = measure_power(ctx, seconds);
+    if (idle_power < 0) {
+        fprintf(stderr, "Failed to measure the idle power: %s\n",
+            pwr_strerror(ctx));
+        ret = EXIT_FAILURE;
+    } else {
+        printf("idle: %.2f W\n", idle_power);
+    }
+
+    for (unsigned long i = 0; i < num_islands && ret == EXIT_SUCCESS; ++i) {
+        unsigned int num_levels = pwr_num_speed_levels(ctx, i);
+        double watts[num_levels], throughput[num_levels];
+
+        for (pwr_load_t load = 0; load < PWR_NB_LOADS; ++load) {
+            if (calibrate(ctx, i, load, seconds, idle_power / num_islands,
+                watts, throughput))
+            {
+                fprintf(stderr, "Failed to calibrate island %lu: %s\n", i,
+                    pwr_strerror(ctx));
+                ret = EXIT_FAILURE;
+                break;
+            }
+
+            printf("island %lu %s:", i, workload_name(kernels[load]));
+            for (unsigned int l = 0; l < num_levels; ++l) {
+                printf(" %.2f", watts[l]);
+            }
+            printf(" W\n");
+
+            pwr_set_level_power(ctx, i, load, watts);
+            if (load == PWR_LOAD_COMPUTE) {
+                pwr_set_level_throughput(ctx, i, throughput);
+            }
+        }
+
+        if (ret == EXIT_SUCCESS) {
+            printf("island %lu voltage:", i);
+            for (unsigned int l = 0; l < num_levels; ++l) {
+                voltage_t voltage = pwr_level_voltage(ctx, i, l);
+                if (pwr_error(ctx) == PWR_OK) {
+                    printf(" %.3f", voltage);
+                } else {
+                    printf(" -");
+                }
+            }
+            printf(" V\n");
+        }
+        pwr_request_speed_level(ctx, i, 0);
+    }
+
+    // speeds are normalized once every island is calibrated
+    for (unsigned long i = 0; i < num_islands && ret == EXIT_SUCCESS; ++i) {
+        printf("island %lu speed:", i);
+        for (unsigned int l = 0; l < pwr_num_speed_levels(ctx, i); ++l) {
+            printf(" %ld", pwr_speed(ctx, i, l));
+        }
+        printf("\n");
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        pwr_save_power_table(ctx, path);
+        if (pwr_error(ctx) != PWR_OK) {
+            fprintf(stderr, "Failed to save the table to %s: %s\n", path,
+                pwr_strerror(ctx));
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    pwr_request_speed_levels(ctx, initial_levels);
+    pwr_finalize(ctx);
+
+    return ret;
+}
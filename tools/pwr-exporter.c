@@ -0,0 +1,533 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * This program exports the node telemetry in the Prometheus text format over
+ * HTTP. A sampler thread reads the hardware once per period; scrapes only
+ * format its last sample, so that they never read sysfs or the MSRs and cost
+ * a formatting pass over the islands and energy domains into a buffer reused
+ * from one scrape to the next.
+ *
+ * Metrics:
+ *  pwr_speed_level{island}               Current speed level.
+ *  pwr_speed_levels{island}              Number of speed levels.
+ *  pwr_frequency_transitions_total{island}
+ *                                        Frequency transitions, from the
+ *                                        cpufreq statistics when available.
+ *  pwr_energy_joules_total{domain}       Energy consumed since the start.
+ *  pwr_power_watts{domain}               Average power over the last period.
+ *  pwr_sample_timestamp_seconds          Unix time of the sample.
+ *
+ * The energy counters are read by stopping and restarting the energy count at
+ * every sample, which leaves a gap of a few microseconds per period.
+ *
+ * Usage:
+ *  pwr-exporter [-p port] [-i period]
+ *
+ *  -p port     TCP port to listen to on localhost (default: 9464).
+ *  -i period   Sampling period, in s (default: 1).
+ *
+ * The cpufreq statistics are read under PWR_SYSFS_ROOT when set, as the
+ * library does.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "power-api.h"
+
+/** The default port */
+#define DEFAULT_PORT 9464
+
+/** The largest request read, the rest is ignored */
+#define REQUEST_SIZE 1024
+
+/** How long a client may take to send its request or read the response, in s */
+#define CLIENT_TIMEOUT 2
+
+/* The last sample of the node */
+typedef struct {
+    /* Protects the sample from the scrapes */
+    pthread_mutex_t lock;
+
+    /* When the sample was taken, in s */
+    double timestamp;
+
+    /* Per island */
+    unsigned long num_islands;
+    unsigned int *levels;
+    unsigned int *num_levels;
+    long *transitions;
+
+    /* First CPU of every island, to read the cpufreq statistics */
+    unsigned long *first_cpu;
+
+    /* Per energy domain, discovered by the first sample */
+    unsigned long num_domains;
+    char **domains;
+    double *joules;
+    double *watts;
+} sample_t;
+
+/* A buffer growing to the largest response, then reused */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t used;
+} buffer_t;
+
+/** Cleared by SIGINT and SIGTERM */
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+/** Unix time, as Prometheus expects for timestamps */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//====-------------------------------------------------------------------------
+// Sampler
+//-----------------------------------------------------------------------------
+
+/**
+ * Reads the frequency transitions of a cpufreq policy.
+ *
+ * @return The transition count, or -1 if the cpufreq statistics are missing.
+ */
+static long read_transitions(unsigned long cpu) {
+    const char *root = getenv(PWR_SYSFS_ROOT_ENV);
+    char path[PATH_MAX];
+    long trans;
+
+    snprintf(path, sizeof(path),
+        "%s/devices/system/cpu/cpu%lu/cpufreq/stats/total_trans",
+        root != NULL ? root : "/sys", cpu);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fscanf(file, "%ld", &trans) != 1) {
+        trans = -1;
+    }
+    fclose(file);
+
+    return trans;
+}
+
+/**
+ * Allocates the sample and finds the first CPU of every island.
+ */
+static void init_sample(pwr_ctx_t *ctx, sample_t *s) {
+    pthread_mutex_init(&s->lock, NULL);
+    s->num_islands = pwr_num_phys_islands(ctx);
+    s->levels = calloc(s->num_islands, sizeof(*s->levels));
+    s->num_levels = calloc(s->num_islands, sizeof(*s->num_levels));
+    s->transitions = calloc(s->num_islands, sizeof(*s->transitions));
+    s->first_cpu = calloc(s->num_islands, sizeof(*s->first_cpu));
+
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        s->first_cpu[i] = (unsigned long) -1;
+        s->num_levels[i] = pwr_num_speed_levels(ctx, i);
+    }
+    for (unsigned long cpu = pwr_num_phys_cpus(ctx); cpu-- > 0;) {
+        unsigned long island = pwr_island_of_cpu(ctx, cpu);
+        if (island < s->num_islands) {
+            s->first_cpu[island] = cpu;
+        }
+    }
+}
+
+static void free_sample(sample_t *s) {
+    for (unsigned long d = 0; d < s->num_domains; ++d) {
+        free(s->domains[d]);
+    }
+    free(s->domains);
+    free(s->joules);
+    free(s->watts);
+    free(s->levels);
+    free(s->num_levels);
+    free(s->transitions);
+    free(s->first_cpu);
+    pthread_mutex_destroy(&s->lock);
+}
+
+/**
+ * Takes a sample. The energy measured since the previous sample is added to
+ * the counters.
+ */
+static void take_sample(pwr_ctx_t *ctx, sample_t *s, bool energy) {
+    long transitions[s->num_islands];
+
+    // read everything before taking the lock, scrapes only wait for copies
+    const pwr_emeas_t *res = energy ? pwr_stop_energy_count(ctx) : NULL;
+    unsigned long num_values = res != NULL ? res->nbValues : 0;
+    long long values[num_values + 1];
+    double duration = 0;
+
+    // restarting the count reuses the results, the duration first
+    if (res != NULL) {
+        memcpy(values, res->values, num_values * sizeof(*values));
+        duration = res->duration;
+        pwr_start_energy_count(ctx);
+    }
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        transitions[i] = s->first_cpu[i] == (unsigned long) -1 ? -1 :
+            read_transitions(s->first_cpu[i]);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->timestamp = now();
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        s->levels[i] = pwr_current_speed_level(ctx, i);
+        s->transitions[i] = transitions[i];
+    }
+
+    if (s->domains == NULL && num_values > 0) {
+        s->num_domains = num_values;
+        s->domains = calloc(s->num_domains, sizeof(*s->domains));
+        s->joules = calloc(s->num_domains, sizeof(*s->joules));
+        s->watts = calloc(s->num_domains, sizeof(*s->watts));
+        for (unsigned long d = 0; d < s->num_domains; ++d) {
+            s->domains[d] = strdup(res->names[d]);
+        }
+    }
+    for (unsigned long d = 0; d < s->num_domains && d < num_values; ++d) {
+        double scale = strcmp(res->units[d], "nJ") == 0 ? 1e-9 : 1;
+        double joules = values[d] * scale;
+
+        s->joules[d] += joules;
+        s->watts[d] = duration > 0 ? joules / duration : 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Sampler thread arguments */
+typedef struct {
+    pwr_ctx_t *ctx;
+    sample_t *sample;
+    double period;
+    bool energy;
+} sampler_t;
+
+static void *sampler(void *arg) {
+    sampler_t *sp = arg;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (running) {
+        next.tv_sec += (time_t) sp->period;
+        next.tv_nsec += (long) ((sp->period - (time_t) sp->period) * 1e9);
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec += 1;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        take_sample(sp->ctx, sp->sample, sp->energy);
+    }
+
+    return NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Exposition
+//-----------------------------------------------------------------------------
+
+/**
+ * Appends formatted text to a buffer, growing it if needed.
+ */
+static void append(buffer_t *b, const char *format, ...) {
+    va_list ap;
+
+    for (;;) {
+        va_start(ap, format);
+        int len = vsnprintf(b->data + b->used, b->size - b->used, format, ap);
+        va_end(ap);
+
+        if (len < 0) {
+            return;
+        }
+        if ((size_t) len < b->size - b->used) {
+            b->used += len;
+            return;
+        }
+
+        size_t size = b->size * 2 > b->used + len + 1 ?
+            b->size * 2 : b->used + len + 1;
+        char *data = realloc(b->data, size);
+        if (data == NULL) {
+            return;
+        }
+        b->data = data;
+        b->size = size;
+    }
+}
+
+/**
+ * Formats the last sample in the Prometheus text format.
+ */
+static void format_sample(sample_t *s, buffer_t *b) {
+    pthread_mutex_lock(&s->lock);
+
+    append(b, "# HELP pwr_speed_level Current speed level.\n"
+        "# TYPE pwr_speed_level gauge\n");
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        append(b, "pwr_speed_level{island=\"%lu\"} %u\n", i, s->levels[i]);
+    }
+
+    append(b, "# HELP pwr_speed_levels Number of speed levels.\n"
+        "# TYPE pwr_speed_levels gauge\n");
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        append(b, "pwr_speed_levels{island=\"%lu\"} %u\n", i,
+            s->num_levels[i]);
+    }
+
+    append(b, "# HELP pwr_frequency_transitions_total Frequency transitions.\n"
+        "# TYPE pwr_frequency_transitions_total counter\n");
+    for (unsigned long i = 0; i < s->num_islands; ++i) {
+        if (s->transitions[i] >= 0) {
+            append(b, "pwr_frequency_transitions_total{island=\"%lu\"} %ld\n",
+                i, s->transitions[i]);
+        }
+    }
+
+    append(b, "# HELP pwr_energy_joules_total Energy consumed.\n"
+        "# TYPE pwr_energy_joules_total counter\n");
+    for (unsigned long d = 0; d < s->num_domains; ++d) {
+        append(b, "pwr_energy_joules_total{domain=\"%s\"} %.6f\n",
+            s->domains[d], s->joules[d]);
+    }
+
+    append(b, "# HELP pwr_power_watts Average power over the last period.\n"
+        "# TYPE pwr_power_watts gauge\n");
+    for (unsigned long d = 0; d < s->num_domains; ++d) {
+        append(b, "pwr_power_watts{domain=\"%s\"} %.3f\n", s->domains[d],
+            s->watts[d]);
+    }
+
+    append(b, "# HELP pwr_sample_timestamp_seconds Time of the sample.\n"
+        "# TYPE pwr_sample_timestamp_seconds gauge\n"
+        "pwr_sample_timestamp_seconds %.6f\n", s->timestamp);
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a request up to the end of its headers, or as much as fits.
+ *
+ * @return False if the client failed or timed out before.
+ */
+static bool read_request(int fd, char *request, size_t size) {
+    size_t len = 0;
+
+    request[0] = '\0';
+    while (len < size - 1 && strstr(request, "\r\n\r\n") == NULL) {
+        ssize_t got = read(fd, request + len, size - 1 - len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        len += got;
+        request[len] = '\0';
+    }
+
+    return len > 0;
+}
+
+/**
+ * Answers a request. Only GET /metrics is served.
+ */
+static void serve(int fd, sample_t *s, buffer_t *body, buffer_t *header) {
+    char request[REQUEST_SIZE];
+
+    // scrapes are served one at a time, a stalled client must not block them
+    struct timeval timeout = { .tv_sec = CLIENT_TIMEOUT, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (!read_request(fd, request, sizeof(request))) {
+        return;
+    }
+
+    body->used = 0;
+    header->used = 0;
+    if (strncmp(request, "GET /metrics ", 13) == 0 ||
+        strncmp(request, "GET /metrics?", 13) == 0)
+    {
+        format_sample(s, body);
+        append(header, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n");
+    } else {
+        append(body, "Not found\n");
+        append(header, "HTTP/1.0 404 Not Found\r\n"
+            "Content-Type: text/plain\r\n");
+    }
+    append(header, "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+        body->used);
+
+    if (write_all(fd, header->data, header->used)) {
+        write_all(fd, body->data, body->used);
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = DEFAULT_PORT;
+    double period = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:i:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'i': period = atof(optarg); break;
+            default:
+                printf("Usage: %s [-p port] [-i period]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (period <= 0) {
+        fprintf(stderr, "The period must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    pwr_ctx_t *ctx = pwr_initialize(NULL, NULL, NULL);
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        fprintf(stderr, "Failed to initialize the structure module\n");
+        return EXIT_FAILURE;
+    }
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    if (server < 0 ||
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) ||
+        bind(server, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(server, 16))
+    {
+        perror("Failed to listen");
+        if (server >= 0) {
+            close(server);
+        }
+        pwr_finalize(ctx);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sample_t sample;
+    memset(&sample, 0, sizeof(sample));
+    init_sample(ctx, &sample);
+
+    sampler_t sp = { ctx, &sample, period,
+        pwr_is_initialized(ctx, PWR_MODULE_ENERGY) };
+    if (sp.energy) {
+        pwr_start_energy_count(ctx);
+    }
+    take_sample(ctx, &sample, false);
+
+    // the signals must interrupt accept(), hence reach the main thread
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+    pthread_t thread;
+    int failed = pthread_create(&thread, NULL, sampler, &sp);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (failed) {
+        fprintf(stderr, "Failed to start the sampler\n");
+        close(server);
+        pwr_finalize(ctx);
+        free_sample(&sample);
+        return EXIT_FAILURE;
+    }
+
+    buffer_t body = { NULL, 0, 0 };
+    buffer_t header = { NULL, 0, 0 };
+    while (running) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        serve(client, &sample, &body, &header);
+        close(client);
+    }
+
+    // the sampler stops after its current period
+    pthread_join(thread, NULL);
+    close(server);
+    if (sp.energy) {
+        pwr_stop_energy_count(ctx);
+    }
+    pwr_finalize(ctx);
+
+    free(body.data);
+    free(header.data);
+    free_sample(&sample);
+
+    return EXIT_SUCCESS;
+}
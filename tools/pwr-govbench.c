@@ -0,0 +1,388 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * This program compares the kernel cpufreq governors with the speed policies
+ * of the library. Every workload runs once under every policy while the time,
+ * the energy and the frequency transitions are measured. Synthetic workloads
+ * run for a fixed time and report the work done, a command runs to completion.
+ *
+ * Policies:
+ *  performance, ondemand, schedutil  Kernel governors.
+ *  pwr-membound                      Userspace governor driven by the
+ *                                    memory-boundedness controller.
+ *
+ * Every workload runs in a child process, so that the library policies get
+ * their own library context. The governor in use before the benchmark is
+ * restored at the end.
+ *
+ * Usage:
+ *  pwr-govbench [-t seconds] [-p policy,...] [command]
+ *
+ *  -t seconds  Run time of the synthetic workloads (default: 10).
+ *  -p policies Comma-separated policies to compare (default: all).
+ *  command     Also run this command under every policy.
+ *
+ * Typical output:
+ *  workload  policy          time (s)  energy (J)  power (W)  trans.  work/J
+ *  compute   performance       10.001     612.350     61.229       0   467.2
+ *  compute   pwr-membound      10.001     598.112     59.805      12   474.8
+ *  ...
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+/** Time left to the system to settle after a governor change, in s */
+#define SETTLE_TIME 0.5
+
+/* A speed policy */
+typedef struct {
+    const char *name;
+
+    /* Governor to set */
+    const char *governor;
+
+    /* Does the library control the speed? */
+    bool library;
+} policy_t;
+
+/* A synthetic workload */
+typedef struct {
+    const char *name;
+    workload_kind_t kind;
+    double duty;
+} bench_workload_t;
+
+/** All the policies */
+static const policy_t policies[] = {
+    { "performance", "performance", false },
+    { "ondemand", "ondemand", false },
+    { "schedutil", "schedutil", false },
+    { "pwr-membound", "userspace", true },
+};
+
+#define NB_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+/** All the synthetic workloads */
+static const bench_workload_t workloads[] = {
+    { "compute", WORKLOAD_COMPUTE, 1 },
+    { "memory", WORKLOAD_MEMORY, 1 },
+    { "latency", WORKLOAD_LATENCY, 1 },
+    { "burst", WORKLOAD_COMPUTE, 0.3 },
+};
+
+#define NB_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Measurements of a run */
+typedef struct {
+    double time;
+    double energy;
+    long transitions;
+    unsigned long long blocks;
+} result_t;
+
+//====-------------------------------------------------------------------------
+// Child side: run a workload under a policy
+//-----------------------------------------------------------------------------
+
+/**
+ * Runs a synthetic workload (workload >= 0) or a command, with the library
+ * controlling the speed if requested, and writes the work done to a pipe.
+ */
+static int run_child(int workload, double seconds, bool library, int out_fd,
+    char **command)
+{
+    unsigned long long blocks = 0;
+    pwr_ctx_t *ctx = pwr_initialize(NULL, NULL, NULL);
+
+    if (library) {
+        pwr_membound_start(ctx, NULL);
+        if (pwr_error(ctx) != PWR_OK) {
+            fprintf(stderr, "Failed to start the controller: %s\n",
+                pwr_strerror(ctx));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (workload >= 0) {
+        workload_params_t params;
+        workload_default_params(workloads[workload].kind, &params);
+        params.duty = workloads[workload].duty;
+
+        workload_t *wl = workload_start(ctx, WORKLOAD_ALL_ISLANDS, &params);
+        if (wl == NULL) {
+            return EXIT_FAILURE;
+        }
+        struct timespec ts = {
+            .tv_sec = (time_t) seconds,
+            .tv_nsec = (long) ((seconds - (time_t) seconds) * 1e9)
+        };
+        nanosleep(&ts, NULL);
+        blocks = workload_stop(wl);
+    } else {
+        pid_t son;
+        if (!(son = fork())) {
+            execvp(command[0], command);
+            perror("Failed to run the command");
+            _exit(EXIT_FAILURE);
+        }
+        waitpid(son, NULL, 0);
+    }
+
+    if (library) {
+        pwr_membound_stop(ctx);
+    }
+    pwr_finalize(ctx);
+
+    return write(out_fd, &blocks, sizeof(blocks)) == sizeof(blocks) ?
+        EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//====-------------------------------------------------------------------------
+// Parent side: measure the runs
+//-----------------------------------------------------------------------------
+
+/**
+ * Sums the frequency transitions of every CPU.
+ *
+ * @return The transition count, or -1 if the cpufreq statistics are missing.
+ */
+static long count_transitions(pwr_ctx_t *ctx) {
+    long total = 0;
+
+    for (unsigned long cpu = 0; cpu < pwr_num_phys_cpus(ctx); ++cpu) {
+        char path[96];
+        long trans;
+
+        snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%lu/cpufreq/stats/total_trans", cpu);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            return -1;
+        }
+        if (fscanf(file, "%ld", &trans) != 1) {
+            trans = 0;
+        }
+        fclose(file);
+        total += trans;
+    }
+
+    return total;
+}
+
+static double energy_joules(const pwr_emeas_t *res) {
+    double joules = 0;
+
+    for (unsigned int i = 0; i < res->nbValues; ++i) {
+        double scale = strcmp(res->units[i], "nJ") == 0 ? 1e-9 : 1;
+        joules += res->values[i] * scale;
+    }
+
+    return joules;
+}
+
+/**
+ * Runs a workload under a policy in a child process and measures it.
+ *
+ * @return 0 on success.
+ */
+static int measure(pwr_ctx_t *ctx, const char *self, int workload,
+    double seconds, const policy_t *policy, char **command, result_t *result)
+{
+    int fds[2];
+
+    pwr_set_governor(ctx, policy->governor);
+    if (pwr_error(ctx) != PWR_OK) {
+        return -1;
+    }
+
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = SETTLE_TIME * 1e9 };
+    nanosleep(&ts, NULL);
+
+    if (pipe(fds)) {
+        return -1;
+    }
+
+    long transitions = count_transitions(ctx);
+    pwr_start_energy_count(ctx);
+
+    pid_t son = fork();
+    if (son == 0) {
+        // re-execute to get a fresh library state in the child
+        char workload_str[16], seconds_str[32], library_str[2], fd_str[16];
+        snprintf(workload_str, sizeof(workload_str), "%d", workload);
+        snprintf(seconds_str, sizeof(seconds_str), "%f", seconds);
+        snprintf(library_str, sizeof(library_str), "%d", policy->library);
+        snprintf(fd_str, sizeof(fd_str), "%d", fds[1]);
+
+        int argc = 0;
+        while (command != NULL && command[argc] != NULL) {
+            ++argc;
+        }
+        char *args[argc + 7];
+        args[0] = (char *) self;
+        args[1] = "-R";
+        args[2] = workload_str;
+        args[3] = seconds_str;
+        args[4] = library_str;
+        args[5] = fd_str;
+        for (int a = 0; a < argc; ++a) {
+            args[6 + a] = command[a];
+        }
+        args[6 + argc] = NULL;
+
+        execv("/proc/self/exe", args);
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+
+    int status = EXIT_FAILURE;
+    if (son > 0) {
+        waitpid(son, &status, 0);
+    }
+    const pwr_emeas_t *res = pwr_stop_energy_count(ctx);
+    long end_transitions = count_transitions(ctx);
+
+    result->blocks = 0;
+    if (read(fds[0], &result->blocks, sizeof(result->blocks)) !=
+        sizeof(result->blocks))
+    {
+        status = EXIT_FAILURE;
+    }
+    close(fds[0]);
+
+    if (son < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        return -1;
+    }
+
+    result->time = res->duration;
+    result->energy = energy_joules(res);
+    result->transitions = transitions < 0 || end_transitions < 0 ?
+        -1 : end_transitions - transitions;
+
+    return 0;
+}
+
+static void print_result(const char *workload, const policy_t *policy,
+    const result_t *r, const result_t *reference)
+{
+    printf("%-9s %-14s %9.3f %11.3f %10.3f ", workload, policy->name, r->time,
+        r->energy, r->energy / r->time);
+
+    if (r->transitions >= 0) {
+        printf("%7ld", r->transitions);
+    } else {
+        printf("%7s", "n/a");
+    }
+
+    if (r->blocks > 0) {
+        printf(" %8.1f", r->blocks / r->energy);
+    } else {
+        printf(" %8s", "-");
+    }
+
+    // energy and time relative to the first policy measured
+    if (reference != NULL && reference != r) {
+        printf("  (energy %+.1f%%, time %+.1f%%)",
+            100 * (r->energy / reference->energy - 1),
+            100 * (r->time / reference->time - 1));
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    double seconds = 10;
+    const char *selected = NULL;
+    int opt;
+
+    // child mode: -R workload seconds library fd [command]
+    if (argc >= 6 && strcmp(argv[1], "-R") == 0) {
+        return run_child(atoi(argv[2]), atof(argv[3]), atoi(argv[4]),
+            atoi(argv[5]), argv + 6);
+    }
+
+    while ((opt = getopt(argc, argv, "+t:p:")) != -1) {
+        switch (opt) {
+            case 't': seconds = atof(optarg); break;
+            case 'p': selected = optarg; break;
+            default:
+                printf("Usage: %s [-t seconds] [-p policy,...] [command]\n",
+                    argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    char **command = optind < argc ? argv + optind : NULL;
+
+    pwr_ctx_t *ctx = pwr_initialize(NULL, NULL, NULL);
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT) ||
+        !pwr_is_initialized(ctx, PWR_MODULE_ENERGY))
+    {
+        fprintf(stderr, "Failed to initialize the structure and energy "
+            "modules\n");
+        return EXIT_FAILURE;
+    }
+
+    char initial_governor[64];
+    pwr_governor(ctx, initial_governor, sizeof(initial_governor));
+    if (pwr_error(ctx) != PWR_OK) {
+        fprintf(stderr, "Failed to read the governor: %s\n",
+            pwr_strerror(ctx));
+        return EXIT_FAILURE;
+    }
+
+    printf("%-9s %-14s %9s %11s %10s %7s %8s\n", "workload", "policy",
+        "time (s)", "energy (J)", "power (W)", "trans.", "work/J");
+
+    for (int w = command != NULL ? -1 : 0; w < (int) NB_WORKLOADS; ++w) {
+        const char *name = w >= 0 ? workloads[w].name : "command";
+        result_t results[NB_POLICIES];
+        const result_t *reference = NULL;
+
+        for (unsigned int p = 0; p < NB_POLICIES; ++p) {
+            if (selected != NULL && strstr(selected, policies[p].name) == NULL) {
+                continue;
+            }
+
+            if (measure(ctx, argv[0], w, seconds, &policies[p], command,
+                &results[p]))
+            {
+                printf("%-9s %-14s unavailable\n", name, policies[p].name);
+                continue;
+            }
+
+            if (reference == NULL) {
+                reference = &results[p];
+            }
+            print_result(name, &policies[p], &results[p], reference);
+        }
+    }
+
+    pwr_set_governor(ctx, initial_governor);
+    pwr_finalize(ctx);
+
+    return EXIT_SUCCESS;
+}
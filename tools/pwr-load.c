@@ -0,0 +1,117 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * This program runs a synthetic workload, either on every CPU or on the CPUs
+ * of a single island, and reports the work done. It is typically combined with
+ * emeas to measure the energy of a reproducible load.
+ *
+ * Usage:
+ *  pwr-load [-k kind] [-i island] [-d duty] [-p period] [-f MiB] [-t seconds]
+ *
+ *  -k kind     compute, memory, latency or idle (default: compute).
+ *  -i island   Island to load (default: all the CPUs).
+ *  -d duty     Fraction of each period spent running (default: 1).
+ *  -p period   Duty cycle period, in s (default: 0.1).
+ *  -f MiB      Memory footprint of the memory and latency kernels.
+ *  -t seconds  How long to run (default: 10).
+ *
+ * Typical output:
+ *  compute: 10.000 s., 28611 blocks, 2861.1 blocks/s
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+int main(int argc, char **argv) {
+    workload_kind_t kind = WORKLOAD_COMPUTE;
+    unsigned long island = WORKLOAD_ALL_ISLANDS;
+    double duty = 1, period = 0, seconds = 10;
+    size_t footprint = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:i:d:p:f:t:")) != -1) {
+        switch (opt) {
+            case 'k':
+                if (workload_parse(optarg, &kind)) {
+                    fprintf(stderr, "Unknown workload: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i': island = strtoul(optarg, NULL, 10); break;
+            case 'd': duty = atof(optarg); break;
+            case 'p': period = atof(optarg); break;
+            case 'f': footprint = strtoul(optarg, NULL, 10) << 20; break;
+            case 't': seconds = atof(optarg); break;
+            default:
+                printf("Usage: %s [-k kind] [-i island] [-d duty] [-p period] "
+                    "[-f MiB] [-t seconds]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (duty < 0 || duty > 1 || seconds <= 0) {
+        fprintf(stderr, "Invalid duty cycle or duration\n");
+        return EXIT_FAILURE;
+    }
+
+    pwr_ctx_t *ctx = pwr_initialize(NULL, NULL, NULL);
+
+    if (!pwr_is_initialized(ctx, PWR_MODULE_STRUCT)) {
+        fprintf(stderr, "Failed to initialize the structure module\n");
+        return EXIT_FAILURE;
+    }
+
+    if (island != WORKLOAD_ALL_ISLANDS && island >= pwr_num_phys_islands(ctx)) {
+        fprintf(stderr, "Invalid island: %lu\n", island);
+        return EXIT_FAILURE;
+    }
+
+    workload_params_t params;
+    workload_default_params(kind, &params);
+    params.duty = duty;
+    if (period > 0) {
+        params.period = period;
+    }
+    if (footprint > 0) {
+        params.footprint = footprint;
+    }
+
+    workload_t *wl = workload_start(ctx, island, &params);
+    if (wl == NULL) {
+        fprintf(stderr, "Failed to start the workload\n");
+        return EXIT_FAILURE;
+    }
+
+    struct timespec ts = {
+        .tv_sec = (time_t) seconds,
+        .tv_nsec = (long) ((seconds - (time_t) seconds) * 1e9)
+    };
+    nanosleep(&ts, NULL);
+
+    unsigned long long blocks = workload_stop(wl);
+    printf("%s: %.3f s., %llu blocks, %.1f blocks/s\n", workload_name(kind),
+        seconds, blocks, blocks / seconds);
+
+    pwr_finalize(ctx);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,325 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * This preloadable library lowers the speed level of the islands while the
+ * threads of an unmodified program are blocked waiting. It interposes on the
+ * usual blocking calls and brackets them with pwr_wait_begin() and
+ * pwr_wait_end(). Waits shorter than the grace period never change the speed
+ * level. The slack reclaimed is reported on exit.
+ *
+ * Interposed calls:
+ *  - MPI_Wait, MPI_Waitall, MPI_Waitany, MPI_Waitsome, MPI_Barrier (when
+ *    built with MPI support)
+ *  - pthread_cond_wait, pthread_cond_timedwait
+ *  - poll, epoll_wait (calls with a zero timeout are not waits)
+ *  - syscall(SYS_futex, FUTEX_WAIT*) issued directly by the program
+ *
+ * Usage:
+ *  LD_PRELOAD=tools/libpwr-wait.so command
+ *
+ * Environment:
+ *  PWR_WAIT_GRACE   Grace period before lowering an island, in s.
+ *  PWR_WAIT_QUORUM  Fraction of the island CPUs that must be waiting.
+ *
+ * Typical output on exit:
+ *  pwr-wait: 1532 waits, 12.410 s. waiting, 211 lowerings, 10.872 s. lowered
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#ifdef HAS_MPI
+#include <mpi.h>
+#endif
+
+#include "power-api.h"
+
+/** The library context, NULL if the speed cannot be controlled */
+static pwr_ctx_t *ctx = NULL;
+
+/** Set while the calling thread is inside an interposed call */
+static __thread int in_wait = 0;
+
+/** Threads inside the library, pwr_wait_fini() waits for them to leave */
+static int active_calls = 0;
+
+/**
+ * Gets the context to call the library with, NULL once it is finalized. The
+ * call must be followed by leave_library() when the context is not NULL.
+ */
+static pwr_ctx_t *enter_library(void) {
+    __atomic_add_fetch(&active_calls, 1, __ATOMIC_SEQ_CST);
+    pwr_ctx_t *wait_ctx = __atomic_load_n(&ctx, __ATOMIC_SEQ_CST);
+    if (wait_ctx == NULL) {
+        __atomic_sub_fetch(&active_calls, 1, __ATOMIC_RELEASE);
+    }
+    return wait_ctx;
+}
+
+/** Leaves the library, entered with enter_library() */
+static void leave_library(void) {
+    __atomic_sub_fetch(&active_calls, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Declares a wait around a call to the real function. The errno of the call
+ * is kept, the callers test it for EAGAIN, ETIMEDOUT or EINTR. The library
+ * is only entered around pwr_wait_begin() and pwr_wait_end(), so that the
+ * threads blocked in the real call do not delay the finalization.
+ */
+#define WAIT_CALL(ret, call)                                    \
+    do {                                                        \
+        pwr_ctx_t *wait_ctx;                                    \
+        if (ctx == NULL || in_wait ||                           \
+            (wait_ctx = enter_library()) == NULL)               \
+        {                                                       \
+            ret = call;                                         \
+            break;                                              \
+        }                                                       \
+        in_wait = 1;                                            \
+        pwr_wait_begin(wait_ctx);                               \
+        leave_library();                                        \
+        ret = call;                                             \
+        int saved_errno = errno;                                \
+        if ((wait_ctx = enter_library()) != NULL) {             \
+            pwr_wait_end(wait_ctx);                             \
+            leave_library();                                    \
+        }                                                       \
+        errno = saved_errno;                                    \
+        in_wait = 0;                                            \
+    } while (0)
+
+static int (*real_pthread_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_pthread_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *,
+    const struct timespec *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_epoll_wait)(int, struct epoll_event *, int, int);
+static long (*real_syscall)(long, ...);
+
+/**
+ * Looks the interposed functions up. Interposed calls may happen before the
+ * constructor runs, so every wrapper checks that the lookup was done.
+ */
+static void resolve_symbols(void) {
+    // skip the legacy versions of the condition variable symbols
+    real_pthread_cond_wait =
+        dlvsym(RTLD_NEXT, "pthread_cond_wait", "GLIBC_2.3.2");
+    real_pthread_cond_timedwait =
+        dlvsym(RTLD_NEXT, "pthread_cond_timedwait", "GLIBC_2.3.2");
+    if (real_pthread_cond_wait == NULL) {
+        real_pthread_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+        real_pthread_cond_timedwait =
+            dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    }
+    real_poll = dlsym(RTLD_NEXT, "poll");
+    real_epoll_wait = dlsym(RTLD_NEXT, "epoll_wait");
+    real_syscall = dlsym(RTLD_NEXT, "syscall");
+}
+
+/** Makes sure a real function was looked up */
+#define RESOLVE(name) \
+    if (real_##name == NULL) resolve_symbols()
+
+//====-------------------------------------------------------------------------
+// Setup / report
+//-----------------------------------------------------------------------------
+
+__attribute__((constructor))
+static void pwr_wait_init(void) {
+    in_wait = 1;
+    resolve_symbols();
+
+    pwr_ctx_t *new_ctx = pwr_initialize(NULL, NULL, NULL);
+    if (!pwr_is_initialized(new_ctx, PWR_MODULE_DVFS)) {
+        fprintf(stderr, "pwr-wait: speed control unavailable, disabled\n");
+        pwr_finalize(new_ctx);
+        in_wait = 0;
+        return;
+    }
+
+    const char *grace = getenv("PWR_WAIT_GRACE");
+    const char *quorum = getenv("PWR_WAIT_QUORUM");
+    if (grace != NULL || quorum != NULL) {
+        pwr_wait_configure(new_ctx,
+            grace != NULL ? atof(grace) : 0.001,
+            quorum != NULL ? atof(quorum) : 1);
+        if (pwr_error(new_ctx) != PWR_OK) {
+            fprintf(stderr, "pwr-wait: invalid configuration: %s\n",
+                pwr_strerror(new_ctx));
+        }
+    }
+
+    __atomic_store_n(&ctx, new_ctx, __ATOMIC_RELEASE);
+    in_wait = 0;
+}
+
+__attribute__((destructor))
+static void pwr_wait_fini(void) {
+    pwr_wait_report_t report;
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    pwr_ctx_t *old_ctx = ctx;
+    __atomic_store_n(&ctx, NULL, __ATOMIC_SEQ_CST);
+
+    // the threads still in pwr_wait_begin() or pwr_wait_end() finish first
+    while (__atomic_load_n(&active_calls, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+
+    pwr_wait_report(old_ctx, &report);
+    fprintf(stderr, "pwr-wait: %lu waits, %.3f s. waiting, "
+        "%lu lowerings, %.3f s. lowered\n", report.waits, report.wait_time,
+        report.lowerings, report.lowered_time);
+
+    pwr_finalize(old_ctx);
+}
+
+//====-------------------------------------------------------------------------
+// POSIX waits
+//-----------------------------------------------------------------------------
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    int ret;
+
+    RESOLVE(pthread_cond_wait);
+    WAIT_CALL(ret, real_pthread_cond_wait(cond, mutex));
+    return ret;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+    const struct timespec *abstime)
+{
+    int ret;
+
+    RESOLVE(pthread_cond_timedwait);
+    WAIT_CALL(ret, real_pthread_cond_timedwait(cond, mutex, abstime));
+    return ret;
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    int ret;
+
+    RESOLVE(poll);
+    if (timeout == 0) {
+        return real_poll(fds, nfds, timeout);
+    }
+    WAIT_CALL(ret, real_poll(fds, nfds, timeout));
+    return ret;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+    int timeout)
+{
+    int ret;
+
+    RESOLVE(epoll_wait);
+    if (timeout == 0) {
+        return real_epoll_wait(epfd, events, maxevents, timeout);
+    }
+    WAIT_CALL(ret, real_epoll_wait(epfd, events, maxevents, timeout));
+    return ret;
+}
+
+/** Bytes of stack arguments forwarded by syscall(), the last ones included */
+#define SYSCALL_STACK_ARGS (64)
+
+long syscall(long number, ...) {
+    long args[6], ret;
+    va_list ap;
+
+    RESOLVE(syscall);
+
+    // the other calls are forwarded as they are, their arguments unknown
+    if (number != SYS_futex) {
+        __builtin_return(__builtin_apply((void (*)()) real_syscall,
+            __builtin_apply_args(), SYSCALL_STACK_ARGS));
+    }
+
+    // futex(uaddr, op, val, timeout, uaddr2, val3)
+    va_start(ap, number);
+    for (int i = 0; i < 6; ++i) {
+        args[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+    int op = args[1] & FUTEX_CMD_MASK;
+    if (op != FUTEX_WAIT && op != FUTEX_WAIT_BITSET) {
+        return real_syscall(number, args[0], args[1], args[2], args[3],
+            args[4], args[5]);
+    }
+
+    WAIT_CALL(ret, real_syscall(number, args[0], args[1], args[2], args[3],
+        args[4], args[5]));
+    return ret;
+}
+
+//====-------------------------------------------------------------------------
+// MPI waits
+//-----------------------------------------------------------------------------
+
+#ifdef HAS_MPI
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+    int ret;
+    WAIT_CALL(ret, PMPI_Wait(request, status));
+    return ret;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+    int ret;
+    WAIT_CALL(ret, PMPI_Waitall(count, requests, statuses));
+    return ret;
+}
+
+int MPI_Waitany(int count, MPI_Request requests[], int *index,
+    MPI_Status *status)
+{
+    int ret;
+    WAIT_CALL(ret, PMPI_Waitany(count, requests, index, status));
+    return ret;
+}
+
+int MPI_Waitsome(int incount, MPI_Request requests[], int *outcount,
+    int indices[], MPI_Status statuses[])
+{
+    int ret;
+    WAIT_CALL(ret, PMPI_Waitsome(incount, requests, outcount, indices,
+        statuses));
+    return ret;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+    int ret;
+    WAIT_CALL(ret, PMPI_Barrier(comm));
+    return ret;
+}
+
+#endif
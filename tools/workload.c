@@ -0,0 +1,340 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "workload.h"
+
+/** Multiply-add chains run in parallel by the compute kernel */
+#define COMPUTE_CHAINS 16
+
+/** Iterations of the compute kernel per block */
+#define COMPUTE_BLOCK (64 * 1024)
+
+/** Elements of each array updated by the memory kernel per block */
+#define MEMORY_BLOCK (64 * 1024)
+
+/** Dependent loads of the latency kernel per block */
+#define LATENCY_BLOCK (16 * 1024)
+
+/** Size of the nodes of the pointer chain, one cache line */
+#define LATENCY_STRIDE (64 / sizeof(size_t))
+
+/** Longest sleep between two checks of the stop flag, in ns */
+#define MAX_SLEEP 10000000
+
+/* A workload thread */
+typedef struct {
+    pthread_t thread;
+    struct workload *wl;
+    unsigned long cpu;
+
+    /* Blocks of work done, read atomically while the workload runs */
+    unsigned long long blocks;
+} worker_t;
+
+/* A running workload */
+struct workload {
+    workload_params_t params;
+
+    /* Set to stop the threads */
+    volatile int stop;
+
+    /* Pointer chain shared by the latency kernel threads */
+    size_t *chain;
+    size_t chain_nodes;
+
+    unsigned long num_workers;
+    worker_t workers[];
+};
+
+/** Names of the kernels */
+static const char *names[WORKLOAD_NB_KINDS] = {
+    "compute", "memory", "latency", "idle"
+};
+
+/** Prevents the compiler from optimizing the kernels away */
+static volatile double sink;
+
+//====-------------------------------------------------------------------------
+// Kernels
+//-----------------------------------------------------------------------------
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Independent chains let the compiler fill the vector units.
+ */
+static void compute_block(double *acc) {
+    for (int i = 0; i < COMPUTE_BLOCK; ++i) {
+        for (int c = 0; c < COMPUTE_CHAINS; ++c) {
+            acc[c] = acc[c] * 0.999999 + 0.000001;
+        }
+    }
+}
+
+/**
+ * STREAM triad on the next block of the arrays.
+ */
+static void memory_block(double *a, const double *b, const double *c,
+    size_t size, size_t *pos)
+{
+    size_t end = *pos + MEMORY_BLOCK < size ? *pos + MEMORY_BLOCK : size;
+
+    for (size_t i = *pos; i < end; ++i) {
+        a[i] = b[i] + 3.0 * c[i];
+    }
+    *pos = end < size ? end : 0;
+}
+
+/**
+ * Follows the pointer chain, every load depending on the previous one.
+ */
+static void latency_block(const size_t *chain, size_t *node) {
+    size_t n = *node;
+
+    for (int i = 0; i < LATENCY_BLOCK; ++i) {
+        n = chain[n * LATENCY_STRIDE];
+    }
+    *node = n;
+}
+
+/**
+ * Builds a single random cycle through the nodes (Sattolo's algorithm), so
+ * that the chain visits every cache line in an unpredictable order.
+ */
+static size_t *build_chain(size_t nodes) {
+    size_t *chain = malloc(nodes * LATENCY_STRIDE * sizeof(*chain));
+    size_t *perm = malloc(nodes * sizeof(*perm));
+    unsigned int seed = 42;
+
+    if (chain == NULL || perm == NULL) {
+        free(chain);
+        free(perm);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nodes; ++i) {
+        perm[i] = i;
+    }
+    for (size_t i = nodes - 1; i > 0; --i) {
+        size_t j = ((size_t) rand_r(&seed) * RAND_MAX + rand_r(&seed)) % i;
+        size_t tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    for (size_t i = 0; i < nodes; ++i) {
+        chain[perm[i] * LATENCY_STRIDE] = perm[(i + 1) % nodes];
+    }
+
+    free(perm);
+    return chain;
+}
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    struct workload *wl = w->wl;
+    const workload_params_t *p = &wl->params;
+    double acc[COMPUTE_CHAINS] = { 0 };
+    double *a = NULL, *b = NULL, *c = NULL;
+    size_t size = 0, pos = 0;
+    size_t node = (w->cpu * 7919) % (wl->chain_nodes ? wl->chain_nodes : 1);
+
+    // allocate from the pinned thread, close to its CPU
+    if (p->kind == WORKLOAD_MEMORY) {
+        size = p->footprint / (3 * sizeof(double));
+        a = malloc(size * sizeof(*a));
+        b = malloc(size * sizeof(*b));
+        c = malloc(size * sizeof(*c));
+        if (a == NULL || b == NULL || c == NULL || size == 0) {
+            goto out;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            a[i] = 0;
+            b[i] = 1;
+            c[i] = 2;
+        }
+    }
+
+    uint64_t period = p->period * 1e9;
+    uint64_t busy = p->duty * period;
+    uint64_t start = now_ns();
+
+    while (!wl->stop) {
+        // sleep during the idle part of the period
+        if (p->kind == WORKLOAD_IDLE || busy == 0 ||
+            (busy < period && (now_ns() - start) % period >= busy))
+        {
+            uint64_t left = period - (now_ns() - start) % period;
+            sleep_ns(left < MAX_SLEEP ? left : MAX_SLEEP);
+            continue;
+        }
+
+        switch (p->kind) {
+            case WORKLOAD_COMPUTE:
+                compute_block(acc);
+                break;
+            case WORKLOAD_MEMORY:
+                memory_block(a, b, c, size, &pos);
+                break;
+            case WORKLOAD_LATENCY:
+                latency_block(wl->chain, &node);
+                break;
+            default:
+                break;
+        }
+        __atomic_store_n(&w->blocks, w->blocks + 1, __ATOMIC_RELAXED);
+    }
+
+    sink = acc[0] + (a != NULL ? a[0] : 0) + node;
+
+out:
+    free(a);
+    free(b);
+    free(c);
+    return NULL;
+}
+
+//====-------------------------------------------------------------------------
+// Workload management
+//-----------------------------------------------------------------------------
+
+void workload_default_params(workload_kind_t kind, workload_params_t *params) {
+    params->kind = kind;
+    params->duty = 1;
+    params->period = 0.1;
+    params->footprint = kind == WORKLOAD_LATENCY ? 64 << 20 : 16 << 20;
+}
+
+workload_t *workload_start(pwr_ctx_t *ctx, unsigned long island,
+    const workload_params_t *params)
+{
+    unsigned long num_cpus = pwr_num_phys_cpus(ctx);
+    struct workload *wl =
+        calloc(1, sizeof(*wl) + num_cpus * sizeof(wl->workers[0]));
+
+    if (wl == NULL || params->kind >= WORKLOAD_NB_KINDS) {
+        free(wl);
+        return NULL;
+    }
+    wl->params = *params;
+    if (wl->params.period <= 0) {
+        wl->params.period = 0.1;
+    }
+
+    if (params->kind == WORKLOAD_LATENCY) {
+        wl->chain_nodes = params->footprint / (LATENCY_STRIDE * sizeof(size_t));
+        if (wl->chain_nodes < 2 ||
+            (wl->chain = build_chain(wl->chain_nodes)) == NULL)
+        {
+            free(wl);
+            return NULL;
+        }
+    }
+
+    for (unsigned long cpu = 0; cpu < num_cpus; ++cpu) {
+        if (island != WORKLOAD_ALL_ISLANDS &&
+            pwr_island_of_cpu(ctx, cpu) != island)
+        {
+            continue;
+        }
+
+        worker_t *w = &wl->workers[wl->num_workers];
+        pthread_attr_t attr;
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+        w->wl = wl;
+        w->cpu = cpu;
+        if (pthread_create(&w->thread, &attr, worker, w) == 0) {
+            ++wl->num_workers;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    if (wl->num_workers == 0) {
+        free(wl->chain);
+        free(wl);
+        return NULL;
+    }
+
+    return wl;
+}
+
+unsigned long long workload_stop(workload_t *wl) {
+    unsigned long long blocks = 0;
+
+    wl->stop = 1;
+    for (unsigned long w = 0; w < wl->num_workers; ++w) {
+        pthread_join(wl->workers[w].thread, NULL);
+        blocks += wl->workers[w].blocks;
+    }
+
+    free(wl->chain);
+    free(wl);
+    return blocks;
+}
+
+unsigned long long workload_blocks(const workload_t *wl) {
+    unsigned long long blocks = 0;
+
+    for (unsigned long w = 0; w < wl->num_workers; ++w) {
+        blocks += __atomic_load_n(&wl->workers[w].blocks, __ATOMIC_RELAXED);
+    }
+
+    return blocks;
+}
+
+unsigned long workload_num_threads(const workload_t *wl) {
+    return wl->num_workers;
+}
+
+const char *workload_name(workload_kind_t kind) {
+    return kind < WORKLOAD_NB_KINDS ? names[kind] : "unknown";
+}
+
+int workload_parse(const char *name, workload_kind_t *kind) {
+    for (int k = 0; k < WORKLOAD_NB_KINDS; ++k) {
+        if (strcmp(name, names[k]) == 0) {
+            *kind = k;
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,115 @@
+/**
+  * Copyright 2014 Reservoir Labs, Inc.
+  *
+  *	Licensed under the Apache License, Version 2.0 (the "License");
+  *	you may not use this file except in compliance with the License.
+  *	You may obtain a copy of the License at
+  *
+  *		http://www.apache.org/licenses/LICENSE-2.0
+  *
+  *	Unless required by applicable law or agreed to in writing, software
+  *	distributed under the License is distributed on an "AS IS" BASIS,
+  *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  *	See the License for the specific language governing permissions and
+  *	limitations under the License.
+  */
+
+/*
+ * Synthetic workloads shared by the tools. A workload runs one thread pinned
+ * on every CPU of an island, or of the whole node, until it is stopped.
+ *
+ * Kernels:
+ *  - compute: independent multiply-add chains, vectorized by the compiler
+ *  - memory:  STREAM triad over arrays much larger than the caches
+ *  - latency: dependent loads chasing pointers through a random cycle
+ *  - idle:    sleeps
+ *
+ * Every kernel can run in bursts: it runs for a fraction (the duty cycle) of
+ * each period and sleeps for the rest of it. Work is counted in blocks of
+ * fixed size, so that the throughput of two runs of the same kernel can be
+ * compared.
+ */
+
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include <stddef.h>
+
+#include "power-api.h"
+
+/** Island identifier running a workload on every CPU */
+#define WORKLOAD_ALL_ISLANDS ((unsigned long) -1)
+
+/* The workload kernels */
+typedef enum {
+    WORKLOAD_COMPUTE = 0,
+    WORKLOAD_MEMORY,
+    WORKLOAD_LATENCY,
+    WORKLOAD_IDLE,
+    WORKLOAD_NB_KINDS
+} workload_kind_t;
+
+/* Workload parameters */
+typedef struct {
+    /* The kernel to run */
+    workload_kind_t kind;
+
+    /* Fraction of each period spent running the kernel, in [0, 1] */
+    double duty;
+
+    /* Length of a duty cycle period, in s */
+    double period;
+
+    /* Memory used by each thread of the memory and latency kernels, in B */
+    size_t footprint;
+} workload_params_t;
+
+/* A running workload */
+typedef struct workload workload_t;
+
+/**
+ * Sets the parameters to a continuous run of a kernel with its default
+ * footprint.
+ */
+void workload_default_params(workload_kind_t kind, workload_params_t *params);
+
+/**
+ * Starts a workload on every CPU of an island.
+ *
+ * @param island The island, or WORKLOAD_ALL_ISLANDS.
+ *
+ * @return The workload, or NULL if no thread could be started.
+ */
+workload_t *workload_start(pwr_ctx_t *ctx, unsigned long island,
+    const workload_params_t *params);
+
+/**
+ * Stops a workload and releases it.
+ *
+ * @return How many blocks of work were done.
+ */
+unsigned long long workload_stop(workload_t *wl);
+
+/**
+ * Reads how many blocks of work were done so far, while the workload runs.
+ */
+unsigned long long workload_blocks(const workload_t *wl);
+
+/**
+ * Gets the number of threads running the workload, one per CPU.
+ */
+unsigned long workload_num_threads(const workload_t *wl);
+
+/**
+ * Gets the name of a kernel.
+ */
+const char *workload_name(workload_kind_t kind);
+
+/**
+ * Finds a kernel by name.
+ *
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int workload_parse(const char *name, workload_kind_t *kind);
+
+#endif